@@ -0,0 +1,260 @@
+//
+//  DmmBench.c
+//  dmmbench - the dmmsend object's message path, timed on Linux
+//
+//  DmmSend.c is built unmodified against the Max API shim in MaxShim/ and an
+//  instance is driven straight through its message handlers, as a patcher
+//  would: setpoints in through the inlet, serial bytes out of the serial
+//  outlet, drive replies back in as serialByte messages. Every scenario runs
+//  on a fresh instance; each message is timed on its own, clocks the object
+//  sets are run between messages, outside the timing.
+//
+//  Build:
+//    cc -std=gnu99 -O2 -DDMM_STANDALONE -IDmmDriver -IDmmBench/MaxShim -o dmmbench DmmBench/DmmBench.c
+//       DmmBench/MaxShim/MaxShim.c DmmSend.c DmmDriver/DmmDriver.c DmmDriver/DmmClock.c
+//       DmmDriver/DmmLoop.c DmmDriver/DmmEstimator.c DmmDriver/DmmDiscover.c DmmDriver/DmmScan.c
+//       DmmDriver/DmmHoming.c DmmDriver/DmmIngress.c DmmDriver/DmmMailbox.c DmmDriver/DmmSpline.c
+//       DmmDriver/DmmSegments.c DmmDriver/DmmHistory.c DmmDriver/DmmThermal.c DmmDriver/DmmHybrid.c DmmDriver/DmmLink.c
+//       DmmDriver/DmmRelative.c DmmDriver/DmmHistogram.c -lpthread -lrt -lm
+//
+//  Scenarios:
+//    speed       speed <n>, a different value every time
+//    readPos     readPosition
+//    reply       a position reply, one serialByte message per byte
+//    track       track <target> then the position reply it gets answered with
+//    moveAll     moveAll to 8 axes
+//    estimate    estimate 0, no link traffic
+//    encode      128 frames of every length, to 128 axes, one Encode_Package
+//                call each as Send_Package makes them; no object involved
+//    encodeVec   the same 128 frames in one Encode_Packages call, four at a
+//                time in vector lanes
+//
+//  Output, one line per scenario: messages, ns per message (mean, median,
+//  99th percentile, max), then outlet calls and atoms per message for the
+//  outlets left to right (serial, position, tracking, info).
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sysexits.h>
+
+#include "MaxShim.h"
+#include "DmmDriver.h"
+#include "DmmProtocol.h"
+
+#define BENCH_OUTLETS 4
+#define BENCH_FRAMES 128        // Per encode message
+
+typedef struct {
+    const char *name;
+    int messagesPerStep;
+    // Sends the messages of step i, timing each into ns[]; returns how many it sent
+    int (*step)(void *x, long i, long long *ns);
+} BenchScenario_t;
+
+static long long nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long timedSend(void *x, const char *message, short ac, t_atom *av) {
+    long long t0 = nowNs();
+    MaxShim_Send(x, message, ac, av);
+    long long t = nowNs() - t0;
+    MaxShim_RunClocks();
+    return t;
+}
+
+static long long timedLong(void *x, const char *message, long n) {
+    t_atom a;
+    atom_setlong(&a, n);
+    return timedSend(x, message, 1, &a);
+}
+
+// A position reply from axis 0, in as many serialByte messages as it has bytes
+static int sendReply(void *x, long pos, long long *ns) {
+    unsigned char B[8];
+    int n = Encode_Package(Is_AbsPos32, 0, pos, B);
+    for (int i = 0; i < n; i++) {
+        ns[i] = timedLong(x, "serialByte", B[i]);
+    }
+    return n;
+}
+
+static int stepSpeed(void *x, long i, long long *ns) {
+    ns[0] = timedLong(x, "speed", i % 200 - 100);
+    return 1;
+}
+
+static int stepReadPos(void *x, long i, long long *ns) {
+    ns[0] = timedSend(x, "readPosition", 0, NULL);
+    return 1;
+}
+
+static int stepReply(void *x, long i, long long *ns) {
+    return sendReply(x, (i * 7919) % 200000 - 100000, ns); // 4 to 6 byte packages
+}
+
+static int stepTrack(void *x, long i, long long *ns) {
+    ns[0] = timedLong(x, "track", 1000 + i % 64);
+    return 1 + sendReply(x, 1000 + (i * 13) % 64, ns + 1);
+}
+
+static int stepMoveAll(void *x, long i, long long *ns) {
+    t_atom av[8];
+    for (int a = 0; a < 8; a++) {
+        atom_setlong(av + a, (i + a * 1000) % 100000);
+    }
+    ns[0] = timedSend(x, "moveAll", 8, av);
+    return 1;
+}
+
+static int stepEstimate(void *x, long i, long long *ns) {
+    t_atom a;
+    atom_setfloat(&a, 0);
+    ns[0] = timedSend(x, "estimate", 1, &a);
+    return 1;
+}
+
+typedef struct {
+    char axes[BENCH_FRAMES];
+    unsigned char funcs[BENCH_FRAMES];
+    long values[BENCH_FRAMES];
+    unsigned char out[BENCH_FRAMES * DMM_MAX_FRAME];
+} BenchFrames_t;
+
+static BenchFrames_t frames;
+
+// Positions, speeds and gains, 4 to 7 byte frames mixed
+static void makeFrames(long i) {
+    static const unsigned char funcs[] = { Go_Absolute_Pos, Turn_ConstSpeed, Set_MainGain, General_Read };
+    static const long range[] = { 1 << 27, 1 << 20, 1 << 13, 1 << 6 };
+    for (int k = 0; k < BENCH_FRAMES; k++) {
+        unsigned long h = (unsigned long)(i * BENCH_FRAMES + k) * 2654435761UL;
+        frames.axes[k] = (char)k;
+        frames.funcs[k] = funcs[k & 3];
+        frames.values[k] = (long)(h % (2 * range[(h >> 8) & 3])) - range[(h >> 8) & 3];
+    }
+}
+
+static int stepEncode(void *x, long i, long long *ns) {
+    makeFrames(i);
+    long long t0 = nowNs();
+    int total = 0;
+    for (int k = 0; k < BENCH_FRAMES; k++) {
+        total += Encode_Package(frames.funcs[k], frames.axes[k], frames.values[k], frames.out + total);
+    }
+    ns[0] = nowNs() - t0;
+    return total > 0;
+}
+
+static int stepEncodeVec(void *x, long i, long long *ns) {
+    makeFrames(i);
+    long long t0 = nowNs();
+    int total = Encode_Packages(frames.axes, frames.funcs, frames.values, BENCH_FRAMES, frames.out, NULL);
+    ns[0] = nowNs() - t0;
+    return total > 0;
+}
+
+static const BenchScenario_t scenarios[] = {
+    { "speed", 1, stepSpeed },
+    { "readPos", 1, stepReadPos },
+    { "reply", DMM_MAX_FRAME, stepReply },
+    { "track", 1 + DMM_MAX_FRAME, stepTrack },
+    { "moveAll", 1, stepMoveAll },
+    { "estimate", 1, stepEstimate },
+    { "encode", 1, stepEncode },
+    { "encodeVec", 1, stepEncodeVec },
+};
+
+static int compareLongLong(const void *a, const void *b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run(const BenchScenario_t *sc, long steps) {
+    void *x = MaxShim_New("dmmsend", 0, NULL);
+    if (x == NULL) {
+        fprintf(stderr, "dmmbench: can't make a dmmsend\n");
+        exit(EX_SOFTWARE);
+    }
+    // Warm up, then count from zero
+    long long *ns = malloc(sizeof(long long) * steps * sc->messagesPerStep);
+    for (long i = 0; i < 1000; i++) {
+        sc->step(x, i, ns);
+    }
+    for (int o = 0; o < BENCH_OUTLETS; o++) {
+        MaxShimOutlet_t *out = MaxShim_Outlet(x, o);
+        memset(out->calls, 0, sizeof(out->calls));
+        out->atoms = 0;
+    }
+    long messages = 0;
+    for (long i = 0; i < steps; i++) {
+        messages += sc->step(x, i, ns + messages);
+    }
+    long long total = 0;
+    for (long i = 0; i < messages; i++) {
+        total += ns[i];
+    }
+    qsort(ns, messages, sizeof(ns[0]), compareLongLong);
+    printf("%-9s %9ld %8.1f %8lld %8lld %9lld", sc->name, messages, (double)total / messages,
+           ns[messages / 2], ns[messages * 99 / 100], ns[messages - 1]);
+    for (int o = 0; o < BENCH_OUTLETS; o++) {
+        MaxShimOutlet_t *out = MaxShim_Outlet(x, o);
+        unsigned long calls = 0;
+        for (int k = 0; k < Outlet_KindCount; k++) {
+            calls += out->calls[k];
+        }
+        printf(" %6.3f %6.2f", (double)calls / messages, (double)out->atoms / messages);
+    }
+    printf("\n");
+    free(ns);
+    object_free(x);
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: dmmbench [-n steps] [-v] [scenario ...]\n"
+            "  -n  steps per scenario, default 200000\n"
+            "  -v  show what the object posts\n"
+            "  scenarios: speed readPos reply track moveAll estimate encode encodeVec, default all\n");
+    exit(EX_USAGE);
+}
+
+int main(int argc, char **argv) {
+    long steps = 200000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:v")) != -1) {
+        switch (opt) {
+            case 'n': steps = atol(optarg); break;
+            case 'v': MaxShim_SetVerbose(true); break;
+            default: usage();
+        }
+    }
+    if (steps <= 0) {
+        usage();
+    }
+    ext_main();
+    printf("%-9s %9s %8s %8s %8s %9s", "scenario", "messages", "mean_ns", "p50_ns", "p99_ns", "max_ns");
+    const char *outletNames[BENCH_OUTLETS] = { "serial", "pos", "track", "info" };
+    for (int o = 0; o < BENCH_OUTLETS; o++) {
+        printf(" %6.6s %6.6s", outletNames[o], "atoms");
+    }
+    printf("\n");
+    int count = sizeof(scenarios) / sizeof(scenarios[0]);
+    for (int s = 0; s < count; s++) {
+        Boolean wanted = optind == argc;
+        for (int a = optind; a < argc; a++) {
+            wanted |= strcmp(argv[a], scenarios[s].name) == 0;
+        }
+        if (wanted) {
+            run(&scenarios[s], steps);
+        }
+    }
+    fprintf(stderr, "dmmbench: the object posted %lu times\n", MaxShim_Posts());
+    return EX_OK;
+}
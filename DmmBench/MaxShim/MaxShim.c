@@ -0,0 +1,463 @@
+//
+//  MaxShim.c
+//  dmmbench
+//
+
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "MaxShim.h"
+#include "DmmClock.h"
+
+#define MAXSHIM_CLASSES 8
+#define MAXSHIM_METHODS 64
+#define MAXSHIM_OUTLETS 64
+#define MAXSHIM_CLOCKS 64
+#define MAXSHIM_SYMBOL_BUCKETS 1024
+
+typedef struct {
+    const char *name;
+    method fn;
+    short types[MAXSHIM_MAX_ARGS];
+    int ntypes;
+} MaxShimMethod_t;
+
+struct maxshim_class {
+    const char *name;
+    method mnew, mfree;
+    long size;
+    short newTypes[MAXSHIM_MAX_ARGS];
+    int nNewTypes;
+    MaxShimMethod_t methods[MAXSHIM_METHODS];
+    int nmethods;
+    Boolean registered;
+};
+
+typedef struct {
+    t_object ob;
+    void *owner;
+    method fn;
+    Boolean set;
+    DmmTime_t dueAt;            // DmmNow when it was set, + its delay
+} MaxShimClock_t;
+
+typedef struct symbolEntry {
+    t_symbol sym;
+    struct symbolEntry *next;
+} SymbolEntry_t;
+
+static t_class classes[MAXSHIM_CLASSES];
+static int nclasses;
+static t_class clockClass = { "clock" };
+static MaxShimOutlet_t *outlets[MAXSHIM_OUTLETS]; // Creation order
+static int noutlets;
+static MaxShimClock_t *clocks[MAXSHIM_CLOCKS];
+static int nclocks;
+static SymbolEntry_t *symbols[MAXSHIM_SYMBOL_BUCKETS];
+static unsigned long posts;
+static Boolean verbose;
+
+static void vpost(const char *prefix, const char *fmt, va_list ap) {
+    posts++;
+    if (verbose) {
+        fputs(prefix, stderr);
+        vfprintf(stderr, fmt, ap);
+        if (fmt[0] == 0 || fmt[strlen(fmt) - 1] != '\n') {
+            fputc('\n', stderr);
+        }
+    }
+}
+
+void post(C74_CONST char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vpost("", fmt, ap);
+    va_end(ap);
+}
+
+void object_post(t_object *x, C74_CONST char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vpost("", fmt, ap);
+    va_end(ap);
+}
+
+void object_error(t_object *x, C74_CONST char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vpost("error: ", fmt, ap);
+    va_end(ap);
+}
+
+unsigned long MaxShim_Posts(void) {
+    return posts;
+}
+
+void MaxShim_SetVerbose(Boolean postsToStderr) {
+    verbose = postsToStderr;
+}
+
+// Interned, so symbols compare by pointer as in Max
+t_symbol *gensym(C74_CONST char *s) {
+    unsigned long h = 5381;
+    for (const char *p = s; *p; p++) {
+        h = h * 33 + (unsigned char)*p;
+    }
+    SymbolEntry_t **bucket = &symbols[h % MAXSHIM_SYMBOL_BUCKETS];
+    for (SymbolEntry_t *e = *bucket; e; e = e->next) {
+        if (strcmp(e->sym.s_name, s) == 0) {
+            return &e->sym;
+        }
+    }
+    SymbolEntry_t *e = calloc(1, sizeof(*e));
+    e->sym.s_name = strdup(s);
+    e->next = *bucket;
+    *bucket = e;
+    return &e->sym;
+}
+
+static int argTypes(va_list ap, short *types) {
+    int n = 0;
+    for (int t = va_arg(ap, int); t != A_NOTHING && n < MAXSHIM_MAX_ARGS; t = va_arg(ap, int)) {
+        types[n++] = (short)t;
+    }
+    return n;
+}
+
+t_class *class_new(C74_CONST char *name, C74_CONST method mnew, C74_CONST method mfree, long size, C74_CONST method mmenu, short type, ...) {
+    if (nclasses == MAXSHIM_CLASSES) {
+        return NULL;
+    }
+    t_class *c = &classes[nclasses++];
+    memset(c, 0, sizeof(*c));
+    c->name = name;
+    c->mnew = mnew;
+    c->mfree = mfree;
+    c->size = size;
+    if (type != A_NOTHING) {
+        c->newTypes[c->nNewTypes++] = type;
+        va_list ap;
+        va_start(ap, type);
+        c->nNewTypes += argTypes(ap, c->newTypes + 1);
+        va_end(ap);
+    }
+    return c;
+}
+
+t_max_err class_addmethod(t_class *c, C74_CONST method m, C74_CONST char *name, ...) {
+    if (c->nmethods == MAXSHIM_METHODS) {
+        return 1;
+    }
+    MaxShimMethod_t *md = &c->methods[c->nmethods++];
+    md->name = name;
+    md->fn = m;
+    va_list ap;
+    va_start(ap, name);
+    md->ntypes = argTypes(ap, md->types);
+    va_end(ap);
+    return 0;
+}
+
+t_max_err class_register(t_symbol *name_space, t_class *c) {
+    c->registered = true;
+    return 0;
+}
+
+void *object_alloc(t_class *c) {
+    t_object *x = calloc(1, c->size);
+    if (x) {
+        x->o_class = c;
+    }
+    return x;
+}
+
+t_max_err object_free(void *x) {
+    t_object *ob = (t_object*)x;
+    if (ob == NULL) {
+        return 1;
+    }
+    if (ob->o_class == &clockClass) {
+        for (int i = 0; i < nclocks; i++) {
+            if (clocks[i] == x) {
+                clocks[i] = clocks[--nclocks];
+                break;
+            }
+        }
+    } else {
+        if (ob->o_class->mfree) {
+            ((void (*)(void*))ob->o_class->mfree)(x);
+        }
+        for (int i = 0; i < noutlets; i++) {
+            if (outlets[i]->owner == x) {
+                free(outlets[i]);
+                memmove(outlets + i, outlets + i + 1, (noutlets - i - 1) * sizeof(outlets[0]));
+                noutlets--;
+                i--;
+            }
+        }
+    }
+    free(x);
+    return 0;
+}
+
+void *outlet_new(void *x, C74_CONST char *s) {
+    if (noutlets == MAXSHIM_OUTLETS) {
+        return NULL;
+    }
+    MaxShimOutlet_t *o = calloc(1, sizeof(*o));
+    o->owner = x;
+    outlets[noutlets++] = o;
+    return o;
+}
+
+void *intout(void *x) {
+    return outlet_new(x, "int");
+}
+
+void *listout(void *x) {
+    return outlet_new(x, "list");
+}
+
+static void *out(void *o, MaxShimOutletKind_t kind, t_symbol *s, short ac, const t_atom *av) {
+    MaxShimOutlet_t *outlet = (MaxShimOutlet_t*)o;
+    if (outlet == NULL) {
+        return NULL;
+    }
+    outlet->calls[kind]++;
+    outlet->atoms += ac;
+    if (outlet->HookPtr) {
+        outlet->HookPtr(kind, s, ac, av, outlet->ctx);
+    }
+    return o;
+}
+
+void *outlet_int(void *o, t_atom_long n) {
+    t_atom a;
+    atom_setlong(&a, n);
+    return out(o, Outlet_Int, NULL, 1, &a);
+}
+
+void *outlet_float(void *o, double f) {
+    t_atom a;
+    atom_setfloat(&a, f);
+    return out(o, Outlet_Float, NULL, 1, &a);
+}
+
+void *outlet_list(void *o, t_symbol *s, short ac, t_atom *av) {
+    return out(o, Outlet_List, s, ac, av);
+}
+
+void *outlet_anything(void *o, t_symbol *s, short ac, t_atom *av) {
+    return out(o, Outlet_Anything, s, ac, av);
+}
+
+MaxShimOutlet_t *MaxShim_Outlet(void *x, int i) {
+    int n = 0;
+    for (int k = noutlets - 1; k >= 0; k--) { // Created right to left
+        if (outlets[k]->owner == x && n++ == i) {
+            return outlets[k];
+        }
+    }
+    return NULL;
+}
+
+int MaxShim_OutletCount(void *x) {
+    int n = 0;
+    for (int k = 0; k < noutlets; k++) {
+        n += outlets[k]->owner == x;
+    }
+    return n;
+}
+
+t_max_err atom_setlong(t_atom *a, t_atom_long b) {
+    a->a_type = A_LONG;
+    a->a_w.w_long = b;
+    return 0;
+}
+
+t_max_err atom_setfloat(t_atom *a, double b) {
+    a->a_type = A_FLOAT;
+    a->a_w.w_float = b;
+    return 0;
+}
+
+t_max_err atom_setsym(t_atom *a, t_symbol *b) {
+    a->a_type = A_SYM;
+    a->a_w.w_sym = b;
+    return 0;
+}
+
+t_atom_long atom_getlong(C74_CONST t_atom *a) {
+    switch (a->a_type) {
+        case A_LONG: return a->a_w.w_long;
+        case A_FLOAT: return (t_atom_long)a->a_w.w_float;
+        default: return 0;
+    }
+}
+
+t_atom_float atom_getfloat(C74_CONST t_atom *a) {
+    switch (a->a_type) {
+        case A_LONG: return (t_atom_float)a->a_w.w_long;
+        case A_FLOAT: return a->a_w.w_float;
+        default: return 0;
+    }
+}
+
+t_symbol *atom_getsym(C74_CONST t_atom *a) {
+    return a->a_type == A_SYM ? a->a_w.w_sym : gensym("");
+}
+
+void *clock_new(void *obj, method fn) {
+    if (nclocks == MAXSHIM_CLOCKS) {
+        return NULL;
+    }
+    MaxShimClock_t *c = calloc(1, sizeof(*c));
+    c->ob.o_class = &clockClass;
+    c->owner = obj;
+    c->fn = fn;
+    clocks[nclocks++] = c;
+    return c;
+}
+
+void clock_delay(void *x, long n) {
+    if (x) {
+        ((MaxShimClock_t*)x)->set = true;
+        ((MaxShimClock_t*)x)->dueAt = DmmNow() + (DmmTime_t)n * 1000;
+    }
+}
+
+void clock_unset(void *x) {
+    if (x) {
+        ((MaxShimClock_t*)x)->set = false;
+    }
+}
+
+int MaxShim_RunClocks(void) {
+    int ran = 0;
+    for (int i = 0; i < nclocks; i++) {
+        MaxShimClock_t *c = clocks[i];
+        if (c->set) {
+            c->set = false; // The tick sets it again if it wants another
+            ((void (*)(void*))c->fn)(c->owner);
+            ran++;
+        }
+    }
+    return ran;
+}
+
+int MaxShim_RunClocksDue(void) {
+    int ran = 0;
+    DmmTime_t now = DmmNow();
+    for (int i = 0; i < nclocks; i++) {
+        MaxShimClock_t *c = clocks[i];
+        if (c->set && c->dueAt <= now) {
+            c->set = false;
+            ((void (*)(void*))c->fn)(c->owner);
+            ran++;
+        }
+    }
+    return ran;
+}
+
+Boolean MaxShim_NextClock(long long *at) {
+    Boolean any = false;
+    for (int i = 0; i < nclocks; i++) {
+        if (clocks[i]->set && (!any || clocks[i]->dueAt < *at)) {
+            *at = clocks[i]->dueAt;
+            any = true;
+        }
+    }
+    return any;
+}
+
+static t_class *findClass(const char *name) {
+    for (int i = 0; i < nclasses; i++) {
+        if (classes[i].registered && strcmp(classes[i].name, name) == 0) {
+            return &classes[i];
+        }
+    }
+    return NULL;
+}
+
+void *MaxShim_New(const char *className, short ac, t_atom *av) {
+    t_class *c = findClass(className);
+    if (c == NULL) {
+        return NULL;
+    }
+    if (c->nNewTypes > 0 && c->newTypes[0] == A_GIMME) {
+        return ((void *(*)(t_symbol*, long, t_atom*))c->mnew)(gensym(className), ac, av);
+    }
+    return ((void *(*)(void))c->mnew)();
+}
+
+// Typed arguments in the order the method declared them, defaults where the message has none
+Boolean MaxShim_Send(void *x, const char *message, short ac, t_atom *av) {
+    t_class *c = ((t_object*)x)->o_class;
+    MaxShimMethod_t *m = NULL;
+    for (int i = 0; i < c->nmethods; i++) {
+        if (strcmp(c->methods[i].name, message) == 0) {
+            m = &c->methods[i];
+            break;
+        }
+    }
+    if (m == NULL || (m->ntypes > 0 && m->types[0] == A_CANT)) {
+        object_error((t_object*)x, "%s doesn't understand \"%s\"", c->name, message);
+        return false;
+    }
+    if (m->ntypes > 0 && m->types[0] == A_GIMME) {
+        ((void (*)(void*, t_symbol*, long, t_atom*))m->fn)(x, gensym(message), ac, av);
+        return true;
+    }
+    char sig[MAXSHIM_MAX_ARGS + 1];
+    t_atom_long l[MAXSHIM_MAX_ARGS];
+    double f[MAXSHIM_MAX_ARGS];
+    t_symbol *s[MAXSHIM_MAX_ARGS];
+    for (int i = 0; i < m->ntypes; i++) {
+        Boolean have = i < ac;
+        switch (m->types[i]) {
+            case A_LONG: case A_DEFLONG:
+                sig[i] = 'l';
+                l[i] = have ? atom_getlong(av + i) : 0;
+                break;
+            case A_FLOAT: case A_DEFFLOAT:
+                sig[i] = 'f';
+                f[i] = have ? atom_getfloat(av + i) : 0;
+                break;
+            case A_SYM: case A_DEFSYM:
+                sig[i] = 's';
+                s[i] = have ? atom_getsym(av + i) : gensym("");
+                break;
+            default:
+                sig[i] = '?';
+        }
+    }
+    sig[m->ntypes] = 0;
+    // The signatures DmmSend.c declares
+    if (strcmp(sig, "") == 0) {
+        ((void (*)(void*))m->fn)(x);
+    } else if (strcmp(sig, "l") == 0) {
+        ((void (*)(void*, t_atom_long))m->fn)(x, l[0]);
+    } else if (strcmp(sig, "f") == 0) {
+        ((void (*)(void*, double))m->fn)(x, f[0]);
+    } else if (strcmp(sig, "s") == 0) {
+        ((void (*)(void*, t_symbol*))m->fn)(x, s[0]);
+    } else if (strcmp(sig, "ll") == 0) {
+        ((void (*)(void*, t_atom_long, t_atom_long))m->fn)(x, l[0], l[1]);
+    } else if (strcmp(sig, "lll") == 0) {
+        ((void (*)(void*, t_atom_long, t_atom_long, t_atom_long))m->fn)(x, l[0], l[1], l[2]);
+    } else if (strcmp(sig, "lf") == 0) {
+        ((void (*)(void*, t_atom_long, double))m->fn)(x, l[0], f[1]);
+    } else if (strcmp(sig, "fff") == 0) {
+        ((void (*)(void*, double, double, double))m->fn)(x, f[0], f[1], f[2]);
+    } else {
+        object_error((t_object*)x, "no shim for %s's \"%s\" arguments", c->name, message);
+        return false;
+    }
+    return true;
+}
+
+Boolean MaxShim_SendLong(void *x, const char *message, t_atom_long n) {
+    t_atom a;
+    atom_setlong(&a, n);
+    return MaxShim_Send(x, message, 1, &a);
+}
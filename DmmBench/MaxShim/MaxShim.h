@@ -0,0 +1,128 @@
+//
+//  MaxShim.h
+//  dmmbench
+//
+//  The part of the Max object API DmmSend.c uses, enough to build the object
+//  unmodified on Linux and drive it from a test program. Classes, methods and
+//  objects behave as in Max as far as DmmSend.c can tell; outlets only count
+//  what goes out of them (and hand it to a hook, if one is set), and clocks
+//  fire when the host program runs them, not on a scheduler: all of them, or
+//  those whose delay is up on DmmNow, which may be simulated time.
+//
+
+#ifndef dmmbench_MaxShim_h
+#define dmmbench_MaxShim_h
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+#include <limits.h>
+
+#define C74_EXPORT
+#define C74_CONST const
+
+typedef unsigned char Boolean;
+typedef long t_atom_long;
+typedef double t_atom_float;
+typedef long t_max_err;
+typedef void *(*method)(void *, ...);
+
+typedef struct _symbol {
+    const char *s_name;
+    struct object *s_thing;
+} t_symbol;
+
+typedef enum {
+    A_NOTHING = 0, A_LONG, A_FLOAT, A_SYM, A_OBJ,
+    A_DEFLONG, A_DEFFLOAT, A_DEFSYM, A_GIMME, A_CANT
+} e_max_atomtypes;
+
+typedef struct atom {
+    short a_type;
+    union {
+        t_atom_long w_long;
+        t_atom_float w_float;
+        t_symbol *w_sym;
+        void *w_obj;
+    } a_w;
+} t_atom;
+
+typedef struct maxshim_class t_class;
+
+typedef struct object {
+    t_class *o_class;
+} t_object;
+
+enum { ASSIST_INLET = 1, ASSIST_OUTLET };
+#define CLASS_BOX gensym("box")
+#define CLASS_NOBOX gensym("nobox")
+#define MAXSHIM_MAX_ARGS 8
+
+#ifndef MIN
+    #define MIN(a,b) ((a<b) ? a : b)
+#endif
+
+#ifndef MAX
+    #define MAX(a,b) ((a>b) ? a : b)
+#endif
+
+// Max API
+void post(C74_CONST char *fmt, ...);
+void object_post(t_object *x, C74_CONST char *fmt, ...);
+void object_error(t_object *x, C74_CONST char *fmt, ...);
+t_symbol *gensym(C74_CONST char *s);
+t_class *class_new(C74_CONST char *name, C74_CONST method mnew, C74_CONST method mfree, long size, C74_CONST method mmenu, short type, ...);
+t_max_err class_addmethod(t_class *c, C74_CONST method m, C74_CONST char *name, ...);
+t_max_err class_register(t_symbol *name_space, t_class *c);
+void *object_alloc(t_class *c);
+t_max_err object_free(void *x);
+void *outlet_new(void *x, C74_CONST char *s);
+void *intout(void *x);
+void *listout(void *x);
+void *outlet_int(void *o, t_atom_long n);
+void *outlet_float(void *o, double f);
+void *outlet_list(void *o, t_symbol *s, short ac, t_atom *av);
+void *outlet_anything(void *o, t_symbol *s, short ac, t_atom *av);
+t_max_err atom_setlong(t_atom *a, t_atom_long b);
+t_max_err atom_setfloat(t_atom *a, double b);
+t_max_err atom_setsym(t_atom *a, t_symbol *b);
+t_atom_long atom_getlong(C74_CONST t_atom *a);
+t_atom_float atom_getfloat(C74_CONST t_atom *a);
+t_symbol *atom_getsym(C74_CONST t_atom *a);
+void *clock_new(void *obj, method fn);
+void clock_delay(void *x, long n);
+void clock_unset(void *x);
+
+// Host side
+typedef enum { Outlet_Int = 0, Outlet_Float, Outlet_List, Outlet_Anything, Outlet_KindCount } MaxShimOutletKind_t;
+
+typedef struct MaxShimOutlet {
+    void *owner;
+    unsigned long calls[Outlet_KindCount];
+    unsigned long atoms;
+    // Called for every message out, n = 1 for int and float
+    void (*HookPtr)(MaxShimOutletKind_t kind, t_symbol *s, short ac, const t_atom *av, void *ctx);
+    void *ctx;
+} MaxShimOutlet_t;
+
+// Calls the loader entry point of the object's source (main, renamed ext_main by ext.h)
+int ext_main(void);
+// New instance of a registered class, as a box "name args..." would make it
+void *MaxShim_New(const char *className, short ac, t_atom *av);
+// Sends "message args..." to the object's inlet; false if the class has no such method
+Boolean MaxShim_Send(void *x, const char *message, short ac, t_atom *av);
+Boolean MaxShim_SendLong(void *x, const char *message, t_atom_long n);
+// Outlet i of x counted from the left, as in a patcher
+MaxShimOutlet_t *MaxShim_Outlet(void *x, int i);
+int MaxShim_OutletCount(void *x);
+// Runs clocks that are due; n in ms is ignored, every set clock is due. Returns how many ran.
+int MaxShim_RunClocks(void);
+// Runs the clocks whose delay is up by DmmNow, each once. Returns how many ran.
+int MaxShim_RunClocksDue(void);
+// When the next set clock is due, on DmmNow; false if none is set
+Boolean MaxShim_NextClock(long long *at);
+unsigned long MaxShim_Posts(void);
+void MaxShim_SetVerbose(Boolean postsToStderr);
+
+#endif
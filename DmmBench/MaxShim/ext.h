@@ -0,0 +1,16 @@
+//
+//  ext.h
+//  dmmbench
+//
+//  Stands in for the Max SDK's ext.h when building DmmSend.c on Linux, see MaxShim.h.
+//
+
+#ifndef dmmbench_ext_h
+#define dmmbench_ext_h
+
+#include "MaxShim.h"
+
+// Max loads an external by calling its entry point; here the host program does
+#define main ext_main
+
+#endif
@@ -0,0 +1,13 @@
+//
+//  ext_obex.h
+//  dmmbench
+//
+//  Stands in for the Max SDK's ext_obex.h; everything DmmSend.c needs is in MaxShim.h.
+//
+
+#ifndef dmmbench_ext_obex_h
+#define dmmbench_ext_obex_h
+
+#include "MaxShim.h"
+
+#endif
@@ -0,0 +1,1087 @@
+//
+//  DmmCli.c
+//  dmmcli - headless command line frontend for DmmDriver
+//
+//  Streams setpoints from stdin (or a file) to DMM drives on a tty, paced to
+//  what the 38400 baud link can carry. Input is only consumed once the
+//  previous frame has left, so a fast producer is held back by the pipe.
+//  Decoded replies are written to stdout, one per line. With -p the tool keeps
+//  polling after the input ends, until interrupted.
+//
+//  Build (Linux):
+//    cc -std=gnu99 -O2 -DDMM_STANDALONE -IDmmDriver -o dmmcli DmmCli/DmmCli.c
+//       DmmDriver/DmmDriver.c DmmDriver/DmmClock.c DmmDriver/DmmDiscover.c DmmDriver/DmmScan.c
+//       DmmDriver/DmmPacer.c DmmDriver/DmmIngress.c DmmDriver/DmmMailbox.c DmmDriver/DmmSpline.c
+//       DmmDriver/DmmTrace.c DmmDriver/DmmHistory.c DmmDriver/DmmLink.c DmmDriver/DmmRelative.c
+//       DmmDriver/DmmHistogram.c DmmDriver/DmmReactor.c -lpthread -lrt
+//
+//  -P hands every package to a DmmPacer thread, which releases timestamped
+//  records on absolute deadlines; the send jitter histogram is printed to
+//  stderr at the end.
+//
+//  -u takes setpoints from UDP (OSC or binary, see DmmIngress.h) instead of
+//  the input; the latest value per axis goes out as soon as the link is free.
+//  The receive to write latency histogram is printed to stderr at the end.
+//  -M reads the shared memory mailbox of DmmMailbox.h the same way, whenever
+//  the link is free; the two can be combined. Speeds from either are held to
+//  +-100, as dmmsend holds them.
+//
+//  -w treats the input as waypoints (position, time_ms required) and streams
+//  Go_Absolute_Pos packages along a smooth curve through them at the rate the
+//  link allows, see DmmSpline.h. Input is read ahead of time so the curve can
+//  look past the next waypoint. With -r moves go as Go_Relative_Pos steps
+//  where those are shorter, absolute again every second, see DmmRelative.h.
+//  With -t a package may be up to counts off the curve where that makes it
+//  shorter.
+//
+//  -T writes the tracepoints of a -DDMM_TRACE build to file at exit, when they
+//  aren't going to USDT probes (see DmmTrace.h).
+//
+//  -H records every position and torque reply to the history store in dir
+//  (DmmHistory.h), alongside whatever else the run does.
+//
+//  -R keeps -u and -M running through a serial link that drops out (a USB
+//  adapter pulled, a drive powered off): the tty is reopened with backoff and
+//  whatever the drives missed is sent again once they answer, see DmmLink.h.
+//
+//  -S scans the bus instead and prints one line per drive found:
+//    <axis> status <s> config <c> gearNumber <g> position <p>
+//
+//  Given several ttys, each is a link of its own and all of them are run from
+//  one epoll thread, see DmmReactor.h. Setpoints carry the index of their tty
+//  among the arguments and go out as soon as it has room, timestamps aside;
+//  replies are printed with the index before the axis.
+//
+//  Text input, one setpoint per line ('#' starts a comment):
+//    <axis> <setpoint> [<time_ms>]
+//  time_ms is relative to the first record; records are held until then.
+//  With several ttys:
+//    <port> <axis> <setpoint>
+//
+//  Binary input (-b), little endian, 12 bytes per record:
+//    int32 time_ms, int32 setpoint, uint8 axis, uint8 port, uint8 reserved[2]
+//  time_ms < 0 means send as soon as the link allows. port is 0 with one tty.
+//
+//  Output, one decoded reply per line:
+//    <time_ms> <axis> <function code> <value>
+//  or with several ttys
+//    <time_ms> <port> <axis> <function code> <value>
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <termios.h>
+#include <sysexits.h>
+#include <sys/ioctl.h>
+
+#include "DmmDriver.h"
+#include "DmmProtocol.h"
+#include "DmmScan.h"
+#include "DmmPacer.h"
+#include "DmmIngress.h"
+#include "DmmMailbox.h"
+#include "DmmSpline.h"
+#include "DmmTrace.h"
+#include "DmmHistory.h"
+#include "DmmLink.h"
+#include "DmmReactor.h"
+
+#ifndef MIN
+    #define MIN(a,b) ((a<b) ? a : b)
+#endif
+
+#ifndef MAX
+    #define MAX(a,b) ((a>b) ? a : b)
+#endif
+
+#define CLI_TX_BUFFER (DMM_MAX_AXES * Setting_Count * DMM_MAX_FRAME) // A whole DmmLink replay in one go
+#define CLI_OUTQ_LIMIT DMM_MAX_FRAME // Don't queue more than a frame in the kernel
+#define CLI_PACER_HIGH_WATER 64      // Stop reading input while this many packages wait in the pacer
+#define CLI_LINK_POLL_US 5000        // Longest sleep while the link is supervised
+#define CLI_MAX_PORTS 256
+#define CLI_MAX_REMOTE_SPEED 100     // dmmsend's SAFE MAX SPEEDS, for speeds off the network or a mailbox
+
+typedef enum { Mode_Speed = 0, Mode_Position } CliMode_t;
+
+typedef struct {
+    int port;
+    int axis;
+    long value;
+    long time_ms; // < 0: no timestamp
+} CliRecord_t;
+
+typedef struct {
+    int tty;                 // -1 while a supervised link is down and the port closed
+    const char *ttyPath;
+    DmmLink_t *link;         // -R, NULL otherwise
+    DmmProtocolState_t state;
+    unsigned char tx[CLI_TX_BUFFER];
+    size_t txLen;
+    unsigned long txDropped; // Bytes that didn't fit, reported as they go
+    long long linkFreeAt_us; // When the link model says the last queued byte has left
+    long long start_us;
+    Boolean polledAxis[DMM_MAX_AXES];
+} DmmCli_t;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void onSignal(int sig) {
+    interrupted = 1;
+}
+
+// Whole packages: all of it is queued or, should it ever not fit, none of it
+static void CliSerialWriteBuffer(const unsigned char *bytes, int length, void *hook) {
+    DmmCli_t *cli = (DmmCli_t*)hook;
+    if (length > (int)(sizeof(cli->tx) - cli->txLen)) {
+        cli->txDropped += length;
+        fprintf(stderr, "dmmcli: transmit buffer full, %d bytes dropped (%lu in all)\n", length, cli->txDropped);
+        return;
+    }
+    memcpy(cli->tx + cli->txLen, bytes, length);
+    cli->txLen += length;
+}
+
+static void CliSerialWrite(char c, void *hook) {
+    unsigned char b = (unsigned char)c;
+    CliSerialWriteBuffer(&b, 1, hook);
+}
+
+static void CliReportPosition(long pos, void *hook) {
+    // Positions are printed with every other reply by CliReportReply
+}
+
+static void CliReportReply(char axis, unsigned char code, long value, void *hook) {
+    DmmCli_t *cli = (DmmCli_t*)hook;
+    printf("%lld %d %d %ld\n", (DmmNow() - cli->start_us) / 1000, axis, code, value);
+    fflush(stdout);
+}
+
+static int openTty(const char *path) {
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
+        fprintf(stderr, "dmmcli: can't open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) { // Not a tty (e.g. a pipe under test) is fine
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, B38400);
+        cfsetospeed(&tio, B38400);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+        tio.c_cc[VMIN] = 0;
+        tio.c_cc[VTIME] = 0;
+        if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+            fprintf(stderr, "dmmcli: can't configure %s: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+// Bytes the kernel still holds for the tty, 0 if it can't tell us
+static int ttyOutQueue(int fd) {
+    int n = 0;
+    if (ioctl(fd, TIOCOUTQ, &n) != 0) {
+        return 0;
+    }
+    return n;
+}
+
+static Boolean linkReady(DmmCli_t *cli) {
+    return cli->txLen == 0 && DmmNow() >= cli->linkFreeAt_us && ttyOutQueue(cli->tty) < CLI_OUTQ_LIMIT;
+}
+
+static void flushTx(DmmCli_t *cli) {
+    while (cli->txLen > 0) {
+        ssize_t n = write(cli->tty, cli->tx, cli->txLen);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                return; // poll() will call us back on POLLOUT
+            }
+            if (cli->link) {
+                DmmLink_TransportError(cli->link);
+                cli->txLen = 0; // Replayed once the link is back, if it matters
+                return;
+            }
+            fprintf(stderr, "dmmcli: write: %s\n", strerror(errno));
+            exit(EX_IOERR);
+        }
+        long long t = DmmNow();
+        if (cli->linkFreeAt_us < t) {
+            cli->linkFreeAt_us = t;
+        }
+        cli->linkFreeAt_us += n * DMM_BYTE_TIME_US;
+        memmove(cli->tx, cli->tx + n, cli->txLen - n);
+        cli->txLen -= n;
+    }
+}
+
+static void sendRecord(DmmCli_t *cli, CliMode_t mode, const CliRecord_t *r) {
+    if (mode == Mode_Speed) {
+        MoveMotorConstantRotation(&cli->state, (char)r->axis, r->value);
+    } else {
+        MoveMotorToAbsolutePosition32(&cli->state, (char)r->axis, r->value);
+    }
+    cli->polledAxis[r->axis] = true;
+    flushTx(cli);
+}
+
+// Returns 1 with a record, 0 on a line to skip, -1 at end of input
+static int readTextRecord(FILE *in, CliRecord_t *r) {
+    char line[256];
+    if (fgets(line, sizeof(line), in) == NULL) {
+        return -1;
+    }
+    char *hash = strchr(line, '#');
+    if (hash) {
+        *hash = 0;
+    }
+    r->port = 0;
+    r->time_ms = -1;
+    int n = sscanf(line, "%d %ld %ld", &r->axis, &r->value, &r->time_ms);
+    if (n < 2) {
+        return 0;
+    }
+    return 1;
+}
+
+static int readPortRecord(FILE *in, CliRecord_t *r) {
+    char line[256];
+    if (fgets(line, sizeof(line), in) == NULL) {
+        return -1;
+    }
+    char *hash = strchr(line, '#');
+    if (hash) {
+        *hash = 0;
+    }
+    r->time_ms = -1;
+    return sscanf(line, "%d %d %ld", &r->port, &r->axis, &r->value) == 3;
+}
+
+static int readBinaryRecord(FILE *in, CliRecord_t *r) {
+    unsigned char b[12];
+    if (fread(b, 1, sizeof(b), in) != sizeof(b)) {
+        return -1;
+    }
+    int32_t t = (int32_t)(b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24);
+    int32_t v = (int32_t)(b[4] | b[5] << 8 | b[6] << 16 | (uint32_t)b[7] << 24);
+    r->time_ms = t;
+    r->value = v;
+    r->axis = b[8];
+    r->port = b[9];
+    return 1;
+}
+
+static void CliReportScan(const DmmAxisSnapshot_t *axes, int count, DmmTime_t elapsedUs, void *hook) {
+    for (int i = 0; i < count; i++) {
+        printf("%d", axes[i].axis);
+        for (int p = 0; p < Param_Count; p++) {
+            if ((axes[i].have | axes[i].missing) & (1 << p)) {
+                if (axes[i].have & (1 << p)) {
+                    printf(" %s %ld", DmmParamName(p), axes[i].value[p]);
+                } else {
+                    printf(" %s ?", DmmParamName(p));
+                }
+            }
+        }
+        printf("\n");
+    }
+    fprintf(stderr, "dmmcli: %d drives in %.1f ms\n", count, elapsedUs / 1000.0);
+}
+
+static void CliIgnoreReply(char axis, unsigned char code, long value, void *hook) {
+    // Scan results are printed by CliReportScan
+}
+
+static int runScan(DmmCli_t *cli) {
+    static DmmScan_t scan;
+    DmmScan_Init(&scan, &cli->state);
+    scan.ReportScanPtr = &CliReportScan;
+    DmmScan_Start(&scan, 0, DMM_MAX_AXES - 1);
+    flushTx(cli);
+    while (!interrupted && DmmScan_Poll(&scan)) {
+        flushTx(cli);
+        struct pollfd fd = { cli->tty, POLLIN | (cli->txLen > 0 ? POLLOUT : 0), 0 };
+        if (poll(&fd, 1, 1) > 0 && (fd.revents & POLLIN)) {
+            unsigned char buf[64];
+            ssize_t n = read(cli->tty, buf, sizeof(buf));
+            for (ssize_t i = 0; i < n; i++) {
+                ReadPackage(&cli->state, buf[i]);
+            }
+        }
+    }
+    DmmScan_Close(&scan);
+    return EX_OK;
+}
+
+// Pacer thread: straight to the tty, waiting for room if the kernel queue is full
+static void CliDirectWriteBuffer(const unsigned char *bytes, int length, void *hook) {
+    DmmCli_t *cli = (DmmCli_t*)hook;
+    while (length > 0) {
+        ssize_t n = write(cli->tty, bytes, length);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                struct pollfd fd = { cli->tty, POLLOUT, 0 };
+                poll(&fd, 1, 10);
+                continue;
+            }
+            fprintf(stderr, "dmmcli: write: %s\n", strerror(errno));
+            exit(EX_IOERR);
+        }
+        bytes += n;
+        length -= n;
+    }
+}
+
+static void CliDirectWrite(char c, void *hook) {
+    unsigned char b = (unsigned char)c;
+    CliDirectWriteBuffer(&b, 1, hook);
+}
+
+static int runPaced(DmmCli_t *cli, FILE *in, Boolean binary, CliMode_t mode, double pollHz) {
+    static DmmPacer_t pacer;
+    cli->state.SerialWritePtr = &CliDirectWrite;
+    cli->state.SerialWriteBufferPtr = &CliDirectWriteBuffer;
+    if (!DmmPacer_Start(&pacer, &cli->state)) {
+        return EX_OSERR;
+    }
+    int inFd = fileno(in);
+    Boolean inputDone = false;
+    long long firstTime_ms = -1;
+    DmmTime_t streamStart = 0;
+    DmmTime_t pollPeriod = pollHz > 0 ? (DmmTime_t)(1000000.0 / pollHz) : 0;
+    DmmTime_t nextPoll = DmmNow();
+    int pollAxis = 0;
+    while (!interrupted && (!inputDone || DmmPacer_Pending(&pacer) > 0 || pollPeriod > 0)) {
+        Boolean wantInput = !inputDone && DmmPacer_Pending(&pacer) < CLI_PACER_HIGH_WATER;
+        struct pollfd fds[2] = { { cli->tty, POLLIN, 0 }, { inFd, POLLIN, 0 } };
+        if (poll(fds, wantInput ? 2 : 1, wantInput ? 100 : 2) < 0 && errno != EINTR) {
+            fprintf(stderr, "dmmcli: poll: %s\n", strerror(errno));
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            unsigned char buf[64];
+            ssize_t n = read(cli->tty, buf, sizeof(buf));
+            DmmPacer_LockState(&pacer); // The pacer thread sends on the same state
+            for (ssize_t i = 0; i < n; i++) {
+                ReadPackage(&cli->state, buf[i]);
+            }
+            DmmPacer_UnlockState(&pacer);
+        }
+        if (fds[0].revents & (POLLHUP | POLLERR)) {
+            fprintf(stderr, "dmmcli: serial link closed\n");
+            break;
+        }
+        DmmTime_t now = DmmNow();
+        if (wantInput && (fds[1].revents & (POLLIN | POLLHUP))) {
+            CliRecord_t r;
+            int got = binary ? readBinaryRecord(in, &r) : readTextRecord(in, &r);
+            if (got < 0) {
+                inputDone = true;
+            } else if (got > 0 && r.axis >= 0 && r.axis < DMM_MAX_AXES) {
+                DmmTime_t due = now;
+                if (r.time_ms >= 0) {
+                    if (firstTime_ms < 0) {
+                        firstTime_ms = r.time_ms;
+                        streamStart = now;
+                    }
+                    due = streamStart + (r.time_ms - firstTime_ms) * 1000;
+                }
+                while (!DmmPacer_Submit(&pacer, due, mode == Mode_Speed ? Turn_ConstSpeed : Go_Absolute_Pos, (char)r.axis, r.value)) {
+                    usleep(1000);
+                }
+                cli->polledAxis[r.axis] = true;
+            }
+        }
+        if (pollPeriod > 0 && now >= nextPoll) {
+            for (int n = 0; n < DMM_MAX_AXES; n++) {
+                pollAxis = (pollAxis + 1) % DMM_MAX_AXES;
+                if (cli->polledAxis[pollAxis]) {
+                    DmmPacer_Submit(&pacer, now, General_Read, (char)pollAxis, Is_AbsPos32);
+                    break;
+                }
+            }
+            nextPoll = now + pollPeriod;
+        }
+    }
+    DmmPacer_Stop(&pacer, !interrupted);
+    DmmPacer_PrintHistogram(&pacer, stderr);
+    tcdrain(cli->tty);
+    return EX_OK;
+}
+
+static int wakePipe[2] = { -1, -1 };
+
+// Listener thread: the main loop sleeps in poll()
+static void CliIngressWake(void *hook) {
+    char c = 0;
+    (void)!write(wakePipe[1], &c, 1);
+}
+
+static void CliIngressDispatch(DmmIngressKind_t kind, char axis, long value, void *hook) {
+    DmmCli_t *cli = (DmmCli_t*)hook;
+    CliRecord_t r;
+    r.axis = axis;
+    r.value = kind == Ingress_Speed ? MAX(-CLI_MAX_REMOTE_SPEED, MIN(CLI_MAX_REMOTE_SPEED, value)) : value;
+    r.time_ms = -1;
+    sendRecord(cli, kind == Ingress_Speed ? Mode_Speed : Mode_Position, &r);
+}
+
+static void CliMailboxDispatch(DmmMailboxKind_t kind, char axis, long value, void *hook) {
+    CliIngressDispatch(kind == Mailbox_Speed ? Ingress_Speed : Ingress_Position, axis, value, hook);
+}
+
+static Boolean CliReopen(void *hook) {
+    DmmCli_t *cli = (DmmCli_t*)hook;
+    if (cli->tty >= 0) {
+        close(cli->tty);
+    }
+    cli->tty = openTty(cli->ttyPath);
+    cli->linkFreeAt_us = DmmNow();
+    return cli->tty >= 0;
+}
+
+static void CliReportLink(Boolean up, DmmTime_t downUs, int replayed, void *hook) {
+    if (up) {
+        fprintf(stderr, "dmmcli: serial link back after %.1f ms, %d packages replayed\n", downUs / 1000.0, replayed);
+    } else {
+        fprintf(stderr, "dmmcli: serial link down\n");
+    }
+}
+
+// Setpoints from UDP (port >= 0), a shared memory mailbox (name), or both
+static int runListen(DmmCli_t *cli, int port, const char *mailboxName, double pollHz) {
+    static DmmIngress_t ingress;
+    static DmmMailbox_t mailbox;
+    Boolean haveMailbox = mailboxName != NULL;
+    if (pipe(wakePipe) != 0) {
+        fprintf(stderr, "dmmcli: pipe: %s\n", strerror(errno));
+        return EX_OSERR;
+    }
+    fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+    DmmIngress_Init(&ingress, &cli->state);
+    ingress.WakePtr = &CliIngressWake;
+    ingress.DispatchPtr = &CliIngressDispatch;
+    ingress.hook = cli;
+    if (port >= 0) {
+        if (!DmmIngress_Start(&ingress, (unsigned short)port)) {
+            return EX_UNAVAILABLE;
+        }
+        fprintf(stderr, "dmmcli: listening on udp port %d\n", ingress.port);
+    }
+    if (haveMailbox) {
+        if (!DmmMailbox_Open(&mailbox, &cli->state, mailboxName, true, DMM_MAX_AXES)) {
+            DmmIngress_Stop(&ingress);
+            return EX_UNAVAILABLE;
+        }
+        mailbox.DispatchPtr = &CliMailboxDispatch;
+        mailbox.hook = cli;
+        fprintf(stderr, "dmmcli: reading mailbox %s\n", mailbox.name);
+    }
+    DmmTime_t pollPeriod = pollHz > 0 ? (DmmTime_t)(1000000.0 / pollHz) : 0;
+    DmmTime_t nextPoll = DmmNow();
+    int pollAxis = 0;
+    while (!interrupted) {
+        // One package per free link slot, so a newer value can still replace the rest
+        if (linkReady(cli)) {
+            int sent = DmmIngress_Poll(&ingress, 1);
+            if (sent == 0 && haveMailbox) {
+                sent = DmmMailbox_Poll(&mailbox, 1);
+            }
+            if (sent == 0 && pollPeriod > 0 && DmmNow() >= nextPoll) {
+                for (int n = 0; n < DMM_MAX_AXES; n++) {
+                    pollAxis = (pollAxis + 1) % DMM_MAX_AXES;
+                    if (cli->polledAxis[pollAxis]) {
+                        ReadMotorPosition32(&cli->state, (char)pollAxis);
+                        flushTx(cli);
+                        break;
+                    }
+                }
+                nextPoll = DmmNow() + pollPeriod;
+            }
+        }
+        DmmTime_t t = DmmNow();
+        long long wait_us = -1;
+        if (cli->txLen == 0 && (DmmIngress_Pending(&ingress) > 0 || pollPeriod > 0)) {
+            wait_us = MAX(0, cli->linkFreeAt_us - t);
+            if (DmmIngress_Pending(&ingress) == 0) {
+                wait_us = MAX(wait_us, nextPoll - t);
+            }
+            if (wait_us == 0 && ttyOutQueue(cli->tty) >= CLI_OUTQ_LIMIT) {
+                wait_us = DMM_BYTE_TIME_US;
+            }
+        }
+        if (haveMailbox && cli->txLen == 0) {
+            // Mailbox writers don't wake us: look again at the next transmit opportunity
+            long long linkWait = MAX(DMM_BYTE_TIME_US, cli->linkFreeAt_us - t);
+            if (wait_us < 0 || linkWait < wait_us) {
+                wait_us = linkWait;
+            }
+        }
+        if (cli->link && (wait_us < 0 || wait_us > CLI_LINK_POLL_US)) {
+            wait_us = CLI_LINK_POLL_US;
+        }
+        struct pollfd fds[2] = { { cli->tty, POLLIN | (cli->txLen > 0 ? POLLOUT : 0), 0 }, { wakePipe[0], POLLIN, 0 } };
+        if (poll(fds, 2, wait_us < 0 ? -1 : (int)((wait_us + 999) / 1000)) < 0 && errno != EINTR) {
+            fprintf(stderr, "dmmcli: poll: %s\n", strerror(errno));
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            unsigned char buf[64];
+            ssize_t n = read(cli->tty, buf, sizeof(buf));
+            for (ssize_t i = 0; i < n; i++) {
+                ReadPackage(&cli->state, buf[i]);
+            }
+        }
+        if (fds[0].revents & (POLLHUP | POLLERR)) {
+            if (cli->link == NULL) {
+                fprintf(stderr, "dmmcli: serial link closed\n");
+                break;
+            }
+            DmmLink_TransportError(cli->link);
+            close(cli->tty);
+            cli->tty = -1; // Until reopened, poll() skips it
+        }
+        if (fds[0].revents & POLLOUT) {
+            flushTx(cli);
+        }
+        if (fds[1].revents & POLLIN) {
+            char buf[64];
+            while (read(wakePipe[0], buf, sizeof(buf)) > 0) {
+            }
+        }
+        if (cli->link) {
+            DmmLink_Poll(cli->link);
+            flushTx(cli);
+        }
+    }
+    if (port >= 0) {
+        DmmIngress_Stop(&ingress);
+        DmmIngress_PrintLatency(&ingress, stderr);
+    }
+    if (haveMailbox) {
+        DmmMailbox_PrintAge(&mailbox, stderr);
+        DmmMailbox_Close(&mailbox);
+    }
+    if (cli->tty >= 0) {
+        tcdrain(cli->tty);
+    }
+    return EX_OK;
+}
+
+// Waypoints from the input, sampled onto the link by DmmSpline
+static int runWaypoints(DmmCli_t *cli, FILE *in, Boolean binary, double pollHz, Boolean steps, long tolerance) {
+    static DmmSpline_t spline;
+    static DmmRelative_t relative;
+    DmmSpline_Init(&spline, &cli->state);
+    spline.tolerance = tolerance;
+    if (steps) {
+        DmmRelative_Init(&relative, &cli->state);
+        spline.relative = &relative;
+    }
+    int inFd = fileno(in);
+    CliRecord_t pending;
+    Boolean havePending = false, inputDone = false, queued = false;
+    long long firstTime_ms = -1;
+    DmmTime_t streamStart = 0;
+    DmmTime_t pollPeriod = pollHz > 0 ? (DmmTime_t)(1000000.0 / pollHz) : 0;
+    DmmTime_t nextPoll = DmmNow();
+    int pollAxis = 0;
+    while (!interrupted && (!inputDone || havePending || queued || cli->txLen > 0)) {
+        if (havePending) {
+            if (firstTime_ms < 0) {
+                firstTime_ms = pending.time_ms;
+                streamStart = DmmNow();
+            }
+            DmmTime_t t = streamStart + (pending.time_ms - firstTime_ms) * 1000;
+            if (DmmSpline_Add(&spline, (char)pending.axis, t, pending.value)) {
+                cli->polledAxis[pending.axis] = true;
+                havePending = false;
+                queued = true;
+            } else if (DmmSpline_Queued(&spline, (char)pending.axis) < DMM_SPLINE_WAYPOINTS) {
+                fprintf(stderr, "dmmcli: waypoint at %ld ms not after the last one, ignored\n", pending.time_ms);
+                havePending = false;
+            }
+        }
+        if (linkReady(cli)) {
+            unsigned long sent = spline.sent;
+            queued = DmmSpline_Poll(&spline);
+            flushTx(cli);
+            if (spline.sent == sent && pollPeriod > 0 && DmmNow() >= nextPoll) {
+                for (int n = 0; n < DMM_MAX_AXES; n++) {
+                    pollAxis = (pollAxis + 1) % DMM_MAX_AXES;
+                    if (cli->polledAxis[pollAxis]) {
+                        ReadMotorPosition32(&cli->state, (char)pollAxis);
+                        flushTx(cli);
+                        break;
+                    }
+                }
+                nextPoll = DmmNow() + pollPeriod;
+            }
+        }
+        DmmTime_t t = DmmNow();
+        long long wait_us = -1;
+        if (queued || cli->txLen > 0) {
+            wait_us = MAX(0, MAX(cli->linkFreeAt_us, spline.nextSendAt) - t);
+            if (wait_us == 0) {
+                wait_us = DMM_BYTE_TIME_US; // Between waypoints, or the kernel still holds bytes
+            }
+        }
+        Boolean wantInput = !inputDone && !havePending;
+        struct pollfd fds[2] = { { cli->tty, POLLIN | (cli->txLen > 0 ? POLLOUT : 0), 0 }, { inFd, POLLIN, 0 } };
+        if (poll(fds, wantInput ? 2 : 1, wait_us < 0 ? -1 : (int)((wait_us + 999) / 1000)) < 0 && errno != EINTR) {
+            fprintf(stderr, "dmmcli: poll: %s\n", strerror(errno));
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            unsigned char buf[64];
+            ssize_t n = read(cli->tty, buf, sizeof(buf));
+            for (ssize_t i = 0; i < n; i++) {
+                ReadPackage(&cli->state, buf[i]);
+            }
+        }
+        if (fds[0].revents & (POLLHUP | POLLERR)) {
+            fprintf(stderr, "dmmcli: serial link closed\n");
+            break;
+        }
+        if (fds[0].revents & POLLOUT) {
+            flushTx(cli);
+        }
+        if (wantInput && (fds[1].revents & (POLLIN | POLLHUP))) {
+            int got = binary ? readBinaryRecord(in, &pending) : readTextRecord(in, &pending);
+            if (got < 0) {
+                inputDone = true;
+            } else if (got > 0) {
+                if (pending.axis < 0 || pending.axis >= DMM_MAX_AXES || pending.time_ms < 0) {
+                    fprintf(stderr, "dmmcli: waypoints need an axis 0 - 127 and a time, ignored\n");
+                } else {
+                    havePending = true;
+                }
+            }
+        }
+    }
+    fprintf(stderr, "dmmcli: %lu packages, %lu bytes, %lu shortened\n", spline.sent, spline.bytes, spline.shortened);
+    if (steps) {
+        fprintf(stderr, "dmmcli: %lu steps, %lu absolute, %lu resyncs, %lu bytes saved\n",
+                relative.relative, relative.absolute, relative.resyncs, relative.bytesSaved);
+        DmmRelative_Close(&relative);
+    }
+    DmmSpline_Close(&spline);
+    tcdrain(cli->tty);
+    return EX_OK;
+}
+
+static DmmTime_t portsStart;
+
+static void CliReportEvents(const DmmReactorEvent_t *events, int count, void *hook) {
+    for (int i = 0; i < count; i++) {
+        const DmmReactorEvent_t *e = &events[i];
+        printf("%lld %d %d %d %ld\n", (e->decodedAt - portsStart) / 1000, e->port, e->axis, e->code, e->value);
+    }
+    fflush(stdout);
+}
+
+static void CliReportPortError(int port, int err, void *hook) {
+    fprintf(stderr, "dmmcli: port %d: %s, closed\n", port, strerror(err));
+}
+
+// Bytes on their way to the drives on the port: the reactor's ring and the kernel's queue
+static int portQueued(DmmReactor_t *r, int port) {
+    return (int)DmmReactor_TxQueued(r, port) + ttyOutQueue(r->ports[port].fd);
+}
+
+// Several ttys, one thread
+static int runPorts(char **paths, int count, FILE *in, Boolean binary, CliMode_t mode, double pollHz) {
+    static DmmReactor_t reactor;
+    static Boolean polled[CLI_MAX_PORTS][DMM_MAX_AXES];
+    if (!DmmReactor_Init(&reactor, count)) {
+        fprintf(stderr, "dmmcli: epoll: %s\n", strerror(errno));
+        return EX_OSERR;
+    }
+    reactor.ReportEventsPtr = &CliReportEvents;
+    reactor.ReportPortErrorPtr = &CliReportPortError;
+    for (int i = 0; i < count; i++) {
+        int fd = openTty(paths[i]);
+        if (fd < 0) {
+            DmmReactor_Close(&reactor);
+            return EX_NOINPUT;
+        }
+        if (DmmReactor_AddPort(&reactor, fd) < 0) {
+            fprintf(stderr, "dmmcli: can't watch %s: %s\n", paths[i], strerror(errno));
+            DmmReactor_Close(&reactor);
+            return EX_OSERR;
+        }
+    }
+    portsStart = DmmNow();
+    int inFd = fileno(in);
+    CliRecord_t pending;
+    Boolean havePending = false, inputDone = false;
+    DmmTime_t pollPeriod = pollHz > 0 ? (DmmTime_t)(1000000.0 / pollHz) : 0;
+    DmmTime_t nextPoll = portsStart;
+    unsigned long sent = 0, polls = 0;
+    for (;;) {
+        Boolean busy = false;
+        for (int i = 0; i < count; i++) {
+            busy |= reactor.ports[i].open && DmmReactor_TxQueued(&reactor, i) > 0;
+        }
+        if (interrupted || (inputDone && !havePending && !busy && pollPeriod == 0)) {
+            break;
+        }
+        if (havePending && !reactor.ports[pending.port].open) {
+            havePending = false; // Closed on an error, already reported
+        }
+        if (havePending && portQueued(&reactor, pending.port) < CLI_OUTQ_LIMIT) {
+            DmmProtocolState_t *pp = DmmReactor_State(&reactor, pending.port);
+            if (mode == Mode_Speed) {
+                MoveMotorConstantRotation(pp, (char)pending.axis, pending.value);
+            } else {
+                MoveMotorToAbsolutePosition32(pp, (char)pending.axis, pending.value);
+            }
+            polled[pending.port][pending.axis] = true;
+            havePending = false;
+            sent++;
+        }
+        // One position read per polled axis per period, on every port at once
+        if (pollPeriod > 0 && DmmNow() >= nextPoll) {
+            for (int i = 0; i < count; i++) {
+                for (int a = 0; a < DMM_MAX_AXES; a++) {
+                    if (polled[i][a] && reactor.ports[i].open) {
+                        ReadMotorPosition32(DmmReactor_State(&reactor, i), (char)a);
+                        polls++;
+                    }
+                }
+            }
+            nextPoll = DmmNow() + pollPeriod;
+        }
+        if (!inputDone && !havePending) {
+            struct pollfd fd = { inFd, POLLIN, 0 };
+            if (poll(&fd, 1, 0) > 0) {
+                int got = binary ? readBinaryRecord(in, &pending) : readPortRecord(in, &pending);
+                if (got < 0) {
+                    inputDone = true;
+                } else if (got > 0) {
+                    if (pending.port < 0 || pending.port >= count || pending.axis < 0 || pending.axis >= DMM_MAX_AXES) {
+                        fprintf(stderr, "dmmcli: port %d axis %d out of range, ignored\n", pending.port, pending.axis);
+                    } else {
+                        havePending = true;
+                    }
+                }
+            }
+        }
+        if (DmmReactor_Run(&reactor, havePending ? 0 : 1) < 0) {
+            fprintf(stderr, "dmmcli: epoll: %s\n", strerror(errno));
+            break;
+        }
+        if (havePending) {
+            usleep(DMM_BYTE_TIME_US); // The kernel's queue draining doesn't wake epoll
+        }
+    }
+    unsigned long rx = 0, tx = 0, dropped = 0;
+    for (int i = 0; i < count; i++) {
+        rx += reactor.ports[i].rxBytes;
+        tx += reactor.ports[i].txBytes;
+        dropped += reactor.ports[i].txDropped;
+    }
+    fprintf(stderr, "dmmcli: %d ports, %lu setpoints, %lu polls, %lu bytes out, %lu in, %lu dropped\n",
+            count, sent, polls, tx, rx, dropped);
+    DmmReactor_Close(&reactor);
+    return EX_OK;
+}
+
+static const char *tracePath = NULL;
+
+static void writeTrace(void) {
+    FILE *out = fopen(tracePath, "w");
+    if (out == NULL) {
+        fprintf(stderr, "dmmcli: can't open %s: %s\n", tracePath, strerror(errno));
+        return;
+    }
+    int n = DmmTrace_Dump(out);
+    fclose(out);
+    fprintf(stderr, "dmmcli: %d trace records in %s\n", n, tracePath);
+}
+
+static DmmHistory_t history;
+
+static void closeHistory(void) {
+    uint64_t samples = 0;
+    size_t bytes = 0;
+    for (int i = 0; i < DMM_MAX_AXES; i++) {
+        for (int c = 0; c < History_Channels; c++) {
+            if (history.series[i][c]) {
+                uint64_t n;
+                bytes += DmmHistory_Bytes(&history, (char)i, (DmmHistoryChannel_t)c, &n);
+                samples += n;
+            }
+        }
+    }
+    fprintf(stderr, "dmmcli: history %lu samples this run, %llu stored in %zu bytes\n",
+            history.samples, (unsigned long long)samples, bytes);
+    DmmHistory_Close(&history);
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: dmmcli [-m speed|position] [-b] [-p hz] [-i file] [-P] tty\n"
+            "       dmmcli -w [-r] [-t counts] [-b] [-p hz] [-i file] tty\n"
+            "       dmmcli [-u port] [-M name] [-p hz] [-R] tty\n"
+            "       dmmcli -S tty\n"
+            "       dmmcli [-m speed|position] [-b] [-p hz] [-i file] tty tty ...\n"
+            "  -m  setpoint kind, default speed (Turn_ConstSpeed)\n"
+            "  -b  binary records instead of text lines\n"
+            "  -p  poll position of every axis seen at this rate\n"
+            "  -i  read setpoints from file instead of stdin\n"
+            "  -P  release packages from a paced thread at their timestamps\n"
+            "  -w  input is waypoints, stream a smooth curve through them\n"
+            "  -r  with -w, send relative steps where those are shorter\n"
+            "  -t  with -w, move a package up to counts off the curve where that makes it shorter\n"
+            "  -u  take setpoints from OSC or binary UDP datagrams on port\n"
+            "  -M  take setpoints from the shared memory mailbox /name\n"
+            "  -T  write the frame path trace to file at exit (-DDMM_TRACE builds)\n"
+            "  -H  record position and torque replies to the history store in dir\n"
+            "  -R  with -u or -M, reopen the tty and resend what the drives missed when the link drops\n"
+            "  -S  list the drives on the bus and exit\n");
+    exit(EX_USAGE);
+}
+
+int main(int argc, char **argv) {
+    CliMode_t mode = Mode_Speed;
+    Boolean binary = false;
+    double pollHz = 0;
+    const char *inPath = NULL;
+    Boolean scanOnly = false, paced = false, waypoints = false, steps = false;
+    long tolerance = 0;
+    int udpPort = -1;
+    const char *mailboxName = NULL;
+    const char *historyDir = NULL;
+    Boolean reconnect = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:bp:i:SPwrt:u:M:T:H:R")) != -1) {
+        switch (opt) {
+            case 'm':
+                if (strncmp(optarg, "pos", 3) == 0) {
+                    mode = Mode_Position;
+                } else if (strcmp(optarg, "speed") == 0) {
+                    mode = Mode_Speed;
+                } else {
+                    usage();
+                }
+                break;
+            case 'b': binary = true; break;
+            case 'p': pollHz = atof(optarg); break;
+            case 'i': inPath = optarg; break;
+            case 'S': scanOnly = true; break;
+            case 'P': paced = true; break;
+            case 'w': waypoints = true; break;
+            case 'r': steps = true; break;
+            case 't': tolerance = MAX(0, atol(optarg)); break;
+            case 'u': udpPort = atoi(optarg); break;
+            case 'M': mailboxName = optarg; break;
+            case 'T': tracePath = optarg; break;
+            case 'H': historyDir = optarg; break;
+            case 'R': reconnect = true; break;
+            default: usage();
+        }
+    }
+    if (optind >= argc || argc - optind > CLI_MAX_PORTS) {
+        usage();
+    }
+    if (argc - optind > 1) {
+        if (scanOnly || paced || waypoints || udpPort >= 0 || mailboxName || historyDir || reconnect) {
+            usage(); // One tty only
+        }
+        FILE *in = inPath ? fopen(inPath, binary ? "rb" : "r") : stdin;
+        if (in == NULL) {
+            fprintf(stderr, "dmmcli: can't open %s: %s\n", inPath, strerror(errno));
+            return EX_NOINPUT;
+        }
+        setvbuf(in, NULL, _IONBF, 0);
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+        return runPorts(argv + optind, argc - optind, in, binary, mode, pollHz);
+    }
+
+    if (tracePath) {
+        atexit(writeTrace);
+    }
+    static DmmCli_t cli;
+    memset(&cli, 0, sizeof(cli));
+    cli.ttyPath = argv[optind];
+    cli.tty = openTty(cli.ttyPath);
+    if (cli.tty < 0) {
+        return EX_NOINPUT;
+    }
+    if (historyDir && !scanOnly) {
+        if (!DmmHistory_Open(&history, &cli.state, historyDir)) {
+            fprintf(stderr, "dmmcli: can't open history store %s: %s\n", historyDir, strerror(errno));
+            return EX_CANTCREAT;
+        }
+        atexit(closeHistory);
+    }
+    if (scanOnly) {
+        cli.state.SerialWritePtr = &CliSerialWrite;
+        cli.state.SerialWriteBufferPtr = &CliSerialWriteBuffer;
+        cli.state.ReportPositionPtr = &CliReportPosition;
+        cli.state.ReportReplyPtr = &CliIgnoreReply;
+        cli.state.hook = &cli;
+        signal(SIGINT, onSignal);
+        return runScan(&cli);
+    }
+    if (udpPort >= 0 || mailboxName) {
+        cli.state.SerialWritePtr = &CliSerialWrite;
+        cli.state.SerialWriteBufferPtr = &CliSerialWriteBuffer;
+        cli.state.ReportPositionPtr = &CliReportPosition;
+        cli.state.ReportReplyPtr = &CliReportReply;
+        cli.state.hook = &cli;
+        cli.start_us = DmmNow();
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+        static DmmLink_t link;
+        if (reconnect) {
+            DmmLink_Init(&link, &cli.state);
+            link.ReopenPtr = &CliReopen;
+            link.ReportLinkPtr = &CliReportLink;
+            link.hook = &cli;
+            cli.link = &link;
+        }
+        return runListen(&cli, udpPort, mailboxName, pollHz);
+    }
+    FILE *in = inPath ? fopen(inPath, binary ? "rb" : "r") : stdin;
+    if (in == NULL) {
+        fprintf(stderr, "dmmcli: can't open %s: %s\n", inPath, strerror(errno));
+        return EX_NOINPUT;
+    }
+    int inFd = fileno(in);
+    cli.state.SerialWritePtr = &CliSerialWrite;
+    cli.state.SerialWriteBufferPtr = &CliSerialWriteBuffer;
+    cli.state.ReportPositionPtr = &CliReportPosition;
+    cli.state.ReportReplyPtr = &CliReportReply;
+    cli.state.hook = &cli;
+    cli.start_us = DmmNow();
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    setvbuf(in, NULL, _IONBF, 0); // poll() on inFd must see what stdio hasn't consumed
+    if (waypoints) {
+        return runWaypoints(&cli, in, binary, pollHz, steps, tolerance);
+    }
+    if (paced) {
+        return runPaced(&cli, in, binary, mode, pollHz);
+    }
+
+    CliRecord_t pending;
+    Boolean havePending = false, inputDone = false;
+    long long firstTime_ms = -1, streamStart_us = 0;
+    long long pollPeriod_us = pollHz > 0 ? (long long)(1000000.0 / pollHz) : 0;
+    long long nextPoll_us = cli.start_us;
+    int pollAxis = 0;
+
+    while (!interrupted && (!inputDone || havePending || cli.txLen > 0 || pollPeriod_us > 0)) {
+        long long t = DmmNow();
+        long long wait_us = -1;
+
+        if (havePending && linkReady(&cli)) {
+            long long due_us = t;
+            if (pending.time_ms >= 0) {
+                if (firstTime_ms < 0) {
+                    firstTime_ms = pending.time_ms;
+                    streamStart_us = t;
+                }
+                due_us = streamStart_us + (pending.time_ms - firstTime_ms) * 1000;
+            }
+            if (due_us <= t) {
+                sendRecord(&cli, mode, &pending);
+                havePending = false;
+            } else {
+                wait_us = due_us - t;
+            }
+        }
+
+        // Position polls only use link time setpoints don't need
+        if (pollPeriod_us > 0 && !havePending && linkReady(&cli) && t >= nextPoll_us) {
+            for (int n = 0; n < DMM_MAX_AXES; n++) {
+                pollAxis = (pollAxis + 1) % DMM_MAX_AXES;
+                if (cli.polledAxis[pollAxis]) {
+                    ReadMotorPosition32(&cli.state, (char)pollAxis);
+                    flushTx(&cli);
+                    break;
+                }
+            }
+            nextPoll_us = t + pollPeriod_us;
+        }
+
+        struct pollfd fds[2];
+        memset(fds, 0, sizeof(fds));
+        int nfds = 0;
+        fds[nfds].fd = cli.tty;
+        fds[nfds].events = POLLIN | (cli.txLen > 0 ? POLLOUT : 0);
+        nfds++;
+        Boolean wantInput = !inputDone && !havePending && cli.txLen == 0;
+        if (wantInput) {
+            fds[nfds].fd = inFd;
+            fds[nfds].events = POLLIN;
+            nfds++;
+        }
+        t = DmmNow();
+        if (havePending || cli.txLen > 0 || pollPeriod_us > 0) {
+            long long linkWait = cli.linkFreeAt_us - t;
+            long long pollWait = pollPeriod_us > 0 ? nextPoll_us - t : linkWait;
+            long long w = MAX(0, MIN(linkWait, pollWait));
+            if (havePending) {
+                w = MAX(w, linkWait);
+            }
+            if (wait_us < 0 || w < wait_us) {
+                wait_us = w;
+            }
+            if (wait_us == 0 && ttyOutQueue(cli.tty) >= CLI_OUTQ_LIMIT) {
+                wait_us = DMM_BYTE_TIME_US;
+            }
+        }
+        int timeout_ms = wait_us < 0 ? -1 : (int)((wait_us + 999) / 1000);
+        if (poll(fds, nfds, timeout_ms) < 0 && errno != EINTR) {
+            fprintf(stderr, "dmmcli: poll: %s\n", strerror(errno));
+            return EX_OSERR;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            unsigned char buf[64];
+            ssize_t n = read(cli.tty, buf, sizeof(buf));
+            for (ssize_t i = 0; i < n; i++) {
+                ReadPackage(&cli.state, buf[i]);
+            }
+        }
+        if (fds[0].revents & (POLLHUP | POLLERR)) {
+            fprintf(stderr, "dmmcli: serial link closed\n");
+            return EX_IOERR;
+        }
+        if (fds[0].revents & POLLOUT) {
+            flushTx(&cli);
+        }
+        if (wantInput && (fds[1].revents & (POLLIN | POLLHUP))) {
+            int got = binary ? readBinaryRecord(in, &pending) : readTextRecord(in, &pending);
+            if (got < 0) {
+                inputDone = true;
+            } else if (got > 0) {
+                if (pending.axis < 0 || pending.axis >= DMM_MAX_AXES) {
+                    fprintf(stderr, "dmmcli: axis %d out of range, ignored\n", pending.axis);
+                } else {
+                    havePending = true;
+                }
+            }
+        }
+    }
+
+    tcdrain(cli.tty);
+    close(cli.tty);
+    return EX_OK;
+}
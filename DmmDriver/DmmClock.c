@@ -0,0 +1,90 @@
+//
+//  DmmClock.c
+//  dmmsend
+//
+
+#include "DmmClock.h"
+
+#if defined(_MSC_VER)
+    #define DMM_THREAD_LOCAL __declspec(thread)
+#else
+    #define DMM_THREAD_LOCAL __thread
+#endif
+
+static DMM_THREAD_LOCAL DmmTimeSource_t threadSource;
+static DMM_THREAD_LOCAL void *threadSourceCtx;
+
+#if defined(_WIN32)
+#include <windows.h>
+
+static DmmTime_t wallNow(void) {
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft); // 100 ns since 1601
+    ULARGE_INTEGER t = { { ft.dwLowDateTime, ft.dwHighDateTime } };
+    return (DmmTime_t)(t.QuadPart / 10) - 11644473600000000LL;
+}
+
+static DmmTime_t monotonicNow(void) {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&t);
+    return (DmmTime_t)(t.QuadPart / freq.QuadPart) * 1000000LL
+         + (DmmTime_t)(t.QuadPart % freq.QuadPart) * 1000000LL / freq.QuadPart;
+}
+
+#elif defined(__APPLE__)
+#include <mach/mach_time.h>
+#include <sys/time.h>
+
+static DmmTime_t wallNow(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (DmmTime_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static DmmTime_t monotonicNow(void) {
+    static mach_timebase_info_data_t tb;
+    if (tb.denom == 0) {
+        mach_timebase_info(&tb);
+    }
+    return (DmmTime_t)(mach_absolute_time() * tb.numer / tb.denom / 1000);
+}
+
+#else
+#include <time.h>
+
+static DmmTime_t wallNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (DmmTime_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static DmmTime_t monotonicNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (DmmTime_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+#endif
+
+void DmmClock_SetThreadSource(DmmTimeSource_t source, void *ctx) {
+    threadSource = source;
+    threadSourceCtx = ctx;
+}
+
+DmmTime_t DmmNow(void) {
+    if (threadSource) {
+        return threadSource(threadSourceCtx);
+    }
+    return monotonicNow();
+}
+
+DmmTime_t DmmClock_WallOffset(void) {
+    if (threadSource) {
+        return 0;
+    }
+    return wallNow() - monotonicNow();
+}
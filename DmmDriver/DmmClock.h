@@ -0,0 +1,22 @@
+//
+//  DmmClock.h
+//  dmmsend
+//
+//  Monotonic time for everything in the driver that measures or schedules.
+//
+
+#ifndef dmmsend_DmmClock_h
+#define dmmsend_DmmClock_h
+
+typedef long long DmmTime_t; // Microseconds, monotonic, arbitrary epoch
+
+typedef DmmTime_t (*DmmTimeSource_t)(void *ctx);
+
+DmmTime_t DmmNow(void);
+// DmmNow on the calling thread answers from source until it is set back to NULL,
+// so a simulation can run driver modules on its own time
+void DmmClock_SetThreadSource(DmmTimeSource_t source, void *ctx);
+// Epoch time in microseconds - DmmNow; 0 under a thread source, whose time is its own epoch
+DmmTime_t DmmClock_WallOffset(void);
+
+#endif
@@ -0,0 +1,139 @@
+//
+//  DmmDiscover.c
+//  dmmsend
+//
+
+#include <string.h>
+
+#include "DmmDiscover.h"
+#include "DmmProtocol.h"
+
+static const struct {
+    unsigned char readFunc;
+    long readData;          // Dummy unless General_Read
+    unsigned char isCode;   // Function code of the reply
+    const char *name;
+} Params[Param_Count] = {
+    { Read_MainGain, 0, Is_MainGain, "mainGain" },
+    { Read_SpeedGain, 0, Is_SpeedGain, "speedGain" },
+    { Read_IntGain, 0, Is_IntGain, "intGain" },
+    { Read_DriveConfig, 0, Is_Config, "config" },
+    { Read_Drive_Status, 0, Is_Status, "status" },
+    { Read_Pos_OnRange, 0, Is_PosOn_Range, "posOnRange" },
+    { Read_GearNumber, 0, Is_GearNumber, "gearNumber" },
+    { General_Read, Is_AbsPos32, Is_AbsPos32, "position" },
+};
+
+const char *DmmParamName(DmmParam_t param) {
+    return param < Param_Count ? Params[param].name : "unknown";
+}
+
+static int slotFor(DmmDiscover_t *d, char axis) {
+    for (int i = 0; i < d->axisCount; i++) {
+        if (d->axis[i].axis == axis) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void DmmDiscover_OnReply(DmmProtocolState_t *pp, char axisID, unsigned char code, long value, void *ctx) {
+    DmmDiscover_t *d = (DmmDiscover_t*)ctx;
+    if (!d->running) {
+        return;
+    }
+    int slot = slotFor(d, axisID);
+    if (slot < 0) {
+        return;
+    }
+    for (int p = 0; p < Param_Count; p++) {
+        if (Params[p].isCode == code) {
+            d->axis[slot].value[p] = value;
+            d->axis[slot].have |= 1 << p;
+        }
+    }
+}
+
+// Sends the reads still missing for a slot, returns the worst case time for their replies
+static DmmTime_t sendMissing(DmmDiscover_t *d, int slot) {
+    int replies = 0;
+    for (int p = 0; p < Param_Count; p++) {
+        if ((d->paramMask & (1 << p)) && !(d->axis[slot].have & (1 << p))) {
+            Send_Package(d->pp, Params[p].readFunc, d->axis[slot].axis, Params[p].readData);
+            replies++;
+        }
+    }
+    d->tries[slot]++;
+    return DMM_BYTES_TIME_US(replies * DMM_MAX_FRAME);
+}
+
+void DmmDiscover_Start(DmmDiscover_t *d, const char *axes, int n) {
+    DmmTime_t now = DmmNow();
+    d->axisCount = n < DMM_MAX_AXES ? n : DMM_MAX_AXES;
+    d->started = now;
+    d->running = true;
+    d->lineFreeAt = now;
+    for (int i = 0; i < d->axisCount; i++) {
+        memset(&d->axis[i], 0, sizeof(d->axis[i]));
+        d->axis[i].axis = axes[i];
+        d->tries[i] = 0;
+        d->sendAt[i] = now;
+        d->deadline[i] = 0;
+    }
+    DmmDiscover_Poll(d);
+}
+
+Boolean DmmDiscover_Poll(DmmDiscover_t *d) {
+    if (!d->running) {
+        return false;
+    }
+    DmmTime_t now = DmmNow();
+    Boolean done = true;
+    for (int i = 0; i < d->axisCount; i++) {
+        if ((d->axis[i].have & d->paramMask) == d->paramMask) {
+            continue;
+        }
+        if (d->sendAt[i] != 0) {
+            // On a shared reply line the next axis waits until this one's replies are expected back
+            if (now >= d->sendAt[i] && (!d->sharedReplyLine || now >= d->lineFreeAt)) {
+                DmmTime_t requests = DMM_BYTES_TIME_US(Param_Count * 4); // At most
+                DmmTime_t replies = sendMissing(d, i);
+                d->lineFreeAt = now + requests + replies;
+                d->deadline[i] = d->lineFreeAt + d->replyMarginUs;
+                d->sendAt[i] = 0;
+            }
+            done = false;
+        } else if (now >= d->deadline[i]) {
+            if (d->tries[i] <= d->maxRetries) {
+                d->sendAt[i] = now;
+                done = false;
+            }
+        } else {
+            done = false;
+        }
+    }
+    if (done) {
+        d->running = false;
+        for (int i = 0; i < d->axisCount; i++) {
+            d->axis[i].missing = d->paramMask & ~d->axis[i].have;
+        }
+        if (d->ReportSnapshotPtr) {
+            d->ReportSnapshotPtr(d->axis, d->axisCount, now - d->started, d->hook);
+        }
+    }
+    return d->running;
+}
+
+void DmmDiscover_Init(DmmDiscover_t *d, DmmProtocolState_t *pp) {
+    memset(d, 0, sizeof(*d));
+    d->pp = pp;
+    d->sharedReplyLine = true;
+    d->paramMask = DMM_PARAMS_ALL;
+    d->maxRetries = 3;
+    d->replyMarginUs = 20000;
+    AddReplyObserver(pp, &DmmDiscover_OnReply, d);
+}
+
+void DmmDiscover_Close(DmmDiscover_t *d) {
+    RemoveReplyObserver(d->pp, &DmmDiscover_OnReply, d);
+}
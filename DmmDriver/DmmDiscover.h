@@ -0,0 +1,63 @@
+//
+//  DmmDiscover.h
+//  dmmsend
+//
+//  Pipelined parameter discovery. All parameter reads for an axis go out back
+//  to back, replies are matched by axis and function code as they arrive, and
+//  only the reads still unanswered after a timeout are sent again.
+//
+
+#ifndef dmmsend_DmmDiscover_h
+#define dmmsend_DmmDiscover_h
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+
+typedef enum {
+    Param_MainGain = 0,
+    Param_SpeedGain,
+    Param_IntGain,
+    Param_Config,
+    Param_Status,
+    Param_PosOnRange,
+    Param_GearNumber,
+    Param_Position,
+    Param_Count
+} DmmParam_t;
+
+#define DMM_PARAMS_ALL ((1 << Param_Count) - 1)
+
+typedef struct DmmAxisSnapshot {
+    char axis;
+    long value[Param_Count];
+    unsigned int have;          // Bit per DmmParam_t
+    unsigned int missing;       // Asked for but never answered, set when reported
+} DmmAxisSnapshot_t;
+
+typedef struct DmmDiscover {
+    DmmProtocolState_t *pp;
+    Boolean running;
+    Boolean sharedReplyLine;    // Drives share the rx line: stagger axes so replies can't collide
+    unsigned int paramMask;     // Which DmmParam_t to read, DMM_PARAMS_ALL by default
+    int maxRetries;
+    DmmTime_t replyMarginUs;    // Added to the expected reply time before a read counts as lost
+    int axisCount;
+    DmmAxisSnapshot_t axis[DMM_MAX_AXES];
+    DmmTime_t sendAt[DMM_MAX_AXES];   // When the axis's next burst may go out, 0 once sent
+    DmmTime_t lineFreeAt;             // Expected end of the replies to the last burst
+    DmmTime_t deadline[DMM_MAX_AXES]; // Missing replies after this are re-requested
+    int tries[DMM_MAX_AXES];
+    DmmTime_t started;
+    // Called once when every axis is complete or out of retries
+    void (*ReportSnapshotPtr)(const DmmAxisSnapshot_t *axes, int count, DmmTime_t elapsedUs, void *hook);
+    void *hook;
+} DmmDiscover_t;
+
+void DmmDiscover_Init(DmmDiscover_t *d, DmmProtocolState_t *pp);
+void DmmDiscover_Close(DmmDiscover_t *d);
+void DmmDiscover_Start(DmmDiscover_t *d, const char *axes, int n);
+// Sends due bursts and retries; call every few milliseconds while running. Returns running.
+Boolean DmmDiscover_Poll(DmmDiscover_t *d);
+const char *DmmParamName(DmmParam_t param);
+
+#endif
@@ -23,47 +23,13 @@ Communication Format
 
 #include <sysexits.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <limits.h>
 
 #include "DmmDriver.h"
-
-#define Go_Absolute_Pos 0x01
-#define Turn_ConstSpeed 0x0a
-#define Set_Origin 0x00
-#define Set_HighSpeed 0x14
-#define Set_HighAccel 0x15
-#define Set_MainGain  0x10
-#define Set_SpeedGain 0x11
-#define Set_IntGain  0x12
-
-
-#define Set_Drive_Config 0x07
-#define Config_Bit_MOTOR_DRIVE 0x10 // HIGH: Motor Drive Enabled, LOW: Motor Drive Free
-
-#define General_Read 0x0e
-
-#define Is_AbsPos32 0x1b
-#define Is_TrqCurrent 0x1e
-#define Is_MainGain 0x10
-#define Is_SpeedGain 0x11
-#define Is_IntGain 0x12
-#define Is_Status 0x19
-#define Is_Config 0x1a
-#define Is_PosOn_Range 0x17
-#define Is_GearNumber 0x18
-#define Is_TrqCons 0x13
-#define Is_HighSpeed 0x14
-#define Is_HighAccel 0x15
-#define Is_Drive_ID 0x16
-
-#define Read_MainGain 0x18
-#define Read_SpeedGain 0x19
-#define Read_IntGain 0x20
-#define Read_DriveConfig 0x08
-#define Read_Drive_Status 0x09
-#define Read_Pos_OnRange 0x1e
-#define Read_GearNumber 0x1f
-#define Read_Drive_ID 0x06
+#include "DmmProtocol.h"
+#include "DmmTrace.h"
 
 #ifndef MIN
     #define MIN(a,b) ((a<b) ? a : b)
@@ -77,7 +43,8 @@ Communication Format
 ProtocolError_t Get_Function(DmmProtocolState_t*);
 long Cal_SignValue(unsigned char One_Package[8]);
 unsigned int Cal_UnsignedValue(unsigned char One_Package[8]);
-void Make_CRC_Send(DmmProtocolState_t *pp, unsigned char Plength,unsigned char B[8]);
+void Make_CRC(unsigned char Plength,unsigned char B[8]);
+void Write_Package(DmmProtocolState_t* pp, const unsigned char *B, int length);
 
 const char * ParameterName(char isCode) {
     switch(isCode) {
@@ -89,6 +56,7 @@ const char * ParameterName(char isCode) {
         case Is_PosOn_Range : return "Position On Range";
         case Is_GearNumber : return "Gear Number";
         case Is_AbsPos32 : return "Absolute Position";
+        case Is_TrqCurrent : return "Torque Current";
         case Is_TrqCons : return "Torque Contant";
         case Is_HighSpeed : return "Max Speed";
         case Is_HighAccel : return "Max Acceleration";
@@ -102,6 +70,8 @@ void ReadPackage(DmmProtocolState_t* pp, unsigned char c) {
     if( cif == 0) {
       pp->Read_Num = 0;
       pp->Read_Package_Length = 0;
+      pp->Read_FirstByteAt = DmmNow();
+      DMM_TRACEPOINT(rx_first_byte, c, 0, 0);
     }
     if(cif==0 || (pp->Read_Num > 0  && ((pp->Read_Num) < sizeof(pp->Read_Package_Buffer))) ) {
       pp->Read_Package_Buffer[pp->Read_Num] = c;
@@ -119,6 +89,72 @@ void ReadPackage(DmmProtocolState_t* pp, unsigned char c) {
 }
 
 
+// Functions the drive answers
+Boolean Expects_Reply(unsigned char func)
+{
+  switch (func) {
+    case General_Read:
+    case Read_MainGain:
+    case Read_SpeedGain:
+    case Read_IntGain:
+    case Read_DriveConfig:
+    case Read_Drive_Status:
+    case Read_Pos_OnRange:
+    case Read_GearNumber:
+    case Read_Drive_ID:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static void Track_Request(DmmProtocolState_t* pp, char ID, DmmTime_t sentAt, DmmTime_t doneAt)
+{
+  if (pp->PendingCount == DMM_MAX_PENDING_READS) { // Oldest was never answered
+    pp->PendingHead = (pp->PendingHead + 1) % DMM_MAX_PENDING_READS;
+    pp->PendingCount--;
+  }
+  int i = (pp->PendingHead + pp->PendingCount++) % DMM_MAX_PENDING_READS;
+  pp->PendingReads[i].axis = ID;
+  pp->PendingReads[i].sentAt = sentAt;
+  pp->PendingReads[i].doneAt = doneAt;
+}
+
+// Fills Read_Timing for the reply just decoded. The drive answers in order, so the oldest
+// request from that axis is the one; older ones from other axes went unanswered.
+static void Time_Reply(DmmProtocolState_t* pp, char ID)
+{
+  DmmReplyTiming_t *t = &pp->Read_Timing;
+  DmmTime_t lastByteTime = DMM_BYTES_TIME_US(pp->Read_Package_Length - 1);
+  t->decodedAt = DmmNow();
+  // Bytes read in one chunk share a time stamp; the first can't have come later than this
+  t->firstByteAt = MIN(pp->Read_FirstByteAt, t->decodedAt - lastByteTime);
+  t->requestSentAt = t->requestDoneAt = 0;
+  // Too old to be answered now: the request or its reply was lost
+  while (pp->PendingCount > 0 && t->firstByteAt - pp->PendingReads[pp->PendingHead].doneAt > DMM_REPLY_TIMEOUT_US) {
+    pp->PendingHead = (pp->PendingHead + 1) % DMM_MAX_PENDING_READS;
+    pp->PendingCount--;
+  }
+  for (int n = 0; n < pp->PendingCount; n++) {
+    int i = (pp->PendingHead + n) % DMM_MAX_PENDING_READS;
+    if (pp->PendingReads[i].axis == ID) {
+      t->requestSentAt = pp->PendingReads[i].sentAt;
+      t->requestDoneAt = pp->PendingReads[i].doneAt;
+      pp->PendingHead = (i + 1) % DMM_MAX_PENDING_READS;
+      pp->PendingCount -= n + 1;
+      break;
+    }
+  }
+  // The drive samples after the request is in and before the reply starts out, whose first
+  // byte took a byte time on the line; without a request, just before the reply starts
+  DmmTime_t replyStart = t->firstByteAt - DMM_BYTE_TIME_US;
+  if (t->requestSentAt && t->requestDoneAt < replyStart) {
+    t->sampledAt = t->requestDoneAt + (replyStart - t->requestDoneAt) / 2;
+  } else {
+    t->sampledAt = replyStart;
+  }
+}
+
 ProtocolError_t Get_Function(DmmProtocolState_t* pp)
 {
   char ID = -1,ReceivedFunction_Code = -1, CRC_Check = -1;
@@ -134,7 +170,8 @@ ProtocolError_t Get_Function(DmmProtocolState_t* pp)
   CRC_Check &= 0x7f;
   
   if(CRC_Check!= 0){
-      post("CRC Error\n");
+      DMM_TRACEPOINT(crc_fail, ID, ReceivedFunction_Code, pp->Read_Package_Length);
+      pp->CrcErrors++; // Counted, not posted: a noisy line fails hundreds an hour
       return CRC_Error;
   }
   switch(ReceivedFunction_Code){
@@ -158,10 +195,17 @@ ProtocolError_t Get_Function(DmmProtocolState_t* pp)
         default:
             value = Cal_SignValue(pp->Read_Package_Buffer);
   }
+  Time_Reply(pp, ID);
+  DMM_TRACEPOINT(frame_decode, ID, ReceivedFunction_Code, pp->Read_Package_Length);
+  DMM_TRACEPOINT(dispatch, ID, ReceivedFunction_Code, pp->Read_Package_Length);
   //
-    if (pp->Drive_Read_Code == Is_AbsPos32) {
-        pp->ReportPositionPtr(value,pp->hook);
-    } else {
+    if (ReceivedFunction_Code == Is_AbsPos32) {
+        if (pp->ReportPositionTimedPtr) {
+            pp->ReportPositionTimedPtr(value, &pp->Read_Timing, pp->hook);
+        } else {
+            pp->ReportPositionPtr(value,pp->hook);
+        }
+    } else if (pp->ReportReplyPtr == NULL) {
         post("Axis: %d, %s (%d): Value: %ld\n",
              ID,
              ParameterName(ReceivedFunction_Code),
@@ -171,9 +215,62 @@ ProtocolError_t Get_Function(DmmProtocolState_t* pp)
   pp->Drive_Read_Axis_ID = ID;
   pp->Drive_Read_Code = (unsigned char)ReceivedFunction_Code;
   pp->Drive_Read_Value = value;
+  if (pp->ReportReplyPtr) {
+      pp->ReportReplyPtr(ID, (unsigned char)ReceivedFunction_Code, value, pp->hook);
+  }
+  for (int i = 0; i < pp->ObserverCount; i++) {
+      pp->Observers[i].fn(pp, ID, (unsigned char)ReceivedFunction_Code, value, pp->Observers[i].ctx);
+  }
+  DMM_TRACEPOINT(dispatch_done, ID, ReceivedFunction_Code, pp->Read_Package_Length);
   return Complete_Success;
 }
 
+Boolean AddReplyObserver(DmmProtocolState_t* pp, DmmReplyObserver_t fn, void *ctx) {
+    if (pp->ObserverCount >= DMM_MAX_OBSERVERS) {
+        post("Too many reply observers\n");
+        return false;
+    }
+    pp->Observers[pp->ObserverCount].fn = fn;
+    pp->Observers[pp->ObserverCount].ctx = ctx;
+    pp->ObserverCount++;
+    return true;
+}
+
+Boolean AddCommandObserver(DmmProtocolState_t* pp, DmmCommandObserver_t fn, void *ctx) {
+    if (pp->CommandObserverCount >= DMM_MAX_OBSERVERS) {
+        post("Too many command observers\n");
+        return false;
+    }
+    pp->CommandObservers[pp->CommandObserverCount].fn = fn;
+    pp->CommandObservers[pp->CommandObserverCount].ctx = ctx;
+    pp->CommandObserverCount++;
+    return true;
+}
+
+void RemoveCommandObserver(DmmProtocolState_t* pp, DmmCommandObserver_t fn, void *ctx) {
+    for (int i = 0; i < pp->CommandObserverCount; i++) {
+        if (pp->CommandObservers[i].fn == fn && pp->CommandObservers[i].ctx == ctx) {
+            for (int j = i + 1; j < pp->CommandObserverCount; j++) {
+                pp->CommandObservers[j - 1] = pp->CommandObservers[j];
+            }
+            pp->CommandObserverCount--;
+            return;
+        }
+    }
+}
+
+void RemoveReplyObserver(DmmProtocolState_t* pp, DmmReplyObserver_t fn, void *ctx) {
+    for (int i = 0; i < pp->ObserverCount; i++) {
+        if (pp->Observers[i].fn == fn && pp->Observers[i].ctx == ctx) {
+            for (int j = i + 1; j < pp->ObserverCount; j++) {
+                pp->Observers[j - 1] = pp->Observers[j];
+            }
+            pp->ObserverCount--;
+            return;
+        }
+    }
+}
+
 /*
 bool printStatusByte(unsigned char statusByte) {
     bool FatalError = false;
@@ -231,7 +328,8 @@ bool printStatusByte(unsigned char statusByte) {
 /*Get data with sign - long*/
 long Cal_SignValue(unsigned char One_Package[8])
 {
-  char Package_Length,OneChar;
+  char Package_Length;
+  signed char OneChar; // plain char is unsigned on ARM, sign extension below needs signed
   int i;
   long Lcmd;
   OneChar = One_Package[1];
@@ -282,62 +380,209 @@ unsigned int Cal_UnsignedValue(unsigned char One_Package[8])
 // always B0, but in the code of below, the first byte is always B0.
 //
 
-void Send_Package(DmmProtocolState_t* pp,unsigned char func, char ID , long Displacement)
+// Shortest package that carries Displacement: 4 bytes for 7 bits of data up to 7 bytes for 28
+unsigned char Package_Length_For(long Displacement)
 {
-  pp->ProtocolError = false;
-    
-  unsigned char B[8],Package_Length,Function_Code;
   long TempLong;
-  B[1] = B[2] = B[3] = B[4] = B[5] = (unsigned char)0x80;
-  B[0] = ID&0x7f;
-  Function_Code = func & 0x1f;
-  TempLong = Displacement & 0x0fffffff; //Max 28bits
-  B[5] += (unsigned char)TempLong&0x0000007f;
-  TempLong = TempLong>>7;
-  B[4] += (unsigned char)TempLong&0x0000007f;
-  TempLong = TempLong>>7;
-  B[3] += (unsigned char)TempLong&0x0000007f;
-  TempLong = TempLong>>7;
-  B[2] += (unsigned char)TempLong&0x0000007f;
-  Package_Length = 7;
-  TempLong = Displacement;
+  unsigned char Package_Length = 7;
+  TempLong = Displacement; // Arithmetic shift: all 0s or all 1s (-1, whatever the width of long) fits
   TempLong = TempLong >> 20;
-  if(( TempLong == 0x00000000) || ( TempLong == 0xffffffff))
+  if(( TempLong == 0x00000000) || ( TempLong == -1))
   {//Three byte data
-    B[2] = B[3];
-    B[3] = B[4];
-    B[4] = B[5];
     Package_Length = 6;
   }
   TempLong = Displacement;
   TempLong = TempLong >> 13;
-  if(( TempLong == 0x00000000) || ( TempLong == 0xffffffff))
+  if(( TempLong == 0x00000000) || ( TempLong == -1))
   {//Two byte data
-    B[2] = B[3];
-    B[3] = B[4];
     Package_Length = 5;
   }
   TempLong = Displacement;
   TempLong = TempLong >> 6;
-  if(( TempLong == 0x00000000) || ( TempLong == 0xffffffff))
+  if(( TempLong == 0x00000000) || ( TempLong == -1))
   {//One byte data
-    B[2] = B[3];
     Package_Length = 4;
   }
-  B[1] += (Package_Length-4)*32 + Function_Code;
-  Make_CRC_Send(pp, Package_Length,B);
+  return Package_Length;
 }
 
+// Builds the complete package, CRC included, into B. Returns its length.
+unsigned char Encode_Package(unsigned char func, char ID, long Displacement, unsigned char B[8])
+{
+  unsigned char Package_Length,Function_Code;
+  long TempLong;
+  B[0] = ID&0x7f;
+  Function_Code = func & 0x1f;
+  Package_Length = Package_Length_For(Displacement);
+  TempLong = Displacement & 0x0fffffff; //Max 28bits
+  for (int i = Package_Length-2; i >= 2; i--) { // 7 bits per byte, most significant first
+    B[i] = 0x80 + (unsigned char)(TempLong&0x0000007f);
+    TempLong = TempLong>>7;
+  }
+  B[1] = 0x80 + (Package_Length-4)*32 + Function_Code;
+  Make_CRC(Package_Length, B);
+  DMM_TRACEPOINT(frame_encode, B[0], Function_Code, Package_Length);
+  return Package_Length;
+}
+
+// Four lanes of 32 bits, on SSE2 or NEON: GCC (12 on) and Clang lower these to whatever the target has
+#if defined(__has_builtin) && defined(__BYTE_ORDER__)
+#if __has_builtin(__builtin_shufflevector) && __has_builtin(__builtin_convertvector) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define DMM_VECTOR_ENCODE 1
+#endif
+#endif
+
+#if DMM_VECTOR_ENCODE
+typedef int32_t DmmV4i_t __attribute__((vector_size(16)));
+typedef uint32_t DmmV4u_t __attribute__((vector_size(16)));
+typedef long DmmV4l_t __attribute__((vector_size(4 * sizeof(long))));
+typedef unsigned char DmmV4b_t __attribute__((vector_size(4)));
 
-void Make_CRC_Send(DmmProtocolState_t* pp, unsigned char Plength,unsigned char B[8])
+// Four frames at once into out, Encode_Package's arithmetic lane by lane, and their lengths into L.
+// Each frame is stored as 8 bytes, past its end into where the next one goes, so there must be one.
+// Returns the bytes the four take, 0 if a value needs more than 32 bits to size.
+static int Encode_Four(const char *ID, const unsigned char *func, const long *Displacement, unsigned char *out, unsigned char L[4])
+{
+  DmmV4l_t wide;
+  DmmV4b_t ids, fns;
+  memcpy(&wide, Displacement, sizeof(wide));
+  memcpy(&ids, ID, sizeof(ids));
+  memcpy(&fns, func, sizeof(fns));
+  DmmV4i_t v = __builtin_convertvector(wide, DmmV4i_t);
+  DmmV4l_t back = __builtin_convertvector(v, DmmV4l_t) ^ wide;
+  if (back[0] | back[1] | back[2] | back[3]) {
+    return 0;
+  }
+  DmmV4u_t id = __builtin_convertvector(ids, DmmV4u_t) & 0x7f;
+  DmmV4u_t fn = __builtin_convertvector(fns, DmmV4u_t) & 0x1f;
+  // Package_Length_For: all 1s where the value fits in 1, 2 or 3 data bytes
+  DmmV4i_t sign = v >> 31;
+  DmmV4u_t fits1 = (DmmV4u_t)((v >> 6) == sign), fits2 = (DmmV4u_t)((v >> 13) == sign), fits3 = (DmmV4u_t)((v >> 20) == sign);
+  DmmV4u_t len = 7 + fits1 + fits2 + fits3;
+  // 7 bit groups, least significant first
+  DmmV4u_t t = (DmmV4u_t)v & 0x0fffffff;
+  DmmV4u_t g0 = (t & 0x7f) | 0x80, g1 = ((t >> 7) & 0x7f) | 0x80, g2 = ((t >> 14) & 0x7f) | 0x80, g3 = (t >> 21) | 0x80;
+  DmmV4u_t b1 = 0x80 + ((len - 4) << 5) + fn;
+  DmmV4u_t crc = ((id + b1 + g0 + (g1 & ~fits1) + (g2 & ~fits2) + (g3 & ~fits3)) & 0xff) | 0x80;
+  // Data most significant first, moved down over the groups a shorter frame leaves out
+  DmmV4u_t d = g3 | g2 << 8 | g1 << 16 | g0 << 24;
+  d = (d & ~fits3) | ((d >> 8) & fits3);
+  d = (d & ~fits2) | ((d >> 8) & fits2);
+  d = (d & ~fits1) | ((d >> 8) & fits1);
+  // Bytes 0-3 and 4-7 of each frame; the CRC lands in byte 3 (4 byte frames) to 6 (7 byte frames)
+  DmmV4u_t lo = id | b1 << 8 | d << 16 | ((crc << 24) & fits1);
+  DmmV4u_t hi = (d >> 16) | (crc & fits2 & ~fits1) | ((crc << 8) & fits3 & ~fits2) | ((crc << 16) & ~fits3);
+  uint64_t W[4];
+  DmmV4u_t w01 = __builtin_shufflevector(lo, hi, 0, 4, 1, 5), w23 = __builtin_shufflevector(lo, hi, 2, 6, 3, 7);
+  memcpy(W, &w01, sizeof(w01));
+  memcpy(W + 2, &w23, sizeof(w23));
+  int Total = 0;
+  for (int k = 0; k < 4; k++) {
+    memcpy(out + Total, &W[k], 8);
+    L[k] = (unsigned char)len[k];
+    Total += L[k];
+    DMM_TRACEPOINT(frame_encode, ID[k] & 0x7f, func[k] & 0x1f, L[k]);
+  }
+  return Total;
+}
+#endif
+
+// Frames for n commands packed back to back into out, which needs room for n * DMM_MAX_FRAME bytes.
+// Each is byte for byte what Encode_Package makes; lengths go to Length unless it is NULL.
+// Returns the bytes written.
+int Encode_Packages(const char *ID, const unsigned char *func, const long *Displacement, int n, unsigned char *out, unsigned char *Length)
+{
+  int Total = 0, i = 0;
+#if DMM_VECTOR_ENCODE
+  unsigned char L[4];
+  for (; i + 4 < n; i += 4) { // Not the last four: the 8 byte stores need a frame after them
+    int Bytes = Encode_Four(ID + i, func + i, Displacement + i, out + Total, L);
+    if (Bytes == 0) {
+      break; // The rest one by one
+    }
+    if (Length) {
+      memcpy(Length + i, L, 4);
+    }
+    Total += Bytes;
+  }
+#endif
+  for (; i < n; i++) {
+    unsigned char Len = Encode_Package(func[i], ID[i], Displacement[i], out + Total);
+    if (Length) {
+      Length[i] = Len;
+    }
+    Total += Len;
+  }
+  return Total;
+}
+
+void Send_Package(DmmProtocolState_t* pp,unsigned char func, char ID , long Displacement)
+{
+  pp->ProtocolError = false;
+    
+  unsigned char B[8],Package_Length;
+  Package_Length = Encode_Package(func, ID, Displacement, B);
+  DmmTime_t sentAt = DmmNow();
+  Write_Package(pp, B, Package_Length);
+  if (Expects_Reply(func & 0x1f)) {
+    Track_Request(pp, ID & 0x7f, sentAt, pp->TxFreeAt);
+  }
+  for (int i = 0; i < pp->CommandObserverCount; i++) {
+      pp->CommandObservers[i].fn(pp, ID, func & 0x1f, Displacement, pp->CommandObservers[i].ctx);
+  }
+}
+
+
+// Any number of packages, to any axes, in one write per DMM_MAX_AXES of them; observers and reply
+// timing as if each had gone through Send_Package. Returns the bytes written.
+int Send_Packages(DmmProtocolState_t* pp, const char *ID, const unsigned char *func, const long *Displacement, int n)
+{
+  unsigned char Buffer[DMM_MAX_AXES * DMM_MAX_FRAME], Length[DMM_MAX_AXES];
+  int Written = 0;
+  pp->ProtocolError = false;
+  for (int First = 0; First < n; First += DMM_MAX_AXES) {
+    int Count = MIN(n - First, DMM_MAX_AXES);
+    int Total = Encode_Packages(ID + First, func + First, Displacement + First, Count, Buffer, Length);
+    DmmTime_t sentAt = DmmNow();
+    DmmTime_t doneAt = MAX(pp->TxFreeAt, sentAt);
+    Write_Package(pp, Buffer, Total);
+    for (int i = First; i < First + Count; i++) {
+      doneAt += DMM_BYTES_TIME_US(Length[i - First]);
+      if (Expects_Reply(func[i] & 0x1f)) {
+        Track_Request(pp, ID[i] & 0x7f, sentAt, doneAt);
+      }
+      for (int j = 0; j < pp->CommandObserverCount; j++) {
+        pp->CommandObservers[j].fn(pp, ID[i], func[i] & 0x1f, Displacement[i], pp->CommandObservers[j].ctx);
+      }
+    }
+    Written += Total;
+  }
+  return Written;
+}
+
+void Make_CRC(unsigned char Plength,unsigned char B[8])
 {
   unsigned char Error_Check = 0;
   for(int i=0;i<Plength-1;i++) {
-    pp->SerialWritePtr(B[i],pp->hook);
     Error_Check += B[i];
   }
-  Error_Check = Error_Check|0x80;
-  pp->SerialWritePtr(Error_Check, pp->hook);
+  B[Plength-1] = Error_Check|0x80;
+}
+
+// Hands bytes to the caller in one go when it can take a buffer, byte by byte otherwise
+void Write_Package(DmmProtocolState_t* pp, const unsigned char *B, int length)
+{
+  DmmTime_t now = DmmNow();
+  pp->TxFreeAt = MAX(pp->TxFreeAt, now) + DMM_BYTES_TIME_US(length);
+  DMM_TRACEPOINT(frame_write, B[0], B[1] & 0x1f, length);
+  if (pp->SerialWriteBufferPtr) {
+    pp->SerialWriteBufferPtr(B, length, pp->hook);
+  } else {
+    for (int i = 0; i < length; i++) {
+      pp->SerialWritePtr(B[i], pp->hook);
+    }
+  }
+  DMM_TRACEPOINT(frame_written, B[0], B[1] & 0x1f, length);
 }
 
 
@@ -362,6 +607,54 @@ void MoveMotorToAbsolutePosition32(DmmProtocolState_t* pp, char Axis_Num,long Po
   Send_Package(pp,Go_Absolute_Pos, Axis_Num, Pos32);
 }
 
+// All axes' Go_Absolute_Pos packages in one contiguous write. A drive starts moving once its
+// last byte is in, so the spread between the first and last start is the line time of everything
+// after the first package: the longest goes first, the rest shortest first to bring the average
+// start in. Returns that spread in microseconds.
+long MoveAllToAbsolutePosition32(DmmProtocolState_t* pp, const char *Axes, const long *Pos32, int n)
+{
+  unsigned char Buffer[DMM_MAX_AXES * DMM_MAX_FRAME], Packed[DMM_MAX_AXES * DMM_MAX_FRAME], Length[DMM_MAX_AXES];
+  unsigned char Func[DMM_MAX_AXES];
+  int Order[DMM_MAX_AXES], Offset[DMM_MAX_AXES], Total = 0;
+  n = MIN(n, DMM_MAX_AXES);
+  if (n <= 0) {
+    return 0;
+  }
+  memset(Func, Go_Absolute_Pos, n);
+  Encode_Packages(Axes, Func, Pos32, n, Packed, Length);
+  for (int i = 0; i < n; i++) {
+    Offset[i] = Total;
+    Total += Length[i];
+    Order[i] = i;
+  }
+  Total = 0;
+  for (int i = 1; i < n; i++) { // Insertion sort, ascending length
+    int k = Order[i], j = i;
+    while (j > 0 && Length[Order[j-1]] > Length[k]) {
+      Order[j] = Order[j-1];
+      j--;
+    }
+    Order[j] = k;
+  }
+  int Longest = Order[n-1];
+  for (int j = n-1; j > 0; j--) {
+    Order[j] = Order[j-1];
+  }
+  Order[0] = Longest;
+  for (int i = 0; i < n; i++) {
+    memcpy(Buffer + Total, Packed + Offset[Order[i]], Length[Order[i]]);
+    Total += Length[Order[i]];
+  }
+  pp->ProtocolError = false;
+  Write_Package(pp, Buffer, Total);
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < pp->CommandObserverCount; j++) {
+      pp->CommandObservers[j].fn(pp, Axes[i], Go_Absolute_Pos, Pos32[i], pp->CommandObservers[j].ctx);
+    }
+  }
+  return DMM_BYTES_TIME_US(Total - Length[Longest]);
+}
+
 void MoveMotorConstantRotation(DmmProtocolState_t* pp, char Axis_Num,long r) {
     // TODO set Limits for 3 byte value of r
     Send_Package(pp, Turn_ConstSpeed, Axis_Num, r);
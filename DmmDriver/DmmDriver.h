@@ -9,8 +9,50 @@
 #ifndef dmmsend_DmmDriver_h
 #define dmmsend_DmmDriver_h
 
+#if defined(DMM_STANDALONE) && !defined(C74_EXPORT) // Building outside of Max (e.g. DmmCli), supply what ext.h would
+#include <stdio.h>
+#include <stdbool.h>
+typedef unsigned char Boolean;
+#define post(...) fprintf(stderr, __VA_ARGS__)
+#endif
+
+#include "DmmClock.h"
+
+// Link timing: 38400 baud, 1 start + 8 data + 1 stop bit per byte
+#define DMM_BAUD 38400
+#define DMM_BITS_PER_BYTE 10
+#define DMM_BYTE_TIME_US ((1000000L * DMM_BITS_PER_BYTE) / DMM_BAUD) // ~260us
+#define DMM_BYTES_TIME_US(n) (((long)(n) * 1000000L * DMM_BITS_PER_BYTE) / DMM_BAUD)
+#define DMM_MAX_FRAME 7
+#define DMM_VALUE_MIN (-(1L << 27)) // A package carries 28 bits, signed
+#define DMM_VALUE_MAX ((1L << 27) - 1)
+#define DMM_MAX_AXES 128 // Axis IDs are 7 bits
+
 typedef enum {In_Progress = 0, Complete_Success,  CRC_Error, Timeout_Error } ProtocolError_t;
 
+#define DMM_MAX_OBSERVERS 16
+#define DMM_MAX_PENDING_READS 16 // Requests awaiting a reply, for timing replies
+#define DMM_REPLY_TIMEOUT_US 50000 // A reply starts within this of its request leaving the line, or never does
+
+// When the reply being reported was asked for, arrived and was decoded (DmmNow time)
+typedef struct DmmReplyTiming {
+    DmmTime_t requestSentAt;    // Request handed to the serial write, 0 if no request matched
+    DmmTime_t requestDoneAt;    // Its last byte off the line, by the link model
+    DmmTime_t firstByteAt;      // First reply byte in, no later than the line allows for the last one
+    DmmTime_t decodedAt;        // Last byte in and decoded
+    DmmTime_t sampledAt;        // Estimate: between request in and reply out at the drive
+} DmmReplyTiming_t;
+
+struct DmmProtocolState;
+
+// Called for every decoded reply, after the state's Drive_Read_* fields are updated.
+// Observers may send packages from inside the callback.
+typedef void (*DmmReplyObserver_t)(struct DmmProtocolState *pp, char axis, unsigned char code, long value, void *ctx);
+// Called for every package once it has been handed to SerialWritePtr. Must not send.
+typedef void (*DmmCommandObserver_t)(struct DmmProtocolState *pp, char axis, unsigned char func, long value, void *ctx);
+
+// Sending and decoding both update the state (pending reads, TxFreeAt, the read buffer), and nothing
+// in it is locked: one state must not be used from two threads at once. DmmPacer has a lock for this.
 typedef struct DmmProtocolState {
     unsigned char Read_Package_Buffer[8],Read_Num,Read_Package_Length;
     unsigned char MotorPosition32Ready_Flag, MotorTorqueCurrentReady_Flag, MainGainRead_Flag;
@@ -19,16 +61,54 @@ typedef struct DmmProtocolState {
     char Drive_Read_Axis_ID;
     unsigned char Drive_Read_Code;
     Boolean ProtocolError;
+    unsigned long CrcErrors;    // Replies that failed their check
     void (*SerialWritePtr)(char byte, void *hook); // Caller must provide this function
-    void (*ReportPositionPtr)(long pos, void * hook); // Caller must provide this function
+    void (*SerialWriteBufferPtr)(const unsigned char *bytes, int length, void *hook); // Optional, whole packages at once
+    void (*ReportPositionPtr)(long pos, void * hook); // Caller must provide this function, or:
+    void (*ReportPositionTimedPtr)(long pos, const DmmReplyTiming_t *timing, void *hook); // Optional, used instead
+    void (*ReportReplyPtr)(char axis, unsigned char code, long value, void *hook); // Optional, every decoded reply
     void *hook; // Caller Can pull anything in here and it will be returned
+    struct {
+        DmmReplyObserver_t fn;
+        void *ctx;
+    } Observers[DMM_MAX_OBSERVERS]; // Driver modules (DmmLoop, ...) hook in here
+    unsigned char ObserverCount;
+    struct {
+        DmmCommandObserver_t fn;
+        void *ctx;
+    } CommandObservers[DMM_MAX_OBSERVERS];
+    unsigned char CommandObserverCount;
+    // Reply timing; Read_Timing describes the reply being reported
+    DmmTime_t Read_FirstByteAt;
+    DmmReplyTiming_t Read_Timing;
+    DmmTime_t TxFreeAt;         // When everything written so far is off the line
+    struct {
+        char axis;
+        DmmTime_t sentAt, doneAt;
+    } PendingReads[DMM_MAX_PENDING_READS]; // Oldest first, drives answer in order
+    unsigned char PendingHead, PendingCount;
 } DmmProtocolState_t;
 
 void MoveMotorToAbsolutePosition32(DmmProtocolState_t *pp, char Axis, long pos);
 void ResetOrgin(DmmProtocolState_t* pp, char Axis);
 void SetMaxAccel(DmmProtocolState_t* pp, char Axis, int maxAccel);
 void SetMaxSpeed(DmmProtocolState_t* pp, char Axis, int maxSpeed);
+void SetMainGain(DmmProtocolState_t* pp, char Axis_Num, int gain);
+void SetSpeedGain(DmmProtocolState_t* pp, char Axis_Num, long gain);
+void SetIntGain(DmmProtocolState_t* pp, char Axis_Num, long gain);
 void ReadMotorPosition32(DmmProtocolState_t *pp, char Axis);
 void MoveMotorConstantRotation(DmmProtocolState_t* pp, char Axis_Num,long r);
+long MoveAllToAbsolutePosition32(DmmProtocolState_t* pp, const char *Axes, const long *Pos32, int n);
 void ReadPackage(DmmProtocolState_t* pp, unsigned char c);
+const char * ParameterName(char isCode);
+void Send_Package(DmmProtocolState_t* pp, unsigned char func, char ID, long Displacement);
+int Send_Packages(DmmProtocolState_t* pp, const char *ID, const unsigned char *func, const long *Displacement, int n);
+unsigned char Package_Length_For(long Displacement);
+unsigned char Encode_Package(unsigned char func, char ID, long Displacement, unsigned char B[8]);
+int Encode_Packages(const char *ID, const unsigned char *func, const long *Displacement, int n, unsigned char *out, unsigned char *Length);
+Boolean Expects_Reply(unsigned char func);
+Boolean AddReplyObserver(DmmProtocolState_t* pp, DmmReplyObserver_t fn, void *ctx);
+void RemoveReplyObserver(DmmProtocolState_t* pp, DmmReplyObserver_t fn, void *ctx);
+Boolean AddCommandObserver(DmmProtocolState_t* pp, DmmCommandObserver_t fn, void *ctx);
+void RemoveCommandObserver(DmmProtocolState_t* pp, DmmCommandObserver_t fn, void *ctx);
 #endif
@@ -0,0 +1,151 @@
+//
+//  DmmEstimator.c
+//  dmmsend
+//
+
+#include <string.h>
+
+#include "DmmEstimator.h"
+#include "DmmProtocol.h"
+
+#define EST_SETTLE_US 500000  // Time after a speed change before its velocity is trusted for learning
+#define EST_LEARN_RATE 0.1
+#define EST_MAX_DT_US 5000000 // Past this, restart rather than extrapolate a stale velocity
+
+static double commandedVelocity(const DmmEstimatorAxis_t *a) {
+    double scale = a->speedScale > 0 ? a->speedScale : a->learnedScale;
+    return a->cmdValue * scale;
+}
+
+// Move the estimate forward to t without a measurement
+static void advance(DmmEstimatorAxis_t *a, DmmTime_t t) {
+    if (t > a->t) {
+        a->pos += a->vel * (double)(t - a->t) / 1e6;
+        a->t = t;
+    }
+}
+
+static void DmmEstimator_OnCommand(DmmProtocolState_t *pp, char axisID, unsigned char func, long value, void *ctx) {
+    DmmEstimator_t *est = (DmmEstimator_t*)ctx;
+    DmmEstimatorAxis_t *a = &est->axis[axisID & 0x7f];
+    DmmTime_t now = DmmNow();
+    switch (func) {
+        case Turn_ConstSpeed:
+            if (a->valid) {
+                advance(a, now);
+            }
+            a->cmdKind = Estimator_Cmd_Speed;
+            a->cmdValue = value;
+            a->cmdTime = now;
+            if (a->speedScale > 0 || a->learnedScale > 0) {
+                a->vel = commandedVelocity(a);
+            }
+            break;
+        case Go_Absolute_Pos:
+            if (a->valid) {
+                advance(a, now);
+            }
+            a->cmdKind = Estimator_Cmd_Position;
+            a->cmdValue = value;
+            a->cmdTime = now;
+            break;
+        case Go_Relative_Pos:
+            if (a->valid) {
+                advance(a, now);
+            }
+            if (a->cmdKind != Estimator_Cmd_Position) {
+                a->cmdValue = (long)a->pos;
+            }
+            a->cmdKind = Estimator_Cmd_Position;
+            a->cmdValue += value;
+            a->cmdTime = now;
+            break;
+        case Set_Origin:
+            a->pos = 0;
+            a->t = now;
+            break;
+    }
+}
+
+static void DmmEstimator_OnReply(DmmProtocolState_t *pp, char axisID, unsigned char code, long value, void *ctx) {
+    if (code == Is_AbsPos32) {
+        DmmEstimator_Measure((DmmEstimator_t*)ctx, axisID, value, pp->Read_Timing.sampledAt);
+    }
+}
+
+void DmmEstimator_Measure(DmmEstimator_t *est, char axisID, long z, DmmTime_t t) {
+    DmmEstimatorAxis_t *a = &est->axis[axisID & 0x7f];
+    if (!a->valid || t - a->t > EST_MAX_DT_US) {
+        a->valid = true;
+        a->pos = z;
+        a->vel = a->cmdKind == Estimator_Cmd_Speed ? commandedVelocity(a) : 0;
+        a->t = t;
+        a->samples = 1;
+        return;
+    }
+    if (t <= a->t) { // Out of order or duplicate sample, just pull position towards it
+        a->pos += est->alpha * (z - a->pos);
+        return;
+    }
+    double dt = (double)(t - a->t) / 1e6;
+    advance(a, t);
+    double r = z - a->pos;
+    a->pos += est->alpha * r;
+    a->vel += est->beta * r / dt;
+    a->samples++;
+
+    // Learn counts/s per speed unit while a constant speed command has settled
+    if (a->cmdKind == Estimator_Cmd_Speed && a->cmdValue != 0 && t - a->cmdTime > EST_SETTLE_US && a->samples > 2) {
+        double observed = a->vel / a->cmdValue;
+        if (observed > 0) {
+            a->learnedScale = a->learnedScale > 0 ? a->learnedScale + EST_LEARN_RATE * (observed - a->learnedScale) : observed;
+        }
+    }
+}
+
+Boolean DmmEstimator_Query(DmmEstimator_t *est, char axisID, DmmTime_t t, long *pos, double *vel) {
+    DmmEstimatorAxis_t *a = &est->axis[axisID & 0x7f];
+    if (!a->valid) {
+        return false;
+    }
+    double p = a->pos + a->vel * (double)(t - a->t) / 1e6;
+    double v = a->vel;
+    if (a->cmdKind == Estimator_Cmd_Position) {
+        // The drive stops at the target, so never extrapolate past it
+        double target = a->cmdValue;
+        if ((a->pos <= target && p > target) || (a->pos >= target && p < target)) {
+            p = target;
+            v = 0;
+        }
+    }
+    if (pos) {
+        *pos = (long)(p < 0 ? p - 0.5 : p + 0.5);
+    }
+    if (vel) {
+        *vel = v;
+    }
+    return true;
+}
+
+void DmmEstimator_Init(DmmEstimator_t *est, DmmProtocolState_t *pp) {
+    memset(est, 0, sizeof(*est));
+    est->pp = pp;
+    est->alpha = 0.5;
+    est->beta = 0.1;
+    AddReplyObserver(pp, &DmmEstimator_OnReply, est);
+    AddCommandObserver(pp, &DmmEstimator_OnCommand, est);
+}
+
+void DmmEstimator_Close(DmmEstimator_t *est) {
+    RemoveReplyObserver(est->pp, &DmmEstimator_OnReply, est);
+    RemoveCommandObserver(est->pp, &DmmEstimator_OnCommand, est);
+}
+
+void DmmEstimator_SetGains(DmmEstimator_t *est, double alpha, double beta) {
+    est->alpha = alpha;
+    est->beta = beta;
+}
+
+void DmmEstimator_SetSpeedScale(DmmEstimator_t *est, char axisID, double countsPerSecPerUnit) {
+    est->axis[axisID & 0x7f].speedScale = countsPerSecPerUnit;
+}
@@ -0,0 +1,47 @@
+//
+//  DmmEstimator.h
+//  dmmsend
+//
+//  Per axis alpha-beta position/velocity estimator. Sparse Is_AbsPos32 reads
+//  correct the estimate; Turn_ConstSpeed, Go_Absolute_Pos and Go_Relative_Pos
+//  commands seen on the way out steer it in between, so position can be queried for any time
+//  without extra traffic on the link.
+//
+
+#ifndef dmmsend_DmmEstimator_h
+#define dmmsend_DmmEstimator_h
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+
+typedef enum { Estimator_Cmd_None = 0, Estimator_Cmd_Speed, Estimator_Cmd_Position } DmmEstimatorCmd_t;
+
+typedef struct DmmEstimatorAxis {
+    Boolean valid;              // At least one position read seen
+    double pos;                 // counts, at time t
+    double vel;                 // counts/s
+    DmmTime_t t;
+    DmmEstimatorCmd_t cmdKind;  // Last motion command sent
+    long cmdValue;              // speed units or target counts
+    DmmTime_t cmdTime;
+    double speedScale;          // counts/s per Turn_ConstSpeed unit, 0: learn it
+    double learnedScale;
+    unsigned long samples;
+} DmmEstimatorAxis_t;
+
+typedef struct DmmEstimator {
+    DmmProtocolState_t *pp;
+    double alpha, beta;
+    DmmEstimatorAxis_t axis[DMM_MAX_AXES];
+} DmmEstimator_t;
+
+void DmmEstimator_Init(DmmEstimator_t *est, DmmProtocolState_t *pp);
+void DmmEstimator_Close(DmmEstimator_t *est);
+void DmmEstimator_SetGains(DmmEstimator_t *est, double alpha, double beta);
+void DmmEstimator_SetSpeedScale(DmmEstimator_t *est, char axis, double countsPerSecPerUnit);
+// Feed a position sampled at time t (DmmEstimator_Init hooks decoded replies in already)
+void DmmEstimator_Measure(DmmEstimator_t *est, char axis, long pos, DmmTime_t t);
+// False until the axis has been read once
+Boolean DmmEstimator_Query(DmmEstimator_t *est, char axis, DmmTime_t t, long *pos, double *vel);
+
+#endif
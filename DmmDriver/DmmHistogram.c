@@ -0,0 +1,37 @@
+//
+//  DmmHistogram.c
+//  dmmsend
+//
+
+#include "DmmHistogram.h"
+
+void DmmHistogram_Record(DmmHistogram_t *h, DmmTime_t us) {
+    int b = 0;
+    while (b < DMM_HISTOGRAM_BUCKETS - 1 && us >= (1LL << b)) {
+        b++;
+    }
+    h->bucket[b]++;
+    h->count++;
+    h->sumUs += us;
+    if (us > h->maxUs) {
+        h->maxUs = us;
+    }
+}
+
+double DmmHistogram_Mean(const DmmHistogram_t *h) {
+    return h->count ? h->sumUs / h->count : 0;
+}
+
+void DmmHistogram_Print(const DmmHistogram_t *h, FILE *out) {
+    for (int b = 0; b < DMM_HISTOGRAM_BUCKETS; b++) {
+        if (h->bucket[b] == 0) {
+            continue;
+        }
+        long lo = b == 0 ? 0 : 1L << (b - 1), hi = 1L << b;
+        if (b == DMM_HISTOGRAM_BUCKETS - 1) {
+            fprintf(out, "  >= %7ld us: %lu\n", lo, h->bucket[b]);
+        } else {
+            fprintf(out, "  %7ld - %7ld us: %lu\n", lo, hi, h->bucket[b]);
+        }
+    }
+}
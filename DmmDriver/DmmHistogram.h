@@ -0,0 +1,31 @@
+//
+//  DmmHistogram.h
+//  dmmsend
+//
+//  Latency in log2 buckets, with the count, mean and worst case. Not locked:
+//  a module recording from one thread and reading from another holds its
+//  own lock around both.
+//
+
+#ifndef dmmsend_DmmHistogram_h
+#define dmmsend_DmmHistogram_h
+
+#include <stdio.h>
+
+#include "DmmClock.h"
+
+#define DMM_HISTOGRAM_BUCKETS 24 // [0,1us) [1,2) [2,4) ... [2^22us, ...)
+
+typedef struct DmmHistogram {
+    unsigned long bucket[DMM_HISTOGRAM_BUCKETS];
+    unsigned long count;
+    DmmTime_t maxUs;
+    double sumUs;
+} DmmHistogram_t;
+
+void DmmHistogram_Record(DmmHistogram_t *h, DmmTime_t us);
+double DmmHistogram_Mean(const DmmHistogram_t *h);
+// One line per bucket that has anything in it
+void DmmHistogram_Print(const DmmHistogram_t *h, FILE *out);
+
+#endif
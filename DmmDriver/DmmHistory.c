@@ -0,0 +1,563 @@
+//
+//  DmmHistory.c
+//  dmmsend
+//
+
+#if defined(_WIN32)
+#include <string.h>
+
+#include "DmmHistory.h"
+
+Boolean DmmHistory_Open(DmmHistory_t *h, DmmProtocolState_t *pp, const char *dir) {
+    memset(h, 0, sizeof(*h));
+    post("DmmHistory: not available on Windows\n");
+    return false;
+}
+
+void DmmHistory_Close(DmmHistory_t *h) {
+}
+
+Boolean DmmHistory_Append(DmmHistory_t *h, char axisID, DmmHistoryChannel_t channel, int64_t t, long value) {
+    return false;
+}
+
+Boolean DmmHistory_Range(DmmHistory_t *h, char axisID, DmmHistoryChannel_t channel, int64_t t0, int64_t t1, DmmHistorySummary_t *out) {
+    memset(out, 0, sizeof(*out));
+    return false;
+}
+
+int DmmHistory_Downsample(DmmHistory_t *h, char axisID, DmmHistoryChannel_t channel, int64_t t0, int64_t t1, DmmHistorySummary_t *out, int n) {
+    return 0;
+}
+
+int64_t DmmHistory_Now(DmmHistory_t *h) {
+    return DmmNow() + DmmClock_WallOffset();
+}
+
+size_t DmmHistory_Bytes(DmmHistory_t *h, char axisID, DmmHistoryChannel_t channel, uint64_t *samples) {
+    if (samples) {
+        *samples = 0;
+    }
+    return 0;
+}
+
+void DmmHistory_Flush(DmmHistory_t *h) {
+}
+
+#else
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "DmmHistory.h"
+#include "DmmProtocol.h"
+
+#define HISTORY_BLOCK_MAGIC 0x484d4d44  // "DMMH"
+#define HISTORY_INDEX_MAGIC 0x494d4d44  // "DMMI"
+#define HISTORY_GROW_BLOCKS 64          // Data files grow this many blocks at a time
+#define HISTORY_GROW_RECORDS 1024
+#define HISTORY_MAX_SAMPLE 20           // Two 10 byte varints
+
+typedef struct HistoryBlock {
+    uint32_t magic, count;      // count includes the first sample, held here
+    uint32_t used, sealed;      // Payload bytes
+    int64_t t0, v0;
+} HistoryBlock_t;
+
+typedef struct HistoryIndex {
+    uint32_t magic, level;
+    uint64_t count;
+    unsigned char reserved[48];
+} HistoryIndex_t;
+
+#define HISTORY_PAYLOAD (DMM_HISTORY_BLOCK - sizeof(HistoryBlock_t))
+
+static const char *channelNames[History_Channels] = { "pos", "torque" };
+
+static unsigned put(unsigned char *p, int64_t v) {
+    uint64_t z = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); // Zigzag: small either way is short
+    unsigned n = 0;
+    while (z >= 0x80) {
+        p[n++] = (unsigned char)(z | 0x80);
+        z >>= 7;
+    }
+    p[n++] = (unsigned char)z;
+    return n;
+}
+
+static unsigned get(const unsigned char *p, int64_t *v) {
+    uint64_t z = 0;
+    unsigned n = 0, shift = 0;
+    do {
+        z |= (uint64_t)(p[n] & 0x7f) << shift;
+        shift += 7;
+    } while (p[n++] & 0x80);
+    *v = (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+    return n;
+}
+
+static void summaryAdd(DmmHistorySummary_t *s, int64_t t, int64_t v) {
+    if (s->count == 0) {
+        s->t0 = t;
+        s->min = s->max = (int32_t)v;
+    }
+    s->t1 = t;
+    s->sum += v;
+    if (v < s->min) s->min = (int32_t)v;
+    if (v > s->max) s->max = (int32_t)v;
+    s->count++;
+}
+
+static void summaryMerge(DmmHistorySummary_t *s, const DmmHistorySummary_t *r) {
+    if (r->count == 0) {
+        return;
+    }
+    if (s->count == 0) {
+        *s = *r;
+        return;
+    }
+    s->t0 = r->t0 < s->t0 ? r->t0 : s->t0;
+    s->t1 = r->t1 > s->t1 ? r->t1 : s->t1;
+    s->sum += r->sum;
+    s->min = r->min < s->min ? r->min : s->min;
+    s->max = r->max > s->max ? r->max : s->max;
+    s->count += r->count;
+}
+
+// Mapped files
+
+static Boolean mapOpen(DmmHistoryMap_t *m, const char *path, size_t minSize) {
+    m->fd = open(path, O_RDWR | O_CREAT, 0644);
+    m->base = NULL;
+    if (m->fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(m->fd, &st) < 0) {
+        close(m->fd);
+        return false;
+    }
+    m->size = (size_t)st.st_size;
+    if (m->size < minSize) {
+        if (ftruncate(m->fd, (off_t)minSize) < 0) {
+            close(m->fd);
+            return false;
+        }
+        m->size = minSize;
+    }
+    m->base = mmap(NULL, m->size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+    if (m->base == MAP_FAILED) {
+        m->base = NULL;
+        close(m->fd);
+        return false;
+    }
+    return true;
+}
+
+// Remapped rather than mremap'd, which only Linux has
+static Boolean mapGrow(DmmHistoryMap_t *m, size_t size) {
+    if (size <= m->size) {
+        return true;
+    }
+    if (ftruncate(m->fd, (off_t)size) < 0) {
+        return false;
+    }
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    munmap(m->base, m->size);
+    m->base = base;
+    m->size = size;
+    return true;
+}
+
+static void mapClose(DmmHistoryMap_t *m) {
+    if (m->base) {
+        munmap(m->base, m->size);
+        m->base = NULL;
+    }
+    if (m->fd >= 0) {
+        close(m->fd);
+        m->fd = -1;
+    }
+}
+
+// Blocks
+
+static HistoryBlock_t *block(DmmHistorySeries_t *s, uint64_t j) {
+    return (HistoryBlock_t*)(s->data.base + j * DMM_HISTORY_BLOCK);
+}
+
+static DmmHistorySummary_t *record(DmmHistorySeries_t *s, int level, uint64_t j) {
+    return (DmmHistorySummary_t*)(s->index[level].base + sizeof(HistoryIndex_t)) + j;
+}
+
+typedef struct HistoryCursor {
+    const HistoryBlock_t *b;
+    const unsigned char *p, *end;
+    uint32_t left;
+    int64_t t, v, dt, dv;
+} HistoryCursor_t;
+
+static void cursorStart(HistoryCursor_t *c, const HistoryBlock_t *b) {
+    c->b = b;
+    c->p = (const unsigned char*)(b + 1);
+    c->end = c->p + b->used;
+    c->left = b->count;
+    c->t = c->v = c->dt = c->dv = 0;
+}
+
+static Boolean cursorNext(HistoryCursor_t *c) {
+    if (c->left == 0) {
+        return false;
+    }
+    if (c->left-- == c->b->count) {
+        c->t = c->b->t0;
+        c->v = c->b->v0;
+        return true;
+    }
+    int64_t ddt, ddv;
+    if (c->p >= c->end) {
+        return false;
+    }
+    c->p += get(c->p, &ddt);
+    c->p += get(c->p, &ddv);
+    c->dt += ddt;
+    c->dv += ddv;
+    c->t += c->dt;
+    c->v += c->dv;
+    return true;
+}
+
+static void blockRange(const HistoryBlock_t *b, int64_t t0, int64_t t1, DmmHistorySummary_t *out) {
+    HistoryCursor_t c;
+    cursorStart(&c, b);
+    while (cursorNext(&c) && c.t <= t1) {
+        if (c.t >= t0) {
+            summaryAdd(out, c.t, c.v);
+        }
+    }
+}
+
+static Boolean appendRecord(DmmHistorySeries_t *s, int level, const DmmHistorySummary_t *r) {
+    DmmHistoryMap_t *m = &s->index[level];
+    size_t need = sizeof(HistoryIndex_t) + (s->records[level] + 1) * sizeof(DmmHistorySummary_t);
+    if (need > m->size && !mapGrow(m, m->size + HISTORY_GROW_RECORDS * sizeof(DmmHistorySummary_t))) {
+        return false;
+    }
+    *record(s, level, s->records[level]) = *r;
+    ((HistoryIndex_t*)m->base)->count = ++s->records[level];
+    return true;
+}
+
+// Summaries one level up for every full group below that hasn't one yet
+static void cascade(DmmHistorySeries_t *s) {
+    for (int k = 0; k + 1 < DMM_HISTORY_LEVELS; k++) {
+        while ((s->records[k + 1] + 1) * DMM_HISTORY_FANOUT <= s->records[k]) {
+            DmmHistorySummary_t r = { 0 };
+            uint64_t first = s->records[k + 1] * DMM_HISTORY_FANOUT;
+            for (uint64_t j = first; j < first + DMM_HISTORY_FANOUT; j++) {
+                summaryMerge(&r, record(s, k, j));
+            }
+            if (!appendRecord(s, k + 1, &r)) {
+                return;
+            }
+        }
+    }
+}
+
+static void seal(DmmHistorySeries_t *s) {
+    block(s, s->blocks)->sealed = 1;
+    appendRecord(s, 0, &s->open);
+    s->blocks++;
+    cascade(s);
+    memset(&s->open, 0, sizeof(s->open));
+    s->used = 0;
+}
+
+static Boolean seriesAppend(DmmHistorySeries_t *s, int64_t t, int64_t v) {
+    if (s->open.count > 0) {
+        unsigned char buf[HISTORY_MAX_SAMPLE];
+        int64_t dt = t - s->prevT, dv = v - s->prevV;
+        unsigned n = put(buf, dt - s->prevDt);
+        n += put(buf + n, dv - s->prevDv);
+        if (s->used + n <= HISTORY_PAYLOAD) {
+            HistoryBlock_t *b = block(s, s->blocks);
+            memcpy((unsigned char*)(b + 1) + s->used, buf, n);
+            s->used += n;
+            b->used = s->used;
+            b->count++;
+            s->prevT = t; s->prevV = v;
+            s->prevDt = dt; s->prevDv = dv;
+            summaryAdd(&s->open, t, v);
+            return true;
+        }
+        seal(s);
+    }
+    // First sample of a new block
+    size_t need = (s->blocks + 1) * DMM_HISTORY_BLOCK;
+    if (need > s->data.size && !mapGrow(&s->data, s->data.size + HISTORY_GROW_BLOCKS * DMM_HISTORY_BLOCK)) {
+        return false;
+    }
+    HistoryBlock_t *b = block(s, s->blocks);
+    *b = (HistoryBlock_t){ HISTORY_BLOCK_MAGIC, 1, 0, 0, t, v };
+    s->prevT = t; s->prevV = v;
+    s->prevDt = s->prevDv = 0;
+    summaryAdd(&s->open, t, v);
+    return true;
+}
+
+// Series
+
+static void seriesClose(DmmHistorySeries_t *s) {
+    mapClose(&s->data);
+    for (int k = 0; k < DMM_HISTORY_LEVELS; k++) {
+        mapClose(&s->index[k]);
+    }
+    free(s);
+}
+
+// Picks up after what is on disk: sealed blocks, the open block's encoder state, missing summaries
+static void seriesResume(DmmHistorySeries_t *s) {
+    uint64_t capacity = s->data.size / DMM_HISTORY_BLOCK;
+    while (s->blocks < capacity && block(s, s->blocks)->magic == HISTORY_BLOCK_MAGIC && block(s, s->blocks)->sealed) {
+        s->blocks++;
+    }
+    for (int k = 0; k < DMM_HISTORY_LEVELS; k++) {
+        HistoryIndex_t *x = (HistoryIndex_t*)s->index[k].base;
+        if (x->magic != HISTORY_INDEX_MAGIC) {
+            *x = (HistoryIndex_t){ HISTORY_INDEX_MAGIC, (uint32_t)k, 0 };
+        }
+        s->records[k] = x->count;
+    }
+    if (s->records[0] > s->blocks) {
+        s->records[0] = s->blocks;
+    }
+    for (int k = 1; k < DMM_HISTORY_LEVELS; k++) {
+        if (s->records[k] > s->records[k - 1] / DMM_HISTORY_FANOUT) {
+            s->records[k] = s->records[k - 1] / DMM_HISTORY_FANOUT;
+        }
+    }
+    while (s->records[0] < s->blocks) {
+        DmmHistorySummary_t r = { 0 };
+        blockRange(block(s, s->records[0]), INT64_MIN, INT64_MAX, &r);
+        appendRecord(s, 0, &r);
+    }
+    cascade(s);
+    if (s->blocks < capacity && block(s, s->blocks)->magic == HISTORY_BLOCK_MAGIC) {
+        HistoryCursor_t c;
+        cursorStart(&c, block(s, s->blocks));
+        while (cursorNext(&c)) {
+            summaryAdd(&s->open, c.t, c.v);
+        }
+        s->prevT = c.t; s->prevV = c.v;
+        s->prevDt = c.dt; s->prevDv = c.dv;
+        s->used = (uint32_t)(c.p - (const unsigned char*)(c.b + 1));
+        block(s, s->blocks)->count = s->open.count; // Drops a half written sample
+        block(s, s->blocks)->used = s->used;
+    }
+}
+
+static DmmHistorySeries_t *series(DmmHistory_t *h, char axisID, DmmHistoryChannel_t channel) {
+    int i = axisID & 0x7f;
+    if (channel >= History_Channels) {
+        return NULL;
+    }
+    if (h->series[i][channel]) {
+        return h->series[i][channel];
+    }
+    DmmHistorySeries_t *s = calloc(1, sizeof(DmmHistorySeries_t));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->data.fd = -1;
+    for (int k = 0; k < DMM_HISTORY_LEVELS; k++) {
+        s->index[k].fd = -1;
+    }
+    char path[DMM_HISTORY_PATH + 32];
+    snprintf(path, sizeof(path), "%s/axis%d-%s.blocks", h->dir, i, channelNames[channel]);
+    Boolean ok = mapOpen(&s->data, path, HISTORY_GROW_BLOCKS * DMM_HISTORY_BLOCK);
+    for (int k = 0; ok && k < DMM_HISTORY_LEVELS; k++) {
+        snprintf(path, sizeof(path), "%s/axis%d-%s.idx%d", h->dir, i, channelNames[channel], k);
+        ok = mapOpen(&s->index[k], path, sizeof(HistoryIndex_t) + HISTORY_GROW_RECORDS * sizeof(DmmHistorySummary_t));
+    }
+    if (!ok) {
+        seriesClose(s);
+        return NULL;
+    }
+    seriesResume(s);
+    h->series[i][channel] = s;
+    return s;
+}
+
+static void visit(DmmHistorySeries_t *s, int level, uint64_t j, int64_t t0, int64_t t1, DmmHistorySummary_t *out) {
+    const DmmHistorySummary_t *r = record(s, level, j);
+    if (r->count == 0 || r->t1 < t0 || r->t0 > t1) {
+        return;
+    }
+    if (r->t0 >= t0 && r->t1 <= t1) {
+        summaryMerge(out, r);
+    } else if (level == 0) {
+        blockRange(block(s, j), t0, t1, out);
+    } else {
+        for (uint64_t c = j * DMM_HISTORY_FANOUT; c < (j + 1) * DMM_HISTORY_FANOUT; c++) {
+            visit(s, level - 1, c, t0, t1, out);
+        }
+    }
+}
+
+// Driver
+
+static void DmmHistory_OnReply(DmmProtocolState_t *pp, char axisID, unsigned char code, long value, void *ctx) {
+    DmmHistory_t *h = (DmmHistory_t*)ctx;
+    DmmHistoryChannel_t channel;
+    if (code == Is_AbsPos32) {
+        channel = History_Position;
+    } else if (code == Is_TrqCurrent) {
+        channel = History_Torque;
+    } else {
+        return;
+    }
+    DmmTime_t sampled = pp->Read_Timing.sampledAt ? pp->Read_Timing.sampledAt : DmmNow();
+    DmmHistory_Append(h, axisID, channel, sampled + h->wallOffset, value);
+}
+
+Boolean DmmHistory_Open(DmmHistory_t *h, DmmProtocolState_t *pp, const char *dir) {
+    memset(h, 0, sizeof(*h));
+    if (strlen(dir) >= DMM_HISTORY_PATH) {
+        return false;
+    }
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        return false;
+    }
+    strcpy(h->dir, dir);
+    h->wallOffset = DmmClock_WallOffset();
+    h->pp = pp;
+    if (pp) {
+        AddReplyObserver(pp, &DmmHistory_OnReply, h);
+    }
+    return true;
+}
+
+void DmmHistory_Close(DmmHistory_t *h) {
+    if (h->pp) {
+        RemoveReplyObserver(h->pp, &DmmHistory_OnReply, h);
+        h->pp = NULL;
+    }
+    for (int i = 0; i < DMM_MAX_AXES; i++) {
+        for (int c = 0; c < History_Channels; c++) {
+            if (h->series[i][c]) {
+                seriesClose(h->series[i][c]);
+                h->series[i][c] = NULL;
+            }
+        }
+    }
+}
+
+Boolean DmmHistory_Append(DmmHistory_t *h, char axisID, DmmHistoryChannel_t channel, int64_t t, long value) {
+    DmmHistorySeries_t *s = series(h, axisID, channel);
+    if (s == NULL) {
+        return false;
+    }
+    if (s->open.count > 0 ? t < s->prevT : (s->records[0] > 0 && t < record(s, 0, s->records[0] - 1)->t1)) {
+        h->rejected++;
+        return false;
+    }
+    if (!seriesAppend(s, t, value)) {
+        return false;
+    }
+    h->samples++;
+    return true;
+}
+
+Boolean DmmHistory_Range(DmmHistory_t *h, char axisID, DmmHistoryChannel_t channel, int64_t t0, int64_t t1, DmmHistorySummary_t *out) {
+    memset(out, 0, sizeof(*out));
+    DmmHistorySeries_t *s = series(h, axisID, channel);
+    if (s == NULL) {
+        return false;
+    }
+    // Whole top level summaries, then what each level below has that isn't summarised yet
+    int top = DMM_HISTORY_LEVELS - 1;
+    for (uint64_t j = 0; j < s->records[top]; j++) {
+        visit(s, top, j, t0, t1, out);
+    }
+    for (int k = top - 1; k >= 0; k--) {
+        for (uint64_t j = s->records[k + 1] * DMM_HISTORY_FANOUT; j < s->records[k]; j++) {
+            visit(s, k, j, t0, t1, out);
+        }
+    }
+    const DmmHistorySummary_t *r = &s->open;
+    if (r->count > 0 && r->t1 >= t0 && r->t0 <= t1) {
+        if (r->t0 >= t0 && r->t1 <= t1) {
+            summaryMerge(out, r);
+        } else {
+            blockRange(block(s, s->blocks), t0, t1, out);
+        }
+    }
+    return true;
+}
+
+int DmmHistory_Downsample(DmmHistory_t *h, char axisID, DmmHistoryChannel_t channel, int64_t t0, int64_t t1, DmmHistorySummary_t *out, int n) {
+    if (n <= 0 || t1 < t0) {
+        return 0;
+    }
+    for (int i = 0; i < n; i++) {
+        int64_t a = t0 + (t1 - t0 + 1) * i / n, b = t0 + (t1 - t0 + 1) * (i + 1) / n - 1;
+        if (!DmmHistory_Range(h, axisID, channel, a, b, &out[i])) {
+            return i;
+        }
+    }
+    return n;
+}
+
+int64_t DmmHistory_Now(DmmHistory_t *h) {
+    return DmmNow() + h->wallOffset;
+}
+
+size_t DmmHistory_Bytes(DmmHistory_t *h, char axisID, DmmHistoryChannel_t channel, uint64_t *samples) {
+    DmmHistorySeries_t *s = series(h, axisID, channel);
+    if (samples) {
+        *samples = 0;
+    }
+    if (s == NULL) {
+        return 0;
+    }
+    size_t bytes = (s->blocks + (s->open.count > 0)) * DMM_HISTORY_BLOCK;
+    uint64_t n = s->open.count;
+    for (int k = 0; k < DMM_HISTORY_LEVELS; k++) {
+        bytes += sizeof(HistoryIndex_t) + s->records[k] * sizeof(DmmHistorySummary_t);
+    }
+    for (int k = DMM_HISTORY_LEVELS - 1; k >= 0; k--) {
+        uint64_t first = k == DMM_HISTORY_LEVELS - 1 ? 0 : s->records[k + 1] * DMM_HISTORY_FANOUT;
+        for (uint64_t j = first; j < s->records[k]; j++) {
+            n += record(s, k, j)->count;
+        }
+    }
+    if (samples) {
+        *samples = n;
+    }
+    return bytes;
+}
+
+void DmmHistory_Flush(DmmHistory_t *h) {
+    for (int i = 0; i < DMM_MAX_AXES; i++) {
+        for (int c = 0; c < History_Channels; c++) {
+            DmmHistorySeries_t *s = h->series[i][c];
+            if (s == NULL) {
+                continue;
+            }
+            msync(s->data.base, s->data.size, MS_ASYNC);
+            for (int k = 0; k < DMM_HISTORY_LEVELS; k++) {
+                msync(s->index[k].base, s->index[k].size, MS_ASYNC);
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,82 @@
+//
+//  DmmHistory.h
+//  dmmsend
+//
+//  Long term position and torque history per axis, on disk. Samples are
+//  packed into fixed size blocks as delta-of-delta times and values, zigzag
+//  varints, usually 2 - 4 bytes a sample. Every sealed block gets a min, max,
+//  sum and count summary, and every DMM_HISTORY_FANOUT summaries of a level
+//  are summarised again one level up, so a range query only decodes the
+//  blocks at its two ends.
+//
+//  Each series (axis and channel) is a set of files in the store's directory,
+//  appended to through mmap: axis<N>-<channel>.blocks and .idx0 - .idx3.
+//  Reopening a store carries on where it stopped, rebuilding any summaries a
+//  crash left out. Times are microseconds since the Unix epoch; replies are
+//  recorded at the time the drive sampled them (DmmReplyTiming_t).
+//
+//  Not in Windows builds: there DmmHistory_Open fails and the rest does nothing.
+//
+
+#ifndef dmmsend_DmmHistory_h
+#define dmmsend_DmmHistory_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+
+#define DMM_HISTORY_BLOCK 4096      // Bytes per block
+#define DMM_HISTORY_LEVELS 4        // Summary levels, level 0 is one per block
+#define DMM_HISTORY_FANOUT 64       // Summaries per summary one level up
+#define DMM_HISTORY_PATH 1024
+
+typedef enum { History_Position = 0, History_Torque, History_Channels } DmmHistoryChannel_t;
+
+typedef struct DmmHistorySummary {
+    int64_t t0, t1;         // First and last sample time
+    int64_t sum;
+    int32_t min, max;
+    uint32_t count, reserved;
+} DmmHistorySummary_t;
+
+typedef struct DmmHistoryMap {
+    int fd;
+    unsigned char *base;
+    size_t size;
+} DmmHistoryMap_t;
+
+typedef struct DmmHistorySeries {
+    DmmHistoryMap_t data, index[DMM_HISTORY_LEVELS];
+    uint64_t blocks;                            // Sealed blocks, the open one follows them
+    uint64_t records[DMM_HISTORY_LEVELS];
+    // Open block
+    DmmHistorySummary_t open;
+    int64_t prevT, prevV, prevDt, prevDv;
+    uint32_t used;                              // Payload bytes
+} DmmHistorySeries_t;
+
+typedef struct DmmHistory {
+    DmmProtocolState_t *pp;                     // NULL for a store only read
+    char dir[DMM_HISTORY_PATH];
+    DmmHistorySeries_t *series[DMM_MAX_AXES][History_Channels]; // Opened on first use
+    DmmTime_t wallOffset;                       // Epoch time - DmmNow
+    unsigned long samples, rejected;            // Appended, and dropped for going back in time
+} DmmHistory_t;
+
+// Opens (creating the directory if needed) and, with pp, records every position and torque reply
+Boolean DmmHistory_Open(DmmHistory_t *h, DmmProtocolState_t *pp, const char *dir);
+void DmmHistory_Close(DmmHistory_t *h);
+Boolean DmmHistory_Append(DmmHistory_t *h, char axis, DmmHistoryChannel_t channel, int64_t t, long value);
+// Summary of the samples in [t0, t1]; count 0 if there are none
+Boolean DmmHistory_Range(DmmHistory_t *h, char axis, DmmHistoryChannel_t channel, int64_t t0, int64_t t1, DmmHistorySummary_t *out);
+// n equal buckets over [t0, t1], for plotting
+int DmmHistory_Downsample(DmmHistory_t *h, char axis, DmmHistoryChannel_t channel, int64_t t0, int64_t t1, DmmHistorySummary_t *out, int n);
+// Epoch microseconds now, the time base of the store
+int64_t DmmHistory_Now(DmmHistory_t *h);
+// Bytes on disk in use by a series, for its sample count
+size_t DmmHistory_Bytes(DmmHistory_t *h, char axis, DmmHistoryChannel_t channel, uint64_t *samples);
+void DmmHistory_Flush(DmmHistory_t *h);
+
+#endif
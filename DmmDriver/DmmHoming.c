@@ -0,0 +1,132 @@
+//
+//  DmmHoming.c
+//  dmmsend
+//
+
+#include <string.h>
+
+#include "DmmHoming.h"
+#include "DmmProtocol.h"
+
+static void sendStatusRead(DmmHoming_t *h) {
+    if (h->inFlight < HOMING_MAX_IN_FLIGHT) {
+        h->sentAt[h->inFlight++] = DmmNow();
+    }
+    Send_Package(h->pp, Read_Drive_Status, h->axis, 0); // 0: Dummy Data
+}
+
+static void fillWindow(DmmHoming_t *h) {
+    while (h->inFlight < h->window) {
+        sendStatusRead(h);
+    }
+}
+
+// When the read being answered was sent, 0 if none was outstanding
+static DmmTime_t popSent(DmmHoming_t *h) {
+    if (h->inFlight == 0) {
+        return 0;
+    }
+    DmmTime_t t = h->sentAt[0];
+    h->inFlight--;
+    memmove(h->sentAt, h->sentAt + 1, h->inFlight * sizeof(DmmTime_t));
+    return t;
+}
+
+static void finish(DmmHoming_t *h, Boolean ok) {
+    h->state = ok ? Homing_Done : Homing_Failed;
+    if (h->ReportHomingPtr) {
+        h->ReportHomingPtr(h->axis, ok, h->detectUs, h->windowUs, DmmNow() - h->started, h->hook);
+    }
+}
+
+static void DmmHoming_OnReply(DmmProtocolState_t *pp, char axisID, unsigned char code, long value, void *ctx) {
+    DmmHoming_t *h = (DmmHoming_t*)ctx;
+    if (code != Is_Status || axisID != h->axis || (h->state != Homing_Seeking && h->state != Homing_Settling)) {
+        return;
+    }
+    DmmTime_t now = DmmNow();
+    DmmTime_t sent = popSent(h);
+    int level = (value & Status_Bit_CncZero) ? 1 : 0;
+    h->samples++;
+
+    int alarm = (value & Status_Bits_Alarm) >> 2;
+    if (alarm >= 1 && alarm <= 3) { // Lost phase, over current, over heat; 4 is only a CRC report
+        MoveMotorConstantRotation(pp, h->axis, 0);
+        finish(h, false);
+        return;
+    }
+    if (h->state == Homing_Seeking) {
+        if (h->lastLevel >= 0 && level != h->lastLevel && level == (h->risingEdge ? 1 : 0)) {
+            MoveMotorConstantRotation(pp, h->axis, 0); // Before anything else
+            h->edgeAt = now;
+            h->detectUs = now - sent;
+            h->windowUs = now - h->lastSampleAt;
+            h->state = Homing_Settling;
+            h->stoppedAt = pp->TxFreeAt; // The stop off the line
+        }
+        h->lastLevel = level;
+        h->lastSampleAt = now;
+    } else if (sent >= h->stoppedAt && (value & Status_Bit_InPosition) && !(value & Status_Bit_Busy)) {
+        // Only a read sent after the stop landed shows the axis settled, not just turning steadily
+        ResetOrgin(pp, h->axis);
+        finish(h, true);
+        return;
+    }
+    fillWindow(h);
+}
+
+void DmmHoming_Start(DmmHoming_t *h, char axis, long speed, Boolean risingEdge) {
+    h->axis = axis;
+    h->speed = speed;
+    h->risingEdge = risingEdge;
+    h->state = Homing_Seeking;
+    h->inFlight = 0;
+    h->lastLevel = -1;
+    h->samples = 0;
+    h->detectUs = h->windowUs = 0;
+    h->started = h->lastSampleAt = DmmNow();
+    MoveMotorConstantRotation(h->pp, axis, speed);
+    fillWindow(h);
+}
+
+void DmmHoming_Abort(DmmHoming_t *h) {
+    if (h->state == Homing_Seeking || h->state == Homing_Settling) {
+        MoveMotorConstantRotation(h->pp, h->axis, 0);
+        finish(h, false);
+    }
+}
+
+Boolean DmmHoming_Poll(DmmHoming_t *h) {
+    if (h->state != Homing_Seeking && h->state != Homing_Settling) {
+        return false;
+    }
+    DmmTime_t now = DmmNow();
+    if (h->state == Homing_Seeking && now - h->started > h->seekTimeoutUs) {
+        DmmHoming_Abort(h);
+        return false;
+    }
+    if (h->state == Homing_Settling && now - h->stoppedAt > h->settleTimeoutUs) {
+        DmmHoming_Abort(h); // Never reported settled: no new origin
+        return false;
+    }
+    // Lost reads would stall the window for good
+    while (h->inFlight > 0 && now - h->sentAt[0] > h->replyTimeoutUs) {
+        popSent(h);
+    }
+    fillWindow(h);
+    return true;
+}
+
+void DmmHoming_Init(DmmHoming_t *h, DmmProtocolState_t *pp) {
+    memset(h, 0, sizeof(*h));
+    h->pp = pp;
+    h->window = 2;
+    h->replyTimeoutUs = 20000;
+    h->seekTimeoutUs = 60000000;
+    h->settleTimeoutUs = 2000000;
+    AddReplyObserver(pp, &DmmHoming_OnReply, h);
+}
+
+void DmmHoming_Close(DmmHoming_t *h) {
+    RemoveReplyObserver(h->pp, &DmmHoming_OnReply, h);
+}
@@ -0,0 +1,53 @@
+//
+//  DmmHoming.h
+//  dmmsend
+//
+//  Homing on the CNC zero input (JP3 pin 2, status bit 6). The axis turns at
+//  constant speed while status reads are kept back to back on the link; the
+//  reply showing the edge stops the motor from inside the decode callback.
+//  Once a status read sent after the stop landed shows the drive in position
+//  and not busy, the origin is reset there.
+//
+
+#ifndef dmmsend_DmmHoming_h
+#define dmmsend_DmmHoming_h
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+
+#define HOMING_MAX_IN_FLIGHT 4
+
+typedef enum { Homing_Idle = 0, Homing_Seeking, Homing_Settling, Homing_Done, Homing_Failed } DmmHomingState_t;
+
+typedef struct DmmHoming {
+    DmmProtocolState_t *pp;
+    DmmHomingState_t state;
+    char axis;
+    long speed;
+    Boolean risingEdge;         // Home where the input goes HIGH, else where it goes LOW
+    int window;                 // Status reads kept in flight, 2 keeps the request line busy
+    DmmTime_t replyTimeoutUs;   // A read not answered by then is written off
+    DmmTime_t seekTimeoutUs;    // Give up (and stop) if no edge by then
+    DmmTime_t settleTimeoutUs;  // Fail, origin untouched, if in position never shows
+    // Outstanding reads, oldest first; the drive answers in order
+    DmmTime_t sentAt[HOMING_MAX_IN_FLIGHT];
+    int inFlight;
+    int lastLevel;              // -1 until the first status reply
+    DmmTime_t lastSampleAt;
+    DmmTime_t started, edgeAt;
+    DmmTime_t stoppedAt;        // The stop's last byte off the line
+    DmmTime_t detectUs;         // Edge reply decoded - its request sent: the age bound of the sample
+    DmmTime_t windowUs;         // Between the last sample before the edge and the one showing it
+    unsigned long samples;
+    void (*ReportHomingPtr)(char axis, Boolean ok, DmmTime_t detectUs, DmmTime_t windowUs, DmmTime_t totalUs, void *hook);
+    void *hook;
+} DmmHoming_t;
+
+void DmmHoming_Init(DmmHoming_t *h, DmmProtocolState_t *pp);
+void DmmHoming_Close(DmmHoming_t *h);
+void DmmHoming_Start(DmmHoming_t *h, char axis, long speed, Boolean risingEdge);
+void DmmHoming_Abort(DmmHoming_t *h);
+// Times out lost reads and the whole move; call every millisecond or so while running
+Boolean DmmHoming_Poll(DmmHoming_t *h);
+
+#endif
@@ -0,0 +1,151 @@
+//
+//  DmmHybrid.c
+//  dmmsend
+//
+
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+
+#include "DmmHybrid.h"
+#include "DmmProtocol.h"
+
+#ifndef MAX
+    #define MAX(a,b) ((a>b) ? a : b)
+#endif
+
+static double expectedAt(DmmHybrid_t *h, DmmHybridAxis_t *a, DmmTime_t t) {
+    return a->anchorPos + h->speedScale * a->speed * (double)(t - a->anchorAt) / 1e6;
+}
+
+// speed + trim, within maxSpeed, but never the other way or stopped
+static long onLink(DmmHybrid_t *h, DmmHybridAxis_t *a) {
+    long v = a->speed + a->trim;
+    v = v < -h->maxSpeed ? -h->maxSpeed : v > h->maxSpeed ? h->maxSpeed : v;
+    if (a->speed > 0 && v < 1) {
+        v = 1;
+    } else if (a->speed < 0 && v > -1) {
+        v = -1;
+    }
+    return v;
+}
+
+static void send(DmmHybrid_t *h, int i) {
+    DmmHybridAxis_t *a = &h->axis[i];
+    long v = onLink(h, a);
+    if (v != a->sent) {
+        MoveMotorConstantRotation(h->pp, (char)i, v);
+        a->sent = v;
+    }
+}
+
+static void DmmHybrid_OnReply(DmmProtocolState_t *pp, char axisID, unsigned char code, long value, void *ctx) {
+    DmmHybrid_t *h = (DmmHybrid_t*)ctx;
+    int i = axisID & 0x7f;
+    DmmHybridAxis_t *a = &h->axis[i];
+    if (code != Is_AbsPos32 || !a->active) {
+        return;
+    }
+    DmmTime_t t = pp->Read_Timing.sampledAt ? pp->Read_Timing.sampledAt : DmmNow();
+    if (!a->anchored) {
+        a->anchorPos = value;
+        a->anchorAt = t;
+        a->anchored = true;
+        return;
+    }
+    if (t < a->anchorAt) {
+        return; // Sampled before the last speed change took
+    }
+    a->error = expectedAt(h, a, t) - value;
+    a->maxError = MAX(a->maxError, fabs(a->error));
+    a->reads++;
+    int trim = 0;
+    if (a->speed != 0 && fabs(a->error) > h->deadband) {
+        double units = a->error / (h->speedScale * h->horizonUs / 1e6);
+        trim = (int)lround(units < -h->maxTrim ? -h->maxTrim : units > h->maxTrim ? h->maxTrim : units);
+    }
+    if (trim != a->trim) {
+        a->trim = trim;
+        long before = a->sent;
+        send(h, i);
+        if (a->sent != before) {
+            a->trims++;
+        }
+    }
+    if (h->ReportDriftPtr) {
+        h->ReportDriftPtr((char)i, a->error, a->trim, h->hook);
+    }
+}
+
+void DmmHybrid_Init(DmmHybrid_t *h, DmmProtocolState_t *pp, long maxSpeed) {
+    memset(h, 0, sizeof(*h));
+    h->pp = pp;
+    h->maxSpeed = maxSpeed;
+    h->speedScale = 273;        // ~1 rpm on a 16384 count encoder, as DmmSimDrive
+    h->readUs = 500000;
+    h->horizonUs = 2000000;
+    h->deadband = 50;
+    h->maxTrim = 2;
+    AddReplyObserver(pp, &DmmHybrid_OnReply, h);
+}
+
+void DmmHybrid_Close(DmmHybrid_t *h) {
+    RemoveReplyObserver(h->pp, &DmmHybrid_OnReply, h);
+}
+
+void DmmHybrid_Speed(DmmHybrid_t *h, char axisID, long speed) {
+    int i = axisID & 0x7f;
+    DmmHybridAxis_t *a = &h->axis[i];
+    DmmTime_t now = DmmNow();
+    if (!a->active) {
+        memset(a, 0, sizeof(*a));
+        a->active = true;
+        a->sent = LONG_MIN;
+        a->speed = speed;
+        send(h, i);
+        ReadMotorPosition32(h->pp, (char)i); // Anchors the expected position
+        a->nextReadAt = now + h->readUs;
+        return;
+    }
+    if (a->anchored) {
+        a->anchorPos = expectedAt(h, a, now);
+    }
+    a->speed = speed;
+    if (speed == 0) {
+        a->trim = 0;
+    }
+    send(h, i);
+    if (a->anchored) {
+        a->anchorAt = MAX(now, h->pp->TxFreeAt); // When the new speed is in at the drive
+    }
+}
+
+void DmmHybrid_Stop(DmmHybrid_t *h, char axisID) {
+    h->axis[axisID & 0x7f].active = false;
+}
+
+Boolean DmmHybrid_Expected(DmmHybrid_t *h, char axisID, DmmTime_t t, double *pos) {
+    DmmHybridAxis_t *a = &h->axis[axisID & 0x7f];
+    if (!a->active || !a->anchored) {
+        return false;
+    }
+    *pos = expectedAt(h, a, t);
+    return true;
+}
+
+Boolean DmmHybrid_Poll(DmmHybrid_t *h) {
+    Boolean active = false;
+    DmmTime_t now = DmmNow();
+    for (int i = 0; i < DMM_MAX_AXES; i++) {
+        DmmHybridAxis_t *a = &h->axis[i];
+        if (!a->active) {
+            continue;
+        }
+        active = true;
+        if (now >= a->nextReadAt) {
+            ReadMotorPosition32(h->pp, (char)i);
+            a->nextReadAt = now + h->readUs;
+        }
+    }
+    return active;
+}
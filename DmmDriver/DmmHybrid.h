@@ -0,0 +1,64 @@
+//
+//  DmmHybrid.h
+//  dmmsend
+//
+//  Constant rotation that keeps its place. The commanded Turn_ConstSpeed is
+//  integrated into where the axis is expected to be, at speedScale counts/s
+//  per unit; a position read every readUs is compared with that, and a small
+//  trim (at most maxTrim units, never reversing or stopping the axis, nor
+//  taking it past the caller's maxSpeed) is folded into the next speed
+//  command to close the error over horizonUs.
+//  Only Turn_ConstSpeed ever goes out, and only when speed + trim changes, so
+//  the link carries one read and the odd speed package a readUs.
+//
+//  The first read anchors the expected position. An axis told to stop stops:
+//  drift built up at speed 0 is made good once it turns again.
+//
+
+#ifndef dmmsend_DmmHybrid_h
+#define dmmsend_DmmHybrid_h
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+
+typedef struct DmmHybridAxis {
+    Boolean active;
+    long speed;                 // Commanded, Turn_ConstSpeed units
+    int trim;                   // Added to it on the link
+    long sent;                  // Last Turn_ConstSpeed sent
+    Boolean anchored;
+    double anchorPos;           // Expected position at anchorAt, counts
+    DmmTime_t anchorAt;
+    DmmTime_t nextReadAt;
+    double error;               // Expected - measured at the last read
+    double maxError;            // Largest |error| since started
+    unsigned long reads, trims; // trims: packages sent for a trim change alone
+} DmmHybridAxis_t;
+
+typedef struct DmmHybrid {
+    DmmProtocolState_t *pp;
+    DmmHybridAxis_t axis[DMM_MAX_AXES];
+    double speedScale;          // counts/s per Turn_ConstSpeed unit the choreography assumes
+    DmmTime_t readUs;
+    DmmTime_t horizonUs;        // Error is closed over this long
+    double deadband;            // counts, no trim within
+    int maxTrim;                // Turn_ConstSpeed units
+    long maxSpeed;              // speed + trim never goes past this either way
+    // Every read while active
+    void (*ReportDriftPtr)(char axis, double error, int trim, void *hook);
+    void *hook;
+} DmmHybrid_t;
+
+// maxSpeed: the caller's limit on what goes out, trim included
+void DmmHybrid_Init(DmmHybrid_t *h, DmmProtocolState_t *pp, long maxSpeed);
+void DmmHybrid_Close(DmmHybrid_t *h);
+// Turn at speed; starts hybrid mode on the axis if it isn't in it
+void DmmHybrid_Speed(DmmHybrid_t *h, char axis, long speed);
+// Leaves hybrid mode, sends nothing
+void DmmHybrid_Stop(DmmHybrid_t *h, char axis);
+// Expected position at t; false before the first read
+Boolean DmmHybrid_Expected(DmmHybrid_t *h, char axis, DmmTime_t t, double *pos);
+// Sends due position reads; call every millisecond or so while it returns true
+Boolean DmmHybrid_Poll(DmmHybrid_t *h);
+
+#endif
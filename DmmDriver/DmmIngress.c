@@ -0,0 +1,387 @@
+//
+//  DmmIngress.c
+//  dmmsend
+//
+
+#if defined(_WIN32)
+#include <string.h>
+
+#include "DmmIngress.h"
+
+void DmmIngress_Init(DmmIngress_t *in, DmmProtocolState_t *pp) {
+    memset(in, 0, sizeof(*in));
+    in->pp = pp;
+    in->sock = -1;
+}
+
+Boolean DmmIngress_Start(DmmIngress_t *in, unsigned short port) {
+    post("DmmIngress: not available on Windows\n");
+    return false;
+}
+
+void DmmIngress_Stop(DmmIngress_t *in) {
+}
+
+int DmmIngress_Feed(DmmIngress_t *in, const unsigned char *data, int length, DmmTime_t receivedAt) {
+    return 0;
+}
+
+int DmmIngress_Poll(DmmIngress_t *in, int maxCommands) {
+    return 0;
+}
+
+int DmmIngress_Pending(DmmIngress_t *in) {
+    return 0;
+}
+
+unsigned long DmmIngress_Latency(DmmIngress_t *in, DmmHistogram_t *latency) {
+    memset(latency, 0, sizeof(*latency));
+    return 0;
+}
+
+void DmmIngress_PrintLatency(DmmIngress_t *in, FILE *out) {
+}
+
+#else
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "DmmIngress.h"
+#include "DmmProtocol.h"
+
+#define INGRESS_MAX_BUNDLE_DEPTH 4
+
+static uint32_t be32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// Positions and speeds go out as 28 bits: anything past that is clamped to it and counted as malformed
+static long clamped(double v, int *malformed) {
+    if (v < DMM_VALUE_MIN || v > DMM_VALUE_MAX) {
+        (*malformed)++;
+        return v < 0 ? DMM_VALUE_MIN : DMM_VALUE_MAX;
+    }
+    return (long)(v < 0 ? v - 0.5 : v + 0.5);
+}
+
+// Latest value wins; a slot already waiting keeps its place in the queue
+static void put(DmmIngress_t *in, DmmIngressKind_t kind, int axis, long value, DmmTime_t receivedAt) {
+    int i = axis * Ingress_KindCount + kind;
+    pthread_mutex_lock(&in->lock);
+    DmmIngressSlot_t *s = &in->slot[i];
+    if (s->pending) {
+        in->superseded++;
+    } else {
+        in->order[(in->orderHead + in->orderCount++) % DMM_INGRESS_SLOTS] = (unsigned short)i;
+        s->pending = true;
+    }
+    s->value = value;
+    s->receivedAt = receivedAt;
+    in->messages++;
+    pthread_mutex_unlock(&in->lock);
+}
+
+// OSC strings are NUL terminated and padded to 4 bytes. Returns the offset after it, -1 if it runs off the end.
+static int oscString(const unsigned char *data, int length, int at) {
+    const unsigned char *end = memchr(data + at, 0, length - at);
+    if (end == NULL) {
+        return -1;
+    }
+    int next = ((int)(end - data) + 4) & ~3;
+    return next <= length ? next : -1;
+}
+
+static int parseOscMessage(DmmIngress_t *in, const unsigned char *data, int length, DmmTime_t receivedAt, int *malformed) {
+    int tags = oscString(data, length, 0);
+    if (tags < 0 || tags >= length || data[tags] != ',') {
+        return -1;
+    }
+    int args = oscString(data, length, tags);
+    if (args < 0 || data[tags + 1] == 0) {
+        return -1;
+    }
+    const char *address = (const char*)data;
+    if (strncmp(address, "/axis/", 6) != 0) {
+        return -1;
+    }
+    char *rest;
+    long axis = strtol(address + 6, &rest, 10);
+    if (rest == address + 6 || axis < 0 || axis >= DMM_MAX_AXES) {
+        return -1;
+    }
+    DmmIngressKind_t kind;
+    if (strcmp(rest, "/speed") == 0) {
+        kind = Ingress_Speed;
+    } else if (strcmp(rest, "/pos") == 0 || strcmp(rest, "/position") == 0) {
+        kind = Ingress_Position;
+    } else {
+        return -1;
+    }
+    const unsigned char *a = data + args;
+    int room = length - args;
+    long value;
+    switch (data[tags + 1]) {
+        case 'i':
+            if (room < 4) return -1;
+            value = clamped((int32_t)be32(a), malformed);
+            break;
+        case 'f': {
+            if (room < 4) return -1;
+            uint32_t bits = be32(a);
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            if (!isfinite(f)) return -1;
+            value = clamped(f, malformed);
+            break;
+        }
+        case 'h':
+            if (room < 8) return -1;
+            value = clamped((double)(int64_t)((uint64_t)be32(a) << 32 | be32(a + 4)), malformed);
+            break;
+        case 'd': {
+            if (room < 8) return -1;
+            uint64_t bits = (uint64_t)be32(a) << 32 | be32(a + 4);
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            if (!isfinite(d)) return -1;
+            value = clamped(d, malformed);
+            break;
+        }
+        default:
+            return -1;
+    }
+    put(in, kind, (int)axis, value, receivedAt);
+    return 1;
+}
+
+static int parseOsc(DmmIngress_t *in, const unsigned char *data, int length, DmmTime_t receivedAt, int depth, int *malformed) {
+    if (length >= 16 && memcmp(data, "#bundle", 8) == 0) {
+        // Time tags are ignored: a setpoint goes out as soon as it arrives
+        int taken = 0;
+        int at = 16;
+        if (depth >= INGRESS_MAX_BUNDLE_DEPTH) {
+            return -1;
+        }
+        while (at + 4 <= length) {
+            int size = (int)be32(data + at);
+            at += 4;
+            if (size <= 0 || size > length - at || (size & 3)) {
+                return -1;
+            }
+            int n = parseOsc(in, data + at, size, receivedAt, depth + 1, malformed);
+            if (n < 0) {
+                (*malformed)++;
+            } else {
+                taken += n;
+            }
+            at += size;
+        }
+        return taken;
+    }
+    return parseOscMessage(in, data, length, receivedAt, malformed);
+}
+
+static int parseBinary(DmmIngress_t *in, const unsigned char *data, int length, DmmTime_t receivedAt, int *malformed) {
+    int taken = 0;
+    for (int at = 0; at + 6 <= length; at += 6) {
+        DmmIngressKind_t kind;
+        if (data[at] == 's') {
+            kind = Ingress_Speed;
+        } else if (data[at] == 'p') {
+            kind = Ingress_Position;
+        } else {
+            (*malformed)++;
+            continue;
+        }
+        if (data[at + 1] >= DMM_MAX_AXES) {
+            (*malformed)++;
+            continue;
+        }
+        put(in, kind, data[at + 1], clamped((int32_t)be32(data + at + 2), malformed), receivedAt);
+        taken++;
+    }
+    return taken;
+}
+
+int DmmIngress_Feed(DmmIngress_t *in, const unsigned char *data, int length, DmmTime_t receivedAt) {
+    int n, malformed = 0;
+    if (length > 0 && (data[0] == '/' || data[0] == '#')) {
+        n = parseOsc(in, data, length, receivedAt, 0, &malformed);
+    } else if (length > 0 && length % 6 == 0) {
+        n = parseBinary(in, data, length, receivedAt, &malformed);
+    } else {
+        n = -1;
+    }
+    if (n < 0) {
+        malformed++;
+        n = 0;
+    }
+    pthread_mutex_lock(&in->lock);
+    in->datagrams++;
+    in->malformed += malformed;
+    pthread_mutex_unlock(&in->lock);
+    return n;
+}
+
+static void *ingressThread(void *arg) {
+    DmmIngress_t *in = (DmmIngress_t*)arg;
+    unsigned char buf[DMM_INGRESS_DATAGRAM];
+    struct pollfd fds[2] = { { in->sock, POLLIN, 0 }, { in->stopPipe[0], POLLIN, 0 } };
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            post("DmmIngress: poll: %s\n", strerror(errno));
+            break;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+        // Everything queued in the socket, each datagram stamped as it is taken
+        for (;;) {
+            ssize_t n = recv(in->sock, buf, sizeof(buf), MSG_DONTWAIT);
+            DmmTime_t now = DmmNow();
+            if (n < 0) {
+                break;
+            }
+            if (DmmIngress_Feed(in, buf, (int)n, now) > 0 && in->WakePtr) {
+                in->WakePtr(in->hook);
+            }
+        }
+    }
+    return NULL;
+}
+
+void DmmIngress_Init(DmmIngress_t *in, DmmProtocolState_t *pp) {
+    memset(in, 0, sizeof(*in));
+    in->pp = pp;
+    in->sock = -1;
+    in->stopPipe[0] = in->stopPipe[1] = -1;
+    pthread_mutex_init(&in->lock, NULL);
+}
+
+Boolean DmmIngress_Start(DmmIngress_t *in, unsigned short port) {
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    DmmIngress_Stop(in);
+    in->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (in->sock < 0) {
+        post("DmmIngress: socket: %s\n", strerror(errno));
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(in->sock, (struct sockaddr*)&addr, sizeof(addr)) != 0
+        || getsockname(in->sock, (struct sockaddr*)&addr, &addrLen) != 0) {
+        post("DmmIngress: can't listen on port %d: %s\n", port, strerror(errno));
+        close(in->sock);
+        in->sock = -1;
+        return false;
+    }
+    in->port = ntohs(addr.sin_port);
+    if (pipe(in->stopPipe) != 0) {
+        post("DmmIngress: pipe: %s\n", strerror(errno));
+        close(in->sock);
+        in->sock = -1;
+        return false;
+    }
+    in->running = true;
+    if (pthread_create(&in->thread, NULL, ingressThread, in) != 0) {
+        post("DmmIngress: can't start thread\n");
+        in->running = false;
+        DmmIngress_Stop(in);
+        return false;
+    }
+    return true;
+}
+
+void DmmIngress_Stop(DmmIngress_t *in) {
+    if (in->running) {
+        char c = 0;
+        while (write(in->stopPipe[1], &c, 1) < 0 && errno == EINTR) {
+        }
+        pthread_join(in->thread, NULL);
+        in->running = false;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (in->stopPipe[i] >= 0) {
+            close(in->stopPipe[i]);
+            in->stopPipe[i] = -1;
+        }
+    }
+    if (in->sock >= 0) {
+        close(in->sock);
+        in->sock = -1;
+    }
+}
+
+int DmmIngress_Poll(DmmIngress_t *in, int maxCommands) {
+    int sent = 0;
+    while (maxCommands <= 0 || sent < maxCommands) {
+        pthread_mutex_lock(&in->lock);
+        if (in->orderCount == 0) {
+            pthread_mutex_unlock(&in->lock);
+            break;
+        }
+        int i = in->order[in->orderHead];
+        in->orderHead = (in->orderHead + 1) % DMM_INGRESS_SLOTS;
+        in->orderCount--;
+        DmmIngressSlot_t s = in->slot[i];
+        in->slot[i].pending = false;
+        pthread_mutex_unlock(&in->lock);
+
+        DmmIngressKind_t kind = (DmmIngressKind_t)(i % Ingress_KindCount);
+        char axis = (char)(i / Ingress_KindCount);
+        if (in->DispatchPtr) {
+            in->DispatchPtr(kind, axis, s.value, in->hook);
+        } else if (kind == Ingress_Speed) {
+            MoveMotorConstantRotation(in->pp, axis, s.value);
+        } else {
+            MoveMotorToAbsolutePosition32(in->pp, axis, s.value);
+        }
+        DmmTime_t written = DmmNow();
+
+        pthread_mutex_lock(&in->lock);
+        DmmHistogram_Record(&in->latency, written - s.receivedAt);
+        pthread_mutex_unlock(&in->lock);
+        sent++;
+    }
+    return sent;
+}
+
+int DmmIngress_Pending(DmmIngress_t *in) {
+    pthread_mutex_lock(&in->lock);
+    int n = in->orderCount;
+    pthread_mutex_unlock(&in->lock);
+    return n;
+}
+
+unsigned long DmmIngress_Latency(DmmIngress_t *in, DmmHistogram_t *latency) {
+    pthread_mutex_lock(&in->lock);
+    *latency = in->latency;
+    pthread_mutex_unlock(&in->lock);
+    return latency->count;
+}
+
+void DmmIngress_PrintLatency(DmmIngress_t *in, FILE *out) {
+    DmmHistogram_t latency;
+    unsigned long n = DmmIngress_Latency(in, &latency);
+    pthread_mutex_lock(&in->lock);
+    fprintf(out, "ingress: %lu datagrams, %lu setpoints, %lu superseded, %lu malformed\n",
+            in->datagrams, in->messages, in->superseded, in->malformed);
+    pthread_mutex_unlock(&in->lock);
+    fprintf(out, "receive to write: %lu setpoints, mean %.1f us, max %lld us\n", n, DmmHistogram_Mean(&latency), latency.maxUs);
+    DmmHistogram_Print(&latency, out);
+}
+
+#endif
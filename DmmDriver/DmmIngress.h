@@ -0,0 +1,83 @@
+//
+//  DmmIngress.h
+//  dmmsend
+//
+//  Setpoints straight off the network. A listener thread takes UDP datagrams
+//  and drops every speed or position setpoint into a per-axis table where the
+//  latest value wins; DmmIngress_Poll, called by whoever owns the serial
+//  link, sends what is pending in arrival order. The time from receiving a
+//  datagram to handing its package to the serial write is kept as a histogram.
+//
+//  Datagrams are either OSC, a message or a bundle of messages:
+//    /axis/<N>/speed <i|f|h|d>    Turn_ConstSpeed
+//    /axis/<N>/pos <i|f|h|d>      Go_Absolute_Pos (also /axis/<N>/position)
+//  or compact binary, any number of 6 byte records:
+//    uint8 kind ('s' speed, 'p' position), uint8 axis, int32 value big endian
+//  Float values are rounded; NaN and infinity are dropped, and values past
+//  the 28 bits a package carries are clamped, both counted as malformed.
+//
+//  Not in Windows builds: there DmmIngress_Start fails and the rest does nothing.
+//
+
+#ifndef dmmsend_DmmIngress_h
+#define dmmsend_DmmIngress_h
+
+#include <stdio.h>
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+#include "DmmHistogram.h"
+
+#define DMM_INGRESS_DATAGRAM 1472
+
+typedef enum { Ingress_Speed = 0, Ingress_Position, Ingress_KindCount } DmmIngressKind_t;
+
+#define DMM_INGRESS_SLOTS (DMM_MAX_AXES * Ingress_KindCount)
+
+typedef struct DmmIngressSlot {
+    long value;
+    DmmTime_t receivedAt;   // Of the value that will be sent, not the first one it replaced
+    Boolean pending;
+} DmmIngressSlot_t;
+
+typedef struct DmmIngress {
+    DmmProtocolState_t *pp;
+    int sock;
+    int stopPipe[2];
+    unsigned short port;    // Bound port, useful after asking for 0
+#if !defined(_WIN32)
+    pthread_t thread;
+    pthread_mutex_t lock;
+#endif
+    Boolean running;
+    DmmIngressSlot_t slot[DMM_INGRESS_SLOTS]; // axis * Ingress_KindCount + kind
+    unsigned short order[DMM_INGRESS_SLOTS];  // Pending slots, oldest first; a slot is queued once
+    int orderHead, orderCount;
+    // Counters
+    unsigned long datagrams, messages, malformed;
+    unsigned long superseded;   // Overwritten by a newer value before being sent
+    DmmHistogram_t latency;     // Receive to serial write, one per setpoint sent
+    // Listener thread, once per datagram that left something pending. Must not send.
+    void (*WakePtr)(void *hook);
+    // Poll's thread; sends the package itself when NULL
+    void (*DispatchPtr)(DmmIngressKind_t kind, char axis, long value, void *hook);
+    void *hook;
+} DmmIngress_t;
+
+void DmmIngress_Init(DmmIngress_t *in, DmmProtocolState_t *pp);
+// Listen on UDP port (0 for any free one), all interfaces
+Boolean DmmIngress_Start(DmmIngress_t *in, unsigned short port);
+void DmmIngress_Stop(DmmIngress_t *in);
+// Parse one datagram as if it had arrived at receivedAt, returns the setpoints taken
+int DmmIngress_Feed(DmmIngress_t *in, const unsigned char *data, int length, DmmTime_t receivedAt);
+// Send up to maxCommands pending setpoints (all of them if <= 0), returns how many were sent
+int DmmIngress_Poll(DmmIngress_t *in, int maxCommands);
+int DmmIngress_Pending(DmmIngress_t *in);
+// Copies the latency histogram out, returns the number of setpoints sent
+unsigned long DmmIngress_Latency(DmmIngress_t *in, DmmHistogram_t *latency);
+void DmmIngress_PrintLatency(DmmIngress_t *in, FILE *out);
+
+#endif
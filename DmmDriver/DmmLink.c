@@ -0,0 +1,182 @@
+//
+//  DmmLink.c
+//  dmmsend
+//
+
+#include <string.h>
+
+#include "DmmLink.h"
+#include "DmmProtocol.h"
+
+#ifndef MIN
+    #define MIN(a,b) ((a<b) ? a : b)
+#endif
+
+static int settingFor(unsigned char func) {
+    switch (func) {
+        case Set_MainGain: return Setting_MainGain;
+        case Set_SpeedGain: return Setting_SpeedGain;
+        case Set_IntGain: return Setting_IntGain;
+        case Set_HighSpeed: return Setting_HighSpeed;
+        case Set_HighAccel: return Setting_HighAccel;
+        case Turn_ConstSpeed:
+        case Go_Absolute_Pos: return Setting_Motion;
+        default: return -1;
+    }
+}
+
+static void probe(DmmLink_t *l) {
+    Send_Package(l->pp, Read_Drive_Status, l->probeAxis, 0); // 0: Dummy Data
+    l->probeDoneAt = l->pp->TxFreeAt;
+}
+
+static void down(DmmLink_t *l) {
+    DmmTime_t now = DmmNow();
+    l->state = Link_Down;
+    l->downAt = now;
+    l->confirmedAtDown = l->confirmedUpTo;
+    l->backoffUs = l->minBackoffUs;
+    l->nextAttemptAt = now;
+    l->unanswered = 0;
+    l->drops++;
+    // Whatever was in flight is gone
+    l->pp->Read_Num = 0;
+    l->pp->PendingCount = 0;
+    l->pp->TxFreeAt = now;
+    if (l->ReportLinkPtr) {
+        l->ReportLinkPtr(false, 0, 0, l->hook);
+    }
+}
+
+// In one go, however many axes there are
+static int replay(DmmLink_t *l) {
+    int n = 0;
+    for (int i = 0; i < DMM_MAX_AXES; i++) {
+        for (int k = 0; k < Setting_Count; k++) {
+            DmmLinkSetting_t *s = &l->desired[i][k];
+            if (s->set && (l->replayAll || s->sentAt > l->confirmedAtDown)) {
+                l->replayAxes[n] = (char)i;
+                l->replayFuncs[n] = s->func;
+                l->replayValues[n] = s->value;
+                n++;
+            }
+        }
+    }
+    Send_Packages(l->pp, l->replayAxes, l->replayFuncs, l->replayValues, n);
+    l->replayed += n;
+    return n;
+}
+
+static void DmmLink_OnReply(DmmProtocolState_t *pp, char axisID, unsigned char code, long value, void *ctx) {
+    DmmLink_t *l = (DmmLink_t*)ctx;
+    l->heard = true;
+    l->unanswered = 0;
+    l->probeAxis = axisID & 0x7f;
+    l->probeAxisKnown = true;
+    if (pp->Read_Timing.requestSentAt > l->confirmedUpTo) {
+        l->confirmedUpTo = pp->Read_Timing.requestSentAt;
+    }
+    if (l->state == Link_Down) {
+        l->state = Link_Up;
+        pp->PendingCount = 0; // Probes to other axes that went unanswered
+        int n = replay(l);
+        if (l->ReportLinkPtr) {
+            l->ReportLinkPtr(true, DmmNow() - l->downAt, n, l->hook);
+        }
+    }
+}
+
+static void DmmLink_OnCommand(DmmProtocolState_t *pp, char axisID, unsigned char func, long value, void *ctx) {
+    DmmLink_t *l = (DmmLink_t*)ctx;
+    DmmTime_t now = DmmNow();
+    if (!l->probeAxisKnown) {
+        l->probeAxis = axisID & 0x7f; // Probably there, which 0 needn't be; replaced once a drive answers
+        l->probeAxisKnown = true;
+    }
+    if (Expects_Reply(func)) {
+        if (l->unanswered++ == 0) {
+            l->firstUnansweredAt = now;
+        }
+        l->lastReadAt = now;
+        return;
+    }
+    if (func == Go_Relative_Pos) {
+        DmmLinkSetting_t *m = &l->desired[axisID & 0x7f][Setting_Motion];
+        if (!m->set || m->func != Go_Absolute_Pos) {
+            m->set = false; // Where it ends up isn't known here
+            return;
+        }
+        func = Go_Absolute_Pos; // Replayed as where the steps got to
+        value += m->value;
+    }
+    int k = settingFor(func);
+    if (k >= 0) {
+        l->desired[axisID & 0x7f][k] = (DmmLinkSetting_t){ true, func, value, now };
+    }
+}
+
+void DmmLink_Init(DmmLink_t *l, DmmProtocolState_t *pp) {
+    memset(l, 0, sizeof(*l));
+    l->pp = pp;
+    l->deadUs = 200000;
+    l->keepaliveUs = 250000;
+    l->minBackoffUs = 10000;
+    l->maxBackoffUs = 500000;
+    l->missLimit = 3;
+    AddReplyObserver(pp, &DmmLink_OnReply, l);
+    AddCommandObserver(pp, &DmmLink_OnCommand, l);
+}
+
+void DmmLink_Close(DmmLink_t *l) {
+    RemoveReplyObserver(l->pp, &DmmLink_OnReply, l);
+    RemoveCommandObserver(l->pp, &DmmLink_OnCommand, l);
+}
+
+Boolean DmmLink_IsProbeReply(DmmLink_t *l) {
+    return l->pp->Read_Timing.requestDoneAt == l->probeDoneAt && l->probeDoneAt != 0;
+}
+
+void DmmLink_TransportError(DmmLink_t *l) {
+    if (l->state == Link_Up) {
+        down(l);
+    }
+}
+
+Boolean DmmLink_Poll(DmmLink_t *l) {
+    DmmTime_t now = DmmNow();
+    if (l->state == Link_Down) {
+        if (now >= l->nextAttemptAt) {
+            l->attempts++;
+            if (l->ReopenPtr == NULL || l->ReopenPtr(l->hook)) {
+                probe(l);
+            }
+            if (l->ReopenPtr) {
+                l->nextAttemptAt = now + l->backoffUs;
+                l->backoffUs = MIN(l->backoffUs * 2, l->maxBackoffUs);
+            } else {
+                l->nextAttemptAt = now + l->deadUs / l->missLimit; // Probes alone cost next to nothing
+            }
+        }
+        return true;
+    }
+    if (!l->heard) {
+        return false; // Nothing says replies come back at all
+    }
+    if (l->unanswered >= l->missLimit && now - l->firstUnansweredAt > l->deadUs) {
+        down(l);
+        return true;
+    }
+    // Something to restore: keep reads going so a dead link shows, closer together once one is missed
+    DmmTime_t every = l->unanswered > 0 ? l->deadUs / l->missLimit : l->keepaliveUs;
+    for (int i = 0; i < DMM_MAX_AXES; i++) {
+        for (int k = 0; k < Setting_Count; k++) {
+            if (l->desired[i][k].set) {
+                if (now - l->lastReadAt > every) {
+                    probe(l);
+                }
+                return true;
+            }
+        }
+    }
+    return false;
+}
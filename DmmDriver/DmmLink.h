@@ -0,0 +1,85 @@
+//
+//  DmmLink.h
+//  dmmsend
+//
+//  Serial link supervision. The link is taken for dead when missLimit reads
+//  in a row go unanswered for deadUs, or when the transport says so; it is
+//  then reopened (ReopenPtr, if the caller owns the port) and probed with a
+//  status read, backing off from minBackoffUs to maxBackoffUs, until a reply
+//  comes back. Without ReopenPtr it is only probed, missLimit times a deadUs.
+//
+//  Every gain, limit and motion command sent is kept per axis as the desired
+//  state. A command is confirmed once a reply comes in to a read sent after
+//  it; on reconnect only the commands the drives may not have got, those not
+//  confirmed when the link died and any sent while it was down, are replayed,
+//  gains first, then limits, then motion. With nothing else reading, a status
+//  read goes out every keepaliveUs so a dead link is noticed, and once one is
+//  missed, missLimit of them go out within deadUs.
+//
+//  Nothing is supervised until a reply has been decoded on the state: a port
+//  that is only written to, with no replies wired back, is left alone.
+//
+
+#ifndef dmmsend_DmmLink_h
+#define dmmsend_DmmLink_h
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+
+typedef enum { Link_Up = 0, Link_Down } DmmLinkState_t;
+
+// Replay order
+typedef enum {
+    Setting_MainGain = 0, Setting_SpeedGain, Setting_IntGain,
+    Setting_HighSpeed, Setting_HighAccel,
+    Setting_Motion,             // Turn_ConstSpeed or Go_Absolute_Pos (steps added in), whichever came last
+    Setting_Count
+} DmmLinkSettingKind_t;
+
+typedef struct DmmLinkSetting {
+    Boolean set;
+    unsigned char func;
+    long value;
+    DmmTime_t sentAt;
+} DmmLinkSetting_t;
+
+typedef struct DmmLink {
+    DmmProtocolState_t *pp;
+    DmmLinkState_t state;
+    Boolean heard;              // A reply has come in since init, so replies are wired back
+    DmmLinkSetting_t desired[DMM_MAX_AXES][Setting_Count];
+    DmmTime_t confirmedUpTo;    // Commands sent up to here were followed by a reply
+    DmmTime_t confirmedAtDown;
+    DmmTime_t lastReadAt, firstUnansweredAt;
+    int unanswered;             // Reads sent since the last reply
+    char probeAxis;             // Last axis heard from, else the first one commanded
+    Boolean probeAxisKnown;
+    DmmTime_t probeDoneAt;      // Last probe off the line, to tell its reply apart
+    DmmTime_t downAt, nextAttemptAt, backoffUs;
+    // Settings
+    DmmTime_t deadUs, keepaliveUs, minBackoffUs, maxBackoffUs;
+    int missLimit;
+    Boolean replayAll;          // Replay confirmed commands too, for drives that may have lost power
+    // Counts
+    unsigned long drops, attempts, replayed;
+    // Replay in one write
+    char replayAxes[DMM_MAX_AXES * Setting_Count];
+    unsigned char replayFuncs[DMM_MAX_AXES * Setting_Count];
+    long replayValues[DMM_MAX_AXES * Setting_Count];
+    Boolean (*ReopenPtr)(void *hook);   // Optional, true if the port could be opened
+    // Link went down (up false, downUs 0), or came back after downUs with replayed packages resent
+    void (*ReportLinkPtr)(Boolean up, DmmTime_t downUs, int replayed, void *hook);
+    void *hook;
+} DmmLink_t;
+
+void DmmLink_Init(DmmLink_t *l, DmmProtocolState_t *pp);
+void DmmLink_Close(DmmLink_t *l);
+// A write or read on the port failed, or it hung up
+void DmmLink_TransportError(DmmLink_t *l);
+// Times out reads, keeps the link probed and reopens it; call every millisecond or so while it returns true.
+// False until the first reply, as a write-only port can't be supervised.
+Boolean DmmLink_Poll(DmmLink_t *l);
+// From a reply observer or hook: the reply being decoded answers a keepalive or reconnect probe
+Boolean DmmLink_IsProbeReply(DmmLink_t *l);
+
+#endif
@@ -0,0 +1,141 @@
+//
+//  DmmLoop.c
+//  dmmsend
+//
+
+#include <limits.h>
+#include <string.h>
+
+#include "DmmLoop.h"
+#include "DmmProtocol.h"
+
+#ifndef MIN
+    #define MIN(a,b) ((a<b) ? a : b)
+#endif
+
+#ifndef MAX
+    #define MAX(a,b) ((a>b) ? a : b)
+#endif
+
+#define LOOP_MAX_DT_US 1000000 // Longer gaps (first sample, stalled link) don't integrate
+
+static void readPosition(DmmLoop_t *loop, int i) {
+    ReadMotorPosition32(loop->pp, (char)i);
+    loop->axis[i].reading = true;
+    loop->axis[i].readDoneAt = loop->pp->TxFreeAt;
+}
+
+static void DmmLoop_OnReply(DmmProtocolState_t *pp, char axisID, unsigned char code, long pos, void *ctx) {
+    DmmLoop_t *loop = (DmmLoop_t*)ctx;
+    if (code != Is_AbsPos32 || axisID < 0) {
+        return;
+    }
+    DmmLoopAxis_t *a = &loop->axis[(int)axisID];
+    if (!a->enabled) {
+        return;
+    }
+    Boolean ours = a->reading && pp->Read_Timing.requestDoneAt == a->readDoneAt;
+    if (ours) {
+        a->reading = false;
+    }
+    DmmTime_t now = DmmNow();
+    long error = a->target - pos;
+    double dt = (double)(now - a->lastTime) / 1e6;
+    Boolean haveDt = a->samples > 0 && now > a->lastTime && now - a->lastTime < LOOP_MAX_DT_US;
+
+    double derivative = haveDt ? (error - a->lastError) / dt : 0;
+    double out = a->feedForwardSpeed + a->kp * error + a->ki * a->integral + a->kd * derivative;
+    long speed = (long)(out < 0 ? out - 0.5 : out + 0.5);
+    long clamped = MAX(-a->maxSpeed, MIN(a->maxSpeed, speed));
+    // Anti windup: only integrate while the output isn't pinned in the error's direction
+    if (haveDt && (clamped == speed || (clamped > 0) != (error > 0))) {
+        a->integral += error * dt;
+    }
+
+    if (clamped != a->lastSpeed) {
+        MoveMotorConstantRotation(pp, axisID, clamped);
+        a->lastSpeed = clamped;
+    }
+    if (loop->autoPoll && ours) {
+        readPosition(loop, axisID);
+    }
+    a->lastError = error;
+    a->lastTime = now;
+    a->samples++;
+    if (loop->ReportTrackingErrorPtr) {
+        loop->ReportTrackingErrorPtr(axisID, error, clamped, loop->hook);
+    }
+}
+
+void DmmLoop_Init(DmmLoop_t *loop, DmmProtocolState_t *pp) {
+    memset(loop, 0, sizeof(*loop));
+    loop->pp = pp;
+    loop->autoPoll = true;
+    loop->readTimeoutUs = DMM_REPLY_TIMEOUT_US;
+    for (int i = 0; i < DMM_MAX_AXES; i++) {
+        loop->axis[i].kp = 0.05;
+        loop->axis[i].maxSpeed = 100;
+        loop->axis[i].lastSpeed = LONG_MIN;
+    }
+    AddReplyObserver(pp, &DmmLoop_OnReply, loop);
+}
+
+void DmmLoop_Close(DmmLoop_t *loop) {
+    RemoveReplyObserver(loop->pp, &DmmLoop_OnReply, loop);
+}
+
+void DmmLoop_SetGains(DmmLoop_t *loop, char axis, double kp, double ki, double kd, long maxSpeed) {
+    DmmLoopAxis_t *a = &loop->axis[axis & 0x7f];
+    a->kp = kp;
+    a->ki = ki;
+    a->kd = kd;
+    a->maxSpeed = MAX(0, maxSpeed);
+    a->integral = 0;
+}
+
+void DmmLoop_Track(DmmLoop_t *loop, char axis, long target, long feedForwardSpeed) {
+    DmmLoopAxis_t *a = &loop->axis[axis & 0x7f];
+    a->target = target;
+    a->feedForwardSpeed = feedForwardSpeed;
+    if (!a->enabled) {
+        a->enabled = true;
+        a->integral = 0;
+        a->samples = 0;
+        a->reading = false;
+    }
+    if (!a->reading) {
+        readPosition(loop, axis & 0x7f);
+    }
+}
+
+void DmmLoop_Release(DmmLoop_t *loop, char axis, Boolean stopMotor) {
+    DmmLoopAxis_t *a = &loop->axis[axis & 0x7f];
+    a->enabled = false;
+    a->reading = false;
+    if (stopMotor) {
+        MoveMotorConstantRotation(loop->pp, axis, 0);
+    }
+    a->lastSpeed = LONG_MIN;
+}
+
+Boolean DmmLoop_Poll(DmmLoop_t *loop) {
+    Boolean active = false;
+    DmmTime_t now = DmmNow();
+    for (int i = 0; i < DMM_MAX_AXES; i++) {
+        DmmLoopAxis_t *a = &loop->axis[i];
+        if (!a->enabled) {
+            continue;
+        }
+        active = true;
+        if (!loop->autoPoll) {
+            continue;
+        }
+        if (!a->reading) {
+            readPosition(loop, i);
+        } else if (now - a->readDoneAt > loop->readTimeoutUs) {
+            a->timeouts++;
+            readPosition(loop, i);
+        }
+    }
+    return active;
+}
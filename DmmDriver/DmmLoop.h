@@ -0,0 +1,57 @@
+//
+//  DmmLoop.h
+//  dmmsend
+//
+//  Host side outer position loop. Runs in the decode path: every Is_AbsPos32
+//  reply for a tracked axis is fed to a PID + feed-forward controller and the
+//  resulting Turn_ConstSpeed correction is sent before ReadPackage returns,
+//  followed by the next position read so the loop clocks itself off the link.
+//
+//  Each tracked axis has at most one read of its own out. Only the reply to
+//  that read asks for the next one; replies to reads sent by anything else
+//  still correct the speed. A read not answered within readTimeoutUs of
+//  leaving the line is sent again from DmmLoop_Poll, so a lost read, a reply
+//  that fails its check or a dropped link doesn't stop the loop.
+//
+
+#ifndef dmmsend_DmmLoop_h
+#define dmmsend_DmmLoop_h
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+
+typedef struct DmmLoopAxis {
+    Boolean enabled;
+    long target;            // Desired position, encoder counts
+    long feedForwardSpeed;  // Added to the controller output, Turn_ConstSpeed units
+    double kp, ki, kd;      // Speed units per count, per count*s, per count/s
+    long maxSpeed;          // Output clamp, |speed| <= maxSpeed
+    double integral;        // count*s
+    long lastError;
+    DmmTime_t lastTime;
+    long lastSpeed;         // Last speed sent, LONG_MIN before the first one
+    Boolean reading;        // A read of the loop's own is out
+    DmmTime_t readDoneAt;   // Its last byte off the line, matches the reply's requestDoneAt
+    unsigned long samples, timeouts;
+} DmmLoopAxis_t;
+
+typedef struct DmmLoop {
+    DmmProtocolState_t *pp;
+    Boolean autoPoll;       // Request the next position as soon as a correction is out
+    DmmTime_t readTimeoutUs;
+    DmmLoopAxis_t axis[DMM_MAX_AXES];
+    void (*ReportTrackingErrorPtr)(char axis, long error, long speed, void *hook); // Optional
+    void *hook;
+} DmmLoop_t;
+
+void DmmLoop_Init(DmmLoop_t *loop, DmmProtocolState_t *pp);
+void DmmLoop_Close(DmmLoop_t *loop);
+void DmmLoop_SetGains(DmmLoop_t *loop, char axis, double kp, double ki, double kd, long maxSpeed);
+// Enables the loop for the axis and kicks off the first position read
+void DmmLoop_Track(DmmLoop_t *loop, char axis, long target, long feedForwardSpeed);
+// Stops correcting; the motor keeps the last commanded speed unless stopMotor is set
+void DmmLoop_Release(DmmLoop_t *loop, char axis, Boolean stopMotor);
+// Sends reads that timed out again; call every millisecond or so while it returns true
+Boolean DmmLoop_Poll(DmmLoop_t *loop);
+
+#endif
@@ -0,0 +1,188 @@
+//
+//  DmmMailbox.c
+//  dmmsend
+//
+
+#if defined(_WIN32)
+#include <string.h>
+
+#include "DmmMailbox.h"
+
+Boolean DmmMailbox_Open(DmmMailbox_t *mb, DmmProtocolState_t *pp, const char *name, Boolean create, int axes) {
+    memset(mb, 0, sizeof(*mb));
+    post("DmmMailbox: not available on Windows\n");
+    return false;
+}
+
+void DmmMailbox_Close(DmmMailbox_t *mb) {
+}
+
+void DmmMailbox_Write(DmmMailbox_t *mb, char axis, DmmMailboxKind_t kind, long value) {
+}
+
+int DmmMailbox_Poll(DmmMailbox_t *mb, int maxCommands) {
+    return 0;
+}
+
+unsigned long DmmMailbox_Age(DmmMailbox_t *mb, DmmHistogram_t *age) {
+    memset(age, 0, sizeof(*age));
+    return 0;
+}
+
+void DmmMailbox_PrintAge(DmmMailbox_t *mb, FILE *out) {
+}
+
+#else
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "DmmMailbox.h"
+#include "DmmProtocol.h"
+
+#define load(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define store(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+
+Boolean DmmMailbox_Open(DmmMailbox_t *mb, DmmProtocolState_t *pp, const char *name, Boolean create, int axes) {
+    memset(mb, 0, sizeof(*mb));
+    mb->pp = pp;
+    snprintf(mb->name, sizeof(mb->name), "%s%s", name[0] == '/' ? "" : "/", name);
+    int fd = shm_open(mb->name, O_RDWR | (create ? O_CREAT : 0), 0660);
+    if (fd < 0) {
+        post("DmmMailbox: can't open %s: %s\n", mb->name, strerror(errno));
+        return false;
+    }
+    if (create && ftruncate(fd, sizeof(DmmMailboxShared_t)) != 0) {
+        post("DmmMailbox: can't size %s: %s\n", mb->name, strerror(errno));
+        close(fd);
+        return false;
+    }
+    void *p = mmap(NULL, sizeof(DmmMailboxShared_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        post("DmmMailbox: can't map %s: %s\n", mb->name, strerror(errno));
+        return false;
+    }
+    mb->shared = (DmmMailboxShared_t*)p;
+    if (create) {
+        memset(mb->shared, 0, sizeof(DmmMailboxShared_t));
+        mb->shared->version = DMM_MAILBOX_VERSION;
+        mb->shared->axes = (uint32_t)(axes > 0 && axes <= DMM_MAX_AXES ? axes : DMM_MAX_AXES);
+        mb->shared->slotSize = sizeof(DmmMailboxSlot_t);
+        __atomic_store_n(&mb->shared->magic, DMM_MAILBOX_MAGIC, __ATOMIC_RELEASE); // Header complete
+        mb->owner = true;
+    } else if (__atomic_load_n(&mb->shared->magic, __ATOMIC_ACQUIRE) != DMM_MAILBOX_MAGIC
+               || mb->shared->version != DMM_MAILBOX_VERSION
+               || mb->shared->slotSize != sizeof(DmmMailboxSlot_t)) {
+        post("DmmMailbox: %s is not a version %d mailbox\n", mb->name, DMM_MAILBOX_VERSION);
+        DmmMailbox_Close(mb);
+        return false;
+    }
+    uint32_t shared = mb->shared->axes;
+    mb->axes = shared < 1 ? 1 : shared > DMM_MAX_AXES ? DMM_MAX_AXES : (int)shared;
+    // Whatever is there already is from before we looked; only newer writes go out
+    for (int i = 0; i < DMM_MAX_AXES; i++) {
+        mb->seen[i] = __atomic_load_n(&mb->shared->slot[i].generation, __ATOMIC_ACQUIRE);
+    }
+    return true;
+}
+
+void DmmMailbox_Close(DmmMailbox_t *mb) {
+    if (mb->shared) {
+        munmap(mb->shared, sizeof(DmmMailboxShared_t));
+        mb->shared = NULL;
+        if (mb->owner) {
+            shm_unlink(mb->name);
+        }
+    }
+}
+
+// One writer per axis; different axes can be written from different processes
+void DmmMailbox_Write(DmmMailbox_t *mb, char axis, DmmMailboxKind_t kind, long value) {
+    DmmMailboxSlot_t *s = &mb->shared->slot[axis & 0x7f];
+    uint32_t seq = load(&s->seq);
+    store(&s->seq, seq + 1);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    store(&s->kind, (uint32_t)kind);
+    store(&s->value, (int64_t)value);
+    store(&s->writtenAt, (int64_t)DmmNow());
+    store(&s->generation, load(&s->generation) + 1);
+    __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// A consistent copy, or false if a writer was in the slot
+static Boolean readSlot(DmmMailboxSlot_t *s, DmmMailboxSlot_t *out) {
+    uint32_t before = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if (before & 1) {
+        return false;
+    }
+    out->kind = load(&s->kind);
+    out->value = load(&s->value);
+    out->writtenAt = load(&s->writtenAt);
+    out->generation = load(&s->generation);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return load(&s->seq) == before;
+}
+
+int DmmMailbox_Poll(DmmMailbox_t *mb, int maxCommands) {
+    int sent = 0;
+    int axes = mb->axes;
+    for (int n = 0; n < axes && (maxCommands <= 0 || sent < maxCommands); n++) {
+        int axis = (mb->nextAxis + n) % axes;
+        DmmMailboxSlot_t *s = &mb->shared->slot[axis];
+        if (load(&s->generation) == mb->seen[axis]) {
+            continue;
+        }
+        DmmMailboxSlot_t copy;
+        int tries = 0;
+        while (!readSlot(s, &copy)) {
+            mb->retries++;
+            if (++tries == 4) {
+                break; // Writer busy in it, pick it up next time round
+            }
+        }
+        if (tries == 4) {
+            continue;
+        }
+        mb->skipped += copy.generation - mb->seen[axis] - 1;
+        mb->seen[axis] = copy.generation;
+        if (copy.kind != Mailbox_Speed && copy.kind != Mailbox_Position) {
+            mb->malformed++;
+            continue;
+        }
+        long value = (long)copy.value;
+        if (copy.value < DMM_VALUE_MIN || copy.value > DMM_VALUE_MAX) {
+            mb->malformed++; // A package carries 28 bits
+            value = copy.value < 0 ? DMM_VALUE_MIN : DMM_VALUE_MAX;
+        }
+        if (mb->DispatchPtr) {
+            mb->DispatchPtr((DmmMailboxKind_t)copy.kind, (char)axis, value, mb->hook);
+        } else if (copy.kind == Mailbox_Speed) {
+            MoveMotorConstantRotation(mb->pp, (char)axis, value);
+        } else {
+            MoveMotorToAbsolutePosition32(mb->pp, (char)axis, value);
+        }
+        DmmHistogram_Record(&mb->age, DmmNow() - copy.writtenAt);
+        sent++;
+        mb->nextAxis = (axis + 1) % axes;
+    }
+    return sent;
+}
+
+unsigned long DmmMailbox_Age(DmmMailbox_t *mb, DmmHistogram_t *age) {
+    *age = mb->age;
+    return age->count;
+}
+
+void DmmMailbox_PrintAge(DmmMailbox_t *mb, FILE *out) {
+    DmmHistogram_t age;
+    unsigned long n = DmmMailbox_Age(mb, &age);
+    fprintf(out, "mailbox %s: %lu sent, %lu skipped, %lu torn reads retried, %lu malformed\n", mb->name, n, mb->skipped, mb->retries, mb->malformed);
+    fprintf(out, "write to serial write: mean %.1f us, max %lld us\n", DmmHistogram_Mean(&age), age.maxUs);
+    DmmHistogram_Print(&age, out);
+}
+
+#endif
@@ -0,0 +1,80 @@
+//
+//  DmmMailbox.h
+//  dmmsend
+//
+//  Setpoints from other processes on the same machine through shared memory.
+//  The segment (POSIX shm, "/name") holds one slot per axis guarded by a
+//  sequence lock: a writer makes the sequence odd, stores, makes it even again.
+//  Nothing on the writer's side is a syscall or a copy beyond the slot itself.
+//  The link owner calls DmmMailbox_Poll at each transmit opportunity and sends
+//  the slots whose generation moved since it last looked.
+//
+//  Writers are anything that maps the segment: a C program using
+//  DmmMailbox_Open / DmmMailbox_Write below, or another language following the
+//  layout of DmmMailboxShared_t (64 byte slots, native byte order).
+//
+//  Not in Windows builds: there DmmMailbox_Open fails and the rest does nothing.
+//
+
+#ifndef dmmsend_DmmMailbox_h
+#define dmmsend_DmmMailbox_h
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+#include "DmmHistogram.h"
+
+#define DMM_MAILBOX_MAGIC 0x444d4d42 // "DMMB"
+#define DMM_MAILBOX_VERSION 1
+
+typedef enum { Mailbox_Speed = 0, Mailbox_Position } DmmMailboxKind_t;
+
+typedef struct DmmMailboxSlot {
+    uint32_t seq;           // Odd while a writer is in the slot
+    uint32_t kind;          // DmmMailboxKind_t
+    int64_t value;
+    int64_t writtenAt;      // Writer's DmmNow, the same monotonic clock across processes
+    uint64_t generation;    // Bumped by every write
+    uint8_t reserved[32];
+} DmmMailboxSlot_t;
+
+typedef struct DmmMailboxShared {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t axes;
+    uint32_t slotSize;
+    uint8_t reserved[48];
+    DmmMailboxSlot_t slot[DMM_MAX_AXES];
+} DmmMailboxShared_t;
+
+typedef struct DmmMailbox {
+    DmmProtocolState_t *pp;     // NULL for a writer
+    DmmMailboxShared_t *shared;
+    char name[64];
+    Boolean owner;              // Created the segment, unlinks it on close
+    int axes;                   // The header's, clamped once at open: the header is anyone's to write
+    uint64_t seen[DMM_MAX_AXES]; // Generation last sent
+    int nextAxis;               // Round robin start, so a busy axis can't starve the rest
+    // Counters
+    unsigned long skipped;      // Generations overwritten before a transmit opportunity
+    unsigned long retries;      // Reads that raced a writer
+    unsigned long malformed;    // Slots of an unknown kind, dropped, or past 28 bits, clamped
+    DmmHistogram_t age;         // Write to serial write, one per slot sent
+    void (*DispatchPtr)(DmmMailboxKind_t kind, char axis, long value, void *hook); // Sends the package itself when NULL
+    void *hook;
+} DmmMailbox_t;
+
+// create: make (or reset) the segment for axes axes, else map an existing one
+Boolean DmmMailbox_Open(DmmMailbox_t *mb, DmmProtocolState_t *pp, const char *name, Boolean create, int axes);
+void DmmMailbox_Close(DmmMailbox_t *mb);
+// Writer side
+void DmmMailbox_Write(DmmMailbox_t *mb, char axis, DmmMailboxKind_t kind, long value);
+// Link side: send up to maxCommands changed slots (all if <= 0), returns how many were sent
+int DmmMailbox_Poll(DmmMailbox_t *mb, int maxCommands);
+// Copies the age histogram out, returns the number of slots sent
+unsigned long DmmMailbox_Age(DmmMailbox_t *mb, DmmHistogram_t *age);
+void DmmMailbox_PrintAge(DmmMailbox_t *mb, FILE *out);
+
+#endif
@@ -0,0 +1,213 @@
+//
+//  DmmPacer.c
+//  dmmsend
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "DmmPacer.h"
+
+static Boolean before(const DmmPacerItem_t *a, const DmmPacerItem_t *b) {
+    return a->due < b->due || (a->due == b->due && a->seq < b->seq);
+}
+
+static void heapPush(DmmPacer_t *p, const DmmPacerItem_t *item) {
+    int i = p->count++;
+    p->heap[i] = *item;
+    while (i > 0 && before(&p->heap[i], &p->heap[(i - 1) / 2])) {
+        DmmPacerItem_t t = p->heap[i];
+        p->heap[i] = p->heap[(i - 1) / 2];
+        p->heap[(i - 1) / 2] = t;
+        i = (i - 1) / 2;
+    }
+}
+
+static DmmPacerItem_t heapPop(DmmPacer_t *p) {
+    DmmPacerItem_t top = p->heap[0];
+    p->heap[0] = p->heap[--p->count];
+    int i = 0;
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < p->count && before(&p->heap[l], &p->heap[m])) {
+            m = l;
+        }
+        if (r < p->count && before(&p->heap[r], &p->heap[m])) {
+            m = r;
+        }
+        if (m == i) {
+            break;
+        }
+        DmmPacerItem_t t = p->heap[i];
+        p->heap[i] = p->heap[m];
+        p->heap[m] = t;
+        i = m;
+    }
+    return top;
+}
+
+// Absolute deadline on the same clock as DmmNow
+static void sleepUntil(DmmTime_t deadline) {
+#if defined(__linux__)
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000;
+    ts.tv_nsec = (deadline % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+#else
+    DmmTime_t now;
+    while ((now = DmmNow()) < deadline) {
+        usleep((useconds_t)(deadline - now));
+    }
+#endif
+}
+
+static void condWaitUntil(DmmPacer_t *p, DmmTime_t deadline) {
+#if defined(__linux__)
+    struct timespec ts; // The condition uses CLOCK_MONOTONIC, see DmmPacer_Start
+    ts.tv_sec = deadline / 1000000;
+    ts.tv_nsec = (deadline % 1000000) * 1000;
+    pthread_cond_timedwait(&p->cond, &p->lock, &ts);
+#else
+    DmmTime_t wait = deadline - DmmNow();
+    struct timespec ts;
+    if (wait <= 0) {
+        return;
+    }
+    ts.tv_sec = wait / 1000000;
+    ts.tv_nsec = (wait % 1000000) * 1000;
+    pthread_cond_timedwait_relative_np(&p->cond, &p->lock, &ts);
+#endif
+}
+
+static void *pacerThread(void *arg) {
+    DmmPacer_t *p = (DmmPacer_t*)arg;
+    pthread_mutex_lock(&p->lock);
+    while (p->running || p->count > 0) {
+        if (p->count == 0) {
+            pthread_cond_wait(&p->cond, &p->lock);
+            continue;
+        }
+        DmmTime_t due = p->heap[0].due;
+        if (due < p->linkFreeAt) {
+            due = p->linkFreeAt; // Never faster than the line
+        }
+        DmmTime_t now = DmmNow();
+        if (due - now > p->spinUs && p->running) {
+            // Wakeable, so an earlier submission can jump in
+            condWaitUntil(p, due - p->spinUs);
+            continue;
+        }
+        DmmPacerItem_t item = heapPop(p);
+        pthread_mutex_unlock(&p->lock);
+
+        sleepUntil(due);
+        DmmTime_t released = DmmNow();
+        pthread_mutex_lock(&p->stateLock);
+        Send_Package(p->pp, item.func, item.axis, item.value);
+        pthread_mutex_unlock(&p->stateLock);
+
+        pthread_mutex_lock(&p->lock);
+        DmmHistogram_Record(&p->late, released - due);
+        p->linkFreeAt = released + DMM_BYTES_TIME_US(Package_Length_For(item.value));
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+Boolean DmmPacer_Start(DmmPacer_t *p, DmmProtocolState_t *pp) {
+    memset(p, 0, sizeof(*p));
+    p->pp = pp;
+    p->spinUs = 1000;
+    p->running = true;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_mutex_init(&p->stateLock, NULL);
+#if defined(__linux__)
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&p->cond, &attr);
+    pthread_condattr_destroy(&attr);
+#else
+    pthread_cond_init(&p->cond, NULL);
+#endif
+    if (pthread_create(&p->thread, NULL, pacerThread, p) != 0) {
+        post("DmmPacer: can't start thread\n");
+        p->running = false;
+        return false;
+    }
+    return true;
+}
+
+void DmmPacer_Stop(DmmPacer_t *p, Boolean drain) {
+    pthread_mutex_lock(&p->lock);
+    p->running = false;
+    if (!drain) {
+        p->count = 0;
+    }
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+    p->stopped = true;
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->lock);
+    pthread_mutex_destroy(&p->stateLock);
+}
+
+Boolean DmmPacer_Submit(DmmPacer_t *p, DmmTime_t due, unsigned char func, char axis, long value) {
+    DmmPacerItem_t item;
+    Boolean ok = false;
+    item.due = due;
+    item.func = func;
+    item.axis = axis;
+    item.value = value;
+    pthread_mutex_lock(&p->lock);
+    if (p->count < DMM_PACER_QUEUE) {
+        item.seq = p->seq++;
+        Boolean newHead = p->count == 0 || before(&item, &p->heap[0]);
+        heapPush(p, &item);
+        if (newHead) {
+            pthread_cond_signal(&p->cond);
+        }
+        ok = true;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return ok;
+}
+
+int DmmPacer_Pending(DmmPacer_t *p) {
+    pthread_mutex_lock(&p->lock);
+    int n = p->count;
+    pthread_mutex_unlock(&p->lock);
+    return n;
+}
+
+void DmmPacer_LockState(DmmPacer_t *p) {
+    pthread_mutex_lock(&p->stateLock);
+}
+
+void DmmPacer_UnlockState(DmmPacer_t *p) {
+    pthread_mutex_unlock(&p->stateLock);
+}
+
+unsigned long DmmPacer_Histogram(DmmPacer_t *p, DmmHistogram_t *late) {
+    if (!p->stopped) {
+        pthread_mutex_lock(&p->lock);
+    }
+    *late = p->late;
+    unsigned long n = late->count;
+    if (!p->stopped) {
+        pthread_mutex_unlock(&p->lock);
+    }
+    return n;
+}
+
+void DmmPacer_PrintHistogram(DmmPacer_t *p, FILE *out) {
+    DmmHistogram_t late;
+    unsigned long n = DmmPacer_Histogram(p, &late);
+    fprintf(out, "send jitter: %lu packages, mean %.1f us, max %lld us\n", n, DmmHistogram_Mean(&late), late.maxUs);
+    DmmHistogram_Print(&late, out);
+}
@@ -0,0 +1,66 @@
+//
+//  DmmPacer.h
+//  dmmsend
+//
+//  Paced transmit. Packages are queued with the time they should go out and a
+//  dedicated thread releases each one on an absolute deadline sleep
+//  (clock_nanosleep on Linux), never faster than the line can carry them.
+//  How late every release was is kept as a histogram.
+//
+//  While a pacer runs it is the only writer: everything else sends through
+//  DmmPacer_Submit, and SerialWritePtr is called from the pacer thread.
+//  Sending updates the protocol state's reply timing, so anything else that
+//  touches it, ReadPackage above all, goes between DmmPacer_LockState and
+//  DmmPacer_UnlockState.
+//
+
+#ifndef dmmsend_DmmPacer_h
+#define dmmsend_DmmPacer_h
+
+#include <pthread.h>
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+#include "DmmHistogram.h"
+
+#define DMM_PACER_QUEUE 1024
+
+typedef struct DmmPacerItem {
+    DmmTime_t due;
+    unsigned long seq;      // Keeps submission order among equal deadlines
+    unsigned char func;
+    char axis;
+    long value;
+} DmmPacerItem_t;
+
+typedef struct DmmPacer {
+    DmmProtocolState_t *pp;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_mutex_t stateLock;  // Held around Send_Package, guards pp
+    Boolean running;
+    Boolean stopped;        // Thread joined and locks gone, see DmmPacer_Stop
+    DmmPacerItem_t heap[DMM_PACER_QUEUE]; // Min-heap on (due, seq)
+    int count;
+    unsigned long seq;
+    DmmTime_t linkFreeAt;   // When the last released package is off the wire
+    DmmTime_t spinUs;       // Wake this early on the condition variable, then sleep to the deadline
+    // Jitter, release time - max(due, link free)
+    DmmHistogram_t late;    // Release behind its deadline
+} DmmPacer_t;
+
+Boolean DmmPacer_Start(DmmPacer_t *p, DmmProtocolState_t *pp);
+// Releases what's queued first when drain is set
+void DmmPacer_Stop(DmmPacer_t *p, Boolean drain);
+// False when the queue is full
+Boolean DmmPacer_Submit(DmmPacer_t *p, DmmTime_t due, unsigned char func, char axis, long value);
+int DmmPacer_Pending(DmmPacer_t *p);
+// Around any other use of pp while the pacer runs
+void DmmPacer_LockState(DmmPacer_t *p);
+void DmmPacer_UnlockState(DmmPacer_t *p);
+// Copies the histogram out under the lock (none needed once stopped), returns the number of releases
+unsigned long DmmPacer_Histogram(DmmPacer_t *p, DmmHistogram_t *late);
+void DmmPacer_PrintHistogram(DmmPacer_t *p, FILE *out);
+
+#endif
@@ -0,0 +1,58 @@
+//
+//  DmmProtocol.h
+//  dmmsend
+//
+//  Function codes of the DMM Dyn2 RS232 protocol.
+//  http://dmm-tech.com/Dyn2_v2.html
+//
+
+#ifndef dmmsend_DmmProtocol_h
+#define dmmsend_DmmProtocol_h
+
+#define Go_Absolute_Pos 0x01
+#define Go_Relative_Pos 0x03
+#define Turn_ConstSpeed 0x0a
+#define Set_Origin 0x00
+#define Set_HighSpeed 0x14
+#define Set_HighAccel 0x15
+#define Set_MainGain  0x10
+#define Set_SpeedGain 0x11
+#define Set_IntGain  0x12
+
+
+#define Set_Drive_Config 0x07
+#define Config_Bit_MOTOR_DRIVE 0x10 // HIGH: Motor Drive Enabled, LOW: Motor Drive Free
+
+#define General_Read 0x0e
+
+#define Is_AbsPos32 0x1b
+#define Is_TrqCurrent 0x1e
+#define Is_MainGain 0x10
+#define Is_SpeedGain 0x11
+#define Is_IntGain 0x12
+#define Is_Status 0x19
+#define Is_Config 0x1a
+#define Is_PosOn_Range 0x17
+#define Is_GearNumber 0x18
+#define Is_TrqCons 0x13
+#define Is_HighSpeed 0x14
+#define Is_HighAccel 0x15
+#define Is_Drive_ID 0x16
+
+// Is_Status value
+#define Status_Bit_InPosition 0x01
+#define Status_Bit_Free 0x02
+#define Status_Bits_Alarm 0x1c
+#define Status_Bit_Busy 0x20
+#define Status_Bit_CncZero 0x40
+
+#define Read_MainGain 0x18
+#define Read_SpeedGain 0x19
+#define Read_IntGain 0x1a // Function codes are 5 bits, 0x20 went out as Set_Origin
+#define Read_DriveConfig 0x08
+#define Read_Drive_Status 0x09
+#define Read_Pos_OnRange 0x1e
+#define Read_GearNumber 0x1f
+#define Read_Drive_ID 0x06
+
+#endif
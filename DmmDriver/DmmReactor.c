@@ -0,0 +1,230 @@
+//
+//  DmmReactor.c
+//  dmmsend
+//
+
+#if defined(__linux__)
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "DmmReactor.h"
+
+#define TX_MASK (DMM_REACTOR_TX_RING - 1)
+#define REACTOR_MAX_READY 64
+
+static void flushEvents(DmmReactor_t *r) {
+    if (r->eventCount > 0 && r->ReportEventsPtr) {
+        r->ReportEventsPtr(r->events, r->eventCount, r->hook);
+    }
+    r->delivered += r->eventCount;
+    r->eventCount = 0;
+}
+
+static void PortReportReply(char axis, unsigned char code, long value, void *hook) {
+    DmmReactorPort_t *port = (DmmReactorPort_t*)hook;
+    DmmReactor_t *r = port->reactor;
+    if (r->eventCount == DMM_REACTOR_BATCH) {
+        flushEvents(r);
+    }
+    DmmReactorEvent_t *e = &r->events[r->eventCount++];
+    e->port = port->index;
+    e->axis = axis;
+    e->code = code;
+    e->value = value;
+    e->decodedAt = DmmNow();
+}
+
+static void PortReportPosition(long pos, void *hook) {
+    // Positions arrive through PortReportReply with every other reply
+}
+
+static void armWrite(DmmReactorPort_t *port, Boolean want) {
+    if (port->wantWrite == want || !port->open) {
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+    ev.data.ptr = port;
+    epoll_ctl(port->reactor->epfd, EPOLL_CTL_MOD, port->fd, &ev);
+    port->wantWrite = want;
+}
+
+static void portError(DmmReactorPort_t *port, int err) {
+    DmmReactor_t *r = port->reactor;
+    if (r->ReportPortErrorPtr) {
+        r->ReportPortErrorPtr(port->index, err, r->hook);
+    }
+    DmmReactor_RemovePort(r, port->index);
+}
+
+// Writes as much of the ring as the tty takes, EPOLLOUT only while something's left
+static void drainTx(DmmReactorPort_t *port) {
+    while (port->open && port->txHead != port->txTail) {
+        unsigned int start = port->txTail & TX_MASK;
+        unsigned int len = port->txHead - port->txTail;
+        if (start + len > DMM_REACTOR_TX_RING) {
+            len = DMM_REACTOR_TX_RING - start; // Up to the wrap, the rest next time round
+        }
+        ssize_t n = write(port->fd, port->tx + start, len);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                break;
+            }
+            portError(port, errno);
+            return;
+        }
+        port->txTail += (unsigned int)n;
+        port->txBytes += (unsigned long)n;
+    }
+    armWrite(port, port->txHead != port->txTail);
+}
+
+static void PortWriteBuffer(const unsigned char *bytes, int length, void *hook) {
+    DmmReactorPort_t *port = (DmmReactorPort_t*)hook;
+    if ((unsigned int)length > DMM_REACTOR_TX_RING - (port->txHead - port->txTail)) {
+        port->txDropped += (unsigned long)length; // Whole packages or nothing
+        return;
+    }
+    for (int i = 0; i < length; i++) {
+        port->tx[(port->txHead + i) & TX_MASK] = bytes[i];
+    }
+    port->txHead += (unsigned int)length;
+    armWrite(port, true);
+}
+
+static void PortWrite(char c, void *hook) {
+    unsigned char b = (unsigned char)c;
+    PortWriteBuffer(&b, 1, hook);
+}
+
+static void readPort(DmmReactorPort_t *port) {
+    unsigned char buf[256];
+    for (;;) {
+        ssize_t n = read(port->fd, buf, sizeof(buf));
+        if (n > 0) {
+            port->rxBytes += (unsigned long)n;
+            for (ssize_t i = 0; i < n; i++) {
+                ReadPackage(&port->state, buf[i]);
+            }
+            if (n < (ssize_t)sizeof(buf)) {
+                return;
+            }
+        } else if (n == 0) {
+            portError(port, EPIPE);
+            return;
+        } else {
+            if (errno != EAGAIN && errno != EINTR) {
+                portError(port, errno);
+            }
+            return;
+        }
+    }
+}
+
+Boolean DmmReactor_Init(DmmReactor_t *r, int maxPorts) {
+    memset(r, 0, sizeof(*r));
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epfd < 0) {
+        return false;
+    }
+    r->ports = calloc((size_t)maxPorts, sizeof(DmmReactorPort_t));
+    if (r->ports == NULL) {
+        close(r->epfd);
+        return false;
+    }
+    r->portCapacity = maxPorts;
+    return true;
+}
+
+void DmmReactor_Close(DmmReactor_t *r) {
+    for (int i = 0; i < r->portCount; i++) {
+        DmmReactor_RemovePort(r, i);
+    }
+    free(r->ports);
+    close(r->epfd);
+}
+
+int DmmReactor_AddPort(DmmReactor_t *r, int fd) {
+    int i;
+    for (i = 0; i < r->portCount; i++) { // Reuse a removed slot
+        if (!r->ports[i].open) {
+            break;
+        }
+    }
+    if (i == r->portCapacity) {
+        close(fd);
+        errno = ENOSPC;
+        return -1;
+    }
+    DmmReactorPort_t *port = &r->ports[i];
+    memset(port, 0, sizeof(*port));
+    port->reactor = r;
+    port->index = i;
+    port->fd = fd;
+    port->state.SerialWritePtr = &PortWrite;
+    port->state.SerialWriteBufferPtr = &PortWriteBuffer;
+    port->state.ReportPositionPtr = &PortReportPosition;
+    port->state.ReportReplyPtr = &PortReportReply;
+    port->state.hook = port;
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = port;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    port->open = true;
+    if (i == r->portCount) {
+        r->portCount++;
+    }
+    return i;
+}
+
+void DmmReactor_RemovePort(DmmReactor_t *r, int i) {
+    DmmReactorPort_t *port = &r->ports[i];
+    if (!port->open) {
+        return;
+    }
+    epoll_ctl(r->epfd, EPOLL_CTL_DEL, port->fd, NULL);
+    close(port->fd);
+    port->open = false;
+}
+
+DmmProtocolState_t *DmmReactor_State(DmmReactor_t *r, int port) {
+    return &r->ports[port].state;
+}
+
+unsigned int DmmReactor_TxQueued(DmmReactor_t *r, int port) {
+    return r->ports[port].txHead - r->ports[port].txTail;
+}
+
+int DmmReactor_Run(DmmReactor_t *r, int timeoutMs) {
+    struct epoll_event ready[REACTOR_MAX_READY];
+    r->delivered = 0;
+    int n = epoll_wait(r->epfd, ready, REACTOR_MAX_READY, timeoutMs);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < n; i++) {
+        DmmReactorPort_t *port = (DmmReactorPort_t*)ready[i].data.ptr;
+        if (ready[i].events & EPOLLIN) {
+            readPort(port);
+        }
+        if (port->open && (ready[i].events & EPOLLOUT)) {
+            drainTx(port);
+        }
+        if (port->open && (ready[i].events & (EPOLLERR | EPOLLHUP)) && !(ready[i].events & EPOLLIN)) {
+            portError(port, EPIPE);
+        }
+    }
+    flushEvents(r);
+    return r->delivered;
+}
+
+#endif
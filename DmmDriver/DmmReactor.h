@@ -0,0 +1,70 @@
+//
+//  DmmReactor.h
+//  dmmsend
+//
+//  One thread, many serial ports (Linux). Every port has its own
+//  DmmProtocolState_t, so its own decoder and encoder, and a transmit ring;
+//  a single epoll loop reads whatever arrives, drains the rings as the ttys
+//  take bytes, and hands the replies decoded during an iteration to the
+//  consumer in one batch.
+//
+//  Send to a port with the usual driver calls on DmmReactor_State(r, port);
+//  the bytes are queued and go out from DmmReactor_Run.
+//
+
+#ifndef dmmsend_DmmReactor_h
+#define dmmsend_DmmReactor_h
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+
+#define DMM_REACTOR_TX_RING 1024 // Bytes per port, a power of 2
+#define DMM_REACTOR_BATCH 1024   // Events handed over per callback at most
+
+typedef struct DmmReactorEvent {
+    int port;
+    char axis;
+    unsigned char code;
+    long value;
+    DmmTime_t decodedAt;
+} DmmReactorEvent_t;
+
+struct DmmReactor;
+
+typedef struct DmmReactorPort {
+    struct DmmReactor *reactor;
+    int index;
+    int fd;
+    Boolean open;
+    Boolean wantWrite;          // EPOLLOUT armed
+    DmmProtocolState_t state;
+    unsigned char tx[DMM_REACTOR_TX_RING];
+    unsigned int txHead, txTail; // Free running, masked on access
+    unsigned long txDropped;     // Bytes that didn't fit in the ring
+    unsigned long rxBytes, txBytes;
+} DmmReactorPort_t;
+
+typedef struct DmmReactor {
+    int epfd;
+    DmmReactorPort_t *ports;
+    int portCount, portCapacity;
+    DmmReactorEvent_t events[DMM_REACTOR_BATCH];
+    int eventCount;
+    int delivered;              // This DmmReactor_Run
+    void (*ReportEventsPtr)(const DmmReactorEvent_t *events, int count, void *hook);
+    void (*ReportPortErrorPtr)(int port, int err, void *hook); // Optional, the port is closed after
+    void *hook;
+} DmmReactor_t;
+
+Boolean DmmReactor_Init(DmmReactor_t *r, int maxPorts);
+void DmmReactor_Close(DmmReactor_t *r);
+// Takes ownership of a non-blocking fd, closing it on failure too; returns the port index or -1 with errno set
+int DmmReactor_AddPort(DmmReactor_t *r, int fd);
+void DmmReactor_RemovePort(DmmReactor_t *r, int port);
+DmmProtocolState_t *DmmReactor_State(DmmReactor_t *r, int port);
+unsigned int DmmReactor_TxQueued(DmmReactor_t *r, int port);
+// One pass: wait up to timeoutMs for I/O, service every ready port, deliver the batch.
+// Returns the number of events delivered, -1 on error.
+int DmmReactor_Run(DmmReactor_t *r, int timeoutMs);
+
+#endif
@@ -0,0 +1,116 @@
+//
+//  DmmRelative.c
+//  dmmsend
+//
+
+#include <string.h>
+
+#include "DmmRelative.h"
+#include "DmmProtocol.h"
+
+// A reply failed its check: the line is noisy, so a step may have gone too
+static void checkLine(DmmRelative_t *r) {
+    if (r->pp->CrcErrors != r->crcErrors) {
+        r->crcErrors = r->pp->CrcErrors;
+        for (int i = 0; i < DMM_MAX_AXES; i++) {
+            DmmRelative_Resync(r, (char)i);
+        }
+    }
+}
+
+static Boolean stepFrom(DmmRelative_t *r, int i, long *target) {
+    DmmRelativeAxis_t *a = &r->axis[i];
+    checkLine(r);
+    if (!a->synced
+        || (r->resyncUs > 0 && DmmNow() - a->syncedAt >= r->resyncUs)
+        || (r->resyncSteps > 0 && a->steps >= r->resyncSteps)) {
+        return false;
+    }
+    *target = a->target;
+    return true;
+}
+
+// Go_Relative_Pos with the step, or 0 if the move should go absolute
+static unsigned char relativeLength(DmmRelative_t *r, int i, long pos, long *step) {
+    long target;
+    if (!stepFrom(r, i, &target)) {
+        return 0;
+    }
+    *step = pos - target;
+    unsigned char length = Package_Length_For(*step);
+    return length < Package_Length_For(pos) ? length : 0;
+}
+
+static void DmmRelative_OnCommand(DmmProtocolState_t *pp, char axisID, unsigned char func, long value, void *ctx) {
+    DmmRelative_t *r = (DmmRelative_t*)ctx;
+    DmmRelativeAxis_t *a = &r->axis[axisID & 0x7f];
+    switch (func) {
+        case Go_Absolute_Pos:
+            if (!a->synced || a->steps > 0) {
+                r->resyncs++;
+            }
+            a->synced = true;
+            a->target = value;
+            a->syncedAt = DmmNow();
+            a->steps = 0;
+            break;
+        case Go_Relative_Pos:
+            a->target += value;
+            a->steps++;
+            break;
+        case Turn_ConstSpeed:
+        case Set_Origin:
+            a->synced = false;
+            break;
+    }
+}
+
+static void DmmRelative_OnReply(DmmProtocolState_t *pp, char axisID, unsigned char code, long value, void *ctx) {
+    if (code == Is_Status && (value & Status_Bits_Alarm) != 0) {
+        DmmRelative_Resync((DmmRelative_t*)ctx, axisID);
+    }
+}
+
+void DmmRelative_Init(DmmRelative_t *r, DmmProtocolState_t *pp) {
+    memset(r, 0, sizeof(*r));
+    r->pp = pp;
+    r->resyncUs = 1000000;
+    r->resyncSteps = 100;
+    r->crcErrors = pp->CrcErrors;
+    AddReplyObserver(pp, &DmmRelative_OnReply, r);
+    AddCommandObserver(pp, &DmmRelative_OnCommand, r);
+}
+
+void DmmRelative_Close(DmmRelative_t *r) {
+    RemoveReplyObserver(r->pp, &DmmRelative_OnReply, r);
+    RemoveCommandObserver(r->pp, &DmmRelative_OnCommand, r);
+}
+
+Boolean DmmRelative_Target(DmmRelative_t *r, char axisID, long *target) {
+    return stepFrom(r, axisID & 0x7f, target);
+}
+
+unsigned char DmmRelative_Length(DmmRelative_t *r, char axisID, long pos) {
+    long step;
+    unsigned char length = relativeLength(r, axisID & 0x7f, pos, &step);
+    return length ? length : Package_Length_For(pos);
+}
+
+unsigned char DmmRelative_Move(DmmRelative_t *r, char axisID, long pos) {
+    int i = axisID & 0x7f;
+    long step;
+    unsigned char length = relativeLength(r, i, pos, &step);
+    if (length) {
+        Send_Package(r->pp, Go_Relative_Pos, (char)i, step);
+        r->relative++;
+        r->bytesSaved += Package_Length_For(pos) - length;
+        return length;
+    }
+    MoveMotorToAbsolutePosition32(r->pp, (char)i, pos);
+    r->absolute++;
+    return Package_Length_For(pos);
+}
+
+void DmmRelative_Resync(DmmRelative_t *r, char axisID) {
+    r->axis[axisID & 0x7f].synced = false;
+}
@@ -0,0 +1,53 @@
+//
+//  DmmRelative.h
+//  dmmsend
+//
+//  Position streaming in steps. Far from the origin every Go_Absolute_Pos
+//  takes the full 7 bytes, however little the axis moves; a Go_Relative_Pos
+//  of the step from the last target takes 4 or 5. The drive's target is kept
+//  per axis from every position package sent, whoever sent it, and a move
+//  goes as a step whenever that makes the package shorter.
+//
+//  A step lost on the line would leave the drive off by it for good, so an
+//  axis goes back to Go_Absolute_Pos once resyncUs has passed or resyncSteps
+//  steps have gone since the last one, after a drive alarm (including the
+//  drive's own CRC report), after any reply fails its check, and after
+//  Turn_ConstSpeed or Set_Origin. A move is also sent absolute whenever that
+//  is no longer than the step, which resyncs for nothing.
+//
+
+#ifndef dmmsend_DmmRelative_h
+#define dmmsend_DmmRelative_h
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+
+typedef struct DmmRelativeAxis {
+    Boolean synced;             // target is where the drive is headed
+    long target;                // counts
+    DmmTime_t syncedAt;         // Last Go_Absolute_Pos
+    int steps;                  // Go_Relative_Pos since
+} DmmRelativeAxis_t;
+
+typedef struct DmmRelative {
+    DmmProtocolState_t *pp;
+    DmmRelativeAxis_t axis[DMM_MAX_AXES];
+    DmmTime_t resyncUs;         // 0: no limit
+    int resyncSteps;            // 0: no limit
+    unsigned long crcErrors;    // pp->CrcErrors when last looked at
+    // Counts
+    unsigned long relative, absolute, resyncs, bytesSaved;
+} DmmRelative_t;
+
+void DmmRelative_Init(DmmRelative_t *r, DmmProtocolState_t *pp);
+void DmmRelative_Close(DmmRelative_t *r);
+// Where the axis is headed, if the next move may go as a step from there
+Boolean DmmRelative_Target(DmmRelative_t *r, char axis, long *target);
+// Package length DmmRelative_Move would send for pos
+unsigned char DmmRelative_Length(DmmRelative_t *r, char axis, long pos);
+// Sends pos as a step or absolute, whichever is shorter and allowed; returns the package length
+unsigned char DmmRelative_Move(DmmRelative_t *r, char axis, long pos);
+// The axis's next move goes absolute
+void DmmRelative_Resync(DmmRelative_t *r, char axis);
+
+#endif
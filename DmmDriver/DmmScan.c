@@ -0,0 +1,90 @@
+//
+//  DmmScan.c
+//  dmmsend
+//
+
+#include <string.h>
+
+#include "DmmScan.h"
+#include "DmmProtocol.h"
+
+#define SCAN_GUARD_US 300
+#define SCAN_PARAMS ((1 << Param_Status) | (1 << Param_Config) | (1 << Param_GearNumber) | (1 << Param_Position))
+
+static void DmmScan_OnReply(DmmProtocolState_t *pp, char axisID, unsigned char code, long value, void *ctx) {
+    DmmScan_t *scan = (DmmScan_t*)ctx;
+    if (!scan->running || scan->readingParams || code != Is_Drive_ID || axisID < 0) {
+        return;
+    }
+    if (!scan->found[(int)axisID]) {
+        scan->found[(int)axisID] = true;
+        scan->foundList[scan->foundCount++] = axisID;
+    }
+}
+
+static void DmmScan_OnSnapshot(const DmmAxisSnapshot_t *axes, int count, DmmTime_t elapsedUs, void *hook) {
+    DmmScan_t *scan = (DmmScan_t*)hook;
+    scan->running = false;
+    if (scan->ReportScanPtr) {
+        scan->ReportScanPtr(axes, count, DmmNow() - scan->started, scan->hook);
+    }
+}
+
+void DmmScan_Start(DmmScan_t *scan, int first, int last) {
+    scan->first = first < 0 ? 0 : first;
+    scan->last = last >= DMM_MAX_AXES ? DMM_MAX_AXES - 1 : last;
+    scan->next = scan->first;
+    scan->running = true;
+    scan->readingParams = false;
+    scan->foundCount = 0;
+    memset(scan->found, 0, sizeof(scan->found));
+    scan->started = scan->nextProbeAt = DmmNow();
+    DmmScan_Poll(scan);
+}
+
+Boolean DmmScan_Poll(DmmScan_t *scan) {
+    if (!scan->running) {
+        return false;
+    }
+    if (scan->readingParams) {
+        DmmDiscover_Poll(&scan->discover);
+        return scan->running;
+    }
+    DmmTime_t now = DmmNow();
+    // One probe per poll: a late poll must not bunch probes up, their answers would collide
+    if (scan->next <= scan->last && now >= scan->nextProbeAt) {
+        Send_Package(scan->pp, Read_Drive_ID, (char)scan->next, 0); // 0: Dummy Data
+        scan->next++;
+        scan->nextProbeAt = now + scan->probeSpacingUs;
+        scan->lastDeadline = now + scan->timeoutUs;
+    }
+    if (scan->next > scan->last && now >= scan->lastDeadline) {
+        if (scan->foundCount == 0) {
+            DmmScan_OnSnapshot(NULL, 0, 0, scan);
+        } else {
+            scan->readingParams = true;
+            DmmDiscover_Start(&scan->discover, scan->foundList, scan->foundCount);
+        }
+    }
+    return scan->running;
+}
+
+void DmmScan_Init(DmmScan_t *scan, DmmProtocolState_t *pp) {
+    memset(scan, 0, sizeof(*scan));
+    scan->pp = pp;
+    // Is_Drive_ID answers carry IDs up to 127, a 5 byte package at most
+    scan->probeSpacingUs = DMM_BYTES_TIME_US(Package_Length_For(DMM_MAX_AXES - 1)) + SCAN_GUARD_US;
+    scan->timeoutUs = 10000;
+    AddReplyObserver(pp, &DmmScan_OnReply, scan);
+    DmmDiscover_Init(&scan->discover, pp);
+    scan->discover.paramMask = SCAN_PARAMS;
+    scan->discover.maxRetries = 1;
+    scan->discover.replyMarginUs = scan->timeoutUs;
+    scan->discover.ReportSnapshotPtr = &DmmScan_OnSnapshot;
+    scan->discover.hook = scan;
+}
+
+void DmmScan_Close(DmmScan_t *scan) {
+    RemoveReplyObserver(scan->pp, &DmmScan_OnReply, scan);
+    DmmDiscover_Close(&scan->discover);
+}
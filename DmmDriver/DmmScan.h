@@ -0,0 +1,44 @@
+//
+//  DmmScan.h
+//  dmmsend
+//
+//  Bus enumeration. Read_Drive_ID goes to every ID in turn, spaced just far
+//  enough apart that two answers can't overlap on a shared reply line; each ID
+//  gets a short timeout. The drives that answer are then read with
+//  DmmDiscover for their basic parameters.
+//
+
+#ifndef dmmsend_DmmScan_h
+#define dmmsend_DmmScan_h
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+#include "DmmDiscover.h"
+
+typedef struct DmmScan {
+    DmmProtocolState_t *pp;
+    Boolean running;
+    Boolean readingParams;
+    int first, last;            // ID range probed, inclusive
+    int next;                   // Next ID to probe
+    DmmTime_t nextProbeAt;
+    DmmTime_t probeSpacingUs;   // Between probes, >= one Is_Drive_ID reply on the line
+    DmmTime_t timeoutUs;        // After the last probe, for the last answers
+    DmmTime_t lastDeadline;
+    DmmTime_t started;
+    Boolean found[DMM_MAX_AXES];
+    char foundList[DMM_MAX_AXES];
+    int foundCount;
+    DmmDiscover_t discover;     // Basic parameters of the drives found
+    // Called once with the drives that answered and their parameters
+    void (*ReportScanPtr)(const DmmAxisSnapshot_t *axes, int count, DmmTime_t elapsedUs, void *hook);
+    void *hook;
+} DmmScan_t;
+
+void DmmScan_Init(DmmScan_t *scan, DmmProtocolState_t *pp);
+void DmmScan_Close(DmmScan_t *scan);
+void DmmScan_Start(DmmScan_t *scan, int first, int last);
+// Sends due probes; call every millisecond or so while running. Returns running.
+Boolean DmmScan_Poll(DmmScan_t *scan);
+
+#endif
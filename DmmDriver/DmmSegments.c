@@ -0,0 +1,267 @@
+//
+//  DmmSegments.c
+//  dmmsend
+//
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "DmmSegments.h"
+#include "DmmProtocol.h"
+
+#ifndef MAX
+    #define MAX(a,b) ((a>b) ? a : b)
+#endif
+
+#define SEGMENTS_MIN_LEARN_US 2000 // Moves shorter than this say more about sampling than speed
+
+// Unscaled trapezoid (or triangle) time for d counts
+static double modelUs(DmmSegments_t *s, long d, int speed, int accel) {
+    double v = speed * s->speedUnit, a = accel * s->accelUnit, dist = labs(d);
+    if (v <= 0 || a <= 0) {
+        return 0;
+    }
+    double t = dist < v * v / a ? 2 * sqrt(dist / a) : dist / v + v / a;
+    return t * 1e6;
+}
+
+static void predict(DmmSegments_t *s, DmmSegmentsAxis_t *a) {
+    double us = modelUs(s, a->current.pos - a->start, a->current.speed, a->current.accel);
+    a->durationUs = (DmmTime_t)(us * s->scale);
+}
+
+// Bytes the next move needs on the line: changed limits, then the position
+static int dispatchBytes(DmmSegmentsAxis_t *a, const DmmSegment_t *g) {
+    int n = Package_Length_For(g->pos);
+    if (g->speed != a->speedSent) {
+        n += Package_Length_For(g->speed);
+    }
+    if (g->accel != a->accelSent) {
+        n += Package_Length_For(g->accel);
+    }
+    return n;
+}
+
+static void dispatch(DmmSegments_t *s, int i) {
+    DmmSegmentsAxis_t *a = &s->axis[i];
+    DmmSegment_t g = a->queue[a->head];
+    a->head = (a->head + 1) % DMM_SEGMENTS_QUEUE;
+    a->count--;
+    Boolean boundary = a->moving;
+    if (boundary) {
+        a->start = a->current.pos;
+        a->startKnown = true;
+    } else if (!a->startKnown) {
+        ReadMotorPosition32(s->pp, (char)i); // Answered with where it was before the move is in
+    }
+    DmmTime_t now = DmmNow();
+    if (g.speed != a->speedSent) {
+        SetMaxSpeed(s->pp, (char)i, g.speed);
+        a->speedSent = g.speed;
+    }
+    if (g.accel != a->accelSent) {
+        SetMaxAccel(s->pp, (char)i, g.accel);
+        a->accelSent = g.accel;
+    }
+    MoveMotorToAbsolutePosition32(s->pp, (char)i, g.pos);
+    DmmTime_t arrivesAt = MAX(s->pp->TxFreeAt, now);
+    if (boundary) {
+        DmmTime_t gap = a->idleAt ? MAX(0, arrivesAt - a->idleAt) : 0;
+        a->boundaries++;
+        if (a->idleAt) {
+            a->gapsSeen++;
+        }
+        a->totalGapUs += gap;
+        a->maxGapUs = MAX(a->maxGapUs, gap);
+        if (s->ReportGapPtr) {
+            s->ReportGapPtr((char)i, gap, a->count, s->hook);
+        }
+    }
+    a->current = g;
+    a->moving = true;
+    a->sentAt = now;
+    a->arrivesAt = arrivesAt;
+    a->idleAt = 0;
+    a->durationUs = 0;
+    a->segments++;
+    if (a->startKnown) {
+        predict(s, a);
+    }
+}
+
+static void finish(DmmSegments_t *s, int i, Boolean ok) {
+    DmmSegmentsAxis_t *a = &s->axis[i];
+    a->moving = false;
+    a->start = a->current.pos;
+    a->startKnown = ok;
+    if (s->ReportDonePtr) {
+        s->ReportDonePtr((char)i, ok, a->segments, a->totalGapUs, a->maxGapUs, s->hook);
+    }
+    a->segments = a->boundaries = a->gapsSeen = 0;
+    a->totalGapUs = a->maxGapUs = 0;
+}
+
+// Next move out if it's due: the current one ended, or would by the time it lands
+static void service(DmmSegments_t *s, int i) {
+    DmmSegmentsAxis_t *a = &s->axis[i];
+    if (a->count == 0) {
+        if (a->moving && a->idleAt) {
+            finish(s, i, true);
+        }
+        return;
+    }
+    if (!a->moving || a->idleAt) {
+        dispatch(s, i);
+        return;
+    }
+    if (a->durationUs > 0) {
+        DmmTime_t now = DmmNow();
+        DmmTime_t lands = MAX(now, s->pp->TxFreeAt) + DMM_BYTES_TIME_US(dispatchBytes(a, &a->queue[a->head]));
+        if (lands >= a->arrivesAt + a->durationUs - s->leadUs) {
+            dispatch(s, i);
+        }
+    }
+}
+
+static void fillWindow(DmmSegments_t *s, int i) {
+    DmmSegmentsAxis_t *a = &s->axis[i];
+    while (a->moving && a->inFlight < s->window) {
+        DmmTime_t now = DmmNow();
+        if (a->count > 0 && a->durationUs > 0) {
+            // A read now mustn't hold up the next move
+            DmmTime_t lands = MAX(now, s->pp->TxFreeAt) + DMM_BYTES_TIME_US(4 + dispatchBytes(a, &a->queue[a->head]));
+            if (lands >= a->arrivesAt + a->durationUs - s->leadUs) {
+                return;
+            }
+        }
+        a->readSentAt[a->inFlight++] = now;
+        Send_Package(s->pp, Read_Drive_Status, (char)i, 0); // 0: Dummy Data
+    }
+}
+
+static void popRead(DmmSegmentsAxis_t *a) {
+    if (a->inFlight > 0) {
+        a->inFlight--;
+        memmove(a->readSentAt, a->readSentAt + 1, a->inFlight * sizeof(DmmTime_t));
+    }
+}
+
+static void DmmSegments_OnReply(DmmProtocolState_t *pp, char axisID, unsigned char code, long value, void *ctx) {
+    DmmSegments_t *s = (DmmSegments_t*)ctx;
+    int i = axisID & 0x7f;
+    DmmSegmentsAxis_t *a = &s->axis[i];
+    if (!a->moving && a->count == 0) {
+        if (code == Is_Status) {
+            popRead(a); // Sent before the run ended, nothing goes out after it
+        }
+        return;
+    }
+    const DmmReplyTiming_t *t = &pp->Read_Timing;
+    if (code == Is_AbsPos32) {
+        if (a->moving && !a->startKnown && t->requestSentAt && t->requestSentAt <= a->sentAt) {
+            a->start = value;
+            a->startKnown = true;
+            predict(s, a);
+        }
+    } else if (code == Is_Status) {
+        popRead(a);
+        int alarm = (value & Status_Bits_Alarm) >> 2;
+        if (alarm >= 1 && alarm <= 3) { // Lost phase, over current, over heat; 4 is only a CRC report
+            MoveMotorConstantRotation(pp, (char)i, 0);
+            a->count = 0;
+            finish(s, i, false);
+            return;
+        }
+        // Only a read sent after the move can show it ended
+        if (a->moving && !a->idleAt && t->requestSentAt >= a->sentAt
+            && (value & Status_Bit_InPosition) && !(value & Status_Bit_Busy)) {
+            a->idleAt = MAX(t->sampledAt, a->arrivesAt);
+            double model = modelUs(s, a->current.pos - a->start, a->current.speed, a->current.accel);
+            if (a->startKnown && model >= SEGMENTS_MIN_LEARN_US) {
+                double ratio = (a->idleAt - a->arrivesAt) / model;
+                ratio = ratio < 0.25 ? 0.25 : ratio > 4 ? 4 : ratio;
+                s->scale += 0.25 * (ratio - s->scale);
+            }
+        }
+    } else {
+        return;
+    }
+    service(s, i);
+    fillWindow(s, i);
+}
+
+void DmmSegments_Init(DmmSegments_t *s, DmmProtocolState_t *pp) {
+    memset(s, 0, sizeof(*s));
+    s->pp = pp;
+    s->speedUnit = 2730;
+    s->accelUnit = 50000;
+    s->scale = 1;
+    s->leadUs = 0;
+    s->window = 2;
+    s->replyTimeoutUs = 20000;
+    for (int i = 0; i < DMM_MAX_AXES; i++) {
+        s->axis[i].speedSent = s->axis[i].accelSent = -1;
+    }
+    AddReplyObserver(pp, &DmmSegments_OnReply, s);
+}
+
+void DmmSegments_Close(DmmSegments_t *s) {
+    RemoveReplyObserver(s->pp, &DmmSegments_OnReply, s);
+}
+
+Boolean DmmSegments_Add(DmmSegments_t *s, char axisID, long pos, int speed, int accel) {
+    int i = axisID & 0x7f;
+    DmmSegmentsAxis_t *a = &s->axis[i];
+    if (a->count == DMM_SEGMENTS_QUEUE) {
+        return false;
+    }
+    a->queue[(a->head + a->count++) % DMM_SEGMENTS_QUEUE] = (DmmSegment_t){ pos, speed, accel };
+    if (!a->moving) {
+        a->speedSent = a->accelSent = -1; // Others may have set the limits since the last run
+        service(s, i);
+        fillWindow(s, i);
+    }
+    return true;
+}
+
+void DmmSegments_Clear(DmmSegments_t *s, char axisID) {
+    s->axis[axisID & 0x7f].count = 0;
+}
+
+void DmmSegments_Stop(DmmSegments_t *s, char axisID) {
+    DmmSegmentsAxis_t *a = &s->axis[axisID & 0x7f];
+    a->count = 0;
+    a->moving = false;
+    a->idleAt = 0;
+    a->startKnown = false;
+    a->segments = a->boundaries = a->gapsSeen = 0;
+    a->totalGapUs = a->maxGapUs = 0;
+}
+
+int DmmSegments_Queued(DmmSegments_t *s, char axisID) {
+    return s->axis[axisID & 0x7f].count;
+}
+
+Boolean DmmSegments_Poll(DmmSegments_t *s) {
+    Boolean active = false;
+    DmmTime_t now = DmmNow();
+    for (int i = 0; i < DMM_MAX_AXES; i++) {
+        DmmSegmentsAxis_t *a = &s->axis[i];
+        if (!a->moving && a->count == 0 && a->inFlight == 0) {
+            continue;
+        }
+        // Lost reads would stall the window for good
+        while (a->inFlight > 0 && now - a->readSentAt[0] > s->replyTimeoutUs) {
+            popRead(a);
+        }
+        service(s, i);
+        fillWindow(s, i);
+        active |= a->moving || a->count > 0;
+    }
+    return active;
+}
+
+Boolean DmmSegments_IsStatusReply(DmmSegments_t *s, char axisID, unsigned char code) {
+    return code == Is_Status && s->axis[axisID & 0x7f].inFlight > 0;
+}
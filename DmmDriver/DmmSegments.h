@@ -0,0 +1,85 @@
+//
+//  DmmSegments.h
+//  dmmsend
+//
+//  Queued absolute moves, each with its own max speed and acceleration, run
+//  back to back without the host waiting to see one finish before sending the
+//  next. Status reads are kept in flight on every moving axis. The time a move
+//  takes is predicted from a trapezoid profile, and the next move's packages
+//  are sent so their last byte lands as the current one ends; the prediction
+//  is scaled by what earlier moves actually took.
+//
+//  A move has ended when a status read sent after it shows in position and not
+//  busy. Where that shows before the next move is in, the time from that
+//  sample to the next move's arrival is the idle gap, reported per boundary;
+//  a gap shorter than the spacing of the status reads goes unseen and counts
+//  as 0. Sending a move early redirects the drive before it settles on the old
+//  target, so a lead that is too long cuts corners.
+//
+
+#ifndef dmmsend_DmmSegments_h
+#define dmmsend_DmmSegments_h
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+
+#define DMM_SEGMENTS_QUEUE 32 // Per axis
+#define DMM_SEGMENTS_MAX_IN_FLIGHT 4
+
+typedef struct DmmSegment {
+    long pos;
+    int speed;      // Set_HighSpeed units
+    int accel;      // Set_HighAccel units
+} DmmSegment_t;
+
+typedef struct DmmSegmentsAxis {
+    DmmSegment_t queue[DMM_SEGMENTS_QUEUE];
+    int head, count;
+    Boolean moving;             // A move is out and hasn't been seen to end
+    DmmSegment_t current;
+    DmmTime_t sentAt;           // Its packages handed to the serial write
+    DmmTime_t arrivesAt;        // Its last byte in at the drive, by the link model
+    DmmTime_t durationUs;       // Predicted, 0 until the start position is known
+    DmmTime_t idleAt;           // First sample showing it ended, 0 before
+    Boolean startKnown;
+    long start;                 // Where the current move started
+    int speedSent, accelSent;   // Limits the drive has, -1 if not known
+    DmmTime_t readSentAt[DMM_SEGMENTS_MAX_IN_FLIGHT]; // Oldest first
+    int inFlight;
+    // Since the queue last ran dry
+    unsigned long segments, boundaries, gapsSeen;
+    DmmTime_t totalGapUs, maxGapUs;
+} DmmSegmentsAxis_t;
+
+typedef struct DmmSegments {
+    DmmProtocolState_t *pp;
+    DmmSegmentsAxis_t axis[DMM_MAX_AXES];
+    double speedUnit;           // counts/s per Set_HighSpeed unit, a first guess
+    double accelUnit;           // counts/s^2 per Set_HighAccel unit, a first guess
+    double scale;               // Measured / predicted move time, learnt
+    DmmTime_t leadUs;           // Land the next move this much before the predicted end
+    int window;                 // Status reads kept in flight per moving axis
+    DmmTime_t replyTimeoutUs;   // A read not answered by then is written off
+    // At every boundary between moves, gapUs 0 if no idle was seen
+    void (*ReportGapPtr)(char axis, DmmTime_t gapUs, int remaining, void *hook);
+    // Queue ran dry and the last move ended, or an alarm stopped it (ok false)
+    void (*ReportDonePtr)(char axis, Boolean ok, unsigned long segments, DmmTime_t totalGapUs, DmmTime_t maxGapUs, void *hook);
+    void *hook;
+} DmmSegments_t;
+
+void DmmSegments_Init(DmmSegments_t *s, DmmProtocolState_t *pp);
+void DmmSegments_Close(DmmSegments_t *s);
+// Queues a move; the first one of an idle axis goes out straight away. False if the queue is full.
+Boolean DmmSegments_Add(DmmSegments_t *s, char axis, long pos, int speed, int accel);
+// Drops the queued moves; the one the drive is on runs to its end
+void DmmSegments_Clear(DmmSegments_t *s, char axis);
+// Drops the queue and lets go of the axis, for whoever takes it over: no more reads go out and
+// an alarm no longer stops it; the reads already out are still recognised as they are answered
+void DmmSegments_Stop(DmmSegments_t *s, char axis);
+int DmmSegments_Queued(DmmSegments_t *s, char axis);
+// Sends what is due and times out lost reads; call every millisecond or so while it returns true
+Boolean DmmSegments_Poll(DmmSegments_t *s);
+// From a reply hook, before the observers: the reply being decoded answers one of the queue's status reads
+Boolean DmmSegments_IsStatusReply(DmmSegments_t *s, char axis, unsigned char code);
+
+#endif
@@ -0,0 +1,297 @@
+//
+//  DmmSimDrive.c
+//  dmmsend
+//
+
+#include <string.h>
+#include <math.h>
+
+#include "DmmSimDrive.h"
+#include "DmmProtocol.h"
+
+#ifndef MIN
+    #define MIN(a,b) ((a<b) ? a : b)
+#endif
+
+#ifndef MAX
+    #define MAX(a,b) ((a>b) ? a : b)
+#endif
+
+// Servo gains per unit of the drive's gain parameters, against a unit inertia
+#define SIM_MAIN_GAIN 400.0     // 1/s^2
+#define SIM_SPEED_GAIN 4.5      // 1/s
+#define SIM_INT_GAIN 10000.0    // 1/s^3
+#define SIM_LOST_PHASE 8192     // |reference - motor| that trips alarm 1
+#define SIM_TORQUE_UNIT 100.0   // counts/s^2 per Is_TrqCurrent unit
+
+static void noPosition(long pos, void *hook) {
+}
+
+// The byte as it comes off the line
+static unsigned char line(DmmSimDrive_t *sim, unsigned char byte) {
+    if (sim->rng && sim->byteErrorRate > 0 && DmmSimDrive_Random(sim) < sim->byteErrorRate) {
+        sim->corrupted++;
+        return byte ^ (unsigned char)(1 << (int)(DmmSimDrive_Random(sim) * 8));
+    }
+    return byte;
+}
+
+static Boolean push(DmmSimByte_t *q, unsigned int head, unsigned int *count, unsigned char byte, DmmTime_t at) {
+    if (*count >= DMM_SIM_QUEUE) {
+        return false;
+    }
+    q[(head + (*count)++) & (DMM_SIM_QUEUE - 1)] = (DmmSimByte_t){ byte, at };
+    return true;
+}
+
+static int status(const DmmSimAxis_t *a) {
+    int s = a->alarm << 2;
+    Boolean settling = a->positioning || a->refVel != a->speedCommand;
+    if (!a->positioning && fabs(a->refPos - a->pos) <= a->posOnRange) {
+        s |= Status_Bit_InPosition;
+    }
+    if (settling) {
+        s |= Status_Bit_Busy;
+    }
+    if (a->pos >= a->cncZeroAt) {
+        s |= Status_Bit_CncZero;
+    }
+    return s;
+}
+
+static long readValue(DmmSimDrive_t *sim, int id, int code) {
+    DmmSimAxis_t *a = &sim->axis[id];
+    switch (code) {
+        case Is_AbsPos32: {
+            double noise = sim->rng && sim->positionNoise > 0 ? (2 * DmmSimDrive_Random(sim) - 1) * sim->positionNoise : 0;
+            return (long)floor(a->pos + noise + 0.5);
+        }
+        case Is_TrqCurrent: return MAX(-8191, MIN(8191, (long)(a->torque / SIM_TORQUE_UNIT)));
+        case Is_MainGain: return a->mainGain;
+        case Is_SpeedGain: return a->speedGain;
+        case Is_IntGain: return a->intGain;
+        case Is_Status: {
+            int s = status(a);
+            return s & 0x40 ? s - 0x80 : s; // One data byte, bit 6 is its sign
+        }
+        case Is_Config: return a->config;
+        case Is_PosOn_Range: return a->posOnRange;
+        case Is_GearNumber: return a->gearNumber;
+        case Is_TrqCons: return 1;
+        case Is_HighSpeed: return a->highSpeed;
+        case Is_HighAccel: return a->highAccel;
+        case Is_Drive_ID: return id;
+        default: return 0;
+    }
+}
+
+static void reply(DmmSimDrive_t *sim, int id, int code) {
+    unsigned char B[8];
+    int n = Encode_Package((unsigned char)code, (char)id, readValue(sim, id, code), B);
+    DmmTime_t turnaround = sim->turnaroundUs;
+    if (sim->rng && sim->turnaroundJitterUs > 0) {
+        turnaround += (DmmTime_t)(DmmSimDrive_Random(sim) * sim->turnaroundJitterUs);
+    }
+    DmmTime_t at = MAX(sim->now + turnaround, sim->rxFreeAt);
+    for (int i = 0; i < n; i++) {
+        at += DMM_BYTE_TIME_US;
+        if (!push(sim->toHost, sim->toHostHead, &sim->toHostCount, line(sim, B[i]), at)) {
+            sim->dropped++;
+        }
+    }
+    sim->rxFreeAt = at;
+}
+
+// A complete package from the host, decoded by rx
+static void onHostFrame(char axisID, unsigned char func, long value, void *hook) {
+    DmmSimDrive_t *sim = (DmmSimDrive_t*)hook;
+    int id = axisID & 0x7f;
+    DmmSimAxis_t *a = &sim->axis[id];
+    sim->frames++;
+    if (!a->present) {
+        return;
+    }
+    switch (func) {
+        case Go_Absolute_Pos:
+            a->target = value;
+            a->positioning = true;
+            break;
+        case Go_Relative_Pos: // From the target, or from the reference once there
+            a->target = (a->positioning ? a->target : (long)floor(a->refPos + 0.5)) + value;
+            a->positioning = true;
+            break;
+        case Turn_ConstSpeed:
+            a->positioning = false;
+            a->speedCommand = value * sim->speedUnit;
+            break;
+        case Set_Origin:
+            a->refPos -= a->pos;
+            a->target -= (long)a->pos;
+            a->cncZeroAt -= a->pos;
+            a->pos = 0;
+            break;
+        case Set_HighSpeed: a->highSpeed = value; break;
+        case Set_HighAccel: a->highAccel = value; break;
+        case Set_MainGain: a->mainGain = value; break;
+        case Set_SpeedGain: a->speedGain = value; break;
+        case Set_IntGain: a->intGain = value; break;
+        case Set_Drive_Config: a->config = value; break;
+        case General_Read: reply(sim, id, (int)(value & 0x1f)); break;
+        case Read_MainGain: reply(sim, id, Is_MainGain); break;
+        case Read_SpeedGain: reply(sim, id, Is_SpeedGain); break;
+        case Read_IntGain: reply(sim, id, Is_IntGain); break;
+        case Read_DriveConfig: reply(sim, id, Is_Config); break;
+        case Read_Drive_Status: reply(sim, id, Is_Status); break;
+        case Read_Pos_OnRange: reply(sim, id, Is_PosOn_Range); break;
+        case Read_GearNumber: reply(sim, id, Is_GearNumber); break;
+        case Read_Drive_ID: reply(sim, id, Is_Drive_ID); break;
+        default: break;
+    }
+}
+
+static void step(DmmSimDrive_t *sim, DmmSimAxis_t *a, double dt) {
+    double accel = a->highAccel * sim->highAccelUnit;
+    double want;
+    if (a->positioning) {
+        // Trapezoid: as fast as allowed, but never past what can still stop at the target
+        double d = a->target - a->refPos;
+        double vmax = a->highSpeed * sim->highSpeedUnit;
+        want = (d < 0 ? -1 : 1) * MIN(vmax, sqrt(2 * accel * fabs(d)));
+    } else {
+        want = a->speedCommand;
+    }
+    double dv = want - a->refVel;
+    a->refVel += MAX(-accel * dt, MIN(accel * dt, dv));
+    a->refPos += a->refVel * dt;
+    if (a->positioning && fabs(a->target - a->refPos) < 0.5 && fabs(a->refVel) <= accel * dt) {
+        a->refPos = a->target;
+        a->refVel = 0;
+        a->positioning = false;
+        a->speedCommand = 0;
+    }
+
+    double e = a->refPos - a->pos;
+    if (a->alarm == 0 && fabs(e) > SIM_LOST_PHASE) {
+        a->alarm = 1;
+    }
+    if (a->alarm == 1) {
+        a->torque = 0; // Shaft goes free
+    } else {
+        a->integral += e * dt;
+        a->torque = a->mainGain * SIM_MAIN_GAIN * e
+                  + a->speedGain * SIM_SPEED_GAIN * (a->refVel - a->vel)
+                  + a->intGain * SIM_INT_GAIN * a->integral;
+    }
+    double acc = a->torque;
+    if (a->vel != 0 || fabs(acc) > sim->friction) {
+        acc -= (a->vel > 0 || (a->vel == 0 && acc > 0) ? 1 : -1) * sim->friction;
+    }
+    double v = a->vel + acc * dt;
+    if (a->vel != 0 && (v > 0) != (a->vel > 0) && a->torque * a->vel <= 0) {
+        v = 0; // Friction stops it, it doesn't reverse it
+    }
+    a->vel = v;
+    a->pos += a->vel * dt;
+}
+
+static void stepTo(DmmSimDrive_t *sim, DmmTime_t t) {
+    while (sim->stepAt + DMM_SIM_STEP_US <= t) {
+        sim->stepAt += DMM_SIM_STEP_US;
+        for (int i = 0; i < sim->axisCount; i++) {
+            step(sim, &sim->axis[sim->present[i]], DMM_SIM_STEP_US / 1e6);
+        }
+    }
+}
+
+void DmmSimDrive_Init(DmmSimDrive_t *sim, DmmProtocolState_t *host) {
+    memset(sim, 0, sizeof(*sim));
+    sim->host = host;
+    sim->rx.ReportPositionPtr = &noPosition;
+    sim->rx.ReportReplyPtr = &onHostFrame;
+    sim->rx.hook = sim;
+    sim->speedUnit = 273;       // ~1 rpm on a 16384 count encoder
+    sim->highSpeedUnit = 2730;
+    sim->highAccelUnit = 50000;
+    sim->friction = 2000;
+    sim->turnaroundUs = 500;
+}
+
+void DmmSimDrive_AddAxis(DmmSimDrive_t *sim, char axis) {
+    DmmSimAxis_t *a = &sim->axis[axis & 0x7f];
+    if (!a->present) {
+        sim->present[sim->axisCount++] = axis & 0x7f;
+    }
+    memset(a, 0, sizeof(*a));
+    a->present = true;
+    a->mainGain = 40;
+    a->speedGain = 40;
+    a->intGain = 10;
+    a->highSpeed = 10;
+    a->highAccel = 4;
+    a->posOnRange = 10;
+    a->gearNumber = 4096;
+    a->cncZeroAt = HUGE_VAL;
+}
+
+void DmmSimDrive_Seed(DmmSimDrive_t *sim, unsigned long long seed) {
+    sim->rng = seed ? seed : 0x9e3779b97f4a7c15ULL; // xorshift state must not be 0
+}
+
+double DmmSimDrive_Random(DmmSimDrive_t *sim) {
+    unsigned long long x = sim->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    sim->rng = x;
+    return (double)((x * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+void DmmSimDrive_HostWrite(DmmSimDrive_t *sim, const unsigned char *bytes, int length) {
+    DmmTime_t at = MAX(sim->now, sim->txFreeAt);
+    for (int i = 0; i < length; i++) {
+        at += DMM_BYTE_TIME_US;
+        if (!push(sim->toDrive, sim->toDriveHead, &sim->toDriveCount, line(sim, bytes[i]), at)) {
+            sim->dropped++;
+        }
+    }
+    sim->txBytes += length;
+    sim->txFreeAt = at;
+}
+
+void DmmSimDrive_RunUntil(DmmSimDrive_t *sim, DmmTime_t until) {
+    for (;;) {
+        DmmSimByte_t *d = sim->toDriveCount ? &sim->toDrive[sim->toDriveHead] : NULL;
+        DmmSimByte_t *h = sim->toHostCount ? &sim->toHost[sim->toHostHead] : NULL;
+        DmmTime_t next = until;
+        if (d && d->at < next) {
+            next = d->at;
+        }
+        if (h && h->at < next) {
+            next = h->at;
+        }
+        stepTo(sim, next);
+        sim->now = MAX(sim->now, next);
+        if (d && d->at <= sim->now) {
+            unsigned char b = d->byte;
+            sim->toDriveHead = (sim->toDriveHead + 1) & (DMM_SIM_QUEUE - 1);
+            sim->toDriveCount--;
+            ReadPackage(&sim->rx, b);
+        } else if (h && h->at <= sim->now) {
+            unsigned char b = h->byte;
+            sim->toHostHead = (sim->toHostHead + 1) & (DMM_SIM_QUEUE - 1);
+            sim->toHostCount--;
+            sim->rxBytes++;
+            if (sim->DeliverPtr) {
+                sim->DeliverPtr(b, sim->hook); // May send too
+            } else {
+                ReadPackage(sim->host, b); // May send, which queues more for the drives
+            }
+        } else {
+            break;
+        }
+    }
+}
+
+DmmTime_t DmmSimDrive_Now(void *sim) {
+    return ((DmmSimDrive_t*)sim)->now;
+}
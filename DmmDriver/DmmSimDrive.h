@@ -0,0 +1,93 @@
+//
+//  DmmSimDrive.h
+//  dmmsend
+//
+//  A simulated bus of DMM drives, for running the driver without hardware.
+//  The host's writes go down a modelled 38400 baud line, each drive decodes
+//  them, follows its trajectory with a PI position / velocity servo driven by
+//  the main, speed and integration gains it was given, and answers after a
+//  turnaround on the shared reply line. Replies are fed to ReadPackage on the
+//  host state at the time their last byte arrives.
+//
+//  Everything runs on simulated time: DmmSimDrive_RunUntil advances it, and
+//  DmmSimDrive_Now can be made the thread's DmmNow so driver modules measure
+//  the same time the drives do.
+//
+//  Faults are off by default. Once DmmSimDrive_Seed is called, bytes on either
+//  line can arrive with a bit flipped, the turnaround can run long and position
+//  reads can carry encoder noise, all drawn from the seed, so a run is the same
+//  every time it is made with the same seed and the same host.
+//
+
+#ifndef dmmsend_DmmSimDrive_h
+#define dmmsend_DmmSimDrive_h
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+
+#define DMM_SIM_STEP_US 100     // Servo and trajectory update period
+#define DMM_SIM_QUEUE 1024      // Bytes in flight each way, a power of 2
+
+typedef struct DmmSimAxis {
+    Boolean present;
+    // As set over the link
+    long mainGain, speedGain, intGain;
+    long highSpeed, highAccel;
+    long config, gearNumber, posOnRange;
+    // Trajectory the servo follows
+    Boolean positioning;        // A position move isn't finished
+    long target;
+    double speedCommand;        // counts/s, from Turn_ConstSpeed
+    double refPos, refVel;
+    // Motor
+    double pos, vel, integral, torque;
+    int alarm;                  // Status bits 2-4
+    double cncZeroAt;           // CNC zero input reads HIGH at or beyond this position
+} DmmSimAxis_t;
+
+typedef struct DmmSimByte {
+    unsigned char byte;
+    DmmTime_t at;               // Last bit in
+} DmmSimByte_t;
+
+typedef struct DmmSimDrive {
+    DmmProtocolState_t *host;
+    DmmProtocolState_t rx;      // Decodes what the host sends
+    DmmSimAxis_t axis[DMM_MAX_AXES];
+    unsigned char present[DMM_MAX_AXES]; // IDs of the axes added, axisCount of them
+    int axisCount;
+    // Model
+    double speedUnit;           // counts/s per Turn_ConstSpeed unit
+    double highSpeedUnit;       // counts/s per Set_HighSpeed unit
+    double highAccelUnit;       // counts/s^2 per Set_HighAccel unit
+    double friction;            // Coulomb, counts/s^2
+    DmmTime_t turnaroundUs;     // Request in to first reply bit out
+    // Faults
+    unsigned long long rng;     // xorshift64* state, 0 until seeded
+    double byteErrorRate;       // Chance a byte has a bit flipped on the way, either line
+    DmmTime_t turnaroundJitterUs; // Turnaround up to this much longer, uniform
+    double positionNoise;       // Is_AbsPos32 off by up to this many counts, uniform
+    // Link and time
+    DmmTime_t now, stepAt;
+    DmmTime_t txFreeAt, rxFreeAt; // Host to drive line, drive to host line
+    DmmSimByte_t toDrive[DMM_SIM_QUEUE], toHost[DMM_SIM_QUEUE];
+    unsigned int toDriveHead, toDriveCount, toHostHead, toHostCount;
+    unsigned long txBytes, rxBytes, dropped, frames, corrupted;
+    // Bytes for the host go here instead of ReadPackage on host, if set
+    void (*DeliverPtr)(unsigned char byte, void *hook);
+    void *hook;
+} DmmSimDrive_t;
+
+void DmmSimDrive_Init(DmmSimDrive_t *sim, DmmProtocolState_t *host);
+void DmmSimDrive_AddAxis(DmmSimDrive_t *sim, char axis);
+// Faults are drawn from seed from now on
+void DmmSimDrive_Seed(DmmSimDrive_t *sim, unsigned long long seed);
+// Uniform in [0, 1) off the seed, for a harness that wants its own draws on the same sequence
+double DmmSimDrive_Random(DmmSimDrive_t *sim);
+// Give the host state's SerialWriteBufferPtr / SerialWritePtr to this
+void DmmSimDrive_HostWrite(DmmSimDrive_t *sim, const unsigned char *bytes, int length);
+// Delivers everything due up to until, in time order
+void DmmSimDrive_RunUntil(DmmSimDrive_t *sim, DmmTime_t until);
+DmmTime_t DmmSimDrive_Now(void *sim); // A DmmTimeSource_t
+
+#endif
@@ -0,0 +1,183 @@
+//
+//  DmmSpline.c
+//  dmmsend
+//
+
+#include <string.h>
+#include <stdint.h>
+
+#include "DmmSpline.h"
+#include "DmmProtocol.h"
+
+#define ONE 65536 // Q16 fixed point
+
+static DmmWaypoint_t *at(DmmSplineAxis_t *a, int i) {
+    return &a->wp[(a->head + i) % DMM_SPLINE_WAYPOINTS];
+}
+
+// Waypoints before the current segment's start are no longer needed, except the one
+// the start's tangent is taken from. Past the end only the last one stays, to hold.
+static void prune(DmmSplineAxis_t *a, DmmTime_t t) {
+    while (a->count >= 2 && at(a, a->count - 1)->t <= t) {
+        a->head = (a->head + 1) % DMM_SPLINE_WAYPOINTS;
+        a->count--;
+    }
+    while (a->count >= 3 && at(a, 2)->t <= t) {
+        a->head = (a->head + 1) % DMM_SPLINE_WAYPOINTS;
+        a->count--;
+    }
+}
+
+// Tangent at waypoint i times h, the length of the segment it is used on: counts
+static int64_t tangent(DmmSplineAxis_t *a, int i, int64_t h) {
+    if (i == 0 || i == a->count - 1) {
+        return 0; // Start from and come to rest at the ends
+    }
+    DmmWaypoint_t *prev = at(a, i - 1), *next = at(a, i + 1);
+    return ((int64_t)next->pos - prev->pos) * h / (next->t - prev->t);
+}
+
+static Boolean evaluate(DmmSplineAxis_t *a, DmmTime_t t, long *pos) {
+    if (a->count == 0 || t < at(a, 0)->t) {
+        return false;
+    }
+    if (t >= at(a, a->count - 1)->t) {
+        *pos = at(a, a->count - 1)->pos;
+        return true;
+    }
+    int k = 0;
+    while (at(a, k + 1)->t <= t) {
+        k++;
+    }
+    DmmWaypoint_t *p0 = at(a, k), *p1 = at(a, k + 1);
+    int64_t h = p1->t - p0->t;
+    int64_t s = ((int64_t)(t - p0->t) << 16) / h;
+    int64_t s2 = s * s >> 16;
+    int64_t s3 = s2 * s >> 16;
+    int64_t h00 = 2 * s3 - 3 * s2 + ONE;
+    int64_t h10 = s3 - 2 * s2 + s;
+    int64_t h01 = -2 * s3 + 3 * s2;
+    int64_t h11 = s3 - s2;
+    int64_t v = h00 * p0->pos + h10 * tangent(a, k, h) + h01 * p1->pos + h11 * tangent(a, k + 1, h);
+    *pos = (long)((v + ONE / 2) >> 16);
+    return true;
+}
+
+// The value within tolerance of v whose package is shortest
+static long shorten(long v, long tolerance) {
+    for (int bits = 6; bits < 27; bits += 7) { // 4, 5 and 6 byte packages carry 7, 14, 21 bits
+        long lo = -(1L << bits), hi = (1L << bits) - 1;
+        long c = v < lo ? lo : v > hi ? hi : v;
+        if (c - v <= tolerance && v - c <= tolerance) {
+            return c;
+        }
+    }
+    return v;
+}
+
+// The value to send for v and its package length, as a step where that is shorter
+static long package(DmmSpline_t *s, int i, long v, unsigned char *length) {
+    long whole = shorten(v, s->tolerance), target;
+    *length = Package_Length_For(whole);
+    if (s->relative && DmmRelative_Target(s->relative, (char)i, &target)) {
+        long step = shorten(v - target, s->tolerance);
+        if (Package_Length_For(step) < *length) {
+            *length = Package_Length_For(step);
+            return target + step;
+        }
+    }
+    return whole;
+}
+
+void DmmSpline_Init(DmmSpline_t *s, DmmProtocolState_t *pp) {
+    memset(s, 0, sizeof(*s));
+    s->pp = pp;
+    s->linkShare = 1;
+    s->tolerance = 0;
+}
+
+void DmmSpline_Close(DmmSpline_t *s) {
+    for (int i = 0; i < DMM_MAX_AXES; i++) {
+        s->axis[i].count = 0;
+    }
+}
+
+Boolean DmmSpline_Add(DmmSpline_t *s, char axisID, DmmTime_t t, long pos) {
+    DmmSplineAxis_t *a = &s->axis[axisID & 0x7f];
+    if (a->count == DMM_SPLINE_WAYPOINTS || (a->count > 0 && t <= at(a, a->count - 1)->t)) {
+        return false;
+    }
+    a->wp[(a->head + a->count) % DMM_SPLINE_WAYPOINTS] = (DmmWaypoint_t){ t, pos };
+    a->count++;
+    return true;
+}
+
+void DmmSpline_Clear(DmmSpline_t *s, char axisID) {
+    DmmSplineAxis_t *a = &s->axis[axisID & 0x7f];
+    a->count = 0;
+    a->sentAny = false;
+}
+
+int DmmSpline_Queued(DmmSpline_t *s, char axisID) {
+    return s->axis[axisID & 0x7f].count;
+}
+
+Boolean DmmSpline_Evaluate(DmmSpline_t *s, char axisID, DmmTime_t t, long *pos) {
+    return evaluate(&s->axis[axisID & 0x7f], t, pos);
+}
+
+Boolean DmmSpline_Poll(DmmSpline_t *s) {
+    DmmTime_t now = DmmNow();
+    Boolean busy = now < s->nextSendAt || s->pp->TxFreeAt > now;
+    Boolean moving = false;
+    for (int n = 0; n < DMM_MAX_AXES; n++) {
+        int i = (s->nextAxis + n) % DMM_MAX_AXES;
+        DmmSplineAxis_t *a = &s->axis[i];
+        if (a->count == 0) {
+            continue;
+        }
+        DmmWaypoint_t *last = at(a, a->count - 1);
+        if (a->sentAny && a->lastSent == last->pos && last->t <= now && !a->stepped) {
+            continue; // Holding at the last waypoint
+        }
+        moving = true;
+        long v;
+        if (busy || !evaluate(a, now, &v)) {
+            continue;
+        }
+        // The drive acts on the package once its last byte is in
+        unsigned char length;
+        package(s, i, v, &length);
+        DmmTime_t arrives = now + DMM_BYTES_TIME_US(length);
+        evaluate(a, arrives, &v);
+        prune(a, now);
+        long shortV = package(s, i, v, &length);
+        // Coming to rest lands on the waypoint itself, absolute, so a step lost on the way doesn't stay
+        Boolean rest = v == last->pos && last->t <= arrives;
+        Boolean settle = s->relative && rest;
+        if (rest) {
+            shortV = v;
+        }
+        if (a->sentAny && shortV == a->lastSent && !(settle && a->stepped)) {
+            continue;
+        }
+        if (shortV != v) {
+            s->shortened++;
+        }
+        if (s->relative && !settle) {
+            length = DmmRelative_Move(s->relative, (char)i, shortV);
+        } else {
+            length = Package_Length_For(shortV);
+            MoveMotorToAbsolutePosition32(s->pp, (char)i, shortV);
+        }
+        a->stepped = s->relative && !settle;
+        a->lastSent = shortV;
+        a->sentAny = true;
+        s->sent++;
+        s->bytes += length;
+        s->nextSendAt = now + (DmmTime_t)(DMM_BYTES_TIME_US(length) / (s->linkShare > 0 ? s->linkShare : 1));
+        s->nextAxis = (i + 1) % DMM_MAX_AXES;
+        busy = true;
+    }
+    return moving;
+}
@@ -0,0 +1,66 @@
+//
+//  DmmSpline.h
+//  dmmsend
+//
+//  Position streaming from sparse waypoints. Each axis takes timestamped
+//  waypoints and follows a Catmull-Rom curve through them (cubic Hermite with
+//  tangents from the neighbouring waypoints, in fixed point), sampled into
+//  Go_Absolute_Pos packages as often as the link allows. Where the curve can
+//  be moved by up to tolerance counts to make a package shorter, it is (set
+//  with dmmsend's waypointTolerance or dmmcli -t). With relative set, moves go
+//  as Go_Relative_Pos steps where those are shorter. The package that brings
+//  the axis to rest goes absolute, exactly to the last waypoint.
+//
+//  The segment between two waypoints bends towards the one after them when it
+//  is already queued, so keep at least two waypoints ahead for smooth motion.
+//  Nothing is sent before the first waypoint's time: start from where the
+//  motor is. The drive's own max speed and acceleration still apply and should
+//  be above what the curve asks for. Once past the last waypoint the axis
+//  holds there, and a waypoint added later continues the curve from it.
+//
+
+#ifndef dmmsend_DmmSpline_h
+#define dmmsend_DmmSpline_h
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+#include "DmmRelative.h"
+
+#define DMM_SPLINE_WAYPOINTS 64 // Per axis
+
+typedef struct DmmWaypoint {
+    DmmTime_t t;
+    long pos;
+} DmmWaypoint_t;
+
+typedef struct DmmSplineAxis {
+    DmmWaypoint_t wp[DMM_SPLINE_WAYPOINTS];
+    int head, count;
+    Boolean sentAny;
+    long lastSent;
+    Boolean stepped;            // Last package went through relative
+} DmmSplineAxis_t;
+
+typedef struct DmmSpline {
+    DmmProtocolState_t *pp;
+    DmmSplineAxis_t axis[DMM_MAX_AXES];
+    double linkShare;           // Fraction of the line the stream may take, 1: all of it
+    long tolerance;             // Counts a package may be off the curve to be shorter
+    DmmRelative_t *relative;    // Optional, moves go through it
+    int nextAxis;               // Round robin, so axes share the link
+    DmmTime_t nextSendAt;
+    unsigned long sent, bytes, shortened;
+} DmmSpline_t;
+
+void DmmSpline_Init(DmmSpline_t *s, DmmProtocolState_t *pp);
+void DmmSpline_Close(DmmSpline_t *s);
+// Waypoint at time t (DmmNow clock); false if the queue is full or t isn't after the last one
+Boolean DmmSpline_Add(DmmSpline_t *s, char axis, DmmTime_t t, long pos);
+void DmmSpline_Clear(DmmSpline_t *s, char axis);
+int DmmSpline_Queued(DmmSpline_t *s, char axis); // Including the one an axis holds at
+// Position on the curve at t, false before the first waypoint or with none queued
+Boolean DmmSpline_Evaluate(DmmSpline_t *s, char axis, DmmTime_t t, long *pos);
+// Sends the next package if the link has room. Returns true until every axis holds at its last waypoint.
+Boolean DmmSpline_Poll(DmmSpline_t *s);
+
+#endif
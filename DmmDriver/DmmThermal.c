@@ -0,0 +1,213 @@
+//
+//  DmmThermal.c
+//  dmmsend
+//
+
+#include <string.h>
+#include <math.h>
+
+#include "DmmThermal.h"
+#include "DmmProtocol.h"
+
+#ifndef MAX
+    #define MAX(a,b) ((a>b) ? a : b)
+#endif
+
+#define THERMAL_ALARM_OVER_HEAT 3
+
+static int scaled(int base, double scale) {
+    int v = (int)lround(base * scale);
+    return v < 1 ? 1 : v > base ? base : v;
+}
+
+static double scaleFor(DmmThermal_t *t, double heat) {
+    double knee = t->ceiling * (1 - t->band);
+    if (heat <= knee) {
+        return 1;
+    }
+    double s = (t->ceiling - heat) / (t->ceiling - knee);
+    return s < t->minScale ? t->minScale : s > 1 ? 1 : s;
+}
+
+static int send(DmmThermal_t *t, int i) {
+    DmmThermalAxis_t *a = &t->axis[i];
+    int n = 0;
+    if (a->speedLimit != a->speedSent) {
+        SetMaxSpeed(t->pp, (char)i, a->speedLimit); // Shadowed by the command observer
+        n++;
+    }
+    if (a->accelLimit != a->accelSent) {
+        SetMaxAccel(t->pp, (char)i, a->accelLimit);
+        n++;
+    }
+    return n;
+}
+
+// Down as soon as heat calls for it, up only once it has fallen hysteresis further
+static void govern(DmmThermal_t *t, int i) {
+    DmmThermalAxis_t *a = &t->axis[i];
+    double down = scaleFor(t, a->heat), up = scaleFor(t, a->heat + t->hysteresis * t->ceiling);
+    int speed = scaled(a->baseSpeed, down), accel = scaled(a->baseAccel, down);
+    if (speed >= a->speedLimit) {
+        speed = MAX(a->speedLimit, scaled(a->baseSpeed, up));
+    }
+    if (accel >= a->accelLimit) {
+        accel = MAX(a->accelLimit, scaled(a->baseAccel, up));
+    }
+    if (speed == a->speedLimit && accel == a->accelLimit) {
+        return;
+    }
+    a->speedLimit = speed;
+    a->accelLimit = accel;
+    a->changes++;
+    if (a->governed) {
+        send(t, i);
+    }
+    if (t->ReportLimitsPtr) {
+        t->ReportLimitsPtr((char)i, speed, accel, a->heat, t->hook);
+    }
+}
+
+static void integrate(DmmThermal_t *t, DmmThermalAxis_t *a, DmmTime_t at) {
+    if (a->sampledAt && at > a->sampledAt) {
+        a->heat += (1 - exp(-(double)(at - a->sampledAt) / t->tauUs)) * (a->square - a->heat);
+    }
+    a->sampledAt = at;
+}
+
+static void DmmThermal_OnReply(DmmProtocolState_t *pp, char axisID, unsigned char code, long value, void *ctx) {
+    DmmThermal_t *t = (DmmThermal_t*)ctx;
+    int i = axisID & 0x7f;
+    DmmThermalAxis_t *a = &t->axis[i];
+    DmmTime_t at = pp->Read_Timing.sampledAt ? pp->Read_Timing.sampledAt : DmmNow();
+    if (code == Is_TrqCurrent) {
+        integrate(t, a, at);
+        double r = value / (a->ratedCurrent > 0 ? a->ratedCurrent : t->ratedCurrent);
+        a->square = r * r;
+        a->current = value;
+        a->samples++;
+        govern(t, i);
+    } else if (code == Is_Status) {
+        Boolean overHeat = ((value & Status_Bits_Alarm) >> 2) == THERMAL_ALARM_OVER_HEAT;
+        Boolean tripped = overHeat && !a->overHeat;
+        a->overHeat = overHeat;
+        if (!tripped) {
+            return;
+        }
+        integrate(t, a, at);
+        if (a->heat > 0 && a->heat < 1) {
+            a->ratedCurrent = (a->ratedCurrent > 0 ? a->ratedCurrent : t->ratedCurrent) * sqrt(a->heat);
+            a->square /= a->heat;
+            a->heat = 1;
+        }
+        a->heat = MAX(a->heat, t->ceiling);
+        a->trips++;
+        govern(t, i);
+    }
+}
+
+static void DmmThermal_OnCommand(DmmProtocolState_t *pp, char axisID, unsigned char func, long value, void *ctx) {
+    DmmThermal_t *t = (DmmThermal_t*)ctx;
+    DmmThermalAxis_t *a = &t->axis[axisID & 0x7f];
+    switch (func) {
+        case Set_HighSpeed:
+            a->speedSent = (int)value;
+            break;
+        case Set_HighAccel:
+            a->accelSent = (int)value;
+            break;
+        case Turn_ConstSpeed:
+            a->turning = value != 0;
+            a->commandedAt = DmmNow();
+            break;
+        case Go_Absolute_Pos:
+        case Go_Relative_Pos:
+            a->turning = false;
+            a->commandedAt = DmmNow();
+            break;
+    }
+}
+
+static Boolean reading(DmmThermal_t *t, DmmThermalAxis_t *a, DmmTime_t now) {
+    return a->monitored
+        && (a->turning
+            || now - a->commandedAt < t->idleUs
+            || a->square >= t->quiet * t->quiet
+            || a->speedLimit != a->baseSpeed || a->accelLimit != a->baseAccel);
+}
+
+void DmmThermal_Init(DmmThermal_t *t, DmmProtocolState_t *pp, int baseSpeed, int baseAccel) {
+    memset(t, 0, sizeof(*t));
+    t->pp = pp;
+    t->ratedCurrent = 2048;
+    t->tauUs = 30000000;
+    t->ceiling = 0.9;
+    t->band = 0.3;
+    t->hysteresis = 0.1;
+    t->minScale = 0.25;
+    t->pollUs = 50000;
+    t->idleUs = 5000000;
+    t->quiet = 0.2;
+    t->readsPerSecond = 100; // 4 byte reads: about a tenth of the line
+    for (int i = 0; i < DMM_MAX_AXES; i++) {
+        DmmThermalAxis_t *a = &t->axis[i];
+        a->baseSpeed = a->speedLimit = baseSpeed;
+        a->baseAccel = a->accelLimit = baseAccel;
+        a->speedSent = a->accelSent = -1;
+    }
+    AddReplyObserver(pp, &DmmThermal_OnReply, t);
+    AddCommandObserver(pp, &DmmThermal_OnCommand, t);
+}
+
+void DmmThermal_Close(DmmThermal_t *t) {
+    RemoveReplyObserver(t->pp, &DmmThermal_OnReply, t);
+    RemoveCommandObserver(t->pp, &DmmThermal_OnCommand, t);
+}
+
+int DmmThermal_Apply(DmmThermal_t *t, char axisID) {
+    int i = axisID & 0x7f;
+    DmmThermalAxis_t *a = &t->axis[i];
+    a->governed = true;
+    a->monitored = true;
+    a->commandedAt = DmmNow();
+    return send(t, i);
+}
+
+void DmmThermal_Release(DmmThermal_t *t, char axisID) {
+    DmmThermalAxis_t *a = &t->axis[axisID & 0x7f];
+    a->governed = false;
+    a->monitored = true;
+    a->commandedAt = DmmNow();
+}
+
+void DmmThermal_Limits(DmmThermal_t *t, char axisID, int *speed, int *accel) {
+    DmmThermalAxis_t *a = &t->axis[axisID & 0x7f];
+    *speed = a->speedLimit;
+    *accel = a->accelLimit;
+}
+
+Boolean DmmThermal_Reading(DmmThermal_t *t, char axisID) {
+    return reading(t, &t->axis[axisID & 0x7f], DmmNow());
+}
+
+Boolean DmmThermal_Poll(DmmThermal_t *t) {
+    Boolean active = false;
+    DmmTime_t now = DmmNow();
+    int due = -1;
+    for (int i = 0; i < DMM_MAX_AXES; i++) {
+        DmmThermalAxis_t *a = &t->axis[i];
+        if (!reading(t, a, now)) {
+            continue;
+        }
+        active = true;
+        if (now >= a->nextReadAt && (due < 0 || a->nextReadAt < t->axis[due].nextReadAt)) {
+            due = i;
+        }
+    }
+    if (due >= 0 && now >= t->nextReadAt) {
+        Send_Package(t->pp, General_Read, (char)due, Is_TrqCurrent);
+        t->axis[due].nextReadAt = now + t->pollUs;
+        t->nextReadAt = now + 1000000 / t->readsPerSecond;
+    }
+    return active;
+}
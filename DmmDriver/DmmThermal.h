@@ -0,0 +1,78 @@
+//
+//  DmmThermal.h
+//  dmmsend
+//
+//  Keeps drives clear of alarm 3 (over heat / over power). Torque current is
+//  read off every monitored axis and integrated as I^2 t through a first order
+//  thermal model: heat 1 is where continuous ratedCurrent settles. As heat
+//  climbs into the top band below the ceiling, the max speed and acceleration
+//  the governor hands the drive fall linearly from their base values, down to
+//  minScale at the ceiling; they go back up once heat has fallen hysteresis
+//  further. An over heat alarm means the model ran cool, so the axis gets its
+//  own ratedCurrent, scaled for the model to read 1 at the trip.
+//
+//  Every Set_HighSpeed and Set_HighAccel on the link is shadowed, whoever sent
+//  it, and the governor only sends a limit the drive doesn't have already.
+//
+//  Reads cost the link, so a monitored axis is only read while it is in use:
+//  turning at a speed, moved within idleUs, drawing quiet of rated current or
+//  more, or with its limits brought down. The heat model holds the last
+//  sample while an axis isn't read. Reads from all axes are spaced to stay
+//  within readsPerSecond, the most overdue axis first.
+//
+
+#ifndef dmmsend_DmmThermal_h
+#define dmmsend_DmmThermal_h
+
+#include "DmmDriver.h"
+#include "DmmClock.h"
+
+typedef struct DmmThermalAxis {
+    Boolean monitored;          // Torque read every pollUs
+    Boolean governed;           // Governed limits sent as they change
+    Boolean turning;            // Last Turn_ConstSpeed wasn't 0
+    DmmTime_t commandedAt;      // Last motion command, or Apply / Release
+    int baseSpeed, baseAccel;   // Limits when cool
+    int speedLimit, accelLimit; // Governed, now
+    int speedSent, accelSent;   // What the drive has, -1 if not known
+    double heat;                // 1 = steady state at ratedCurrent
+    double ratedCurrent;        // Set by an over heat alarm, 0 until then: the shared one
+    double square;              // (I / ratedCurrent)^2 of the last sample, held until the next
+    long current;               // Last Is_TrqCurrent
+    Boolean overHeat;           // Alarm 3 in the last status read
+    DmmTime_t sampledAt, nextReadAt;
+    unsigned long samples, changes, trips; // trips: over heat alarms that came on
+} DmmThermalAxis_t;
+
+typedef struct DmmThermal {
+    DmmProtocolState_t *pp;
+    DmmThermalAxis_t axis[DMM_MAX_AXES];
+    double ratedCurrent;        // Is_TrqCurrent the motor carries continuously, a guess until set
+    DmmTime_t tauUs;            // Thermal time constant
+    double ceiling;             // Heat the limits are brought down by
+    double band;                // Limits start falling at ceiling * (1 - band)
+    double hysteresis;          // Fraction of ceiling heat falls further before limits rise
+    double minScale;
+    DmmTime_t pollUs;           // Per axis, while it is read
+    DmmTime_t idleUs;
+    double quiet;               // Fraction of rated current
+    int readsPerSecond;         // All axes together
+    DmmTime_t nextReadAt;       // Next read may go out, any axis
+    // Governed limits changed
+    void (*ReportLimitsPtr)(char axis, int speed, int accel, double heat, void *hook);
+    void *hook;
+} DmmThermal_t;
+
+void DmmThermal_Init(DmmThermal_t *t, DmmProtocolState_t *pp, int baseSpeed, int baseAccel);
+void DmmThermal_Close(DmmThermal_t *t);
+// Governs the axis from now on and sends whichever limit the drive doesn't have; returns packages sent
+int DmmThermal_Apply(DmmThermal_t *t, char axis);
+// Someone else sends the limits (still monitored, still shadowed)
+void DmmThermal_Release(DmmThermal_t *t, char axis);
+void DmmThermal_Limits(DmmThermal_t *t, char axis, int *speed, int *accel);
+// Torque reads going out for the axis now
+Boolean DmmThermal_Reading(DmmThermal_t *t, char axis);
+// Sends the most overdue torque read if the budget allows; call every millisecond or so while it returns true
+Boolean DmmThermal_Poll(DmmThermal_t *t);
+
+#endif
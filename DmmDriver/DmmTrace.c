@@ -0,0 +1,55 @@
+//
+//  DmmTrace.c
+//  dmmsend
+//
+
+#include "DmmTrace.h"
+
+static const char *eventNames[Trace_Count] = {
+    "frame_encode", "frame_write", "frame_written", "rx_first_byte",
+    "frame_decode", "crc_fail", "dispatch", "dispatch_done"
+};
+
+const char *DmmTrace_EventName(DmmTraceEvent_t event) {
+    return event < Trace_Count ? eventNames[event] : "unknown";
+}
+
+#if defined(DMM_TRACE) && !defined(DMM_TRACE_USDT)
+
+static DmmTraceRecord_t ring[DMM_TRACE_RING];
+static unsigned long written, dumped; // Records ever written, and up to where Dump has been
+
+// Writers may be on any thread (a pacer, a listener); each claims its own slot
+void DmmTrace_Record(DmmTraceEvent_t event, int axis, int func, int length) {
+    unsigned long i = __atomic_fetch_add(&written, 1, __ATOMIC_RELAXED);
+    DmmTraceRecord_t *r = &ring[i & (DMM_TRACE_RING - 1)];
+    r->at = DmmNow();
+    r->event = (unsigned char)event;
+    r->axis = (unsigned char)(axis & 0x7f);
+    r->func = (unsigned char)func;
+    r->length = (unsigned char)length;
+}
+
+// Records being written while this runs may come out half filled, dump when the link is quiet
+int DmmTrace_Dump(FILE *out) {
+    unsigned long end = __atomic_load_n(&written, __ATOMIC_ACQUIRE);
+    unsigned long i = end - dumped > DMM_TRACE_RING ? end - DMM_TRACE_RING : dumped;
+    int n = 0;
+    for (; i != end; i++, n++) {
+        const DmmTraceRecord_t *r = &ring[i & (DMM_TRACE_RING - 1)];
+        fprintf(out, "%lld %s %d %d %d\n", r->at, DmmTrace_EventName((DmmTraceEvent_t)r->event), r->axis, r->func, r->length);
+    }
+    dumped = end;
+    return n;
+}
+
+#else
+
+void DmmTrace_Record(DmmTraceEvent_t event, int axis, int func, int length) {
+}
+
+int DmmTrace_Dump(FILE *out) {
+    return 0;
+}
+
+#endif
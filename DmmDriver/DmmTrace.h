@@ -0,0 +1,76 @@
+//
+//  DmmTrace.h
+//  dmmsend
+//
+//  Static tracepoints on the frame path, to see where a stalled link's time
+//  goes. They compile to nothing unless the driver is built with -DDMM_TRACE.
+//  Every one carries axis, function code and length in bytes:
+//
+//    frame_encode      Encode_Package built a frame
+//    frame_write       Write_Package hands bytes to the serial callback (first frame's axis and code)
+//    frame_written     the callback returned
+//    rx_first_byte     ReadPackage took a start byte (code and length not known yet: 0)
+//    frame_decode      Get_Function decoded a reply
+//    crc_fail          a reply failed its CRC
+//    dispatch          reply callbacks and observers about to run
+//    dispatch_done     they returned
+//
+//  On Linux with <sys/sdt.h> (systemtap-sdt-dev) they are USDT probes of
+//  provider dmm, a single nop each until a tracer attaches:
+//    perf buildid-cache --add ./dmmcli && perf probe -x ./dmmcli 'sdt_dmm:*'
+//    perf record -e 'sdt_dmm:*' ...
+//    bpftrace -e 'usdt:./dmmcli:dmm:frame_decode { @[arg0, arg1] = count(); }'
+//  Anywhere else they are time stamped into an in-process ring of the last
+//  DMM_TRACE_RING records, written out with DmmTrace_Dump.
+//
+
+#ifndef dmmsend_DmmTrace_h
+#define dmmsend_DmmTrace_h
+
+#include <stdio.h>
+
+#include "DmmClock.h"
+
+#define DMM_TRACE_RING 4096 // Records kept, power of 2
+
+typedef enum {
+    Trace_frame_encode = 0,
+    Trace_frame_write,
+    Trace_frame_written,
+    Trace_rx_first_byte,
+    Trace_frame_decode,
+    Trace_crc_fail,
+    Trace_dispatch,
+    Trace_dispatch_done,
+    Trace_Count
+} DmmTraceEvent_t;
+
+typedef struct DmmTraceRecord {
+    DmmTime_t at;
+    unsigned char event, axis, func, length;
+} DmmTraceRecord_t;
+
+#if defined(DMM_TRACE) && defined(__linux__) && defined(__has_include)
+    #if __has_include(<sys/sdt.h>)
+        #include <sys/sdt.h>
+        #define DMM_TRACE_USDT
+    #endif
+#endif
+
+#if !defined(DMM_TRACE)
+    #define DMM_TRACEPOINT(name, axis, func, length) ((void)0)
+#elif defined(DMM_TRACE_USDT)
+    #define DMM_TRACEPOINT(name, axis, func, length) \
+        DTRACE_PROBE3(dmm, name, (int)(axis), (int)(func), (int)(length))
+#else
+    #define DMM_TRACEPOINT(name, axis, func, length) \
+        DmmTrace_Record(Trace_##name, (axis), (func), (length))
+#endif
+
+void DmmTrace_Record(DmmTraceEvent_t event, int axis, int func, int length);
+const char *DmmTrace_EventName(DmmTraceEvent_t event);
+// "<time_us> <event> <axis> <function code> <length>" per record, oldest first, and empties
+// the ring. Returns the number written; 0 when the records go to USDT or tracing is off.
+int DmmTrace_Dump(FILE *out);
+
+#endif
@@ -0,0 +1,440 @@
+//
+//  DmmIngressCheck.c
+//  dmmingresscheck - DmmIngress over UDP loopback
+//
+//  Starts the listener on a free port and sends it OSC and binary datagrams
+//  from a socket of its own on 127.0.0.1, then polls and compares what is
+//  dispatched, value and order, with what should be. Each case waits for the
+//  listener thread to have taken all of its datagrams before polling.
+//
+//  Fixed cases: every OSC argument type and both addresses, bundles, binary
+//  records; latest value wins, with the slot keeping its first place in the
+//  queue and the values it replaced counted as superseded; values past the
+//  28 bits of a package clamped and counted as malformed; NaN, unknown
+//  addresses, axes and kinds, truncated and nested-too-deep datagrams dropped
+//  and counted as malformed. Then -r rounds of random setpoints, each
+//  checked against the latest value per axis and kind.
+//
+//  Build:
+//    cc -std=gnu99 -O2 -DDMM_STANDALONE -IDmmDriver -o dmmingresscheck DmmIngressCheck/DmmIngressCheck.c
+//       DmmDriver/DmmIngress.c DmmDriver/DmmDriver.c DmmDriver/DmmClock.c DmmDriver/DmmHistogram.c
+//       -lpthread -lrt -lm
+//
+//  Output, one tab separated row: cases, datagrams, setpoints dispatched,
+//  errors. Exits 70 on any error, or if the listener doesn't take a case's
+//  datagrams within a second.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sysexits.h>
+
+#include "DmmDriver.h"
+#include "DmmIngress.h"
+
+#define CHECK_MAX_SETPOINTS DMM_INGRESS_SLOTS
+#define CHECK_WAIT_US 1000000       // The listener takes a case's datagrams within this
+#define CHECK_RANDOM_AXES 8         // Few enough that random rounds overwrite a lot
+#define CHECK_REPORT_ERRORS 10      // Described on stderr, the rest only counted
+
+typedef struct {
+    DmmIngressKind_t kind;
+    int axis;
+    long value;
+} CheckSetpoint_t;
+
+typedef struct {
+    DmmIngress_t ingress;
+    int sock;
+    struct sockaddr_in to;
+    unsigned long sent;                 // Datagrams
+    CheckSetpoint_t got[CHECK_MAX_SETPOINTS], want[CHECK_MAX_SETPOINTS];
+    int gotCount, wantCount;
+    unsigned long superseded, malformed; // What the ingress counters should read
+    unsigned long cases, dispatched, errors;
+    unsigned int rng;
+} DmmIngressCheck_t;
+
+static DmmIngressCheck_t check;
+
+static const char *kindNames[Ingress_KindCount] = { "speed", "pos" };
+
+static void fail(const char *name, const char *what, long got, long want) {
+    if (check.errors++ < CHECK_REPORT_ERRORS) {
+        fprintf(stderr, "dmmingresscheck: %s: %s, got %ld, want %ld\n", name, what, got, want);
+    }
+}
+
+static unsigned int random32(void) {
+    check.rng ^= check.rng << 13;
+    check.rng ^= check.rng >> 17;
+    check.rng ^= check.rng << 5;
+    return check.rng;
+}
+
+static void Dispatch(DmmIngressKind_t kind, char axis, long value, void *hook) {
+    if (check.gotCount < CHECK_MAX_SETPOINTS) {
+        check.got[check.gotCount++] = (CheckSetpoint_t){ kind, axis, value };
+    }
+    check.dispatched++;
+}
+
+static void expect(DmmIngressKind_t kind, int axis, long value) {
+    check.want[check.wantCount++] = (CheckSetpoint_t){ kind, axis, value };
+}
+
+static void sendDatagram(const unsigned char *data, int length) {
+    if (sendto(check.sock, data, length, 0, (struct sockaddr*)&check.to, sizeof(check.to)) != length) {
+        fail("sendto", strerror(errno), length, 0);
+        return;
+    }
+    check.sent++;
+}
+
+static void putBe32(unsigned char *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// An OSC string, NUL terminated and padded to 4 bytes
+static int oscString(unsigned char *p, const char *s) {
+    int length = (int)strlen(s);
+    int padded = (length + 4) & ~3;
+    memset(p, 0, padded);
+    memcpy(p, s, length);
+    return padded;
+}
+
+// A message with one argument of type tag, the argument's bytes already big endian
+static int oscMessage(unsigned char *p, const char *address, char tag, const unsigned char *arg, int argLength) {
+    char tags[3] = { ',', tag, 0 };
+    int at = oscString(p, address);
+    at += oscString(p + at, tags);
+    memcpy(p + at, arg, argLength);
+    return at + argLength;
+}
+
+static int oscInt(unsigned char *p, const char *address, int32_t v) {
+    unsigned char arg[4];
+    putBe32(arg, (uint32_t)v);
+    return oscMessage(p, address, 'i', arg, 4);
+}
+
+static int oscFloat(unsigned char *p, const char *address, float v) {
+    unsigned char arg[4];
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    putBe32(arg, bits);
+    return oscMessage(p, address, 'f', arg, 4);
+}
+
+static int oscInt64(unsigned char *p, const char *address, int64_t v) {
+    unsigned char arg[8];
+    putBe32(arg, (uint32_t)((uint64_t)v >> 32));
+    putBe32(arg + 4, (uint32_t)v);
+    return oscMessage(p, address, 'h', arg, 8);
+}
+
+static int oscDouble(unsigned char *p, const char *address, double v) {
+    unsigned char arg[8];
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    putBe32(arg, (uint32_t)(bits >> 32));
+    putBe32(arg + 4, (uint32_t)bits);
+    return oscMessage(p, address, 'd', arg, 8);
+}
+
+// Wraps the elements in a bundle, each led by its size; time tag 1 is "immediately"
+static int oscBundle(unsigned char *p, const unsigned char *elements[], const int lengths[], int count) {
+    int at = oscString(p, "#bundle");
+    memset(p + at, 0, 8);
+    p[at + 7] = 1;
+    at += 8;
+    for (int i = 0; i < count; i++) {
+        putBe32(p + at, (uint32_t)lengths[i]);
+        memcpy(p + at + 4, elements[i], lengths[i]);
+        at += 4 + lengths[i];
+    }
+    return at;
+}
+
+static int binaryRecord(unsigned char *p, char kind, unsigned char axis, int32_t v) {
+    p[0] = (unsigned char)kind;
+    p[1] = axis;
+    putBe32(p + 2, (uint32_t)v);
+    return 6;
+}
+
+static void sendOscInt(const char *address, int32_t v) {
+    unsigned char p[64];
+    sendDatagram(p, oscInt(p, address, v));
+}
+
+static void sendBinary(char kind, unsigned char axis, int32_t v) {
+    unsigned char p[6];
+    sendDatagram(p, binaryRecord(p, kind, axis, v));
+}
+
+static unsigned long counter(unsigned long *field) {
+    pthread_mutex_lock(&check.ingress.lock);
+    unsigned long v = *field;
+    pthread_mutex_unlock(&check.ingress.lock);
+    return v;
+}
+
+// Waits for the listener to take every datagram sent, polls, and compares the dispatched setpoints and counters
+static void finishCase(const char *name, unsigned long superseded, unsigned long malformed) {
+    DmmTime_t deadline = DmmNow() + CHECK_WAIT_US;
+    while (counter(&check.ingress.datagrams) < check.sent) {
+        if (DmmNow() > deadline) {
+            fprintf(stderr, "dmmingresscheck: %s: %lu of %lu datagrams taken\n", name,
+                    counter(&check.ingress.datagrams), check.sent);
+            exit(EX_SOFTWARE);
+        }
+        usleep(100);
+    }
+    check.gotCount = 0;
+    DmmIngress_Poll(&check.ingress, 0);
+    if (check.gotCount != check.wantCount) {
+        fail(name, "setpoints dispatched", check.gotCount, check.wantCount);
+    }
+    for (int i = 0; i < check.gotCount && i < check.wantCount; i++) {
+        CheckSetpoint_t *g = &check.got[i], *w = &check.want[i];
+        char what[64];
+        if (g->kind != w->kind || g->axis != w->axis) {
+            snprintf(what, sizeof(what), "setpoint %d is %s, not %s, axis", i, kindNames[g->kind], kindNames[w->kind]);
+            fail(name, what, g->axis, w->axis);
+        } else if (g->value != w->value) {
+            snprintf(what, sizeof(what), "axis %d %s", g->axis, kindNames[g->kind]);
+            fail(name, what, g->value, w->value);
+        }
+    }
+    // Off by some in one case shouldn't fail every case after it
+    check.superseded += superseded;
+    check.malformed += malformed;
+    if (counter(&check.ingress.superseded) != check.superseded) {
+        fail(name, "superseded", (long)counter(&check.ingress.superseded), (long)check.superseded);
+        check.superseded = counter(&check.ingress.superseded);
+    }
+    if (counter(&check.ingress.malformed) != check.malformed) {
+        fail(name, "malformed", (long)counter(&check.ingress.malformed), (long)check.malformed);
+        check.malformed = counter(&check.ingress.malformed);
+    }
+    check.wantCount = 0;
+    check.cases++;
+}
+
+static void checkTypes(void) {
+    unsigned char p[128];
+    sendOscInt("/axis/1/speed", -42);
+    expect(Ingress_Speed, 1, -42);
+    sendDatagram(p, oscFloat(p, "/axis/2/pos", 12.6f));
+    expect(Ingress_Position, 2, 13);
+    sendDatagram(p, oscFloat(p, "/axis/2/speed", -12.6f));
+    expect(Ingress_Speed, 2, -13);
+    sendDatagram(p, oscInt64(p, "/axis/3/position", 1234567));
+    expect(Ingress_Position, 3, 1234567);
+    sendDatagram(p, oscDouble(p, "/axis/127/pos", -7.4));
+    expect(Ingress_Position, 127, -7);
+    sendBinary('s', 0, 55);
+    expect(Ingress_Speed, 0, 55);
+    sendBinary('p', 4, -100000);
+    expect(Ingress_Position, 4, -100000);
+    finishCase("argument types", 0, 0);
+}
+
+static void checkBundles(void) {
+    unsigned char a[64], b[64], inner[160], p[320];
+    int la = oscInt(a, "/axis/5/speed", 7);
+    int lb = oscInt(b, "/axis/6/pos", 8);
+    const unsigned char *two[] = { a, b };
+    int twoLengths[] = { la, lb };
+    sendDatagram(p, oscBundle(p, two, twoLengths, 2));
+    expect(Ingress_Speed, 5, 7);
+    expect(Ingress_Position, 6, 8);
+    // A bundle in a bundle counts the same
+    int li = oscBundle(inner, two, twoLengths, 2);
+    const unsigned char *nested[] = { inner };
+    int nestedLengths[] = { li };
+    sendDatagram(p, oscBundle(p, nested, nestedLengths, 1));
+    // Several binary records in one datagram
+    int at = binaryRecord(p, 's', 9, 1);
+    at += binaryRecord(p + at, 'p', 9, 2);
+    sendDatagram(p, at);
+    expect(Ingress_Speed, 9, 1);
+    expect(Ingress_Position, 9, 2);
+    finishCase("bundles", 2, 0);
+}
+
+static void checkLatestWins(void) {
+    // Axis 3 speed is first in and stays first, with the last value sent
+    sendOscInt("/axis/3/speed", 10);
+    sendBinary('p', 5, 100);
+    sendOscInt("/axis/3/speed", 20);
+    sendBinary('p', 5, 200);
+    sendBinary('s', 3, 30);
+    sendOscInt("/axis/3/pos", 40);
+    expect(Ingress_Speed, 3, 30);
+    expect(Ingress_Position, 5, 200);
+    expect(Ingress_Position, 3, 40);
+    finishCase("latest value wins", 3, 0);
+}
+
+static void checkClamp(void) {
+    unsigned char p[64];
+    sendOscInt("/axis/1/pos", INT32_MAX);
+    expect(Ingress_Position, 1, DMM_VALUE_MAX);
+    sendOscInt("/axis/1/speed", INT32_MIN);
+    expect(Ingress_Speed, 1, DMM_VALUE_MIN);
+    sendDatagram(p, oscInt64(p, "/axis/2/pos", -((int64_t)1 << 40)));
+    expect(Ingress_Position, 2, DMM_VALUE_MIN);
+    sendDatagram(p, oscDouble(p, "/axis/2/speed", 1e12));
+    expect(Ingress_Speed, 2, DMM_VALUE_MAX);
+    sendDatagram(p, oscFloat(p, "/axis/3/speed", 3e8f));
+    expect(Ingress_Speed, 3, DMM_VALUE_MAX);
+    sendBinary('p', 4, -(1 << 28));
+    expect(Ingress_Position, 4, DMM_VALUE_MIN);
+    // Right at the ends is still in range
+    sendBinary('s', 4, DMM_VALUE_MAX);
+    expect(Ingress_Speed, 4, DMM_VALUE_MAX);
+    sendOscInt("/axis/5/pos", DMM_VALUE_MIN);
+    expect(Ingress_Position, 5, DMM_VALUE_MIN);
+    finishCase("clamp to 28 bits", 0, 6);
+}
+
+static void checkMalformed(void) {
+    unsigned char p[256], a[64], b[64];
+    int malformed = 0;
+    sendDatagram(p, oscFloat(p, "/axis/1/speed", NAN)), malformed++;
+    sendDatagram(p, oscDouble(p, "/axis/1/pos", INFINITY)), malformed++;
+    sendOscInt("/axis/128/speed", 1), malformed++;
+    sendOscInt("/axis/1/torque", 1), malformed++;
+    sendOscInt("/motor/1/speed", 1), malformed++;
+    sendDatagram(p, oscMessage(p, "/axis/1/speed", 's', (const unsigned char*)"abc", 4)), malformed++;
+    // Argument cut short
+    int length = oscInt(p, "/axis/1/speed", 1);
+    sendDatagram(p, length - 4), malformed++;
+    // Not a multiple of 6, and a bad kind and axis among good records
+    sendDatagram((const unsigned char*)"p\001\000\000\000", 5), malformed++;
+    int at = binaryRecord(p, 'x', 1, 1);
+    at += binaryRecord(p + at, 'p', 200, 1);
+    at += binaryRecord(p + at, 'p', 7, 70);
+    sendDatagram(p, at), malformed += 2;
+    expect(Ingress_Position, 7, 70);
+    // A bad element in a bundle is skipped, the rest still taken
+    int la = oscInt(a, "/axis/1/bogus", 1);
+    int lb = oscInt(b, "/axis/8/speed", 80);
+    const unsigned char *pair[] = { a, b };
+    int pairLengths[] = { la, lb };
+    sendDatagram(p, oscBundle(p, pair, pairLengths, 2)), malformed++;
+    expect(Ingress_Speed, 8, 80);
+    // Bundles nested deeper than DmmIngress takes
+    unsigned char nest[2][256];
+    const unsigned char *inner[1];
+    int innerLength[1];
+    int ln = oscInt(nest[0], "/axis/1/speed", 1);
+    for (int depth = 0; depth < 5; depth++) {
+        inner[0] = nest[depth & 1];
+        innerLength[0] = ln;
+        ln = oscBundle(nest[(depth + 1) & 1], inner, innerLength, 1);
+    }
+    sendDatagram(nest[1], ln), malformed++;
+    finishCase("malformed", 0, (unsigned long)malformed);
+}
+
+// Random setpoints on a few axes, each checked against the last one sent for its slot
+static void checkRandom(int rounds, int perRound) {
+    for (int r = 0; r < rounds; r++) {
+        long latest[DMM_INGRESS_SLOTS];
+        Boolean queued[DMM_INGRESS_SLOTS] = { false };
+        int order[DMM_INGRESS_SLOTS], count = 0;
+        unsigned long superseded = 0;
+        for (int k = 0; k < perRound; k++) {
+            DmmIngressKind_t kind = (DmmIngressKind_t)(random32() % Ingress_KindCount);
+            int axis = (int)(random32() % CHECK_RANDOM_AXES);
+            long value = (long)(random32() % (1u << 28)) + DMM_VALUE_MIN;
+            int i = axis * Ingress_KindCount + kind;
+            if (random32() & 1) {
+                char address[32];
+                snprintf(address, sizeof(address), "/axis/%d/%s", axis, kind == Ingress_Speed ? "speed" : "pos");
+                sendOscInt(address, (int32_t)value);
+            } else {
+                sendBinary(kind == Ingress_Speed ? 's' : 'p', (unsigned char)axis, (int32_t)value);
+            }
+            if (queued[i]) {
+                superseded++;
+            } else {
+                queued[i] = true;
+                order[count++] = i;
+            }
+            latest[i] = value;
+        }
+        for (int k = 0; k < count; k++) {
+            expect((DmmIngressKind_t)(order[k] % Ingress_KindCount), order[k] / Ingress_KindCount, latest[order[k]]);
+        }
+        finishCase("random", superseded, 0);
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: dmmingresscheck [-r rounds] [-n setpoints] [-s seed]\n"
+            "  -r  rounds of random setpoints, default 100\n"
+            "  -n  setpoints per round, one datagram each, default 64\n"
+            "  -s  seed, default 1\n");
+    exit(EX_USAGE);
+}
+
+int main(int argc, char **argv) {
+    int rounds = 100, perRound = 64;
+    int opt;
+    check.rng = 1;
+    while ((opt = getopt(argc, argv, "r:n:s:")) != -1) {
+        switch (opt) {
+            case 'r': rounds = atoi(optarg); break;
+            case 'n': perRound = atoi(optarg); break;
+            case 's': check.rng = (unsigned int)strtoul(optarg, NULL, 10) | 1; break;
+            default: usage();
+        }
+    }
+    if (optind != argc || rounds < 0 || perRound < 1) {
+        usage();
+    }
+    DmmIngress_Init(&check.ingress, NULL);
+    check.ingress.DispatchPtr = &Dispatch;
+    if (!DmmIngress_Start(&check.ingress, 0)) {
+        return EX_OSERR;
+    }
+    check.sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (check.sock < 0) {
+        fprintf(stderr, "dmmingresscheck: socket: %s\n", strerror(errno));
+        return EX_OSERR;
+    }
+    memset(&check.to, 0, sizeof(check.to));
+    check.to.sin_family = AF_INET;
+    check.to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    check.to.sin_port = htons(check.ingress.port);
+
+    checkTypes();
+    checkBundles();
+    checkLatestWins();
+    checkClamp();
+    checkMalformed();
+    checkRandom(rounds, perRound);
+
+    DmmIngress_Stop(&check.ingress);
+    close(check.sock);
+    printf("cases\tdatagrams\tdispatched\terrors\n");
+    printf("%lu\t%lu\t%lu\t%lu\n", check.cases, check.sent, check.dispatched, check.errors);
+    return check.errors > 0 ? EX_SOFTWARE : EX_OK;
+}
@@ -0,0 +1,368 @@
+//
+//  DmmPlan.c
+//  dmmplan - offline link capacity planner
+//
+//  Takes a load description for one 38400 baud link, sizes every package with
+//  the same length logic as Send_Package, pushes the workload through a
+//  simulated full duplex link and reports utilisation, queueing latency and the
+//  highest rate each axis could run at.
+//
+//  Build:
+//    cc -std=gnu99 -O2 -DDMM_STANDALONE -IDmmDriver -o dmmplan DmmPlan/DmmPlan.c DmmDriver/DmmDriver.c DmmDriver/DmmClock.c -lm
+//
+//  Load description, one stream per line ('#' starts a comment):
+//    <axis> <command> <rate_hz> [<min> <max>]
+//  min/max is the range the values are drawn from (uniformly); for reads it is
+//  the range of the value the drive answers with. Commands:
+//    speed          Turn_ConstSpeed
+//    dmmspeed       what dmmsend's speed message sends: Turn_ConstSpeed, with the thermal
+//                   governor's readtorque at 20 Hz on the axis alongside (limits only go
+//                   out when they change, too seldom to count)
+//    position       Go_Absolute_Pos
+//    maxspeed       Set_HighSpeed
+//    maxaccel       Set_HighAccel
+//    readposition   General_Read Is_AbsPos32, answered by Is_AbsPos32
+//    readtorque     General_Read Is_TrqCurrent, answered by Is_TrqCurrent
+//    readstatus     Read_Drive_Status, answered by Is_Status
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sysexits.h>
+
+#include "DmmDriver.h"
+#include "DmmProtocol.h"
+
+#define PLAN_MAX_STREAMS 256
+#define PLAN_MAX_PACKAGES 3
+
+typedef struct {
+    const char *name;
+    unsigned char func[PLAN_MAX_PACKAGES]; // Packages sent per event
+    int packages;
+    int valuePackage;   // Which package carries the drawn value, -1: none
+    Boolean reply;      // Drive answers, reply carries the drawn value
+    long defMin, defMax;
+    double torqueHz;    // Brings a readtorque stream on the axis at this rate, 0: none
+} PlanCommand_t;
+
+static const PlanCommand_t Commands[] = {
+    { "speed",        { Turn_ConstSpeed }, 1, 0, false, -100, 100 },
+    { "dmmspeed",     { Turn_ConstSpeed }, 1, 0, false, -100, 100, 20 },
+    { "position",     { Go_Absolute_Pos }, 1, 0, false, -(1L << 27), (1L << 27) - 1 },
+    { "maxspeed",     { Set_HighSpeed }, 1, 0, false, 1, 127 },
+    { "maxaccel",     { Set_HighAccel }, 1, 0, false, 1, 127 },
+    { "readposition", { General_Read }, 1, -1, true, -(1L << 27), (1L << 27) - 1 },
+    { "readtorque",   { General_Read }, 1, -1, true, -32768, 32767 },
+    { "readstatus",   { Read_Drive_Status }, 1, -1, true, 0, 127 },
+};
+
+typedef struct {
+    int axis;
+    const PlanCommand_t *cmd;
+    double rate;
+    long min, max;
+    Boolean fixed;      // Brought in by another stream, doesn't scale with the axis's commands
+    double next;        // Next event time, s
+    // Results
+    unsigned long events;
+    double txBytes, rxBytes;
+    double *latency;    // Per event: generated -> last byte on the wire (requests: reply back)
+    unsigned long latencyCount, latencyCap;
+} PlanStream_t;
+
+static PlanStream_t Streams[PLAN_MAX_STREAMS];
+static int StreamCount = 0;
+
+static double frand(void) {
+    return (double)rand() / ((double)RAND_MAX + 1.0);
+}
+
+static long drawValue(const PlanStream_t *st) {
+    return st->min + (long)(frand() * ((double)st->max - st->min + 1));
+}
+
+// Mean package bytes over the stream's value range, sampled
+static void meanBytes(const PlanStream_t *st, double *tx, double *rx) {
+    const int samples = 4096;
+    double t = 0, r = 0;
+    for (int i = 0; i < samples; i++) {
+        long v = drawValue(st);
+        for (int p = 0; p < st->cmd->packages; p++) {
+            long pv = (p == st->cmd->valuePackage) ? v : (st->cmd->func[p] == Set_HighSpeed || st->cmd->func[p] == Set_HighAccel) ? 4 : 0;
+            t += Package_Length_For(pv);
+        }
+        if (st->cmd->reply) {
+            r += Package_Length_For(v);
+        }
+    }
+    *tx = t / samples;
+    *rx = r / samples;
+}
+
+static const PlanCommand_t *commandNamed(const char *name) {
+    for (size_t i = 0; i < sizeof(Commands) / sizeof(Commands[0]); i++) {
+        if (strcmp(Commands[i].name, name) == 0) {
+            return &Commands[i];
+        }
+    }
+    return NULL;
+}
+
+// One torque read stream per axis, at the fastest rate asked for
+static int addTorqueReads(void) {
+    int n = StreamCount;
+    for (int i = 0; i < n; i++) {
+        double hz = Streams[i].cmd->torqueHz;
+        if (hz <= 0) {
+            continue;
+        }
+        PlanStream_t *st = NULL;
+        for (int j = n; j < StreamCount; j++) {
+            if (Streams[j].axis == Streams[i].axis) {
+                st = &Streams[j];
+            }
+        }
+        if (st == NULL) {
+            if (StreamCount >= PLAN_MAX_STREAMS) {
+                fprintf(stderr, "dmmplan: too many streams\n");
+                return -1;
+            }
+            st = &Streams[StreamCount++];
+            memset(st, 0, sizeof(*st));
+            st->axis = Streams[i].axis;
+            st->cmd = commandNamed("readtorque");
+            st->min = st->cmd->defMin;
+            st->max = st->cmd->defMax;
+            st->fixed = true;
+        }
+        st->rate = fmax(st->rate, hz);
+    }
+    return StreamCount;
+}
+
+static int loadStreams(FILE *in) {
+    char line[256];
+    int lineNo = 0;
+    while (fgets(line, sizeof(line), in)) {
+        lineNo++;
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = 0;
+        }
+        char name[32];
+        int axis;
+        double rate;
+        long min, max;
+        int n = sscanf(line, "%d %31s %lf %ld %ld", &axis, name, &rate, &min, &max);
+        if (n <= 0) {
+            continue;
+        }
+        if (n < 3 || axis < 0 || axis >= DMM_MAX_AXES || rate <= 0) {
+            fprintf(stderr, "dmmplan: line %d: expected <axis> <command> <rate_hz> [<min> <max>]\n", lineNo);
+            return -1;
+        }
+        const PlanCommand_t *cmd = commandNamed(name);
+        if (cmd == NULL) {
+            fprintf(stderr, "dmmplan: line %d: unknown command %s\n", lineNo, name);
+            return -1;
+        }
+        if (StreamCount >= PLAN_MAX_STREAMS) {
+            fprintf(stderr, "dmmplan: too many streams\n");
+            return -1;
+        }
+        PlanStream_t *st = &Streams[StreamCount++];
+        memset(st, 0, sizeof(*st));
+        st->axis = axis;
+        st->cmd = cmd;
+        st->rate = rate;
+        st->min = n >= 5 ? min : cmd->defMin;
+        st->max = n >= 5 ? max : cmd->defMax;
+        if (st->max < st->min) {
+            long t = st->min;
+            st->min = st->max;
+            st->max = t;
+        }
+    }
+    return addTorqueReads();
+}
+
+static void addLatency(PlanStream_t *st, double l) {
+    if (st->latencyCount == st->latencyCap) {
+        st->latencyCap = st->latencyCap ? st->latencyCap * 2 : 1024;
+        st->latency = realloc(st->latency, st->latencyCap * sizeof(double));
+    }
+    st->latency[st->latencyCount++] = l;
+}
+
+static int cmpDouble(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double *sorted, unsigned long n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+    unsigned long i = (unsigned long)ceil(p * n);
+    return sorted[i > 0 ? i - 1 : 0];
+}
+
+// Event driven FIFO link: host -> drive line and drive -> host line are independent (full duplex).
+// A drive answers once the request is in, after turnaround seconds.
+static void simulate(double duration, Boolean poisson, double turnaround, double *txBusy, double *rxBusy) {
+    const double byteTime = (double)DMM_BITS_PER_BYTE / DMM_BAUD;
+    double txFree = 0, rxFree = 0;
+    *txBusy = *rxBusy = 0;
+    for (int i = 0; i < StreamCount; i++) {
+        Streams[i].next = poisson ? -log(1 - frand()) / Streams[i].rate : frand() / Streams[i].rate;
+    }
+    for (;;) {
+        int s = -1;
+        for (int i = 0; i < StreamCount; i++) {
+            if (s < 0 || Streams[i].next < Streams[s].next) {
+                s = i;
+            }
+        }
+        PlanStream_t *st = &Streams[s];
+        double t = st->next;
+        if (t >= duration) {
+            break;
+        }
+        long v = drawValue(st);
+        double start = t > txFree ? t : txFree;
+        double bytes = 0;
+        for (int p = 0; p < st->cmd->packages; p++) {
+            long pv = (p == st->cmd->valuePackage) ? v : (st->cmd->func[p] == Set_HighSpeed || st->cmd->func[p] == Set_HighAccel) ? 4 : 0;
+            bytes += Package_Length_For(pv);
+        }
+        txFree = start + bytes * byteTime;
+        *txBusy += bytes * byteTime;
+        st->txBytes += bytes;
+        double done = txFree;
+        if (st->cmd->reply) {
+            double rbytes = Package_Length_For(v);
+            double rstart = txFree + turnaround > rxFree ? txFree + turnaround : rxFree;
+            rxFree = rstart + rbytes * byteTime;
+            *rxBusy += rbytes * byteTime;
+            st->rxBytes += rbytes;
+            done = rxFree;
+        }
+        st->events++;
+        addLatency(st, done - t);
+        st->next += poisson ? -log(1 - frand()) / st->rate : 1.0 / st->rate;
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: dmmplan [-t seconds] [-s seed] [-p] [-u target] [-r turnaround_ms] [load-file]\n"
+            "  -t  simulated time, default 60\n"
+            "  -s  random seed, default 1\n"
+            "  -p  Poisson arrivals instead of periodic streams with random phase\n"
+            "  -u  utilisation considered sustainable, default 0.8\n"
+            "  -r  drive reply turnaround, default 0.5 ms\n");
+    exit(EX_USAGE);
+}
+
+int main(int argc, char **argv) {
+    double duration = 60, target = 0.8, turnaround = 0.0005;
+    unsigned seed = 1;
+    Boolean poisson = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:s:pu:r:")) != -1) {
+        switch (opt) {
+            case 't': duration = atof(optarg); break;
+            case 's': seed = (unsigned)strtoul(optarg, NULL, 10); break;
+            case 'p': poisson = true; break;
+            case 'u': target = atof(optarg); break;
+            case 'r': turnaround = atof(optarg) / 1000; break;
+            default: usage();
+        }
+    }
+    FILE *in = stdin;
+    if (optind < argc) {
+        in = fopen(argv[optind], "r");
+        if (in == NULL) {
+            perror(argv[optind]);
+            return EX_NOINPUT;
+        }
+    }
+    if (loadStreams(in) <= 0) {
+        fprintf(stderr, "dmmplan: no streams\n");
+        return EX_DATAERR;
+    }
+    srand(seed);
+
+    // Analytic load, bytes per second in each direction
+    const double capacity = (double)DMM_BAUD / DMM_BITS_PER_BYTE;
+    double meanTx[PLAN_MAX_STREAMS], meanRx[PLAN_MAX_STREAMS];
+    double loadTx = 0, loadRx = 0;
+    for (int i = 0; i < StreamCount; i++) {
+        meanBytes(&Streams[i], &meanTx[i], &meanRx[i]);
+        loadTx += meanTx[i] * Streams[i].rate;
+        loadRx += meanRx[i] * Streams[i].rate;
+    }
+
+    double txBusy, rxBusy;
+    simulate(duration, poisson, turnaround, &txBusy, &rxBusy);
+
+    printf("link: %d baud, %.0f bytes/s each way, %.0f s simulated\n", DMM_BAUD, capacity, duration);
+    printf("offered load: tx %.1f%%  rx %.1f%%\n", 100 * loadTx / capacity, 100 * loadRx / capacity);
+    printf("simulated:    tx %.1f%%  rx %.1f%%\n", 100 * txBusy / duration, 100 * rxBusy / duration);
+    if (loadTx > capacity || loadRx > capacity) {
+        printf("OVERLOADED: queues grow without bound, latencies below are meaningless\n");
+    }
+    printf("\n%-4s %-13s %8s %7s %7s %9s %9s %9s %9s\n",
+           "axis", "command", "rate", "tx B", "rx B", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (int i = 0; i < StreamCount; i++) {
+        PlanStream_t *st = &Streams[i];
+        qsort(st->latency, st->latencyCount, sizeof(double), cmpDouble);
+        printf("%-4d %-13s %8.1f %7.2f %7.2f %9.2f %9.2f %9.2f %9.2f\n",
+               st->axis, st->cmd->name, st->rate, meanTx[i], meanRx[i],
+               1000 * percentile(st->latency, st->latencyCount, 0.5),
+               1000 * percentile(st->latency, st->latencyCount, 0.9),
+               1000 * percentile(st->latency, st->latencyCount, 0.99),
+               1000 * percentile(st->latency, st->latencyCount, 1.0));
+    }
+
+    // Highest sustainable rate: scale one axis's streams together, everything else fixed,
+    // until the busier direction reaches the target utilisation
+    printf("\nsustainable at %.0f%% utilisation, scaling one axis at a time:\n", 100 * target);
+    printf("%-4s %8s   %s\n", "axis", "scale", "max rates (Hz)");
+    for (int axis = 0; axis < DMM_MAX_AXES; axis++) {
+        double axTx = 0, axRx = 0;
+        Boolean present = false;
+        for (int i = 0; i < StreamCount; i++) {
+            if (Streams[i].axis == axis && !Streams[i].fixed) {
+                present = true;
+                axTx += meanTx[i] * Streams[i].rate;
+                axRx += meanRx[i] * Streams[i].rate;
+            }
+        }
+        if (!present) {
+            continue;
+        }
+        double scale = INFINITY;
+        if (axTx > 0) {
+            scale = fmin(scale, (target * capacity - (loadTx - axTx)) / axTx);
+        }
+        if (axRx > 0) {
+            scale = fmin(scale, (target * capacity - (loadRx - axRx)) / axRx);
+        }
+        if (scale < 0) {
+            scale = 0;
+        }
+        printf("%-4d %7.2fx  ", axis, scale);
+        for (int i = 0; i < StreamCount; i++) {
+            if (Streams[i].axis == axis) {
+                printf(" %s %.1f", Streams[i].cmd->name, Streams[i].rate * (Streams[i].fixed ? 1 : scale));
+            }
+        }
+        printf("\n");
+    }
+    return (loadTx > target * capacity || loadRx > target * capacity) ? EX_UNAVAILABLE : EX_OK;
+}
@@ -0,0 +1,301 @@
+//
+//  DmmReactorCheck.c
+//  dmmreactorcheck - DmmReactor against many pty pairs (Linux)
+//
+//  Every port is a pty pair: DmmReactor owns the tty side, and a fake drive
+//  on the master side decodes what arrives with a DmmProtocolState_t of its
+//  own and answers every General_Read with an Is_AbsPos32. Each round every
+//  port is sent moves and reads whose values carry the port and a sequence
+//  number, more bytes at once than a tty takes, so the transmit rings drain
+//  over several passes with EPOLLOUT. The fake drives write their replies in
+//  pieces of random size, so replies for different ports come in interleaved
+//  and split across reads.
+//
+//  Checks that every fake drive got exactly its own port's packages, in
+//  order; that every reply event came back on the port that answered it, for
+//  the axis and value asked; and that nothing was dropped from a transmit
+//  ring or failed its check on the way.
+//
+//  Build:
+//    cc -std=gnu99 -O2 -DDMM_STANDALONE -IDmmDriver -o dmmreactorcheck DmmReactorCheck/DmmReactorCheck.c
+//       DmmDriver/DmmReactor.c DmmDriver/DmmDriver.c DmmDriver/DmmClock.c -lutil
+//
+//  Output, one tab separated row: ports, rounds, packages sent, replies,
+//  errors, wall seconds. Exits 70 on any error, or if a round's replies
+//  don't all arrive within a second.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <pty.h>
+#include <sysexits.h>
+
+#include "DmmDriver.h"
+#include "DmmProtocol.h"
+#include "DmmReactor.h"
+
+#define CHECK_MAX_PORTS 256
+#define CHECK_ROUND_US 1000000      // A round's replies all arrive within this
+#define CHECK_REPORT_ERRORS 10      // Described on stderr, the rest only counted
+
+// The drive end of a port
+typedef struct {
+    int port;
+    int fd;                     // pty master
+    DmmProtocolState_t rx;      // Decodes what the reactor sent
+    unsigned long nextMove, nextRead; // Sequence numbers expected next
+    unsigned char out[4096];    // Replies not written yet
+    int outLen;
+} CheckDrive_t;
+
+typedef struct {
+    DmmReactor_t reactor;
+    CheckDrive_t drive[CHECK_MAX_PORTS];
+    int ports;
+    unsigned long nextReply[CHECK_MAX_PORTS]; // Read sequence the next reply answers
+    unsigned long sent, replies, errors;
+    unsigned int rng;
+} DmmReactorCheck_t;
+
+static DmmReactorCheck_t check;
+
+// Values carry the port in the high bits and a sequence number in the low 16
+static long tagged(int port, unsigned long seq) {
+    return (long)port << 16 | (long)(seq & 0xffff);
+}
+
+static char axisFor(unsigned long seq) {
+    return (char)(seq % DMM_MAX_AXES);
+}
+
+static void fail(const char *what, int port, long got, long want) {
+    if (check.errors++ < CHECK_REPORT_ERRORS) {
+        fprintf(stderr, "dmmreactorcheck: port %d: %s, got %ld, want %ld\n", port, what, got, want);
+    }
+}
+
+static unsigned int random32(void) {
+    check.rng ^= check.rng << 13;
+    check.rng ^= check.rng >> 17;
+    check.rng ^= check.rng << 5;
+    return check.rng;
+}
+
+static void noPosition(long pos, void *hook) {
+    // Everything comes through DriveFrame
+}
+
+// A package the reactor sent, decoded at the drive end
+static void DriveFrame(char axis, unsigned char func, long value, void *hook) {
+    CheckDrive_t *d = (CheckDrive_t*)hook;
+    if (func == Go_Absolute_Pos) {
+        long want = tagged(d->port, d->nextMove);
+        if (value != want || axis != axisFor(d->nextMove)) {
+            fail("move out of order or from another port", d->port, value, want);
+        }
+        d->nextMove++;
+    } else if (func == General_Read && value == Is_AbsPos32) {
+        unsigned char B[8];
+        int length = Encode_Package(Is_AbsPos32, axis, tagged(d->port, d->nextRead), B);
+        if (axis != axisFor(d->nextRead)) {
+            fail("read for the wrong axis", d->port, axis, axisFor(d->nextRead));
+        }
+        if (d->outLen + length <= (int)sizeof(d->out)) {
+            memcpy(d->out + d->outLen, B, length);
+            d->outLen += length;
+        } else {
+            fail("reply backlog full", d->port, d->outLen, (long)sizeof(d->out));
+        }
+        d->nextRead++;
+    } else {
+        fail("unexpected function code", d->port, func, General_Read);
+    }
+}
+
+static void ReportEvents(const DmmReactorEvent_t *events, int count, void *hook) {
+    for (int i = 0; i < count; i++) {
+        const DmmReactorEvent_t *e = &events[i];
+        unsigned long seq = check.nextReply[e->port]++;
+        check.replies++;
+        if (e->code != Is_AbsPos32) {
+            fail("reply with the wrong code", e->port, e->code, Is_AbsPos32);
+        } else if (e->value != tagged(e->port, seq) || e->axis != axisFor(seq)) {
+            fail("reply for another port or out of order", e->port, e->value, tagged(e->port, seq));
+        }
+    }
+}
+
+static void ReportPortError(int port, int err, void *hook) {
+    fail(strerror(err), port, err, 0);
+}
+
+// Everything the reactor has written so far, through the fake drive
+static void serviceDrive(CheckDrive_t *d) {
+    unsigned char buf[512];
+    ssize_t n;
+    while ((n = read(d->fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            ReadPackage(&d->rx, buf[i]);
+        }
+    }
+    // Replies go back a random piece at a time, frames split anywhere
+    if (d->outLen > 0) {
+        int piece = 1 + (int)(random32() % (unsigned int)d->outLen);
+        n = write(d->fd, d->out, piece);
+        if (n > 0) {
+            memmove(d->out, d->out + n, d->outLen - n);
+            d->outLen -= (int)n;
+        }
+    }
+}
+
+static Boolean openPort(int i) {
+    int master, slave;
+    struct termios tio;
+    memset(&tio, 0, sizeof(tio));
+    cfmakeraw(&tio);
+    if (openpty(&master, &slave, NULL, &tio, NULL) != 0) {
+        fprintf(stderr, "dmmreactorcheck: openpty: %s\n", strerror(errno));
+        return false;
+    }
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    fcntl(slave, F_SETFL, fcntl(slave, F_GETFL) | O_NONBLOCK);
+    if (DmmReactor_AddPort(&check.reactor, slave) != i) {
+        fprintf(stderr, "dmmreactorcheck: can't add port %d: %s\n", i, strerror(errno));
+        close(master);
+        return false;
+    }
+    CheckDrive_t *d = &check.drive[i];
+    memset(d, 0, sizeof(*d));
+    d->port = i;
+    d->fd = master;
+    d->rx.ReportPositionPtr = &noPosition;
+    d->rx.ReportReplyPtr = &DriveFrame;
+    d->rx.hook = d;
+    return true;
+}
+
+// moves and reads per port, interleaved, all queued before the reactor runs
+static void sendRound(int moves, int reads) {
+    for (int i = 0; i < check.ports; i++) {
+        DmmProtocolState_t *pp = DmmReactor_State(&check.reactor, i);
+        static unsigned long moveSeq[CHECK_MAX_PORTS], readSeq[CHECK_MAX_PORTS];
+        for (int k = 0; k < moves || k < reads; k++) {
+            if (k < moves) {
+                MoveMotorToAbsolutePosition32(pp, axisFor(moveSeq[i]), tagged(i, moveSeq[i]));
+                moveSeq[i]++;
+                check.sent++;
+            }
+            if (k < reads) {
+                ReadMotorPosition32(pp, axisFor(readSeq[i]));
+                readSeq[i]++;
+                check.sent++;
+            }
+        }
+    }
+}
+
+static Boolean roundDone(unsigned long repliesWanted) {
+    if (check.replies < repliesWanted) {
+        return false;
+    }
+    for (int i = 0; i < check.ports; i++) {
+        if (DmmReactor_TxQueued(&check.reactor, i) > 0 || check.drive[i].outLen > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: dmmreactorcheck [-n ports] [-r rounds] [-m moves] [-q reads] [-s seed]\n"
+            "  -n  pty pairs, default 64\n"
+            "  -r  rounds, default 100\n"
+            "  -m  moves per port per round, default 60 (7 bytes each)\n"
+            "  -q  position reads per port per round, default 40\n"
+            "  -s  seed for the reply piece sizes, default 1\n");
+    exit(EX_USAGE);
+}
+
+int main(int argc, char **argv) {
+    int rounds = 100, moves = 60, reads = 40;
+    int opt;
+    check.ports = 64;
+    check.rng = 1;
+    while ((opt = getopt(argc, argv, "n:r:m:q:s:")) != -1) {
+        switch (opt) {
+            case 'n': check.ports = atoi(optarg); break;
+            case 'r': rounds = atoi(optarg); break;
+            case 'm': moves = atoi(optarg); break;
+            case 'q': reads = atoi(optarg); break;
+            case 's': check.rng = (unsigned int)strtoul(optarg, NULL, 10) | 1; break;
+            default: usage();
+        }
+    }
+    if (optind != argc || check.ports < 1 || check.ports > CHECK_MAX_PORTS || rounds < 1 || moves < 0 || reads < 0
+        || (moves + reads) * DMM_MAX_FRAME > DMM_REACTOR_TX_RING) {
+        usage();
+    }
+    if (!DmmReactor_Init(&check.reactor, check.ports)) {
+        fprintf(stderr, "dmmreactorcheck: can't start the reactor: %s\n", strerror(errno));
+        return EX_OSERR;
+    }
+    check.reactor.ReportEventsPtr = &ReportEvents;
+    check.reactor.ReportPortErrorPtr = &ReportPortError;
+    for (int i = 0; i < check.ports; i++) {
+        if (!openPort(i)) {
+            return EX_OSERR;
+        }
+    }
+
+    DmmTime_t start = DmmNow();
+    Boolean stalled = false;
+    for (int r = 0; r < rounds && !stalled; r++) {
+        unsigned long repliesWanted = check.replies + (unsigned long)check.ports * reads;
+        sendRound(moves, reads);
+        DmmTime_t deadline = DmmNow() + CHECK_ROUND_US;
+        while (!roundDone(repliesWanted)) {
+            if (DmmNow() > deadline) {
+                fprintf(stderr, "dmmreactorcheck: round %d: %lu of %lu replies\n", r, check.replies, repliesWanted);
+                stalled = true;
+                break;
+            }
+            if (DmmReactor_Run(&check.reactor, 1) < 0) {
+                fprintf(stderr, "dmmreactorcheck: epoll: %s\n", strerror(errno));
+                return EX_OSERR;
+            }
+            for (int i = 0; i < check.ports; i++) {
+                serviceDrive(&check.drive[i]);
+            }
+        }
+    }
+    double wall = (DmmNow() - start) / 1e6;
+
+    for (int i = 0; i < check.ports; i++) {
+        DmmReactorPort_t *port = &check.reactor.ports[i];
+        if (port->txDropped > 0) {
+            fail("bytes dropped from the transmit ring", i, (long)port->txDropped, 0);
+        }
+        if (port->state.CrcErrors > 0 || check.drive[i].rx.CrcErrors > 0) {
+            fail("frames failed their check", i, (long)(port->state.CrcErrors + check.drive[i].rx.CrcErrors), 0);
+        }
+        if (!stalled && (check.drive[i].nextMove != (unsigned long)rounds * moves
+                         || check.drive[i].nextRead != (unsigned long)rounds * reads)) {
+            fail("packages missing at the drive", i, (long)(check.drive[i].nextMove + check.drive[i].nextRead),
+                 (long)rounds * (moves + reads));
+        }
+    }
+    printf("ports\trounds\tsent\treplies\terrors\twall_s\n");
+    printf("%d\t%d\t%lu\t%lu\t%lu\t%.2f\n", check.ports, rounds, check.sent, check.replies, check.errors, wall);
+    DmmReactor_Close(&check.reactor);
+    for (int i = 0; i < check.ports; i++) {
+        close(check.drive[i].fd);
+    }
+    return stalled || check.errors > 0 ? EX_SOFTWARE : EX_OK;
+}
@@ -10,12 +10,42 @@
 #include "ext_obex.h"						// required for new style Max object
 
 #include "DmmDriver.h"
+#include "DmmProtocol.h"
+#include "DmmLoop.h"
+#include "DmmEstimator.h"
+#include "DmmDiscover.h"
+#include "DmmScan.h"
+#include "DmmHoming.h"
+#include "DmmIngress.h"
+#include "DmmMailbox.h"
+#include "DmmSpline.h"
+#include "DmmSegments.h"
+#include "DmmHistory.h"
+#include "DmmThermal.h"
+#include "DmmHybrid.h"
+#include "DmmLink.h"
+#include "DmmRelative.h"
 
-#define MAX_ACCEL 4
+#define MAX_ACCEL 4 // Base limits, brought down by the thermal governor
 #define MAX_SPEED 1
+#define CRC_POST_US 60000000 // Replies that fail their check are posted as a count, this often at most
 
 void SerialWrite(char c, void* hook);
-void ReportPosition(long value, void* hook);
+void SerialWriteBuffer(const unsigned char *bytes, int length, void* hook);
+void ReportPosition(long value, const DmmReplyTiming_t *timing, void* hook);
+void ReportReply(char axis, unsigned char code, long value, void* hook);
+void ReportTrackingError(char axis, long error, long speed, void* hook);
+void ReportSnapshot(const DmmAxisSnapshot_t *axes, int count, DmmTime_t elapsedUs, void* hook);
+void ReportScan(const DmmAxisSnapshot_t *axes, int count, DmmTime_t elapsedUs, void* hook);
+void ReportHoming(char axis, Boolean ok, DmmTime_t detectUs, DmmTime_t windowUs, DmmTime_t totalUs, void* hook);
+void IngressWake(void* hook);
+void IngressDispatch(DmmIngressKind_t kind, char axis, long value, void* hook);
+void MailboxDispatch(DmmMailboxKind_t kind, char axis, long value, void* hook);
+void ReportSegmentGap(char axis, DmmTime_t gapUs, int remaining, void* hook);
+void ReportSegmentsDone(char axis, Boolean ok, unsigned long segments, DmmTime_t totalGapUs, DmmTime_t maxGapUs, void* hook);
+void ReportLimits(char axis, int speed, int accel, double heat, void* hook);
+void ReportDrift(char axis, double error, int trim, void* hook);
+void ReportLink(Boolean up, DmmTime_t downUs, int replayed, void* hook);
 
 ////////////////////////// object struct
 typedef struct _dmmsend 
@@ -23,7 +53,29 @@ typedef struct _dmmsend
 	t_object    ob;			// the object itself (must be first)
     void *m_serialOutlet;
     void *m_posOutlet;
+    void *m_trackingOutlet;
+    void *m_infoOutlet;
     DmmProtocolState_t state;
+    DmmLoop_t loop;
+    DmmEstimator_t estimator;
+    DmmDiscover_t discover;
+    DmmScan_t scan;
+    DmmHoming_t homing;
+    DmmIngress_t ingress;
+    DmmMailbox_t mailbox;
+    DmmSpline_t spline;
+    DmmSegments_t segments;
+    DmmHistory_t history;
+    Boolean historyOpen;
+    DmmThermal_t thermal;
+    DmmHybrid_t hybrid;
+    Boolean hybridMode;
+    DmmLink_t link;
+    DmmRelative_t relative;
+    Boolean relativeMode;
+    unsigned long crcErrorsPosted;
+    DmmTime_t crcPostAt;
+    void *m_clock;
     long pos_cache;
     long speed_cache;
 } t_dmmsend;
@@ -40,6 +92,14 @@ void *dmmsend_class;
 
 // Message handlers
 
+// Governed max speed and accel out to the drive, where it doesn't have them
+static void sendLimits(t_dmmsend *x, char axis) {
+    if (!DmmThermal_Reading(&x->thermal, axis)) {
+        clock_delay(x->m_clock, 1); // Torque reads from dmmsend_tick from now on
+    }
+    DmmThermal_Apply(&x->thermal, axis);
+}
+
 void dmmsend_resetOrigin(t_dmmsend *x)
 {
     assert(x);
@@ -62,15 +122,304 @@ void dmmsend_intPos(t_dmmsend *x, long pos)
 
 void dmmsend_speed(t_dmmsend *x, long speed) {
     speed = MAX(-100,MIN(100,speed)); // SAFE MAX SPEEDS
+    if (x->loop.axis[0].enabled) {
+        DmmLoop_Release(&x->loop, 0, false);
+        x->speed_cache = LONG_MIN;
+    }
+    DmmSpline_Clear(&x->spline, 0);
+    DmmSegments_Stop(&x->segments, 0);
     if (speed != x->speed_cache) {
-        SetMaxSpeed(&(x->state), 0, MAX_SPEED);
-        SetMaxAccel(&(x->state), 0, MAX_ACCEL);
-        MoveMotorConstantRotation(&(x->state),0,speed);
+        sendLimits(x, 0);
+        if (x->hybridMode) {
+            if (!x->hybrid.axis[0].active) {
+                clock_delay(x->m_clock, 1); // Position reads from dmmsend_tick
+            }
+            DmmHybrid_Speed(&x->hybrid, 0, speed);
+        } else {
+            MoveMotorConstantRotation(&(x->state),0,speed);
+        }
 //        post("Move at Contant Speed: %d\n",speed);
         x->speed_cache = speed;
     }
 }
 
+// Closed loop: the driver chases pos with Turn_ConstSpeed corrections off every position reply
+void dmmsend_track(t_dmmsend *x, long pos) {
+    sendLimits(x, 0);
+    DmmSpline_Clear(&x->spline, 0);
+    DmmSegments_Stop(&x->segments, 0);
+    DmmHybrid_Stop(&x->hybrid, 0);
+    DmmLoop_Track(&x->loop, 0, pos, 0);
+    x->speed_cache = LONG_MIN; // The loop owns the speed now
+    clock_delay(x->m_clock, 1); // Reads that go unanswered are sent again from dmmsend_tick
+}
+
+void dmmsend_loopGains(t_dmmsend *x, double kp, double ki, double kd) {
+    DmmLoop_SetGains(&x->loop, 0, kp, ki, kd, 100); // SAFE MAX SPEEDS
+}
+
+void dmmsend_release(t_dmmsend *x) {
+    DmmLoop_Release(&x->loop, 0, true);
+    x->speed_cache = LONG_MIN;
+}
+
+// Estimated position and velocity, offsetMs from now, without touching the link
+void dmmsend_estimate(t_dmmsend *x, double offsetMs) {
+    long pos;
+    double vel;
+    if (DmmEstimator_Query(&x->estimator, 0, DmmNow() + (DmmTime_t)(offsetMs * 1000), &pos, &vel)) {
+        t_atom av[2];
+        atom_setlong(av, pos);
+        atom_setfloat(av + 1, vel);
+        outlet_anything(x->m_infoOutlet, gensym("estimate"), 2, av);
+    }
+}
+
+// moveAll p0 p1 ... : axis i goes to pi, all packages in a single serial write
+void dmmsend_moveAll(t_dmmsend *x, t_symbol *s, long argc, t_atom *argv) {
+    char axes[DMM_MAX_AXES];
+    long pos[DMM_MAX_AXES];
+    int n = (int)MIN(argc, DMM_MAX_AXES);
+    for (int i = 0; i < n; i++) {
+        axes[i] = (char)i;
+        pos[i] = atom_getlong(argv + i);
+        if (x->loop.axis[i].enabled) {
+            DmmLoop_Release(&x->loop, axes[i], false);
+        }
+        DmmSpline_Clear(&x->spline, axes[i]);
+        DmmSegments_Stop(&x->segments, axes[i]);
+        DmmHybrid_Stop(&x->hybrid, axes[i]);
+        sendLimits(x, axes[i]);
+    }
+    if (n > 0) {
+        x->speed_cache = LONG_MIN;
+    }
+    t_atom spread;
+    atom_setlong(&spread, MoveAllToAbsolutePosition32(&(x->state), axes, pos, n));
+    outlet_anything(x->m_infoOutlet, gensym("spread"), 1, &spread);
+}
+
+void dmmsend_tick(t_dmmsend *x) {
+    Boolean discovering = DmmDiscover_Poll(&x->discover);
+    Boolean scanning = DmmScan_Poll(&x->scan);
+    Boolean homing = DmmHoming_Poll(&x->homing);
+    Boolean tracking = DmmLoop_Poll(&x->loop);
+    DmmIngress_Poll(&x->ingress, 0);
+    Boolean mailbox = x->mailbox.shared != NULL;
+    if (mailbox) {
+        DmmMailbox_Poll(&x->mailbox, 0);
+    }
+    Boolean streaming = DmmSpline_Poll(&x->spline);
+    Boolean moving = DmmSegments_Poll(&x->segments);
+    Boolean governing = DmmThermal_Poll(&x->thermal);
+    Boolean hybrid = DmmHybrid_Poll(&x->hybrid);
+    Boolean linked = DmmLink_Poll(&x->link);
+    if (x->state.CrcErrors != x->crcErrorsPosted && DmmNow() >= x->crcPostAt) {
+        post("CRC errors: %lu more, %lu in all\n", x->state.CrcErrors - x->crcErrorsPosted, x->state.CrcErrors);
+        x->crcErrorsPosted = x->state.CrcErrors;
+        x->crcPostAt = DmmNow() + CRC_POST_US;
+    }
+    if (discovering || scanning || homing || tracking || mailbox || streaming || moving || governing || hybrid || linked) {
+        clock_delay(x->m_clock, 1);
+    }
+}
+
+// discover [axis ...] : read every parameter of every axis, pipelined, default axis 0
+void dmmsend_discover(t_dmmsend *x, t_symbol *s, long argc, t_atom *argv) {
+    char axes[DMM_MAX_AXES];
+    int n = (int)MIN(argc, DMM_MAX_AXES);
+    for (int i = 0; i < n; i++) {
+        axes[i] = (char)atom_getlong(argv + i);
+    }
+    if (n == 0) {
+        axes[n++] = 0;
+    }
+    DmmDiscover_Start(&x->discover, axes, n);
+    clock_delay(x->m_clock, 1);
+}
+
+// scan [first last] : find the drives on the bus, IDs 0 - 127 by default
+void dmmsend_scan(t_dmmsend *x, t_symbol *s, long argc, t_atom *argv) {
+    int first = argc > 0 ? (int)atom_getlong(argv) : 0;
+    int last = argc > 1 ? (int)atom_getlong(argv + 1) : DMM_MAX_AXES - 1;
+    DmmScan_Start(&x->scan, first, last);
+    clock_delay(x->m_clock, 1);
+}
+
+// home <speed> [falling] : turn until the CNC zero input changes, stop, reset the origin there
+void dmmsend_home(t_dmmsend *x, long speed, long falling) {
+    speed = MAX(-100,MIN(100,speed)); // SAFE MAX SPEEDS
+    DmmLoop_Release(&x->loop, 0, false);
+    sendLimits(x, 0);
+    DmmSpline_Clear(&x->spline, 0);
+    DmmSegments_Stop(&x->segments, 0);
+    DmmHybrid_Stop(&x->hybrid, 0);
+    DmmHoming_Start(&x->homing, 0, speed, falling == 0); // Rising edge unless asked
+    x->speed_cache = LONG_MIN;
+    clock_delay(x->m_clock, 1);
+}
+
+#if !defined(_WIN32) // No UDP listener or shared memory mailbox on Windows
+
+// listen <port> : take OSC /axis/N/speed, /axis/N/pos (or binary) setpoints over UDP, 0 stops
+void dmmsend_listen(t_dmmsend *x, long port) {
+    DmmIngress_Stop(&x->ingress);
+    if (port > 0 && port < 65536 && DmmIngress_Start(&x->ingress, (unsigned short)port)) {
+        post("DmmSend listening on udp port %ld\n", port);
+    }
+}
+
+// "ingress setpoints superseded malformed mean_ms max_ms", receive to serial write
+void dmmsend_ingress(t_dmmsend *x) {
+    DmmHistogram_t latency;
+    t_atom av[5];
+    atom_setlong(av, DmmIngress_Latency(&x->ingress, &latency));
+    atom_setlong(av + 1, x->ingress.superseded);
+    atom_setlong(av + 2, x->ingress.malformed);
+    atom_setfloat(av + 3, DmmHistogram_Mean(&latency) / 1000.0);
+    atom_setfloat(av + 4, latency.maxUs / 1000.0);
+    outlet_anything(x->m_infoOutlet, gensym("ingress"), 5, av);
+}
+
+// mailbox <name> : send what other processes write to the shared memory mailbox /name, no name closes it
+void dmmsend_mailbox(t_dmmsend *x, t_symbol *name) {
+    DmmMailbox_Close(&x->mailbox);
+    if (name && name->s_name[0]) {
+        if (DmmMailbox_Open(&x->mailbox, &(x->state), name->s_name, true, DMM_MAX_AXES)) {
+            x->mailbox.DispatchPtr = &MailboxDispatch;
+            x->mailbox.hook = (void*)x;
+            clock_delay(x->m_clock, 1);
+        }
+    }
+}
+
+#endif
+
+// waypoint <pos> <ms> : be at pos ms from now, on a smooth curve through the waypoints queued so far
+void dmmsend_waypoint(t_dmmsend *x, long pos, double ms) {
+    if (DmmSpline_Queued(&x->spline, 0) == 0) {
+        DmmSegments_Stop(&x->segments, 0);
+        DmmHybrid_Stop(&x->hybrid, 0);
+        DmmLoop_Release(&x->loop, 0, false);
+        sendLimits(x, 0);
+        x->speed_cache = LONG_MIN;
+    }
+    if (!DmmSpline_Add(&x->spline, 0, DmmNow() + (DmmTime_t)(ms * 1000), pos)) {
+        post("Waypoint ignored, queue full or not after the last one\n");
+    }
+    clock_delay(x->m_clock, 0);
+}
+
+// waypointTolerance <counts> : a package may be this far off the curve where that makes it shorter
+void dmmsend_waypointTolerance(t_dmmsend *x, long counts) {
+    x->spline.tolerance = MAX(0, counts);
+}
+
+void dmmsend_waypointClear(t_dmmsend *x) {
+    DmmSpline_Clear(&x->spline, 0);
+}
+
+// segment <pos> <speed> <accel> : queue a move, run back to back with the ones before it
+void dmmsend_segment(t_dmmsend *x, long pos, long speed, long accel) {
+    if (DmmSegments_Queued(&x->segments, 0) == 0) {
+        DmmSpline_Clear(&x->spline, 0);
+        DmmHybrid_Stop(&x->hybrid, 0);
+        DmmLoop_Release(&x->loop, 0, false);
+        if (!DmmThermal_Reading(&x->thermal, 0)) {
+            clock_delay(x->m_clock, 1);
+        }
+        DmmThermal_Release(&x->thermal, 0); // Segments send their own limits, within the governed ones
+        x->speed_cache = LONG_MIN;
+    }
+    int speedLimit, accelLimit;
+    DmmThermal_Limits(&x->thermal, 0, &speedLimit, &accelLimit);
+    speed = MAX(1,MIN(speedLimit,speed)); // SAFE MAX SPEEDS
+    accel = MAX(1,MIN(accelLimit,accel));
+    if (!DmmSegments_Add(&x->segments, 0, pos, (int)speed, (int)accel)) {
+        post("Segment ignored, queue full\n");
+    }
+    clock_delay(x->m_clock, 1);
+}
+
+void dmmsend_segmentClear(t_dmmsend *x) {
+    DmmSegments_Clear(&x->segments, 0);
+}
+
+#if !defined(_WIN32) // No history store on Windows
+
+// history <dir> : record position and torque replies to the store in dir, history alone stops
+void dmmsend_history(t_dmmsend *x, t_symbol *dir) {
+    if (x->historyOpen) {
+        DmmHistory_Close(&x->history);
+        x->historyOpen = false;
+    }
+    if (dir && dir->s_name[0]) {
+        x->historyOpen = DmmHistory_Open(&x->history, &(x->state), dir->s_name);
+        if (!x->historyOpen) {
+            post("History store %s can't be opened\n", dir->s_name);
+        }
+    }
+}
+
+// historyRange <seconds> : "history pos|torque min max mean count" over the last seconds
+void dmmsend_historyRange(t_dmmsend *x, double seconds) {
+    if (!x->historyOpen) {
+        post("No history store, send history <dir> first\n");
+        return;
+    }
+    int64_t now = DmmHistory_Now(&x->history);
+    const char *names[History_Channels] = { "pos", "torque" };
+    for (int c = 0; c < History_Channels; c++) {
+        DmmHistorySummary_t r;
+        DmmHistory_Range(&x->history, 0, (DmmHistoryChannel_t)c, now - (int64_t)(seconds * 1e6), now, &r);
+        t_atom av[5];
+        atom_setsym(av, gensym(names[c]));
+        atom_setlong(av + 1, r.min);
+        atom_setlong(av + 2, r.max);
+        atom_setfloat(av + 3, r.count ? (double)r.sum / r.count : 0);
+        atom_setlong(av + 4, r.count);
+        outlet_anything(x->m_infoOutlet, gensym("history"), 5, av);
+    }
+}
+
+#endif
+
+// hybrid <on> [speed_scale] : speed keeps its place, trimmed off sparse position reads; 0 goes back to plain speed
+void dmmsend_hybrid(t_dmmsend *x, long on, double speedScale) {
+    x->hybridMode = on != 0;
+    if (speedScale > 0) {
+        x->hybrid.speedScale = speedScale;
+    }
+    if (!x->hybridMode) {
+        DmmHybrid_Stop(&x->hybrid, 0);
+    }
+    x->speed_cache = LONG_MIN; // The next speed goes out either way
+}
+
+// relative <on> [resync_ms] : waypoint and ingress positions go as steps where those are shorter,
+// absolute again at least every resync_ms
+void dmmsend_relative(t_dmmsend *x, long on, double resyncMs) {
+    x->relativeMode = on != 0;
+    x->spline.relative = x->relativeMode ? &x->relative : NULL;
+    if (resyncMs > 0) {
+        x->relative.resyncUs = (DmmTime_t)(resyncMs * 1000);
+    }
+}
+
+// thermal <ceiling> <tau_s> <rated_current> : governor settings, heat 1 is continuous rated current
+void dmmsend_thermal(t_dmmsend *x, double ceiling, double tau, double rated) {
+    if (ceiling > 0) {
+        x->thermal.ceiling = ceiling;
+    }
+    if (tau > 0) {
+        x->thermal.tauUs = (DmmTime_t)(tau * 1e6);
+    }
+    if (rated > 0) {
+        x->thermal.ratedCurrent = rated;
+    }
+    post("Thermal ceiling %.2f, tau %.1f s, rated current %.0f\n", x->thermal.ceiling, x->thermal.tauUs / 1e6, x->thermal.ratedCurrent);
+}
+
 void dmmsend_readPos(t_dmmsend *x) {
     ReadMotorPosition32(&(x->state), 0);
 }
@@ -91,10 +440,194 @@ void SerialWrite(char c, void* hook) {
 }
 
 
-void ReportPosition(long pos, void* hook) {
+static void outputParams(t_dmmsend *x, const DmmAxisSnapshot_t *axes, int count) {
+    t_atom av[Param_Count + 2];
+    for (int i = 0; i < count; i++) {
+        atom_setlong(av, axes[i].axis);
+        for (int p = 0; p < Param_Count; p++) {
+            atom_setlong(av + 1 + p, axes[i].value[p]);
+        }
+        atom_setlong(av + 1 + Param_Count, axes[i].missing);
+        outlet_anything(x->m_infoOutlet, gensym("params"), Param_Count + 2, av);
+    }
+}
+
+// One "params axis <values...> missing" message per axis, then "discovered ms"
+void ReportSnapshot(const DmmAxisSnapshot_t *axes, int count, DmmTime_t elapsedUs, void* hook) {
+    t_dmmsend* x = (t_dmmsend*)hook;
+    t_atom ms;
+    assert(x);
+    outputParams(x, axes, count);
+    atom_setfloat(&ms, elapsedUs / 1000.0);
+    outlet_anything(x->m_infoOutlet, gensym("discovered"), 1, &ms);
+}
+
+// "found id ...", the drives' "params", then "scanned ms"
+void ReportScan(const DmmAxisSnapshot_t *axes, int count, DmmTime_t elapsedUs, void* hook) {
     t_dmmsend* x = (t_dmmsend*)hook;
+    t_atom av[DMM_MAX_AXES];
     assert(x);
-    outlet_int(x->m_posOutlet, pos);
+    for (int i = 0; i < count; i++) {
+        atom_setlong(av + i, axes[i].axis);
+    }
+    outlet_anything(x->m_infoOutlet, gensym("found"), count, av);
+    outputParams(x, axes, count);
+    atom_setfloat(av, elapsedUs / 1000.0);
+    outlet_anything(x->m_infoOutlet, gensym("scanned"), 1, av);
+}
+
+// "homed ok detect_ms window_ms total_ms"
+void ReportHoming(char axis, Boolean ok, DmmTime_t detectUs, DmmTime_t windowUs, DmmTime_t totalUs, void* hook) {
+    t_dmmsend* x = (t_dmmsend*)hook;
+    t_atom av[4];
+    assert(x);
+    atom_setlong(av, ok);
+    atom_setfloat(av + 1, detectUs / 1000.0);
+    atom_setfloat(av + 2, windowUs / 1000.0);
+    atom_setfloat(av + 3, totalUs / 1000.0);
+    outlet_anything(x->m_infoOutlet, gensym("homed"), 4, av);
+}
+
+void SerialWriteBuffer(const unsigned char *bytes, int length, void* hook) {
+    t_dmmsend* x = (t_dmmsend*)hook;
+    t_atom av[DMM_MAX_AXES * DMM_MAX_FRAME];
+    assert(x);
+    length = MIN(length, DMM_MAX_AXES * DMM_MAX_FRAME);
+    for (int i = 0; i < length; i++) {
+        atom_setlong(av + i, bytes[i]);
+    }
+    outlet_list(x->m_serialOutlet, NULL, length, av); // serial writes a list in one go
+}
+
+// Listener thread; the setpoints go out from dmmsend_tick
+void IngressWake(void* hook) {
+    t_dmmsend* x = (t_dmmsend*)hook;
+    clock_delay(x->m_clock, 0);
+}
+
+void IngressDispatch(DmmIngressKind_t kind, char axis, long value, void* hook) {
+    t_dmmsend* x = (t_dmmsend*)hook;
+    assert(x);
+    if (x->loop.axis[(int)axis].enabled) {
+        DmmLoop_Release(&x->loop, axis, false);
+    }
+    DmmSpline_Clear(&x->spline, axis);
+    DmmSegments_Stop(&x->segments, axis);
+    DmmHybrid_Stop(&x->hybrid, axis);
+    sendLimits(x, axis);
+    if (kind == Ingress_Speed) {
+        value = MAX(-100,MIN(100,value)); // SAFE MAX SPEEDS
+        MoveMotorConstantRotation(&(x->state), axis, value);
+        if (axis == 0) {
+            x->speed_cache = value;
+        }
+    } else {
+        if (x->relativeMode) {
+            DmmRelative_Move(&x->relative, axis, value);
+        } else {
+            MoveMotorToAbsolutePosition32(&(x->state), axis, value);
+        }
+        if (axis == 0) {
+            x->speed_cache = LONG_MIN;
+        }
+    }
+}
+
+void MailboxDispatch(DmmMailboxKind_t kind, char axis, long value, void* hook) {
+    IngressDispatch(kind == Mailbox_Speed ? Ingress_Speed : Ingress_Position, axis, value, hook);
+}
+
+// "gap ms remaining": idle time between two segments, 0 when none was seen
+void ReportSegmentGap(char axis, DmmTime_t gapUs, int remaining, void* hook) {
+    t_dmmsend* x = (t_dmmsend*)hook;
+    t_atom av[2];
+    assert(x);
+    atom_setfloat(av, gapUs / 1000.0);
+    atom_setlong(av + 1, remaining);
+    outlet_anything(x->m_infoOutlet, gensym("gap"), 2, av);
+}
+
+// "segments ok count total_gap_ms max_gap_ms"
+void ReportSegmentsDone(char axis, Boolean ok, unsigned long segments, DmmTime_t totalGapUs, DmmTime_t maxGapUs, void* hook) {
+    t_dmmsend* x = (t_dmmsend*)hook;
+    t_atom av[4];
+    assert(x);
+    atom_setlong(av, ok);
+    atom_setlong(av + 1, (long)segments);
+    atom_setfloat(av + 2, totalGapUs / 1000.0);
+    atom_setfloat(av + 3, maxGapUs / 1000.0);
+    outlet_anything(x->m_infoOutlet, gensym("segments"), 4, av);
+}
+
+// "limits axis speed accel heat": the thermal governor moved the limits
+void ReportLimits(char axis, int speed, int accel, double heat, void* hook) {
+    t_dmmsend* x = (t_dmmsend*)hook;
+    t_atom av[4];
+    assert(x);
+    atom_setlong(av, axis);
+    atom_setlong(av + 1, speed);
+    atom_setlong(av + 2, accel);
+    atom_setfloat(av + 3, heat);
+    outlet_anything(x->m_infoOutlet, gensym("limits"), 4, av);
+}
+
+// "drift error trim": expected - measured position in hybrid speed mode, and the trim it got
+void ReportDrift(char axis, double error, int trim, void* hook) {
+    t_dmmsend* x = (t_dmmsend*)hook;
+    t_atom av[2];
+    assert(x);
+    atom_setfloat(av, error);
+    atom_setlong(av + 1, trim);
+    outlet_anything(x->m_infoOutlet, gensym("drift"), 2, av);
+}
+
+// "link 0" when the drives stop answering, "link 1 down_ms replayed" once they answer again and
+// whatever they missed has gone out again
+void ReportLink(Boolean up, DmmTime_t downUs, int replayed, void* hook) {
+    t_dmmsend* x = (t_dmmsend*)hook;
+    t_atom av[3];
+    assert(x);
+    atom_setlong(av, up);
+    if (!up) {
+        // Nothing is known to have got there any more
+        x->pos_cache = LONG_MIN;
+        x->speed_cache = LONG_MIN;
+        post("Serial link down\n");
+        outlet_anything(x->m_infoOutlet, gensym("link"), 1, av);
+        return;
+    }
+    post("Serial link back after %.0f ms, %d packages replayed\n", downUs / 1000.0, replayed);
+    atom_setfloat(av + 1, downUs / 1000.0);
+    atom_setlong(av + 2, replayed);
+    outlet_anything(x->m_infoOutlet, gensym("link"), 3, av);
+}
+
+// Replies to the console, as the driver would post them; positions have their outlet, and the
+// thermal governor's torque reads, the link's keepalives and the segment queue's status reads come too often
+void ReportReply(char axis, unsigned char code, long value, void* hook) {
+    t_dmmsend* x = (t_dmmsend*)hook;
+    if (code == Is_AbsPos32 || code == Is_TrqCurrent || DmmLink_IsProbeReply(&x->link)
+        || DmmSegments_IsStatusReply(&x->segments, axis, code)) {
+        return;
+    }
+    post("Axis: %d, %s (%d): Value: %ld\n", axis, ParameterName(code), code, value);
+}
+
+// "pos sample_ms age_ms": when the drive most likely sampled it (DmmNow clock) and how long ago that was
+void ReportPosition(long pos, const DmmReplyTiming_t *timing, void* hook) {
+    t_dmmsend* x = (t_dmmsend*)hook;
+    t_atom av[3];
+    assert(x);
+    atom_setlong(av, pos);
+    atom_setfloat(av + 1, timing->sampledAt / 1000.0);
+    atom_setfloat(av + 2, (DmmNow() - timing->sampledAt) / 1000.0);
+    outlet_list(x->m_posOutlet, NULL, 3, av);
+}
+
+void ReportTrackingError(char axis, long error, long speed, void* hook) {
+    t_dmmsend* x = (t_dmmsend*)hook;
+    assert(x);
+    outlet_int(x->m_trackingOutlet, error);
 }
 
 
@@ -117,6 +650,31 @@ int C74_EXPORT main(void)
     class_addmethod(c, (method)dmmsend_speed, "speed", A_LONG, 0);
     class_addmethod(c, (method)dmmsend_resetOrigin,"resetOrigin", 0);
     class_addmethod(c, (method)dmmsend_readPos,"readPosition", 0);
+    class_addmethod(c, (method)dmmsend_track, "track", A_LONG, 0);
+    class_addmethod(c, (method)dmmsend_loopGains, "loopGains", A_FLOAT, A_FLOAT, A_FLOAT, 0);
+    class_addmethod(c, (method)dmmsend_release, "release", 0);
+    class_addmethod(c, (method)dmmsend_estimate, "estimate", A_DEFFLOAT, 0);
+    class_addmethod(c, (method)dmmsend_moveAll, "moveAll", A_GIMME, 0);
+    class_addmethod(c, (method)dmmsend_discover, "discover", A_GIMME, 0);
+    class_addmethod(c, (method)dmmsend_scan, "scan", A_GIMME, 0);
+    class_addmethod(c, (method)dmmsend_home, "home", A_LONG, A_DEFLONG, 0);
+#if !defined(_WIN32)
+    class_addmethod(c, (method)dmmsend_listen, "listen", A_LONG, 0);
+    class_addmethod(c, (method)dmmsend_ingress, "ingress", 0);
+    class_addmethod(c, (method)dmmsend_mailbox, "mailbox", A_DEFSYM, 0);
+#endif
+    class_addmethod(c, (method)dmmsend_waypoint, "waypoint", A_LONG, A_FLOAT, 0);
+    class_addmethod(c, (method)dmmsend_waypointClear, "waypointClear", 0);
+    class_addmethod(c, (method)dmmsend_waypointTolerance, "waypointTolerance", A_LONG, 0);
+    class_addmethod(c, (method)dmmsend_segment, "segment", A_LONG, A_LONG, A_LONG, 0);
+    class_addmethod(c, (method)dmmsend_segmentClear, "segmentClear", 0);
+#if !defined(_WIN32)
+    class_addmethod(c, (method)dmmsend_history, "history", A_DEFSYM, 0);
+    class_addmethod(c, (method)dmmsend_historyRange, "historyRange", A_FLOAT, 0);
+#endif
+    class_addmethod(c, (method)dmmsend_hybrid, "hybrid", A_LONG, A_DEFFLOAT, 0);
+    class_addmethod(c, (method)dmmsend_relative, "relative", A_LONG, A_DEFFLOAT, 0);
+    class_addmethod(c, (method)dmmsend_thermal, "thermal", A_FLOAT, A_FLOAT, A_FLOAT, 0);
     class_addmethod(c, (method)dmmsend_intSerial, "serialByte", A_LONG, 0);
 
 	
@@ -138,7 +696,23 @@ void dmmsend_assist(t_dmmsend *x, void *b, long m, long number, char *s)
 
 void dmmsend_free(t_dmmsend *x)
 {
-	;
+    DmmLoop_Close(&x->loop);
+    DmmEstimator_Close(&x->estimator);
+    DmmDiscover_Close(&x->discover);
+    DmmScan_Close(&x->scan);
+    DmmHoming_Close(&x->homing);
+    DmmIngress_Stop(&x->ingress);
+    DmmMailbox_Close(&x->mailbox);
+    DmmSpline_Close(&x->spline);
+    DmmSegments_Close(&x->segments);
+    DmmThermal_Close(&x->thermal);
+    DmmHybrid_Close(&x->hybrid);
+    DmmLink_Close(&x->link);
+    DmmRelative_Close(&x->relative);
+    if (x->historyOpen) {
+        DmmHistory_Close(&x->history);
+    }
+    object_free(x->m_clock);
 }
 
 /*
@@ -180,9 +754,51 @@ void *dmmsend_new(t_symbol *s, long argc, t_atom *argv)
         */
         x->pos_cache = LONG_MIN;
         memset(&(x->state),0,sizeof(x->state));
+        memset(&(x->mailbox), 0, sizeof(x->mailbox));
+        x->historyOpen = false;
         x->state.SerialWritePtr = &SerialWrite;
-        x->state.ReportPositionPtr = &ReportPosition;
+        x->state.SerialWriteBufferPtr = &SerialWriteBuffer;
+        x->state.ReportPositionTimedPtr = &ReportPosition;
+        x->state.ReportReplyPtr = &ReportReply;
         x->state.hook = (void*)x;
+        x->speed_cache = LONG_MIN;
+        x->crcErrorsPosted = 0;
+        x->crcPostAt = 0;
+        DmmLoop_Init(&x->loop, &x->state);
+        x->loop.ReportTrackingErrorPtr = &ReportTrackingError;
+        x->loop.hook = (void*)x;
+        DmmEstimator_Init(&x->estimator, &x->state);
+        DmmDiscover_Init(&x->discover, &x->state);
+        x->discover.ReportSnapshotPtr = &ReportSnapshot;
+        x->discover.hook = (void*)x;
+        DmmScan_Init(&x->scan, &x->state);
+        x->scan.ReportScanPtr = &ReportScan;
+        x->scan.hook = (void*)x;
+        DmmHoming_Init(&x->homing, &x->state);
+        x->homing.ReportHomingPtr = &ReportHoming;
+        x->homing.hook = (void*)x;
+        DmmIngress_Init(&x->ingress, &x->state);
+        x->ingress.WakePtr = &IngressWake;
+        x->ingress.DispatchPtr = &IngressDispatch;
+        x->ingress.hook = (void*)x;
+        DmmSpline_Init(&x->spline, &x->state);
+        DmmSegments_Init(&x->segments, &x->state);
+        x->segments.ReportGapPtr = &ReportSegmentGap;
+        x->segments.ReportDonePtr = &ReportSegmentsDone;
+        x->segments.hook = (void*)x;
+        DmmThermal_Init(&x->thermal, &x->state, MAX_SPEED, MAX_ACCEL);
+        x->thermal.ReportLimitsPtr = &ReportLimits;
+        x->thermal.hook = (void*)x;
+        DmmHybrid_Init(&x->hybrid, &x->state, 100); // SAFE MAX SPEEDS
+        x->hybrid.ReportDriftPtr = &ReportDrift;
+        x->hybrid.hook = (void*)x;
+        x->hybridMode = false;
+        DmmLink_Init(&x->link, &x->state); // The serial object owns the port: probed, not reopened
+        x->link.ReportLinkPtr = &ReportLink;
+        x->link.hook = (void*)x;
+        DmmRelative_Init(&x->relative, &x->state);
+        x->relativeMode = false;
+        x->m_clock = clock_new((t_object *)x, (method)dmmsend_tick);
         
         post("DmmSend Created at with MaxSpeed:%d, and Max Acceleration: %d\n",MAX_SPEED,MAX_ACCEL);
         
@@ -191,8 +807,10 @@ void *dmmsend_new(t_symbol *s, long argc, t_atom *argv)
         
         //intin(...) to creat more inletls
         
-        // add outlets
-        x->m_posOutlet = intout((t_object *)x);
+        // add outlets, right to left
+        x->m_infoOutlet = outlet_new((t_object *)x, NULL); // estimate, spread
+        x->m_trackingOutlet = intout((t_object *)x);
+        x->m_posOutlet = outlet_new((t_object *)x, NULL); // pos sample_ms age_ms
         x->m_serialOutlet = intout((t_object *)x);
         return x;
 
@@ -0,0 +1,283 @@
+//
+//  DmmSoak.c
+//  dmmsoak - long runs of the dmmsend object on simulated time
+//
+//  DmmSend.c is built unmodified against the Max API shim of dmmbench and
+//  wired to a DmmSimDrive axis: the serial outlet goes down the simulated
+//  38400 baud line a byte at a time, replies come back as serialByte
+//  messages when their last bit is in, and the object's clock fires when its
+//  delay is up. DmmNow is the simulation's time throughout, so nothing waits
+//  on the wall clock and an hour of operation runs in a fraction of one.
+//
+//  A patch is played at the object: speed, track, segment, hybrid, release
+//  and readPosition messages at random, about every -e seconds. Patch, line
+//  faults (-f, -j, -n) and link outages (-d) are all drawn from the seed, so
+//  the same seed gives the same run, byte for byte; the digest printed at the
+//  end is a hash of every byte the object sent and when, to compare runs by.
+//
+//  Build:
+//    cc -std=gnu99 -O2 -DDMM_STANDALONE -IDmmDriver -IDmmBench/MaxShim -o dmmsoak DmmSoak/DmmSoak.c
+//       DmmBench/MaxShim/MaxShim.c DmmSend.c DmmDriver/DmmDriver.c DmmDriver/DmmClock.c
+//       DmmDriver/DmmLoop.c DmmDriver/DmmEstimator.c DmmDriver/DmmDiscover.c DmmDriver/DmmScan.c
+//       DmmDriver/DmmHoming.c DmmDriver/DmmIngress.c DmmDriver/DmmMailbox.c DmmDriver/DmmSpline.c
+//       DmmDriver/DmmSegments.c DmmDriver/DmmHistory.c DmmDriver/DmmThermal.c DmmDriver/DmmHybrid.c
+//       DmmDriver/DmmLink.c DmmDriver/DmmRelative.c DmmDriver/DmmSimDrive.c DmmDriver/DmmHistogram.c
+//       -lpthread -lrt -lm
+//
+//  Output, one tab separated row: seed, simulated and wall seconds, patch
+//  messages, tx and rx link utilisation, clock ticks, link drops and the
+//  longest time down, largest hybrid drift, lost phase alarms, corrupted
+//  bytes, digest. Exits 70 if the axis lost phase, or the link was still down
+//  at the end or stayed down more than a second past an outage.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sysexits.h>
+
+#include "MaxShim.h"
+#include "DmmDriver.h"
+#include "DmmSimDrive.h"
+
+#define SOAK_LINK_GRACE_US 1000000  // Longest the link may stay down after an outage ends
+
+typedef struct {
+    void *x;
+    DmmSimDrive_t sim;
+    // Outages
+    DmmTime_t unpluggedUntil;
+    DmmTime_t lastOutageEnd;
+    // Counts
+    unsigned long messages, ticks, drops, alarms, posReplies;
+    DmmTime_t downAt, maxDownUs, firstAlarmAt;
+    Boolean down;
+    double maxDrift;
+    unsigned long long digest;
+    Boolean failed;
+} DmmSoak_t;
+
+static DmmSoak_t soak;
+
+static long long nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Exponential, mean meanUs
+static DmmTime_t interval(DmmTime_t meanUs) {
+    return (DmmTime_t)(-log(1 - DmmSimDrive_Random(&soak.sim)) * meanUs) + 1;
+}
+
+static long uniform(long lo, long hi) {
+    return lo + (long)(DmmSimDrive_Random(&soak.sim) * (hi - lo + 1));
+}
+
+static Boolean unplugged(void) {
+    return soak.sim.now < soak.unpluggedUntil;
+}
+
+// Serial outlet: a package per list, or a byte per int
+static void onSerial(MaxShimOutletKind_t kind, t_symbol *s, short ac, const t_atom *av, void *ctx) {
+    unsigned char B[DMM_MAX_AXES * DMM_MAX_FRAME];
+    unsigned long long h = soak.digest;
+    int n = MIN(ac, (int)sizeof(B));
+    for (int i = 0; i < n; i++) {
+        B[i] = (unsigned char)(atom_getlong(av + i) & 0xff);
+        h = (h ^ B[i]) * 1099511628211ULL;
+    }
+    soak.digest = (h ^ (unsigned long long)soak.sim.now) * 1099511628211ULL;
+    if (!unplugged()) {
+        DmmSimDrive_HostWrite(&soak.sim, B, n);
+    }
+}
+
+static void onPosition(MaxShimOutletKind_t kind, t_symbol *s, short ac, const t_atom *av, void *ctx) {
+    soak.posReplies++;
+}
+
+static void onInfo(MaxShimOutletKind_t kind, t_symbol *s, short ac, const t_atom *av, void *ctx) {
+    if (s == gensym("link")) {
+        if (atom_getlong(av) == 0) {
+            soak.down = true;
+            soak.downAt = soak.sim.now;
+            soak.drops++;
+        } else {
+            soak.down = false;
+            soak.maxDownUs = MAX(soak.maxDownUs, soak.sim.now - soak.downAt);
+        }
+    } else if (s == gensym("drift")) {
+        soak.maxDrift = MAX(soak.maxDrift, fabs(atom_getfloat(av)));
+    }
+}
+
+static void deliver(unsigned char byte, void *hook) {
+    if (!unplugged()) {
+        MaxShim_SendLong(soak.x, "serialByte", byte);
+    }
+}
+
+static void send(const char *message, short ac, t_atom *av) {
+    MaxShim_Send(soak.x, message, ac, av);
+    soak.messages++;
+}
+
+static void sendLongs(const char *message, short ac, long a, long b, long c) {
+    t_atom av[3];
+    atom_setlong(av, a);
+    atom_setlong(av + 1, b);
+    atom_setlong(av + 2, c);
+    send(message, ac, av);
+}
+
+// One message of the patch, picked at random
+static void playPatch(void) {
+    switch (uniform(0, 9)) {
+        case 0: case 1: case 2:
+            sendLongs("speed", 1, uniform(-60, 60), 0, 0);
+            break;
+        case 3: case 4:
+            sendLongs("track", 1, uniform(-200000, 200000), 0, 0);
+            break;
+        case 5: {
+            long n = uniform(1, 4);
+            for (long i = 0; i < n; i++) {
+                sendLongs("segment", 3, uniform(-200000, 200000), uniform(2, 10), uniform(1, 4));
+            }
+            break;
+        }
+        case 6:
+            sendLongs("hybrid", 1, uniform(0, 1), 0, 0);
+            break;
+        case 7:
+            send("release", 0, NULL);
+            break;
+        default:
+            send("readPosition", 0, NULL);
+            break;
+    }
+}
+
+static void check(void) {
+    if (soak.sim.axis[0].alarm != 0) {
+        if (soak.alarms++ == 0) {
+            soak.firstAlarmAt = soak.sim.now;
+            fprintf(stderr, "dmmsoak: lost phase at %.3f s\n", soak.sim.now / 1e6);
+        }
+        soak.failed = true;
+        // Carry on from where the shaft is, as a drive reset would
+        DmmSimAxis_t *a = &soak.sim.axis[0];
+        a->alarm = 0;
+        a->refPos = a->pos;
+        a->refVel = a->vel;
+        a->integral = 0;
+    }
+    if (soak.down && !unplugged() && soak.sim.now - MAX(soak.downAt, soak.lastOutageEnd) > SOAK_LINK_GRACE_US) {
+        fprintf(stderr, "dmmsoak: link down since %.3f s, still at %.3f s\n", soak.downAt / 1e6, soak.sim.now / 1e6);
+        soak.failed = true;
+        soak.downAt = soak.sim.now; // Once per grace period
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: dmmsoak [-t hours] [-s seed] [-e seconds] [-f rate] [-j us] [-n counts] [-d per_hour] [-v]\n"
+            "  -t  simulated time, default 24 hours\n"
+            "  -s  seed for the patch and the faults, default 1\n"
+            "  -e  mean time between patch messages, default 5 s\n"
+            "  -f  chance a byte is corrupted on the line, default 0\n"
+            "  -j  turnaround jitter, default 0 us\n"
+            "  -n  position read noise, default 0 counts\n"
+            "  -d  link outages of 0.1 to 3 s per hour, default 0\n"
+            "  -v  show what the object posts\n");
+    exit(EX_USAGE);
+}
+
+int main(int argc, char **argv) {
+    double hours = 24, eventS = 5, errorRate = 0, outagesPerHour = 0, noise = 0;
+    long jitterUs = 0;
+    unsigned long long seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:s:e:f:j:n:d:v")) != -1) {
+        switch (opt) {
+            case 't': hours = atof(optarg); break;
+            case 's': seed = strtoull(optarg, NULL, 0); break;
+            case 'e': eventS = atof(optarg); break;
+            case 'f': errorRate = atof(optarg); break;
+            case 'j': jitterUs = atol(optarg); break;
+            case 'n': noise = atof(optarg); break;
+            case 'd': outagesPerHour = atof(optarg); break;
+            case 'v': MaxShim_SetVerbose(true); break;
+            default: usage();
+        }
+    }
+    if (hours <= 0 || eventS <= 0 || optind != argc) {
+        usage();
+    }
+
+    DmmSimDrive_Init(&soak.sim, NULL);
+    DmmSimDrive_AddAxis(&soak.sim, 0);
+    DmmSimDrive_Seed(&soak.sim, seed);
+    soak.sim.byteErrorRate = errorRate;
+    soak.sim.turnaroundJitterUs = jitterUs;
+    soak.sim.positionNoise = noise;
+    soak.sim.DeliverPtr = &deliver;
+    soak.sim.now = soak.sim.stepAt = 1000000;
+    soak.digest = 14695981039346656037ULL;
+    DmmClock_SetThreadSource(&DmmSimDrive_Now, &soak.sim);
+
+    ext_main();
+    soak.x = MaxShim_New("dmmsend", 0, NULL);
+    if (soak.x == NULL) {
+        fprintf(stderr, "dmmsoak: can't make a dmmsend\n");
+        return EX_SOFTWARE;
+    }
+    MaxShim_Outlet(soak.x, 0)->HookPtr = &onSerial;
+    MaxShim_Outlet(soak.x, 1)->HookPtr = &onPosition;
+    MaxShim_Outlet(soak.x, 3)->HookPtr = &onInfo;
+
+    DmmTime_t start = soak.sim.now;
+    DmmTime_t end = start + (DmmTime_t)(hours * 3600e6);
+    DmmTime_t eventUs = (DmmTime_t)(eventS * 1e6);
+    DmmTime_t nextEvent = start;
+    DmmTime_t nextOutage = outagesPerHour > 0 ? start + interval((DmmTime_t)(3600e6 / outagesPerHour)) : end;
+    long long wall0 = nowNs();
+    while (soak.sim.now < end) {
+        long long next = MIN(MIN(nextEvent, nextOutage), end);
+        long long clockAt;
+        if (MaxShim_NextClock(&clockAt) && clockAt < next) {
+            next = MAX(clockAt, soak.sim.now);
+        }
+        DmmSimDrive_RunUntil(&soak.sim, next);
+        if (soak.sim.now >= nextOutage) {
+            soak.unpluggedUntil = soak.sim.now + uniform(100000, 3000000);
+            soak.lastOutageEnd = soak.unpluggedUntil;
+            nextOutage = soak.unpluggedUntil + interval((DmmTime_t)(3600e6 / outagesPerHour));
+        }
+        if (soak.sim.now >= nextEvent) {
+            playPatch();
+            nextEvent = soak.sim.now + interval(eventUs);
+        }
+        soak.ticks += MaxShim_RunClocksDue();
+        check();
+    }
+    double wallS = (nowNs() - wall0) / 1e9;
+    if (soak.down) {
+        fprintf(stderr, "dmmsoak: link down at the end, since %.3f s\n", soak.downAt / 1e6);
+        soak.failed = true;
+    }
+
+    double simS = (end - start) / 1e6;
+    double byteS = DMM_BYTE_TIME_US / 1e6;
+    printf("seed\tsim_s\twall_s\tmessages\ttx_util\trx_util\tticks\tpos_replies\tlink_drops\tmax_down_ms\tmax_drift\talarms\tcorrupted\tdigest\n");
+    printf("%llu\t%.0f\t%.2f\t%lu\t%.4f\t%.4f\t%lu\t%lu\t%lu\t%.1f\t%.0f\t%lu\t%lu\t%016llx\n",
+           seed, simS, wallS, soak.messages, soak.sim.txBytes * byteS / simS, soak.sim.rxBytes * byteS / simS,
+           soak.ticks, soak.posReplies, soak.drops, soak.maxDownUs / 1000.0, soak.maxDrift, soak.alarms,
+           soak.sim.corrupted, soak.digest);
+    object_free(soak.x);
+    return soak.failed ? EX_SOFTWARE : EX_OK;
+}
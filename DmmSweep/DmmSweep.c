@@ -0,0 +1,403 @@
+//
+//  DmmSweep.c
+//  dmmsweep - parameter sweeps against simulated drives
+//
+//  Every combination of the swept parameters is one scenario: a DmmSimDrive
+//  axis with the given drive gains, driven by DmmLoop with the given host
+//  gains, polling and setpoint smoothing, following a target profile. The
+//  scenarios are independent and run on simulated time, spread over a pool
+//  of worker threads that steal from each other's queues when they run dry.
+//  One row per scenario goes to stdout, in scenario order, tab separated.
+//
+//  Build:
+//    cc -std=gnu99 -O2 -DDMM_STANDALONE -IDmmDriver -o dmmsweep DmmSweep/DmmSweep.c
+//       DmmDriver/DmmDriver.c DmmDriver/DmmClock.c DmmDriver/DmmLoop.c DmmDriver/DmmSimDrive.c
+//       -lpthread -lm
+//
+//  Parameters, swept with -g name=v1,v2,... or -g name=first:last:step:
+//    mainGain speedGain intGain   drive gains, Set_MainGain / Set_SpeedGain / Set_IntGain
+//    maxAccel                     Set_HighAccel
+//    kp ki kd maxSpeed            DmmLoop gains and output clamp
+//    pollHz                       position reads per second, 0: back to back (DmmLoop autoPoll)
+//    smoothMs                     first order low pass on the target before DmmLoop, 0: off
+//    feedForward                  1: the profile's speed is fed forward, 0: not
+//    profile                      step, sine or triangle
+//    amplitude periodS            profile size in counts and period in seconds
+//    friction                     load friction, counts/s^2
+//
+//  Metrics per scenario: RMS, max and final |target - motor| in counts (motor
+//  position as the simulated drive has it, not as the host last read it),
+//  tx and rx link utilisation, packages sent, position replies, lost phase alarm.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sysexits.h>
+
+#include "DmmDriver.h"
+#include "DmmProtocol.h"
+#include "DmmLoop.h"
+#include "DmmSimDrive.h"
+
+#define SWEEP_MAX_VALUES 64
+#define SWEEP_SAMPLE_US 1000    // Target update and error sampling period
+
+typedef enum {
+    P_MainGain = 0, P_SpeedGain, P_IntGain, P_MaxAccel,
+    P_Kp, P_Ki, P_Kd, P_MaxSpeed,
+    P_PollHz, P_SmoothMs, P_FeedForward,
+    P_Profile, P_Amplitude, P_PeriodS, P_Friction,
+    P_Count
+} SweepParam_t;
+
+typedef enum { Profile_Step = 0, Profile_Sine, Profile_Triangle } SweepProfile_t;
+
+static const char *ProfileNames[] = { "step", "sine", "triangle" };
+
+typedef struct {
+    const char *name;
+    double def;
+    const char *format;
+    double values[SWEEP_MAX_VALUES];
+    int count;              // 0: only the default
+} SweepAxis_t;
+
+static SweepAxis_t Params[P_Count] = {
+    { "mainGain", 40, "%.0f" }, { "speedGain", 40, "%.0f" }, { "intGain", 10, "%.0f" }, { "maxAccel", 4, "%.0f" },
+    { "kp", 0.05, "%g" }, { "ki", 0, "%g" }, { "kd", 0, "%g" }, { "maxSpeed", 100, "%.0f" },
+    { "pollHz", 0, "%g" }, { "smoothMs", 0, "%g" }, { "feedForward", 1, "%.0f" },
+    { "profile", Profile_Sine, NULL }, { "amplitude", 5000, "%.0f" }, { "periodS", 2, "%g" }, { "friction", 2000, "%g" },
+};
+
+typedef struct {
+    double p[P_Count];
+    // Results
+    double rmsError, maxError, finalError;
+    double txUtil, rxUtil;
+    unsigned long packages, replies;
+    Boolean alarm;
+} SweepScenario_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    int *items;
+    int top, bottom;        // Owner takes from the bottom, thieves from the top
+} SweepDeque_t;
+
+typedef struct {
+    SweepScenario_t *scenarios;
+    SweepDeque_t *deques;
+    int workers;
+    double duration;
+} SweepPool_t;
+
+typedef struct {
+    DmmSimDrive_t sim;
+    DmmProtocolState_t pp;
+    DmmLoop_t loop;
+    unsigned long packages, replies;
+} SweepRun_t;
+
+static void SweepWriteBuffer(const unsigned char *bytes, int length, void *hook) {
+    SweepRun_t *run = (SweepRun_t*)hook;
+    DmmSimDrive_HostWrite(&run->sim, bytes, length);
+}
+
+static void SweepWrite(char c, void *hook) {
+    unsigned char b = (unsigned char)c;
+    SweepWriteBuffer(&b, 1, hook);
+}
+
+static void SweepPosition(long pos, void *hook) {
+    ((SweepRun_t*)hook)->replies++;
+}
+
+static void SweepReply(char axis, unsigned char code, long value, void *hook) {
+}
+
+static void SweepCommand(DmmProtocolState_t *pp, char axis, unsigned char func, long value, void *ctx) {
+    ((SweepRun_t*)ctx)->packages++;
+}
+
+// Target position and speed (counts, counts/s) at t seconds
+static void profile(const double *p, double t, double *pos, double *vel) {
+    double a = p[P_Amplitude], period = p[P_PeriodS];
+    switch ((SweepProfile_t)p[P_Profile]) {
+        default:
+        case Profile_Step:
+            *pos = t >= 0.1 ? a : 0;
+            *vel = 0;
+            break;
+        case Profile_Sine:
+            *pos = a * sin(2 * M_PI * t / period);
+            *vel = a * 2 * M_PI / period * cos(2 * M_PI * t / period);
+            break;
+        case Profile_Triangle: {
+            double ph = fmod(t / period, 1.0);
+            double slope = 4 * a / period;
+            if (ph < 0.25) {
+                *pos = ph * 4 * a;
+                *vel = slope;
+            } else if (ph < 0.75) {
+                *pos = a - (ph - 0.25) * 4 * a;
+                *vel = -slope;
+            } else {
+                *pos = -a + (ph - 0.75) * 4 * a;
+                *vel = slope;
+            }
+            break;
+        }
+    }
+}
+
+static void runScenario(SweepScenario_t *s, double duration) {
+    SweepRun_t *run = calloc(1, sizeof(SweepRun_t));
+    const double *p = s->p;
+    run->pp.SerialWritePtr = &SweepWrite;
+    run->pp.SerialWriteBufferPtr = &SweepWriteBuffer;
+    run->pp.ReportPositionPtr = &SweepPosition;
+    run->pp.ReportReplyPtr = &SweepReply;
+    run->pp.hook = run;
+    DmmSimDrive_Init(&run->sim, &run->pp);
+    DmmSimDrive_AddAxis(&run->sim, 0);
+    run->sim.friction = p[P_Friction];
+    DmmClock_SetThreadSource(&DmmSimDrive_Now, &run->sim);
+    AddCommandObserver(&run->pp, &SweepCommand, run);
+
+    SetMainGain(&run->pp, 0, (int)p[P_MainGain]);
+    SetSpeedGain(&run->pp, 0, (long)p[P_SpeedGain]);
+    SetIntGain(&run->pp, 0, (long)p[P_IntGain]);
+    SetMaxAccel(&run->pp, 0, (int)p[P_MaxAccel]);
+    DmmLoop_Init(&run->loop, &run->pp);
+    DmmLoop_SetGains(&run->loop, 0, p[P_Kp], p[P_Ki], p[P_Kd], (long)p[P_MaxSpeed]);
+    run->loop.autoPoll = p[P_PollHz] <= 0;
+
+    DmmTime_t end = (DmmTime_t)(duration * 1e6);
+    DmmTime_t pollPeriod = p[P_PollHz] > 0 ? (DmmTime_t)(1e6 / p[P_PollHz]) : 0;
+    DmmTime_t nextPoll = 0;
+    double alpha = p[P_SmoothMs] > 0 ? 1 - exp(-SWEEP_SAMPLE_US / (p[P_SmoothMs] * 1000)) : 1;
+    double smoothed = 0, sumSq = 0, maxErr = 0, err = 0;
+    unsigned long samples = 0;
+    for (DmmTime_t t = 0; t < end; t += SWEEP_SAMPLE_US) {
+        DmmSimDrive_RunUntil(&run->sim, t);
+        double target, speed;
+        profile(p, t / 1e6, &target, &speed);
+        err = fabs(target - run->sim.axis[0].pos);
+        sumSq += err * err;
+        maxErr = fmax(maxErr, err);
+        samples++;
+
+        smoothed += alpha * (target - smoothed);
+        long ff = p[P_FeedForward] != 0 ? lround(speed / run->sim.speedUnit) : 0;
+        DmmLoop_Track(&run->loop, 0, lround(smoothed), ff);
+        if (pollPeriod > 0 && t >= nextPoll) {
+            ReadMotorPosition32(&run->pp, 0);
+            nextPoll += pollPeriod;
+        }
+    }
+    DmmSimDrive_RunUntil(&run->sim, end);
+    DmmClock_SetThreadSource(NULL, NULL);
+
+    s->rmsError = samples ? sqrt(sumSq / samples) : 0;
+    s->maxError = maxErr;
+    s->finalError = err;
+    s->txUtil = (double)DMM_BYTES_TIME_US(run->sim.txBytes) / end;
+    s->rxUtil = (double)DMM_BYTES_TIME_US(run->sim.rxBytes) / end;
+    s->packages = run->packages;
+    s->replies = run->replies;
+    s->alarm = run->sim.axis[0].alarm != 0;
+    DmmLoop_Close(&run->loop);
+    free(run);
+}
+
+static int take(SweepDeque_t *d, Boolean own) {
+    int item = -1;
+    pthread_mutex_lock(&d->lock);
+    if (d->top < d->bottom) {
+        item = own ? d->items[--d->bottom] : d->items[d->top++];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return item;
+}
+
+typedef struct {
+    SweepPool_t *pool;
+    int index;
+} SweepWorker_t;
+
+static void *worker(void *arg) {
+    SweepWorker_t *w = (SweepWorker_t*)arg;
+    SweepPool_t *pool = w->pool;
+    for (;;) {
+        int item = take(&pool->deques[w->index], true);
+        // Nothing adds work once the pool runs, so every queue empty means done
+        for (int v = 1; item < 0 && v < pool->workers; v++) {
+            item = take(&pool->deques[(w->index + v) % pool->workers], false);
+        }
+        if (item < 0) {
+            return NULL;
+        }
+        runScenario(&pool->scenarios[item], pool->duration);
+    }
+}
+
+static Boolean parseSweep(const char *spec) {
+    const char *eq = strchr(spec, '=');
+    if (eq == NULL) {
+        return false;
+    }
+    SweepAxis_t *a = NULL;
+    for (int i = 0; i < P_Count; i++) {
+        if (strlen(Params[i].name) == (size_t)(eq - spec) && strncmp(spec, Params[i].name, eq - spec) == 0) {
+            a = &Params[i];
+        }
+    }
+    if (a == NULL) {
+        fprintf(stderr, "dmmsweep: unknown parameter in %s\n", spec);
+        return false;
+    }
+    a->count = 0;
+    double first, last, step;
+    if (a != &Params[P_Profile] && sscanf(eq + 1, "%lf:%lf:%lf", &first, &last, &step) == 3) {
+        if (step <= 0) {
+            return false;
+        }
+        for (double v = first; v <= last + step * 1e-9 && a->count < SWEEP_MAX_VALUES; v += step) {
+            a->values[a->count++] = v;
+        }
+        return a->count > 0;
+    }
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "%s", eq + 1);
+    for (char *tok = strtok(buf, ","); tok && a->count < SWEEP_MAX_VALUES; tok = strtok(NULL, ",")) {
+        if (a == &Params[P_Profile]) {
+            int k = 0;
+            while (k < 3 && strcmp(tok, ProfileNames[k]) != 0) {
+                k++;
+            }
+            if (k == 3) {
+                fprintf(stderr, "dmmsweep: unknown profile %s\n", tok);
+                return false;
+            }
+            a->values[a->count++] = k;
+        } else {
+            a->values[a->count++] = atof(tok);
+        }
+    }
+    return a->count > 0;
+}
+
+static void printValue(SweepParam_t i, double v) {
+    if (i == P_Profile) {
+        printf("%s", ProfileNames[(int)v]);
+    } else {
+        printf(Params[i].format, v);
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: dmmsweep [-j threads] [-t seconds] [-g name=values] ...\n"
+            "  -j  worker threads, default one per core\n"
+            "  -t  simulated time per scenario, default 4\n"
+            "  -g  sweep a parameter over v1,v2,... or first:last:step (see DmmSweep.c)\n");
+    exit(EX_USAGE);
+}
+
+int main(int argc, char **argv) {
+    int workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    double duration = 4;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:t:g:")) != -1) {
+        switch (opt) {
+            case 'j': workers = atoi(optarg); break;
+            case 't': duration = atof(optarg); break;
+            case 'g':
+                if (!parseSweep(optarg)) {
+                    usage();
+                }
+                break;
+            default: usage();
+        }
+    }
+    if (workers < 1 || duration <= 0) {
+        usage();
+    }
+
+    // Cartesian product, the first parameter varying slowest
+    long total = 1;
+    for (int i = 0; i < P_Count; i++) {
+        total *= Params[i].count > 0 ? Params[i].count : 1;
+    }
+    SweepScenario_t *scenarios = calloc(total, sizeof(SweepScenario_t));
+    if (scenarios == NULL) {
+        fprintf(stderr, "dmmsweep: %ld scenarios don't fit in memory\n", total);
+        return EX_OSERR;
+    }
+    for (long n = 0; n < total; n++) {
+        long rest = n;
+        for (int i = P_Count - 1; i >= 0; i--) {
+            int c = Params[i].count > 0 ? Params[i].count : 1;
+            scenarios[n].p[i] = Params[i].count > 0 ? Params[i].values[rest % c] : Params[i].def;
+            rest /= c;
+        }
+    }
+
+    // Contiguous shares to start with, stealing evens it out
+    SweepPool_t pool;
+    pool.scenarios = scenarios;
+    pool.workers = workers;
+    pool.duration = duration;
+    pool.deques = calloc(workers, sizeof(SweepDeque_t));
+    int *items = malloc(total * sizeof(int));
+    for (long n = 0; n < total; n++) {
+        items[n] = (int)(total - 1 - n); // Owners pop from the end, so scenario order within a share
+    }
+    for (int w = 0; w < workers; w++) {
+        pthread_mutex_init(&pool.deques[w].lock, NULL);
+        pool.deques[w].items = items;
+        pool.deques[w].top = (int)(total * w / workers);
+        pool.deques[w].bottom = (int)(total * (w + 1) / workers);
+    }
+
+    DmmTime_t started = DmmNow();
+    pthread_t *threads = calloc(workers, sizeof(pthread_t));
+    SweepWorker_t *args = calloc(workers, sizeof(SweepWorker_t));
+    for (int w = 0; w < workers; w++) {
+        args[w].pool = &pool;
+        args[w].index = w;
+        if (pthread_create(&threads[w], NULL, worker, &args[w]) != 0) {
+            fprintf(stderr, "dmmsweep: can't start worker %d\n", w);
+            return EX_OSERR;
+        }
+    }
+    for (int w = 0; w < workers; w++) {
+        pthread_join(threads[w], NULL);
+    }
+    double wall = (DmmNow() - started) / 1e6;
+
+    for (int i = 0; i < P_Count; i++) {
+        printf("%s\t", Params[i].name);
+    }
+    printf("rmsError\tmaxError\tfinalError\ttxUtil\trxUtil\tpackages\treplies\talarm\n");
+    long best = 0;
+    for (long n = 0; n < total; n++) {
+        SweepScenario_t *s = &scenarios[n];
+        for (int i = 0; i < P_Count; i++) {
+            printValue((SweepParam_t)i, s->p[i]);
+            printf("\t");
+        }
+        printf("%.1f\t%.1f\t%.1f\t%.3f\t%.3f\t%lu\t%lu\t%d\n",
+               s->rmsError, s->maxError, s->finalError, s->txUtil, s->rxUtil, s->packages, s->replies, s->alarm);
+        if (!s->alarm && (scenarios[best].alarm || s->rmsError < scenarios[best].rmsError)) {
+            best = n;
+        }
+    }
+    fprintf(stderr, "dmmsweep: %ld scenarios of %.1f s on %d threads in %.1f s, lowest RMS error %.1f in row %ld\n",
+            total, duration, workers, wall, scenarios[best].rmsError, best + 1);
+    return EX_OK;
+}